@@ -0,0 +1,65 @@
+/**
+  ******************************************************************************
+  * @file           : BLOCK_DEVICE
+  * @version        : v1.0
+  * @brief          : Header for block_device file
+  ******************************************************************************
+  * MIT License
+  *
+  * Copyright (c) 2017 Oleksandr Borysov
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+ ******************************************************************************
+*/
+
+
+/* Storage layer under the partitions. Sectors of the volume are striped (RAID-0) across block devices */
+#ifndef __BLOCK_DEVICE_H
+#define __BLOCK_DEVICE_H
+
+#include <stdint.h>
+
+#define MAX_BLOCK_DEVICE_NUMBER  4
+
+#define BLOCK_DEVICE_OK          0
+#define BLOCK_DEVICE_ERROR       1
+// Block device driver. Transfers are started and completed separately to run devices concurrently
+typedef struct {
+   uint8_t (*startRead)(uint8_t*, uint64_t, uint32_t);       // Starts reading of sectors
+   uint8_t (*startWrite)(const uint8_t*, uint64_t, uint32_t);// Starts writing of sectors
+   uint8_t (*waitRead)(void);                                // Waits for the end of the started reading
+   uint8_t (*waitWrite)(void);                               // Waits for the end of the started writing
+   uint8_t (*erase)(uint64_t, uint64_t);                     // Erases sectors
+   uint64_t (*getSectorNumber)(void);                        // Number of the device sectors
+} BlockDevice;
+// Geometry of the stripe
+typedef struct {
+   uint8_t deviceNumber;                            // Number of the striped devices
+   uint32_t stripeUnit;                             // Sectors stored on one device before switching to the next
+} StripeGeometry;
+
+uint8_t registerBlockDevice(const BlockDevice*);
+void initVolume(const BlockDevice*, uint32_t, uint32_t);
+void getStripeGeometry(StripeGeometry*);
+uint64_t getVolumeSectorNumber(void);
+uint8_t volumeReadSectors(uint8_t*, uint64_t, uint32_t);
+uint8_t volumeWriteSectors(const uint8_t*, uint64_t, uint32_t);
+uint8_t volumeEraseSectors(uint64_t, uint64_t);
+
+#endif
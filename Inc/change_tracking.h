@@ -0,0 +1,50 @@
+/**
+  ******************************************************************************
+  * @file           : CHANGE_TRACKING
+  * @version        : v1.0
+  * @brief          : Header for change_tracking file
+  ******************************************************************************
+  * MIT License
+  *
+  * Copyright (c) 2017 Oleksandr Borysov
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+ ******************************************************************************
+*/
+
+
+
+/* Changed block tracking. Host writes mark units of the partition in the change map on the card,
+   the export of the changed units is the checkpoint which clears the map */
+#ifndef __CHANGE_TRACKING_H
+#define __CHANGE_TRACKING_H
+
+#include "sd_io_controller.h"
+
+#define CHANGE_UNIT_MIN_SECTORS  128                // Smallest tracked unit (64 KB), large partitions have larger units
+#define CHANGE_HEADER_SECTORS    1
+#define CHANGE_MAP_BITS          ((CHANGE_MAP_SECTORS - CHANGE_HEADER_SECTORS) * STORAGE_BLOCK_SIZE * 8)
+
+uint8_t markChangedSectors(uint8_t, uint16_t, const Partition*, uint64_t, UINT);
+void closeChangeMap(uint8_t);
+uint8_t forEachChangedRange(uint16_t, const Partition*, uint8_t (*)(uint64_t, uint64_t));
+uint8_t resetChangeMap(uint16_t, const Partition*);
+uint32_t getChangeUnitSectors(const Partition*);
+
+#endif
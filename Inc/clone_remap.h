@@ -0,0 +1,58 @@
+/**
+  ******************************************************************************
+  * @file           : CLONE_REMAP
+  * @version        : v1.0
+  * @brief          : Header for clone_remap file
+  ******************************************************************************
+  * MIT License
+  *
+  * Copyright (c) 2017 Oleksandr Borysov
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+ ******************************************************************************
+*/
+
+
+
+/* Copy-on-write clones of the partitions. The clone shares sectors of the source partition,
+   blocks written through the clone are copied to the pool of the clone and remapped */
+#ifndef __CLONE_REMAP_H
+#define __CLONE_REMAP_H
+
+#include "sd_io_controller.h"
+
+#define CLONE_BLOCK_SECTORS      128                // Copy-on-write unit of the clone (64 KB)
+#define MAX_CLONE_BLOCKS         1024               // Pool blocks of one clone, they must fit the remap log
+#define CLONE_COPY_SECTORS       8                  // Source sectors copied to the pool at once (4 KB)
+                                                    // Pool starts with the remap header and the remap log
+#define CLONE_HEADER_SECTORS     1
+#define CLONE_LOG_SECTORS        (MAX_CLONE_BLOCKS * 4 / STORAGE_BLOCK_SIZE)
+#define CLONE_META_SECTORS       (CLONE_HEADER_SECTORS + CLONE_LOG_SECTORS)
+
+uint8_t isClonePartition(const Partition*);
+void prepareClonePartition(Partition*);
+uint8_t checkClonePartitions(const PartitionsStructure*);
+uint8_t isPartitionCloned(const PartitionsStructure*, const char*);
+uint8_t openCloneRemap(uint8_t, const Partition*, const Partition*, const char*);
+void closeCloneRemap(uint8_t);
+uint64_t getCloneSectorNumber(void);
+uint8_t readCloneSectors(BYTE*, uint64_t, UINT);
+uint8_t writeCloneSectors(BYTE*, uint64_t, UINT);
+
+#endif
@@ -0,0 +1,61 @@
+/**
+  ******************************************************************************
+  * @file           : COMMAND_READER
+  * @version        : v1.0
+  * @brief          : Header for command_reader file
+  ******************************************************************************
+  * MIT License
+  *
+  * Copyright (c) 2017 Oleksandr Borysov
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+ ******************************************************************************
+*/
+
+
+
+
+/* Reader of the command file. The file is read by chunks and parsed in one pass, so
+   the command file of any length needs only the chunk buffer */
+#ifndef __COMMAND_READER_H
+#define __COMMAND_READER_H
+
+#include "ff.h"
+
+#define COMMAND_CHUNK_SIZE       512                // Bytes of the command file read at once, one sector
+#define COMMAND_READER_END       -1                 // No symbols left in the file
+
+// State of the command file reading
+typedef struct {
+   FIL *file;
+   char *chunk;                                     // Buffer of the read chunk
+   uint32_t chunkSize;
+   uint32_t size;                                   // Bytes of the file in the chunk
+   uint32_t position;                               // Next symbol in the chunk
+   uint8_t isFailed;                                // File read failed, the reader is at the end
+} CommandReader;
+
+void beginCommandReader(CommandReader*, FIL*, char*, uint32_t);
+int16_t peekCommandSymbol(CommandReader*);
+uint8_t isCommandLineEnd(CommandReader*);
+uint8_t skipCommandLine(CommandReader*);
+uint8_t readCommandLine(CommandReader*, char*, uint16_t);
+uint8_t readCommandWord(CommandReader*, char*, uint16_t);
+
+#endif
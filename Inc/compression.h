@@ -0,0 +1,55 @@
+/**
+  ******************************************************************************
+  * @file           : COMPRESSION
+  * @version        : v1.0
+  * @brief          : Header for compression file
+  ******************************************************************************
+  * MIT License
+  *
+  * Copyright (c) 2017 Oleksandr Borysov
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+ ******************************************************************************
+*/
+
+
+
+
+/* Transparent compression of the partitions. Chunks of the partition are compressed before the
+   encryption and kept at their own place, the chunk map records the stored sectors of each chunk */
+#ifndef __COMPRESSION_H
+#define __COMPRESSION_H
+
+#include "sd_io_controller.h"
+
+#define COMPRESS_CHUNK_SECTORS   8                  // Logical chunk compressed at once (4 KB)
+#define COMPRESS_CACHE_CHUNKS    4                  // Decompressed chunks kept for the reads
+#define COMPRESS_HEADER_SECTORS  1                  // Partition starts with the header and the chunk map
+#define COMPRESS_MAP_ENTRIES     ((STORAGE_BLOCK_SIZE - 4) / 2)   // Chunks of one map sector, the sector starts with
+                                                    // the generation, each entry has the sectors and the place
+
+uint8_t isCompressedPartition(const Partition*);
+uint8_t checkCompressedPartitions(const PartitionsStructure*);
+uint64_t getCompressedSectorNumber(const Partition*);
+uint8_t openCompressedStore(uint8_t, const Partition*, const char*);
+void closeCompressedStore(uint8_t);
+uint8_t readCompressedSectors(uint8_t, BYTE*, uint64_t, UINT);
+uint8_t writeCompressedSectors(uint8_t, const BYTE*, uint64_t, UINT);
+
+#endif
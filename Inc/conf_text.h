@@ -0,0 +1,61 @@
+/**
+  ******************************************************************************
+  * @file           : CONF_TEXT
+  * @version        : v1.0
+  * @brief          : Header for conf_text file
+  ******************************************************************************
+  * MIT License
+  *
+  * Copyright (c) 2017 Oleksandr Borysov
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+ ******************************************************************************
+*/
+
+
+
+
+/* Text output of the configurations file. The text is formatted to a sector buffer and the file
+   is written by whole sectors, so the file system writes each sector of the file once. Without
+   the file only a window of the text is kept in the buffer */
+#ifndef __CONF_TEXT_H
+#define __CONF_TEXT_H
+
+#include "ff.h"
+
+#define CONF_TEXT_BUFFER_SIZE    512                // Bytes of the text written at once, one sector
+
+// State of the text output
+typedef struct {
+   FIL *file;                                       // NULL if the text is kept in the buffer
+   char *buffer;                                    // CONF_TEXT_BUFFER_SIZE bytes of the not written text
+   uint32_t size;                                   // Bytes of the text in the buffer
+   uint32_t windowStart;                            // Text byte kept first in the buffer without the file
+   uint32_t windowSize;
+   uint32_t length;                                 // Bytes of the whole text
+   uint32_t writeCount;                             // Writes of the file
+   uint8_t isFailed;                                // File write failed, the rest of the text is dropped
+} ConfText;
+
+void beginConfText(ConfText*, FIL*, char*);
+void beginConfTextWindow(ConfText*, char*, uint32_t, uint32_t);
+void printConfText(ConfText*, const char*, ...);
+uint8_t endConfText(ConfText*);
+
+#endif
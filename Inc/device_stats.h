@@ -0,0 +1,108 @@
+/**
+  ******************************************************************************
+  * @file           : DEVICE_STATS
+  * @version        : v1.0
+  * @brief          : Header for device_stats file
+  ******************************************************************************
+  * MIT License
+  *
+  * Copyright (c) 2017 Oleksandr Borysov
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+ ******************************************************************************
+*/
+
+
+#ifndef __DEVICE_STATS_H
+#define __DEVICE_STATS_H
+
+#include <stdint.h>
+// Measurements of the device operations
+typedef struct {
+   uint8_t fileSystemType;                          // FatFs type of the visible partition (FS_FAT12..FS_EXFAT)
+   uint32_t mountTime;                              // Duration of the last file system mount in us
+   uint32_t capacityQueryTime;                      // Duration of the last capacity calculation in us
+   uint32_t capacityQueryCount;                     // Capacity requests of the host
+   uint32_t enumerationStartTime;                   // Tick of the first capacity request, 0 before it
+   uint32_t enumerationTime;                        // ms from the first capacity request to the first mount
+   uint32_t cardInitTime;                           // ms from the reset to the end of the card initialization
+   uint32_t bootMountTime;                          // ms from the reset to the first mount
+   uint8_t isBootRecordUsed;                        // Capacity of the default partition was restored on start
+   uint32_t commandArenaPeak;                       // Bytes of the work arena used by the last command
+   uint32_t commandStackPeak;                       // Bytes of the stack used by the last command
+   uint32_t maxArenaPeak;                           // The highest use of the work arena by a command
+   uint32_t maxStackPeak;
+   uint32_t commandFileBytes;                       // Bytes of the last command file read by chunks
+   uint32_t commandReadTime;                        // us of the last command spent in reading the file chunks
+   uint32_t commandDetectTime;                      // ms from the host write to the execution of the last command
+   uint32_t commandLookupCount;                     // Lookups of the command file after root directory writes
+   uint32_t rootScanCount;                          // Scans of the root directory
+   uint32_t mountCount;                             // Mounts of the command partition file system
+   uint32_t windowDropCount;                        // Windows of FatFs dropped because the host wrote their sectors
+   uint32_t fileSystemReads;                        // Sectors read from the card by FatFs of the device
+   uint32_t fileSystemWrites;                       // Card writes of FatFs of the device
+   uint32_t showConfTime;                           // ms of the last configurations file writing
+   uint32_t showConfFileWrites;                     // File writes of the last configurations file
+   uint32_t showConfCardWrites;                     // Card writes of the last configurations file
+   uint32_t mailboxRequestCount;                    // Requests of the mailbox commands
+   uint32_t mailboxServiceTime;                     // ms from the last mailbox request to its response
+   uint32_t hostRequestCount;                       // Read and write requests of the host
+   uint64_t hostRequestTime;                        // us spent by the requests
+   uint32_t hostRequestMaxTime;                     // The longest request in us
+   uint32_t translationCount;                       // Number of the partition to volume sector translations
+   uint64_t translationCycles;                      // Core cycles spent by the translations
+   uint32_t splitRequestCount;                      // Requests split on the partition extents
+   uint32_t partitionSwitchTime;                    // ms from the partition change to the first ready report of it
+   uint32_t remapLookupCount;                       // Lookups of the clone blocks in the remap table
+   uint64_t remapLookupCycles;                      // Core cycles spent by the remap lookups
+   uint32_t cloneCopyCount;                         // Clone blocks copied from the source on the first write
+   uint64_t exportSectors;                          // Sectors of the last export of the changed blocks
+   uint32_t exportTime;                             // Duration of the last export in ms
+   uint32_t formatSectors;                          // Metadata sectors written by the last quick format
+   uint32_t formatTime;                             // Duration of the last quick format in ms
+   uint8_t formatFailCount;                         // Requested formats which were not done, host formats them
+   uint64_t compressedSectors;                      // Sectors written by the host to the compressed partitions
+   uint64_t storedSectors;                          // Sectors written to the card for them, the chunk map included
+   uint32_t compressCount;                          // Compressed chunks
+   uint64_t compressCycles;                         // Core cycles spent by the chunk compression
+   uint32_t decompressCount;                        // Decompressed chunks
+   uint64_t decompressCycles;                       // Core cycles spent by the chunk decompression
+   uint32_t chunkCacheHits;                         // Chunks found decompressed in the cache
+   uint32_t chunkCacheMisses;
+   uint32_t wearPoolWrites;                         // Hot sectors written to the pool, copies of the collection included
+   uint32_t wearHomeWrites;                         // Sectors returned from the pool to their home place
+   uint32_t wearCollectCount;                       // Collected segments of the pool
+   uint32_t wearCollectTime;                        // Duration of the last segment collection in us
+   uint32_t wearCollectMaxTime;                     // Longest segment collection in us
+   uint32_t wearForegroundCollects;                 // Collections done by the host write when the pool was full
+   uint32_t readCacheHits;                          // Lines of the read-only partitions found in the cache
+   uint32_t readCacheMisses;
+   uint64_t readAheadSectors;                       // Sectors read before the host asked for them
+   uint64_t readDirectSectors;                      // Sectors of the long reads which skipped the cache
+   uint32_t confLoadTime;                           // Duration of the last configurations load in us
+   uint32_t confSaveTime;                           // Duration of the last header save in us
+} DeviceStatistics;
+
+extern DeviceStatistics deviceStatistics;
+
+void initTimeMeasure(void);
+uint32_t getTimeStamp(void);
+uint32_t getElapsedMicros(uint32_t);
+
+#endif
@@ -0,0 +1,45 @@
+/**
+  ******************************************************************************
+  * @file           : LZ_CODEC
+  * @version        : v1.0
+  * @brief          : Header for lz_codec file
+  ******************************************************************************
+  * MIT License
+  *
+  * Copyright (c) 2017 Oleksandr Borysov
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+ ******************************************************************************
+*/
+
+
+
+
+/* Fast LZ codec in LZ4 block format. Used for the chunks of the compressed partitions */
+#ifndef __LZ_CODEC_H
+#define __LZ_CODEC_H
+
+#include <stdint.h>
+
+#define LZ_MAX_INPUT             0xFFFF             // Offsets of the matches are 16-bit
+
+uint32_t compressLZ(const uint8_t*, uint32_t, uint8_t*, uint32_t);
+uint32_t decompressLZ(const uint8_t*, uint32_t, uint8_t*, uint32_t);
+
+#endif
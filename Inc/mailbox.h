@@ -0,0 +1,127 @@
+/**
+  ******************************************************************************
+  * @file           : MAILBOX
+  * @version        : v1.0
+  * @brief          : Header for mailbox file
+  ******************************************************************************
+  * MIT License
+  *
+  * Copyright (c) 2017 Oleksandr Borysov
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+ ******************************************************************************
+*/
+
+
+
+
+/* Request channel of the host. The host sends the request by the vendor SCSI command
+   MAILBOX_WRITE_OPCODE and reads the response by MAILBOX_READ_OPCODE of the same logical
+   unit, the partition sectors are not used. The file is shared with the host tool and the
+   patched USB class, so it depends only on stdint.h */
+#ifndef __MAILBOX_H
+#define __MAILBOX_H
+
+#include <stdint.h>
+
+#define MAILBOX_MAGIC            0x584F424Du        // "MBOX"
+#define MAILBOX_VERSION          1
+#define MAILBOX_WRITE_OPCODE     0xC1               // Vendor command, the data out is the request
+#define MAILBOX_READ_OPCODE      0xC2               // Vendor command, the data in is the response
+#define MAILBOX_CDB_LENGTH       10
+#define MAILBOX_RESPONSE_SIZE    512                // Fits the data buffer of the USB class (MSC_MEDIA_PACKET)
+#define MAILBOX_HEADER_SIZE      32
+#define MAILBOX_DATA_SIZE        (MAILBOX_RESPONSE_SIZE - MAILBOX_HEADER_SIZE)
+                                                    // Lengths of the device strings, equal to sd_io_controller.h
+#define MAILBOX_ROOT_KEY_LENGTH  40
+#define MAILBOX_CONF_KEY_LENGTH  20
+#define MAILBOX_NAME_LENGTH      20
+#define MAILBOX_PART_KEY_LENGTH  20
+                                                    // Flags of the partition
+#define MAILBOX_PART_COMPRESSED  0x01
+#define MAILBOX_PART_READ_ONLY   0x02
+#define MAILBOX_PART_PRIVATE     0x04
+#define MAILBOX_NO_LUN           0xFF               // Partition is not visible
+// Operations of the requests
+typedef enum {
+  MAILBOX_CHANGE_PARTITION = 1,                     // Sets the partition visible through the logical unit
+  MAILBOX_QUERY_CONFIG,                             // Gets the partitions from the entry offset
+  MAILBOX_UPDATE_BEGIN,                             // Starts new configurations with new keys
+  MAILBOX_UPDATE_ADD,                               // Adds the next partition to new configurations
+  MAILBOX_UPDATE_COMMIT,                            // Sets new configurations to the device
+  MAILBOX_READ_STATS                                // Gets text of the configurations file from the byte offset
+} MailboxOperation;
+// Statuses of the responses
+typedef enum {
+  MAILBOX_DONE = 0,
+  MAILBOX_FAILED,
+  MAILBOX_PENDING                                   // Device didn't finish the request, the host reads again
+} MailboxStatus;
+// Request written by the host
+typedef struct {
+   uint32_t magic;                                  // MAILBOX_MAGIC
+   uint16_t version;                                // MAILBOX_VERSION
+   uint16_t operation;                              // MailboxOperation
+   uint32_t sequence;                               // Returned by the response of the request
+   uint32_t offset;                                 // Partition entry or text byte to start from, number
+                                                    // of the added partition
+   uint64_t sectorNumber;                           // Size of the added partition
+   char rootKey[MAILBOX_ROOT_KEY_LENGTH];
+   char confKey[MAILBOX_CONF_KEY_LENGTH];           // Not needed to change the partition
+   char name[MAILBOX_NAME_LENGTH];                  // Partition of the operation
+   char key[MAILBOX_PART_KEY_LENGTH];
+   char sourceName[MAILBOX_NAME_LENGTH];            // Partition shared by the added clone
+   char newRootKey[MAILBOX_ROOT_KEY_LENGTH];        // Keys of new configurations
+   char newConfKey[MAILBOX_CONF_KEY_LENGTH];
+   uint8_t lun;                                     // Logical unit of the changed partition
+   uint8_t extentNumber;
+   uint8_t flags;                                   // MAILBOX_PART_* of the added partition
+   uint8_t formatType;                              // FormatType of quick_format.h
+} MailboxRequest;
+// Response read by the host
+typedef struct {
+   uint32_t magic;                                  // MAILBOX_MAGIC
+   uint16_t version;                                // MAILBOX_VERSION
+   uint16_t status;                                 // MailboxStatus
+   uint32_t sequence;                               // Sequence of the answered request
+   uint32_t length;                                 // Bytes of the data
+   uint32_t total;                                  // Partitions or text bytes the device has
+   uint8_t reserved[MAILBOX_HEADER_SIZE - 20];
+   uint8_t data[MAILBOX_DATA_SIZE];
+} MailboxResponse;
+// Partition of MAILBOX_QUERY_CONFIG response
+typedef struct {
+   uint64_t sectorNumber;
+   char name[MAILBOX_NAME_LENGTH];
+   char sourceName[MAILBOX_NAME_LENGTH];            // Empty if the partition is not a clone
+   uint8_t extentNumber;
+   uint8_t flags;                                   // MAILBOX_PART_*
+   uint8_t lun;                                     // Logical unit of the visible partition or MAILBOX_NO_LUN
+   uint8_t reserved[5];
+} MailboxPartition;
+
+#define MAILBOX_PARTITIONS_PER_RESPONSE (MAILBOX_DATA_SIZE / sizeof(MailboxPartition))
+
+uint8_t writeMailbox(uint8_t, const uint8_t*, uint32_t);
+uint8_t readMailbox(uint8_t, uint8_t*);
+MailboxRequest* getMailboxRequest(void);
+MailboxResponse* getMailboxResponse(void);
+void completeMailboxRequest(uint8_t);
+
+#endif
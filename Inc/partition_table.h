@@ -0,0 +1,55 @@
+/**
+  ******************************************************************************
+  * @file           : PARTITION_TABLE
+  * @version        : v1.0
+  * @brief          : Header for partition_table file
+  ******************************************************************************
+  * MIT License
+  *
+  * Copyright (c) 2017 Oleksandr Borysov
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+ ******************************************************************************
+*/
+
+
+/* On-card partition table. Entries are kept in sectors after the configuration header,
+   names of the live table are indexed in RAM by hash */
+#ifndef __PARTITION_TABLE_H
+#define __PARTITION_TABLE_H
+
+#include "sd_io_controller.h"
+
+#define PART_INDEX_SIZE          (2 * MAX_PART_NUMBER)  // Slots of the name index, power of two
+// Index of the partition extents for the sector translation
+typedef struct {
+   uint64_t extentEnds[MAX_PART_EXTENTS];                 // Partition sector after the end of each extent
+   uint8_t extentNumber;
+} ExtentIndex;
+
+void beginPartitionTable(uint8_t, const char*);
+uint8_t addPartitionEntry(Partition*);
+uint8_t endPartitionTable(uint16_t*, uint64_t*);
+uint8_t buildPartitionIndex(uint8_t, uint16_t, const char*);
+uint8_t readPartitionEntry(uint8_t, uint16_t, const char*, Partition*);
+int32_t findPartitionEntry(const char*, Partition*);
+void buildExtentIndex(const Partition*, ExtentIndex*);
+uint64_t translateExtentSector(const Partition*, const ExtentIndex*, uint64_t, UINT*);
+
+#endif
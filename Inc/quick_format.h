@@ -0,0 +1,54 @@
+/**
+  ******************************************************************************
+  * @file           : QUICK_FORMAT
+  * @version        : v1.0
+  * @brief          : Header for quick_format file
+  ******************************************************************************
+  * MIT License
+  *
+  * Copyright (c) 2017 Oleksandr Borysov
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+ ******************************************************************************
+*/
+
+
+
+
+/* On-device quick format of the partitions created or resized by the configurations update.
+   Only the file system metadata is written, the data clusters are left as they are */
+#ifndef __QUICK_FORMAT_H
+#define __QUICK_FORMAT_H
+
+#include "sd_io_controller.h"
+
+#define MAX_FORMAT_REQUESTS      8                  // Partitions formatted after one update
+// File system of the formatted partition
+typedef enum {
+  FORMAT_NONE = 0,
+  FORMAT_FAT32,
+  FORMAT_EXFAT
+} FormatType;
+
+void resetFormatRequests(void);
+uint8_t requestPartitionFormat(uint16_t, const Partition*, FormatType);
+uint8_t isPartitionFormatPending(uint16_t);
+void formatRequestedPartitions(void);
+
+#endif
@@ -0,0 +1,49 @@
+/**
+  ******************************************************************************
+  * @file           : READ_CACHE
+  * @version        : v1.0
+  * @brief          : Header for read_cache file
+  ******************************************************************************
+  * MIT License
+  *
+  * Copyright (c) 2017 Oleksandr Borysov
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+ ******************************************************************************
+*/
+
+
+
+
+/* Cache of the decrypted sectors of the read-only partitions. Data of such partition never
+   changes while it is visible, so the cached lines are dropped only by the partition switch */
+#ifndef __READ_CACHE_H
+#define __READ_CACHE_H
+
+#include "sd_io_controller.h"
+
+#define READ_CACHE_LINE_SECTORS  8                  // Sectors read from the card at once (4 KB)
+#define READ_CACHE_LINES         6                  // Lines shared by the read-only logical units
+#define READ_AHEAD_LINES         3                  // Lines read by the miss of the sequential reading
+#define READ_CACHE_DIRECT_SECTORS (2 * READ_CACHE_LINE_SECTORS)   // Longer reads from the line start skip the cache
+
+void resetReadCache(uint8_t);
+uint8_t readCachedSectors(uint8_t, BYTE*, uint64_t, UINT, uint64_t, uint8_t (*)(BYTE, BYTE*, DWORD, UINT));
+
+#endif
@@ -0,0 +1,85 @@
+/**
+  ******************************************************************************
+  * @file           : RELOCATION
+  * @version        : v1.0
+  * @brief          : Header for relocation file
+  ******************************************************************************
+  * MIT License
+  *
+  * Copyright (c) 2017 Oleksandr Borysov
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+ ******************************************************************************
+*/
+
+
+/* Relocation of the partition data after the configurations update. Partitions which keep
+   their names are copied from the old layout to the new one in background, progress is journaled */
+#ifndef __RELOCATION_H
+#define __RELOCATION_H
+
+#include "sd_io_controller.h"
+#include "partition_table.h"
+
+#define MAX_RELOCATION_MOVES     32                 // Moves of one update, they must fit the journal sectors
+#define RELOCATION_CHUNK_SECTORS 16                 // Sectors copied at once (8 KB)
+#define RELOCATION_SAVE_CHUNKS   16                 // Chunks copied between journal updates when redo is safe
+#define RELOCATION_STEP_TIME     500                // Background copying time of one idle timer period in ms
+#define NO_TRANSFORM_MOVE        -1                 // Data is not encrypted again
+// Volume sector during the relocation
+#define SECTOR_DIRECT            0                  // Sector has its own data
+#define SECTOR_RELOCATED         1                  // Data of the sector is still at the move source
+#define SECTOR_BLOCKED           2                  // Move source which is not erased yet, it is not usable
+// Status of the partition data relocation
+typedef enum {
+  RELOCATION_NONE = 0,                               // Nothing was moved since the device start
+  RELOCATION_IN_PROGRESS,
+  RELOCATION_DONE,
+  RELOCATION_FAILED
+} RelocationStatus;
+// Progress of the relocation
+typedef struct {
+   uint64_t totalSectors;                            // Sectors of all moves
+   uint64_t movedSectors;
+   uint32_t relocationTime;                          // Duration of the copying in ms
+   uint8_t moveNumber;
+   RelocationStatus status;
+} RelocationProgress;
+
+uint8_t planRelocation(const PartitionsStructure*);
+void resetRelocation(void);
+uint8_t prepareRelocation(const PartitionsStructure*, const PartitionsStructure*);
+void startRelocation(void);
+uint8_t resumeRelocation(const PartitionsStructure*);
+uint8_t runRelocationStep(uint32_t);
+uint8_t isRelocationActive(void);
+uint8_t isRelocationFinished(void);
+void getRelocationOldConf(PartitionsStructure*);
+uint8_t finishRelocation(void);
+uint8_t lookupRelocatedSector(uint64_t*, UINT*, int8_t*);
+void transformRelocatedSectors(BYTE*, int8_t, uint32_t);
+uint8_t readRelocatedSectors(BYTE*, uint64_t, UINT);
+uint8_t writeRelocatedSectors(BYTE*, uint64_t, UINT);
+uint8_t readPartitionExtents(const Partition*, const ExtentIndex*, BYTE*, uint64_t, UINT);
+uint8_t writePartitionExtents(const Partition*, const ExtentIndex*, BYTE*, uint64_t, UINT);
+uint8_t forEachRangeOutsideMoves(uint64_t, uint64_t, uint8_t (*)(uint64_t, uint64_t));
+uint8_t forEachVacatedRange(uint64_t, uint8_t (*)(uint64_t, uint64_t));
+const RelocationProgress* getRelocationProgress(void);
+
+#endif
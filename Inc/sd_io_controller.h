@@ -35,9 +35,11 @@
 
 #include "ff_gen_drv.h"
 #include "fatfs.h"
+#include "block_device.h"
 // For debugging
 #define DEBUG_MOD                 0                  // if DEBUG_MOD != 0 the command file will not deleted
 #define CIPHER_MOD                1                  // if CIPHER_MOD != 0 the cipher logic not active
+#define WEAR_LEVEL_MOD            0                  // if WEAR_LEVEL_MOD != 0 hot sectors are written in place
 
 #define CONF_KEY_LENGHT          20
 #define PART_KEY_LENGHT          20
@@ -45,9 +47,38 @@
 
 #define PART_NAME_LENGHT         20
 
-#define MAX_PART_NUMBER          10
+#define MAX_PART_NUMBER          256
+#define MAX_PART_EXTENTS         8                  // Max number of the memory pieces of one partition
 
-#define STORAGE_SECTOR_NUMBER    2
+#define MAX_LUN_NUMBER           4                  // Partitions visible at once, must match LUNs of STORAGE_Inquirydata_FS
+#define COMMAND_LUN              0                  // Logical unit with the command file, FatFs of the device uses it
+
+#define STORAGE_BLOCK_SIZE       512                // Block Size in Bytes
+                                                    // Stored configurations: header, two partition tables, the relocation
+                                                    // journal, the change maps and the boot record, the new table is
+                                                    // written beside the live one
+#define PART_ENTRY_SIZE          256                // Bytes of the partition entry in the table, fits Partition
+#define PART_ENTRIES_PER_SECTOR  (STORAGE_BLOCK_SIZE / PART_ENTRY_SIZE)
+#define PART_TABLE_SECTORS       (MAX_PART_NUMBER / PART_ENTRIES_PER_SECTOR)
+#define CONF_HEADER_SECTORS      2                  // Header slots, the header is saved to the slot which is not live
+#define RELOCATION_JOURNAL_SECTORS 6                // Journal header and moves of the unfinished relocation
+#define CHANGE_MAP_SECTORS       16                 // Changed blocks of one partition since the last export
+#define BOOT_RECORD_SECTORS      1                  // Geometry of the default partition restored on start
+#define STORAGE_SECTOR_NUMBER    (CONF_HEADER_SECTORS + 2 * PART_TABLE_SECTORS + RELOCATION_JOURNAL_SECTORS \
+                                  + MAX_PART_NUMBER * CHANGE_MAP_SECTORS + BOOT_RECORD_SECTORS)
+
+#define CONF_FORMAT_VERSION      13                 // Version of the stored configurations layout
+
+#define STRIPE_UNIT_SECTORS      128                // Stripe unit of the volume built from several cards (64 KB)
+
+#define ERASE_BATCH_SECTORS      0x10000            // Sectors erased by one card erase command (32 MB)
+#define ERASE_STEP_TIME          500                // Background erasing time of one idle timer period in ms
+
+#define COMMAND_WATCH_RANGES     8                  // Root directory ranges of the command unit checked on host writes
+#define COMMAND_CHANGE_ENTRY     0x01               // Host wrote the root directory
+#define COMMAND_CHANGE_LAYOUT    0x02               // Host wrote the allocation table, root directory can grow
+#define COMMAND_CHANGE_WINDOW    0x04               // Host wrote the sector cached in the window of FatFs
+#define COMMAND_CHANGE_VOLUME    0x08               // Host wrote the boot sectors or the partition was switched
 
 #define PUBLIC_PARTITION_KEY    "public"
 
@@ -62,40 +93,92 @@ typedef enum {
   PUBLIC = 0,                                        // Uses for public partitions
   PRIVATE,                                          // Uses for private partitions
 } PartitionType;
+// Status of the freed memory erasing
+typedef enum {
+  ERASE_NONE = 0,                                    // Nothing was erased since the device start
+  ERASE_IN_PROGRESS,
+  ERASE_DONE,
+  ERASE_FAILED
+} EraseStatus;
+// Range of the SD card sectors
+typedef struct {
+   uint64_t startSector;
+   uint64_t sectorNumber;
+} SectorRange;
+// Progress of the freed memory erasing
+typedef struct {
+   uint64_t freedSectors;                            // Sectors released by the last configuration update
+   uint64_t erasedSectors;                           // Sectors already erased by the card
+   uint32_t eraseTime;                               // Duration of the erasing in ms
+   EraseStatus status;
+} EraseProgress;
 // Partition configurations
 typedef struct {
-   DWORD startSector;
-   DWORD lastSector;
-   UINT sectorNumber;
+   SectorRange extents[MAX_PART_EXTENTS];           // Volume memory of the partition in order of the partition sectors
+   uint8_t extentNumber;
+   uint64_t sectorNumber;                           // Sectors are 64-bit to address SDHC/SDXC cards above 4 GB
    char name[PART_NAME_LENGHT];                     // Partition name must be less than 21 symbols
    char key[PART_KEY_LENGHT];                       // Partition key must be less than 21 symbols
    PartitionType partitionType;
+   char sourceName[PART_NAME_LENGHT];               // Partition shared by the clone, empty if it is not a clone
+   uint32_t cloneId;                                // Marks the remap log in the pool of the clone
+   uint8_t isCompressed;                            // Chunks of the partition are stored compressed
+   uint8_t isReadOnly;                              // Host can't write the partition, its sectors are cached
 } Partition;
-// Device configurations
+// Device configurations, partitions are kept in the partition table on the card
 typedef struct {
-   Partition partitions[MAX_PART_NUMBER];
-   uint8_t partitionsNumber;
-   uint8_t currPartitionNumber;   
+   uint32_t formatVersion;                          // Equals CONF_FORMAT_VERSION
+   uint16_t partitionsNumber;
+   uint16_t currPartitionNumber;
+   uint8_t activeTable;                             // Table area with the live partition entries
+   uint64_t usedSectors;                            // Partitions fill the volume from its start
    InitStatus initializeStatus;    
    char confKey[CONF_KEY_LENGHT];                   // Key for revealing the current configurations of the device
    char rootKey[ROOT_KEY_LENGHT];                   // General password to enter to hidden partitions
+   StripeGeometry stripeGeometry;                   // Cards under the partitions, must match the device cards
 } PartitionsStructure;
 
 extern Diskio_drvTypeDef  SD_Driver;
 
 DSTATUS initSDCard(void);
-uint8_t changePartition(const char*, const char*);
-// Operations with currently visible partition
-int8_t currentPartitionCapacity(uint32_t*, uint16_t*);
-int8_t currentPartitionInit(void);
-int8_t currentPartitionisReady(void);
-int8_t currentPartitionIsWriteProtected(void);
+uint64_t getCardSectorNumber(void);
+uint8_t changePartition(uint8_t, const char*, const char*);
+const Partition* getLunPartition(uint8_t);
+uint8_t isPartitionShown(uint16_t);
+void notifyMediaChange(uint8_t);
+void completeMediaChange(void);
+uint8_t isLunReady(uint8_t);
+// Operations with visible partitions, each partition is the logical unit
+int8_t currentPartitionCapacity(uint8_t, uint32_t*, uint16_t*);
+int8_t currentPartitionInit(uint8_t);
+int8_t currentPartitionisReady(uint8_t);
+int8_t currentPartitionIsWriteProtected(uint8_t);
 int8_t currentPartitionMaxLun(void);
-int8_t currentPartitionRead(BYTE*, DWORD, UINT);
-int8_t currentPartitionWrite(BYTE*, DWORD, UINT);
+int8_t currentPartitionRead(uint8_t, BYTE*, DWORD, UINT);
+int8_t currentPartitionWrite(uint8_t, BYTE*, DWORD, UINT);
 
-uint8_t setConf(PartitionsStructure*, const PartitionsStructure*);
+void beginConf(const PartitionsStructure*, PartitionsStructure*);
+uint8_t addConfPartition(Partition*);
+uint8_t setConf(PartitionsStructure*, PartitionsStructure*);
 uint8_t loadConf(PartitionsStructure*, const char*);
+uint8_t getConfPartition(const PartitionsStructure*, uint16_t, Partition*);
+const EraseProgress* getEraseProgress(void);
+void continueFreedErase(void);
+void continueFormats(void);
+void continueRelocation(void);
+// Host writes that can change the command file
+void resetCommandWatch(const FATFS*);
+void addCommandWatch(uint32_t, uint32_t);
+uint8_t takeCommandChanges(uint32_t*);
 
 uint8_t initStartConf();
+// Stored configurations access
+uint64_t getConfSector(void);
+uint8_t cardReadSectors(BYTE*, uint64_t, uint32_t);
+uint8_t cardWriteSectors(const BYTE*, uint64_t, uint32_t);
+void decryptMemoryAES(BYTE*, const char*, const uint32_t);
+void encryptMemoryAES(BYTE*, const char*, const uint32_t);
+void decryptMemory(BYTE*, const char*, const uint32_t);
+void encryptMemory(BYTE*, const char*, const uint32_t);
+void createKeyWithSpecLength(const char*, char*, const uint16_t);
 #endif
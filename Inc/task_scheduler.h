@@ -0,0 +1,57 @@
+/**
+  ******************************************************************************
+  * @file           : TASK_SCHEDULER
+  * @version        : v1.0
+  * @brief          : Header for task_scheduler file
+  ******************************************************************************
+  * MIT License
+  *
+  * Copyright (c) 2017 Oleksandr Borysov
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+ ******************************************************************************
+*/
+
+
+
+
+/* Tasks of the main loop. Interrupts only post the tasks, the main loop runs them
+   to completion when the host doesn't send requests */
+#ifndef __TASK_SCHEDULER_H
+#define __TASK_SCHEDULER_H
+
+#include <stdint.h>
+
+#define HOST_IDLE_TIME           100                // ms without host requests before the tasks run
+#define URGENT_TASKS             (1u << MAILBOX_TASK)   // Tasks run without waiting for the idle host
+// Tasks in order of their priority
+typedef enum {
+  MAILBOX_TASK = 0,                                 // Request of the mailbox command, the host waits for it
+  IDLE_WORK_TASK,                               // Media change, relocation and the hot sector pool collection
+  COMMAND_TASK,                                     // Lookup and execution of the command file
+  TASK_NUMBER
+} Task;
+
+void postTask(Task);
+void noteHostRequest(void);
+void runTasks(void);
+void holdHostRequests(void);
+void releaseHostRequests(void);
+
+#endif
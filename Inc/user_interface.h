@@ -33,6 +33,8 @@
 
 #include "ff_gen_drv.h"
 
+void doIdleWork(void);
 void checkConfFiles(void);
+void doMailboxRequest(void);
 
 #endif
@@ -0,0 +1,66 @@
+/**
+  ******************************************************************************
+  * @file           : WEAR_LEVELING
+  * @version        : v1.0
+  * @brief          : Header for wear_leveling file
+  ******************************************************************************
+  * MIT License
+  *
+  * Copyright (c) 2017 Oleksandr Borysov
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+ ******************************************************************************
+*/
+
+
+
+
+/* Wear leveling of the hot volume sectors. Often rewritten sectors, like the FAT and the root
+   directory of the partitions, are written to a log in the pool at the end of the first card */
+#ifndef __WEAR_LEVELING_H
+#define __WEAR_LEVELING_H
+
+#include "sd_io_controller.h"
+
+#define WEAR_SEGMENT_SECTORS     16                 // Segment header and the data slots of the log segment
+#define WEAR_SEGMENT_NUMBER      32                 // Segments of the pool, they are written in a ring
+#define WEAR_POOL_SECTORS        (WEAR_SEGMENT_SECTORS * WEAR_SEGMENT_NUMBER)
+#define WEAR_MAP_ENTRIES         128                // Hot sectors kept in the pool at once
+#define WEAR_HOT_COUNTERS        64                 // Write counters of the sectors which are not in the pool
+#define WEAR_HOT_WRITES          16                 // Writes which make the sector hot
+#define WEAR_HOT_REQUEST_SECTORS 8                  // Longer writes carry file data, they are not counted
+#define WEAR_COLD_TIME           60000              // Sector not written for this time in ms is returned home
+#define WEAR_FREE_SEGMENTS       4                  // Free segments kept by the collection in idle time
+#define WEAR_COLLECT_STEP_TIME   100                // Collection time of one idle timer period in ms
+// State of the hot sector pool
+typedef struct {
+   uint32_t eraseCounts[WEAR_SEGMENT_NUMBER];        // Times each segment was written from its start
+   uint16_t mappedSectors;                           // Hot sectors which data is in the pool
+   uint8_t freeSegments;
+} WearPoolState;
+
+uint64_t getWearPoolSector(void);
+uint8_t initWearPool(void);
+uint8_t wearReadSectors(BYTE*, uint64_t, UINT);
+uint8_t wearWriteSectors(const BYTE*, uint64_t, UINT);
+uint8_t flushWearPool(void);
+uint8_t collectWearPool(uint32_t);
+const WearPoolState* getWearPoolState(void);
+
+#endif
@@ -0,0 +1,50 @@
+/**
+  ******************************************************************************
+  * @file           : WORK_ARENA
+  * @version        : v1.0
+  * @brief          : Header for work_arena file
+  ******************************************************************************
+  * MIT License
+  *
+  * Copyright (c) 2017 Oleksandr Borysov
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+ ******************************************************************************
+*/
+
+
+
+
+/* Static arena of the command processing buffers. Buffers are taken and released in the
+   reverse order by the command file execution, so one arena serves all of them */
+#ifndef __WORK_ARENA_H
+#define __WORK_ARENA_H
+
+#include <stdint.h>
+
+#define WORK_ARENA_SIZE          6144               // Command file, new configurations, a header sector and
+                                                    // the 4 KB chunk of the export or of the format
+#define WORK_ARENA_ALIGN         8                  // Buffers are aligned for the structures and DMA
+
+void* allocWorkBuffer(uint32_t);
+void releaseWorkBuffer(void*);
+void beginWorkMeasure(void);
+void endWorkMeasure(void);
+
+#endif
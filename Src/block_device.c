@@ -0,0 +1,253 @@
+/**
+  ******************************************************************************
+  * @file           : BLOCK_DEVICE
+  * @version        : v1.0
+  * @brief          : This file implements the block_device
+  ******************************************************************************
+  * MIT License
+  *
+  * Copyright (c) 2017 Oleksandr Borysov
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+ ******************************************************************************
+*/
+
+
+/* Includes ------------------------------------------------------------------*/
+#include "block_device.h"
+
+/* Private define ------------------------------------------------------------*/
+#define SECTOR_SIZE                      512
+
+/* Private typedef -----------------------------------------------------------*/
+// Part of the volume request placed on one device
+typedef struct {
+   uint8_t device;
+   uint64_t deviceSector;
+   uint32_t count;
+} StripePiece;
+
+/* Private variables ---------------------------------------------------------*/
+const BlockDevice *blockDevices[MAX_BLOCK_DEVICE_NUMBER];  // Striped devices in stripe order
+uint8_t blockDeviceNumber = 1;                             // The first device is given by initVolume
+uint32_t stripeUnit = 1;                                   // Stripe unit in sectors
+uint64_t volumeSectorNumber = 0;                           // Size of the striped volume
+
+/* Private function prototypes -----------------------------------------------*/
+void getStripePiece(uint64_t, uint32_t, StripePiece*);
+
+/*******************************************************************************
+* Description    : Adds block device to the end of the stripe, after the first device.
+* Input          : device - block device driver.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t registerBlockDevice(const BlockDevice *device) {
+  if (blockDeviceNumber >= MAX_BLOCK_DEVICE_NUMBER) {
+    return BLOCK_DEVICE_ERROR;
+  }
+  blockDevices[blockDeviceNumber++] = device;
+  return BLOCK_DEVICE_OK;
+}
+
+/*******************************************************************************
+* Description    : Calculates the volume geometry for the first device and the registered
+*                    devices. Each device reserves the same number of sectors at its end,
+*                    the volume is limited by the smallest device.
+* Input          : firstDevice - the device which keeps the configurations
+*                  unit - stripe unit in sectors
+*                  reservedSectors - sectors reserved at the end of each device.
+* Output         : None.
+* Return         : None.
+*******************************************************************************/
+void initVolume(const BlockDevice *firstDevice, uint32_t unit, uint32_t reservedSectors) {
+  uint64_t deviceSectors = 0;
+  blockDevices[0] = firstDevice;
+  stripeUnit = unit != 0 ? unit : 1;
+  volumeSectorNumber = 0;
+  for (uint8_t i = 0; i < blockDeviceNumber; ++i) {
+    uint64_t sectors = blockDevices[i]->getSectorNumber();
+    sectors = sectors > reservedSectors ? sectors - reservedSectors : 0;
+    if ((i == 0) || (sectors < deviceSectors)) {
+      deviceSectors = sectors;
+    }
+  }
+  if (blockDeviceNumber > 1) {                              // Only full stripe rows are used
+    deviceSectors -= deviceSectors % stripeUnit;
+  }
+  volumeSectorNumber = deviceSectors * blockDeviceNumber;
+}
+
+/*******************************************************************************
+* Description    : Gets current geometry of the stripe.
+* Input          : None.
+* Output         : geometry - the stripe geometry.
+* Return         : None.
+*******************************************************************************/
+void getStripeGeometry(StripeGeometry *geometry) {
+  geometry->deviceNumber = blockDeviceNumber;
+  geometry->stripeUnit = stripeUnit;
+}
+
+/*******************************************************************************
+* Description    : Gets size of the striped volume.
+* Input          : None.
+* Output         : None.
+* Return         : Number of the volume sectors.
+*******************************************************************************/
+uint64_t getVolumeSectorNumber(void) {
+  return volumeSectorNumber;
+}
+
+/*******************************************************************************
+* Description    : Reads sectors of the volume. The request is split on stripe units,
+*                    next unit of the device is started when its previous unit is read,
+*                    so all devices transfer data at the same time.
+* Input          : sector - first volume sector
+*                  count - number of the sectors.
+* Output         : buff - read data.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t volumeReadSectors(uint8_t *buff, uint64_t sector, uint32_t count) {
+  uint8_t busy[MAX_BLOCK_DEVICE_NUMBER] = {0};
+  uint8_t res = BLOCK_DEVICE_OK;
+  StripePiece piece;
+  if ((count == 0) || (sector + count > volumeSectorNumber)) {
+    return BLOCK_DEVICE_ERROR;
+  }
+  while ((count != 0) && (res == BLOCK_DEVICE_OK)) {
+    getStripePiece(sector, count, &piece);
+    if (busy[piece.device]) {
+      res = blockDevices[piece.device]->waitRead();
+    }
+    if ((res == BLOCK_DEVICE_OK)
+        && (blockDevices[piece.device]->startRead(buff, piece.deviceSector, piece.count) == BLOCK_DEVICE_OK)) {
+      busy[piece.device] = 1;
+      buff += piece.count * SECTOR_SIZE;
+      sector += piece.count;
+      count -= piece.count;
+    } else {
+      res = BLOCK_DEVICE_ERROR;
+    }
+  }
+  for (uint8_t i = 0; i < blockDeviceNumber; ++i) {          // Complete started transfers
+    if (busy[i] && (blockDevices[i]->waitRead() != BLOCK_DEVICE_OK)) {
+      res = BLOCK_DEVICE_ERROR;
+    }
+  }
+  return res;
+}
+
+/*******************************************************************************
+* Description    : Writes sectors of the volume. The request is split the same way as reading.
+* Input          : buff - data to write
+*                  sector - first volume sector
+*                  count - number of the sectors.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t volumeWriteSectors(const uint8_t *buff, uint64_t sector, uint32_t count) {
+  uint8_t busy[MAX_BLOCK_DEVICE_NUMBER] = {0};
+  uint8_t res = BLOCK_DEVICE_OK;
+  StripePiece piece;
+  if ((count == 0) || (sector + count > volumeSectorNumber)) {
+    return BLOCK_DEVICE_ERROR;
+  }
+  while ((count != 0) && (res == BLOCK_DEVICE_OK)) {
+    getStripePiece(sector, count, &piece);
+    if (busy[piece.device]) {
+      res = blockDevices[piece.device]->waitWrite();
+    }
+    if ((res == BLOCK_DEVICE_OK)
+        && (blockDevices[piece.device]->startWrite(buff, piece.deviceSector, piece.count) == BLOCK_DEVICE_OK)) {
+      busy[piece.device] = 1;
+      buff += piece.count * SECTOR_SIZE;
+      sector += piece.count;
+      count -= piece.count;
+    } else {
+      res = BLOCK_DEVICE_ERROR;
+    }
+  }
+  for (uint8_t i = 0; i < blockDeviceNumber; ++i) {          // Complete started transfers
+    if (busy[i] && (blockDevices[i]->waitWrite() != BLOCK_DEVICE_OK)) {
+      res = BLOCK_DEVICE_ERROR;
+    }
+  }
+  return res;
+}
+
+/*******************************************************************************
+* Description    : Erases sectors of the volume. Neighbour stripe units of one device
+*                    are joined to erase them by one command.
+* Input          : sector - first volume sector
+*                  count - number of the sectors.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t volumeEraseSectors(uint64_t sector, uint64_t count) {
+  uint64_t runStart[MAX_BLOCK_DEVICE_NUMBER];
+  uint64_t runLength[MAX_BLOCK_DEVICE_NUMBER] = {0};
+  StripePiece piece;
+  if ((count == 0) || (sector + count > volumeSectorNumber)) {
+    return BLOCK_DEVICE_ERROR;
+  }
+  while (count != 0) {
+    getStripePiece(sector, count < stripeUnit ? (uint32_t) count : stripeUnit, &piece);
+    if ((runLength[piece.device] != 0)
+        && (runStart[piece.device] + runLength[piece.device] != piece.deviceSector)) {
+      if (blockDevices[piece.device]->erase(runStart[piece.device], runLength[piece.device]) != BLOCK_DEVICE_OK) {
+        return BLOCK_DEVICE_ERROR;
+      }
+      runLength[piece.device] = 0;
+    }
+    if (runLength[piece.device] == 0) {
+      runStart[piece.device] = piece.deviceSector;
+    }
+    runLength[piece.device] += piece.count;
+    sector += piece.count;
+    count -= piece.count;
+  }
+  for (uint8_t i = 0; i < blockDeviceNumber; ++i) {
+    if ((runLength[i] != 0) && (blockDevices[i]->erase(runStart[i], runLength[i]) != BLOCK_DEVICE_OK)) {
+      return BLOCK_DEVICE_ERROR;
+    }
+  }
+  return BLOCK_DEVICE_OK;
+}
+
+/*******************************************************************************
+* Description    : Translates volume sector to the device sector.
+* Input          : sector - volume sector
+*                  count - number of the requested sectors.
+* Output         : piece - the device, its sector and the number of sectors till end of the stripe unit.
+* Return         : None.
+*******************************************************************************/
+void getStripePiece(uint64_t sector, uint32_t count, StripePiece *piece) {
+  uint64_t unit = sector / stripeUnit;
+  uint32_t offset = sector % stripeUnit;
+  if (blockDeviceNumber == 1) {                              // Nothing to stripe
+    piece->device = 0;
+    piece->deviceSector = sector;
+    piece->count = count;
+    return;
+  }
+  piece->device = unit % blockDeviceNumber;
+  piece->deviceSector = (unit / blockDeviceNumber) * stripeUnit + offset;
+  piece->count = stripeUnit - offset < count ? stripeUnit - offset : count;
+}
@@ -0,0 +1,393 @@
+/**
+  ******************************************************************************
+  * @file           : CHANGE_TRACKING
+  * @version        : v1.0
+  * @brief          : This file implements changed block tracking of the partitions
+  ******************************************************************************
+  * MIT License
+  *
+  * Copyright (c) 2017 Oleksandr Borysov
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+ ******************************************************************************
+*/
+
+
+/* Includes ------------------------------------------------------------------*/
+#include "change_tracking.h"
+#include "clone_remap.h"
+#include "compression.h"
+#include "work_arena.h"
+#include <string.h>
+
+/* Private typedef -----------------------------------------------------------*/
+// First sector of the change map, the bitmap of the units follows it
+typedef struct {
+   uint32_t magic;                                        // CHANGE_MAP_MAGIC if the map was started
+   char name[PART_NAME_LENGHT];                           // Map belongs to the partition with the same name,
+   uint32_t keyCheck;                                     // key and size, other partition starts with the full map
+   uint64_t sectorNumber;
+   uint32_t unitSectors;
+   uint8_t isFull;                                        // All units are changed, changes before the map start are unknown
+} ChangeMapHeader;
+// Change map of the partition visible through the logical unit
+typedef struct {
+   ChangeMapHeader header;
+   BYTE sector[STORAGE_BLOCK_SIZE];                       // Bitmap sector with the last marked units
+   uint16_t partitionNumber;
+   uint8_t mapSector;                                     // Sector of the map in the buffer, NO_MAP_SECTOR if none
+   uint8_t isOpen;
+} ChangeMapCache;
+
+/* Private define ------------------------------------------------------------*/
+#define CHANGE_MAP_MAGIC                 0x43424D50u    // "CBMP"
+#define CHANGE_BITS_PER_SECTOR           (STORAGE_BLOCK_SIZE * 8)
+#define NO_MAP_SECTOR                    0              // Header sector is never kept in the buffer
+#define KEY_CHECK_BASIS                  2166136261u    // FNV-1a hash of the partition key
+#define KEY_CHECK_PRIME                  16777619u
+
+/* Private variables ---------------------------------------------------------*/
+ChangeMapCache changeMapCaches[MAX_LUN_NUMBER];           // Maps of the visible partitions, they are written through
+extern PartitionsStructure partitionsStructure;
+
+/* Private change tracking function prototypes -----------------------------------------------*/
+uint8_t isPartitionTracked(uint16_t, const Partition*);
+void createMapHeader(const Partition*, uint8_t, ChangeMapHeader*);
+uint8_t isMapHeaderActual(const ChangeMapHeader*, const Partition*);
+uint8_t openChangeMap(ChangeMapCache*, uint16_t, const Partition*);
+uint8_t loadMapSector(BYTE*, uint16_t, uint8_t);
+uint8_t storeMapSector(BYTE*, uint16_t, uint8_t);
+uint8_t storeMapHeader(const ChangeMapHeader*, uint16_t, BYTE*);
+uint32_t getKeyCheck(const char*);
+uint64_t getChangeMapSector(uint16_t, uint8_t);
+
+/* Public change tracking functions ---------------------------------------------------------*/
+
+/*******************************************************************************
+* Description    : Marks units of the written sectors in the change map. The bitmap
+*                    sector is written before the data only when the unit changes first
+*                    time since the last export, so the map never misses the write.
+* Input          : lun - logical unit of the partition
+*                  partNumber - number of the partition
+*                  partition - the partition
+*                  sector - first written sector
+*                  count - number of the written sectors.
+* Output         : None.
+* Return         : 0 if success or 1 if the map is not updated.
+*******************************************************************************/
+uint8_t markChangedSectors(uint8_t lun, uint16_t partNumber, const Partition *partition, uint64_t sector, UINT count) {
+  ChangeMapCache *cache = &changeMapCaches[lun];
+  uint8_t isDirty = 0;
+  if (!isPartitionTracked(partNumber, partition) || (count == 0)) {
+    return 0;
+  }
+  if ((!cache->isOpen || (cache->partitionNumber != partNumber)) && (openChangeMap(cache, partNumber, partition) != 0)) {
+    return 1;
+  }
+  if (cache->header.isFull) {
+    return 0;                                                 // Export will take the whole partition anyway
+  }
+  uint64_t lastUnit = (sector + count - 1) / cache->header.unitSectors;
+  for (uint64_t unit = sector / cache->header.unitSectors; unit <= lastUnit; ++unit) {
+    uint8_t mapSector = CHANGE_HEADER_SECTORS + unit / CHANGE_BITS_PER_SECTOR;
+    uint16_t bit = unit % CHANGE_BITS_PER_SECTOR;
+    if (cache->mapSector != mapSector) {
+      if ((isDirty && (storeMapSector(cache->sector, partNumber, cache->mapSector) != 0))
+          || (loadMapSector(cache->sector, partNumber, mapSector) != 0)) {
+        cache->mapSector = NO_MAP_SECTOR;
+        return 1;
+      }
+      cache->mapSector = mapSector;
+      isDirty = 0;
+    }
+    if (!(cache->sector[bit / 8] & (1 << (bit % 8)))) {
+      cache->sector[bit / 8] |= 1 << (bit % 8);
+      isDirty = 1;
+    }
+  }
+  if (isDirty && (storeMapSector(cache->sector, partNumber, cache->mapSector) != 0)) {
+    cache->mapSector = NO_MAP_SECTOR;
+    return 1;
+  }
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Forgets the change map of the logical unit, the map of the next
+*                    partition is read from the card.
+* Input          : lun - the logical unit.
+* Output         : None.
+* Return         : None.
+*******************************************************************************/
+void closeChangeMap(uint8_t lun) {
+  changeMapCaches[lun].isOpen = 0;
+}
+
+/*******************************************************************************
+* Description    : Walks the changed sector ranges of the partition since the last export.
+*                    Neighbour changed units make one range. The partition which map
+*                    doesn't match it is changed whole.
+* Input          : partNumber - number of the partition
+*                  partition - the partition
+*                  action - function called for each changed sector range.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t forEachChangedRange(uint16_t partNumber, const Partition *partition, uint8_t (*action)(uint64_t, uint64_t)) {
+  ChangeMapHeader header;
+  uint64_t rangeStart = 0;
+  uint8_t isInRange = 0;
+  BYTE *mapSector = allocWorkBuffer(STORAGE_BLOCK_SIZE);    // The action takes its buffers after it
+  uint8_t res = 1;
+  if ((mapSector == NULL) || (loadMapSector(mapSector, partNumber, 0) != 0)) {
+    releaseWorkBuffer(mapSector);
+    return res;
+  }
+  memcpy(&header, mapSector, sizeof(header));
+  if (!isMapHeaderActual(&header, partition) || header.isFull) {
+    releaseWorkBuffer(mapSector);
+    return action(0, partition->sectorNumber);
+  }
+  res = 0;
+  uint64_t unitNumber = (partition->sectorNumber + header.unitSectors - 1) / header.unitSectors;
+  for (uint64_t unit = 0; (unit < unitNumber) && (res == 0); ++unit) {
+    uint16_t bit = unit % CHANGE_BITS_PER_SECTOR;
+    if (bit == 0) {
+      res = loadMapSector(mapSector, partNumber, CHANGE_HEADER_SECTORS + unit / CHANGE_BITS_PER_SECTOR);
+    }
+    uint8_t isChanged = mapSector[bit / 8] & (1 << (bit % 8)) ? 1 : 0;
+    if ((res == 0) && isChanged && !isInRange) {
+      rangeStart = unit * header.unitSectors;
+    } else if ((res == 0) && !isChanged && isInRange) {
+      res = action(rangeStart, unit * header.unitSectors - rangeStart);
+    }
+    isInRange = isChanged;
+  }
+  if ((res == 0) && isInRange) {
+    res = action(rangeStart, partition->sectorNumber - rangeStart);
+  }
+  releaseWorkBuffer(mapSector);
+  return res;
+}
+
+/*******************************************************************************
+* Description    : Starts the new change map of the partition after the export. The map
+*                    is marked full while the bitmap is cleared, so power loss never
+*                    leaves the map which misses changes.
+* Input          : partNumber - number of the partition
+*                  partition - the partition.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t resetChangeMap(uint16_t partNumber, const Partition *partition) {
+  ChangeMapHeader header;
+  BYTE *mapSector = allocWorkBuffer(STORAGE_BLOCK_SIZE);
+  uint8_t res = 1;
+  for (uint8_t i = 0; i < MAX_LUN_NUMBER; ++i) {
+    if (changeMapCaches[i].partitionNumber == partNumber) {
+      changeMapCaches[i].isOpen = 0;
+    }
+  }
+  if (mapSector == NULL) {
+    return res;
+  }
+  createMapHeader(partition, 1, &header);
+  res = storeMapHeader(&header, partNumber, mapSector);
+  for (uint8_t i = CHANGE_HEADER_SECTORS; (i < CHANGE_MAP_SECTORS) && (res == 0); ++i) {
+    memset(mapSector, 0, STORAGE_BLOCK_SIZE);
+    res = storeMapSector(mapSector, partNumber, i);
+  }
+  if (res == 0) {
+    header.isFull = 0;
+    res = storeMapHeader(&header, partNumber, mapSector);
+  }
+  releaseWorkBuffer(mapSector);
+  return res;
+}
+
+/*******************************************************************************
+* Description    : Calculates the tracked unit of the partition. The unit is doubled
+*                    till the units of the partition fit the bitmap.
+* Input          : partition - the partition.
+* Output         : None.
+* Return         : Number of the unit sectors.
+*******************************************************************************/
+uint32_t getChangeUnitSectors(const Partition *partition) {
+  uint32_t unitSectors = CHANGE_UNIT_MIN_SECTORS;
+  while ((partition->sectorNumber + unitSectors - 1) / unitSectors > CHANGE_MAP_BITS) {
+    unitSectors *= 2;
+  }
+  return unitSectors;
+}
+
+/* Private change tracking functions ---------------------------------------------------------*/
+
+/*******************************************************************************
+* Description    : Checks the partition writes to be tracked. Zero partition keeps
+*                    the exported files, clones are exported through their source and
+*                    stored sectors of the compressed partition are not the host sectors.
+* Input          : partNumber - number of the partition
+*                  partition - the partition.
+* Output         : None.
+* Return         : True if the writes are marked in the change map.
+*******************************************************************************/
+uint8_t isPartitionTracked(uint16_t partNumber, const Partition *partition) {
+  return (partitionsStructure.initializeStatus == INITIALIZED) && (partNumber != 0)
+      && !isClonePartition(partition) && !isCompressedPartition(partition) ? 1 : 0;
+}
+
+/*******************************************************************************
+* Description    : Fills the change map header of the partition.
+* Input          : partition - the partition
+*                  isFull - 1 if all units are changed.
+* Output         : header - the header.
+* Return         : None.
+*******************************************************************************/
+void createMapHeader(const Partition *partition, uint8_t isFull, ChangeMapHeader *header) {
+  memset(header, 0, sizeof(*header));
+  header->magic = CHANGE_MAP_MAGIC;
+  strncpy(header->name, partition->name, PART_NAME_LENGHT);
+  header->keyCheck = getKeyCheck(partition->key);
+  header->sectorNumber = partition->sectorNumber;
+  header->unitSectors = getChangeUnitSectors(partition);
+  header->isFull = isFull;
+}
+
+/*******************************************************************************
+* Description    : Checks the change map header to belong to the partition.
+* Input          : header - the header
+*                  partition - the partition.
+* Output         : None.
+* Return         : True if the map tracks the partition.
+*******************************************************************************/
+uint8_t isMapHeaderActual(const ChangeMapHeader *header, const Partition *partition) {
+  return (header->magic == CHANGE_MAP_MAGIC)
+      && (strncmp(header->name, partition->name, PART_NAME_LENGHT) == 0)
+      && (header->keyCheck == getKeyCheck(partition->key))
+      && (header->sectorNumber == partition->sectorNumber)
+      && (header->unitSectors == getChangeUnitSectors(partition)) ? 1 : 0;
+}
+
+/*******************************************************************************
+* Description    : Reads the change map header of the partition to the logical unit cache.
+*                    Map of other partition is started full.
+* Input          : cache - cache of the logical unit
+*                  partNumber - number of the partition
+*                  partition - the partition.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t openChangeMap(ChangeMapCache *cache, uint16_t partNumber, const Partition *partition) {
+  cache->isOpen = 0;
+  cache->mapSector = NO_MAP_SECTOR;
+  if (loadMapSector(cache->sector, partNumber, 0) != 0) {
+    return 1;
+  }
+  memcpy(&cache->header, cache->sector, sizeof(cache->header));
+  if (!isMapHeaderActual(&cache->header, partition)) {
+    createMapHeader(partition, 1, &cache->header);
+    if (storeMapHeader(&cache->header, partNumber, cache->sector) != 0) {
+      return 1;
+    }
+  }
+  cache->partitionNumber = partNumber;
+  cache->isOpen = 1;
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Reads and decrypts the change map sector.
+* Input          : partNumber - number of the partition
+*                  mapSector - sector of the map.
+* Output         : buff - the decrypted sector.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t loadMapSector(BYTE *buff, uint16_t partNumber, uint8_t mapSector) {
+  if (cardReadSectors(buff, getChangeMapSector(partNumber, mapSector), 1) != MSD_OK) {
+    return 1;
+  }
+#if  CIPHER_MOD == 0
+  decryptMemoryAES(buff, partitionsStructure.rootKey, STORAGE_BLOCK_SIZE);
+#endif
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Encrypts and writes the change map sector, the buffer keeps the plain sector.
+* Input          : buff - the sector
+*                  partNumber - number of the partition
+*                  mapSector - sector of the map.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t storeMapSector(BYTE *buff, uint16_t partNumber, uint8_t mapSector) {
+  uint8_t res = 1;
+#if  CIPHER_MOD == 0
+  encryptMemoryAES(buff, partitionsStructure.rootKey, STORAGE_BLOCK_SIZE);
+#endif
+  if (cardWriteSectors(buff, getChangeMapSector(partNumber, mapSector), 1) == MSD_OK) {
+    res = 0;
+  }
+#if  CIPHER_MOD == 0
+  decryptMemoryAES(buff, partitionsStructure.rootKey, STORAGE_BLOCK_SIZE);
+#endif
+  return res;
+}
+
+/*******************************************************************************
+* Description    : Writes the change map header.
+* Input          : header - the header
+*                  partNumber - number of the partition
+*                  buff - sector buffer for the header.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t storeMapHeader(const ChangeMapHeader *header, uint16_t partNumber, BYTE *buff) {
+  memset(buff, 0, STORAGE_BLOCK_SIZE);
+  memcpy(buff, header, sizeof(*header));
+  return storeMapSector(buff, partNumber, 0);
+}
+
+/*******************************************************************************
+* Description    : Calculates FNV-1a hash of the partition key. Map is started again
+*                    when the key changes because the stored data is encrypted again.
+* Input          : key - the partition key.
+* Output         : None.
+* Return         : Hash of the key.
+*******************************************************************************/
+uint32_t getKeyCheck(const char *key) {
+  uint32_t hash = KEY_CHECK_BASIS;
+  for (uint8_t i = 0; (i < PART_KEY_LENGHT) && (key[i] != '\0'); ++i) {
+    hash = (hash ^ (uint8_t) key[i]) * KEY_CHECK_PRIME;
+  }
+  return hash;
+}
+
+/*******************************************************************************
+* Description    : Calculates the card sector of the change map sector. Maps follow
+*                    the relocation journal, one map per partition number.
+* Input          : partNumber - number of the partition
+*                  mapSector - sector of the map.
+* Output         : None.
+* Return         : Sector of the first card.
+*******************************************************************************/
+uint64_t getChangeMapSector(uint16_t partNumber, uint8_t mapSector) {
+  return getConfSector() + CONF_HEADER_SECTORS + 2 * PART_TABLE_SECTORS + RELOCATION_JOURNAL_SECTORS
+      + (uint64_t) partNumber * CHANGE_MAP_SECTORS + mapSector;
+}
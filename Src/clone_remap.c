@@ -0,0 +1,497 @@
+/**
+  ******************************************************************************
+  * @file           : CLONE_REMAP
+  * @version        : v1.0
+  * @brief          : This file implements copy-on-write clones of the partitions
+  ******************************************************************************
+  * MIT License
+  *
+  * Copyright (c) 2017 Oleksandr Borysov
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+ ******************************************************************************
+*/
+
+
+/* Includes ------------------------------------------------------------------*/
+#include "clone_remap.h"
+#include "partition_table.h"
+#include "relocation.h"
+#include "device_stats.h"
+#include <string.h>
+
+/* Private typedef -----------------------------------------------------------*/
+// First sector of the clone pool
+typedef struct {
+   uint32_t magic;                                        // CLONE_MAGIC if the pool has the remap log
+   uint32_t cloneId;                                      // Pool of the other clone has other id
+   uint32_t usedPoolBlocks;                               // Pool blocks in use, log entries after them are not valid
+} CloneHeader;
+// Remap table of the visible clone
+typedef struct {
+   Partition clone;                                       // Clone entry, its extents are the pool
+   Partition source;
+   ExtentIndex cloneIndex;
+   ExtentIndex sourceIndex;
+   const char *xorKey;                                    // Key stream of the clone partition
+   uint32_t cloneBlocks[MAX_CLONE_BLOCKS];                // Remapped blocks of the clone in ascending order
+   uint16_t poolBlocks[MAX_CLONE_BLOCKS];                 // Pool block of each remapped block
+   uint16_t remapNumber;
+   uint16_t usedPoolBlocks;                               // Pool blocks counted by the remap header
+   uint16_t poolCapacity;                                 // Pool blocks after the remap log
+   uint8_t lun;                                           // Logical unit of the clone
+   uint8_t isOpen;
+} CloneRemap;
+
+/* Private define ------------------------------------------------------------*/
+#define CLONE_MAGIC                      0x434C4F4Eu    // "CLON"
+#define CLONE_LOG_ENTRIES_PER_SECTOR     (STORAGE_BLOCK_SIZE / 4)
+#define NO_CLONE_BLOCK                   -1
+
+/* Private variables ---------------------------------------------------------*/
+CloneRemap cloneRemap;                                    // Only one clone is visible at once
+uint32_t cloneBuffer[CLONE_COPY_SECTORS * STORAGE_BLOCK_SIZE / 4];  // Copied sectors, word aligned for DMA. Not in
+                                                          // the work arena: host writes copy in the USB interrupt
+
+/* Private clone function prototypes -----------------------------------------------*/
+uint32_t createCloneId(void);
+int32_t findCloneBlock(uint32_t);
+void insertCloneBlock(uint32_t, uint16_t);
+uint64_t getCloneSector(uint64_t, UINT*);
+uint8_t copySourceSectors(uint64_t, uint64_t, uint64_t);
+uint8_t copyOnWrite(BYTE*, uint32_t, uint32_t, UINT);
+uint8_t commitCloneBlock(uint32_t, uint16_t);
+uint8_t loadRemapLog(void);
+void cipherCloneMeta(BYTE*);
+
+/* Public clone functions ---------------------------------------------------------*/
+
+/*******************************************************************************
+* Description    : Checks the partition to be the clone of other partition.
+* Input          : partition - the partition.
+* Output         : None.
+* Return         : True if the partition is the clone.
+*******************************************************************************/
+uint8_t isClonePartition(const Partition *partition) {
+  return partition->sourceName[0] != '\0' ? 1 : 0;
+}
+
+/*******************************************************************************
+* Description    : Sets id of the clone before it is added to the new partition table.
+*                    The clone which keeps its name and source keeps its id and so
+*                    its remapped blocks, other clones start empty.
+* Input          : partition - the partition.
+* Output         : partition - the partition with the clone id.
+* Return         : None.
+*******************************************************************************/
+void prepareClonePartition(Partition *partition) {
+  Partition oldPartition;
+  if (!isClonePartition(partition)) {
+    partition->cloneId = 0;
+    return;
+  }
+  if ((findPartitionEntry(partition->name, &oldPartition) >= 0)       // Live table is still indexed
+      && (strncmp(oldPartition.sourceName, partition->sourceName, PART_NAME_LENGHT) == 0)
+      && (oldPartition.cloneId != 0)) {
+    partition->cloneId = oldPartition.cloneId;
+  } else {
+    partition->cloneId = createCloneId();
+  }
+}
+
+/*******************************************************************************
+* Description    : Checks clones of the new partition table. The source must be other
+*                    partition than zero which is not the clone, the clone has the key of
+*                    the source and the pool fits the remap log and one block at least.
+* Input          : conf - new device configurations with the indexed table.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t checkClonePartitions(const PartitionsStructure *conf) {
+  Partition clone;
+  Partition source;
+  for (uint16_t i = 0; i < conf->partitionsNumber; ++i) {
+    if (getConfPartition(conf, i, &clone) != 0) {
+      return 1;
+    }
+    if (!isClonePartition(&clone)) {
+      continue;
+    }
+    if ((i == 0) || (clone.sectorNumber < CLONE_META_SECTORS + CLONE_BLOCK_SECTORS)
+        || (findPartitionEntry(clone.sourceName, &source) <= 0)    // Zero partition is never cloned
+        || isClonePartition(&source)
+        || (source.partitionType != clone.partitionType)
+        || (strncmp(source.key, clone.key, PART_KEY_LENGHT) != 0)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Checks the partition to have clones. Sectors of such partition are
+*                    shared, so it is visible only for reading.
+* Input          : conf - the device configurations
+*                  name - name of the partition.
+* Output         : None.
+* Return         : True if some clone shares sectors of the partition.
+*******************************************************************************/
+uint8_t isPartitionCloned(const PartitionsStructure *conf, const char *name) {
+  Partition partition;
+  for (uint16_t i = 1; i < conf->partitionsNumber; ++i) {
+    if ((getConfPartition(conf, i, &partition) == 0) && isClonePartition(&partition)
+        && (strncmp(partition.sourceName, name, PART_NAME_LENGHT) == 0)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Loads remap table of the clone which becomes visible. The pool
+*                    without the header of the clone has no remapped blocks.
+* Input          : lun - logical unit of the clone
+*                  clone - the clone partition
+*                  source - the source partition
+*                  xorKey - key stream of the clone partition.
+* Output         : None.
+* Return         : 0 if success or 1 if other logical unit shows the clone or the log is not read.
+*******************************************************************************/
+uint8_t openCloneRemap(uint8_t lun, const Partition *clone, const Partition *source, const char *xorKey) {
+  if (cloneRemap.isOpen && (cloneRemap.lun != lun)) {
+    return 1;
+  }
+  cloneRemap.isOpen = 0;
+  cloneRemap.clone = *clone;
+  cloneRemap.source = *source;
+  buildExtentIndex(&cloneRemap.clone, &cloneRemap.cloneIndex);
+  buildExtentIndex(&cloneRemap.source, &cloneRemap.sourceIndex);
+  cloneRemap.xorKey = xorKey;
+  cloneRemap.lun = lun;
+  cloneRemap.poolCapacity = (clone->sectorNumber - CLONE_META_SECTORS) / CLONE_BLOCK_SECTORS < MAX_CLONE_BLOCKS
+      ? (clone->sectorNumber - CLONE_META_SECTORS) / CLONE_BLOCK_SECTORS : MAX_CLONE_BLOCKS;
+  if (loadRemapLog() != 0) {
+    return 1;
+  }
+  cloneRemap.isOpen = 1;
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Releases remap table of the logical unit.
+* Input          : lun - the logical unit.
+* Output         : None.
+* Return         : None.
+*******************************************************************************/
+void closeCloneRemap(uint8_t lun) {
+  if (cloneRemap.lun == lun) {
+    cloneRemap.isOpen = 0;
+  }
+}
+
+/*******************************************************************************
+* Description    : Returns size of the visible clone, it is the size of the source.
+* Input          : None.
+* Output         : None.
+* Return         : Number of the clone sectors.
+*******************************************************************************/
+uint64_t getCloneSectorNumber(void) {
+  return cloneRemap.source.sectorNumber;
+}
+
+/*******************************************************************************
+* Description    : Reads sectors of the visible clone. Remapped blocks are read from
+*                    the pool, other blocks from the source.
+* Input          : sector - first clone sector
+*                  count - number of the sectors.
+* Output         : buff - read data.
+* Return         : BLOCK_DEVICE_OK if success.
+*******************************************************************************/
+uint8_t readCloneSectors(BYTE *buff, uint64_t sector, UINT count) {
+  while (count != 0) {
+    UINT runLength = count;
+    uint64_t volumeSector = getCloneSector(sector, &runLength);
+    if (readRelocatedSectors(buff, volumeSector, runLength) != BLOCK_DEVICE_OK) {
+      return BLOCK_DEVICE_ERROR;
+    }
+    buff += runLength * STORAGE_BLOCK_SIZE;
+    sector += runLength;
+    count -= runLength;
+  }
+  return BLOCK_DEVICE_OK;
+}
+
+/*******************************************************************************
+* Description    : Writes sectors of the visible clone. The first write to the block
+*                    copies it from the source to the next pool block.
+* Input          : buff - data to write
+*                  sector - first clone sector
+*                  count - number of the sectors.
+* Output         : None.
+* Return         : BLOCK_DEVICE_OK if success or BLOCK_DEVICE_ERROR if the pool is full.
+*******************************************************************************/
+uint8_t writeCloneSectors(BYTE *buff, uint64_t sector, UINT count) {
+  while (count != 0) {
+    uint32_t block = sector / CLONE_BLOCK_SECTORS;
+    uint32_t offset = sector % CLONE_BLOCK_SECTORS;
+    UINT runLength = CLONE_BLOCK_SECTORS - offset < count ? CLONE_BLOCK_SECTORS - offset : count;
+    if (findCloneBlock(block) == NO_CLONE_BLOCK) {
+      if (copyOnWrite(buff, block, offset, runLength) != BLOCK_DEVICE_OK) {
+        return BLOCK_DEVICE_ERROR;
+      }
+    } else {
+      for (UINT written = 0; written < runLength;) {
+        UINT mappedLength = runLength - written;
+        uint64_t volumeSector = getCloneSector(sector + written, &mappedLength);
+        if (writeRelocatedSectors(buff + written * STORAGE_BLOCK_SIZE, volumeSector, mappedLength) != BLOCK_DEVICE_OK) {
+          return BLOCK_DEVICE_ERROR;
+        }
+        written += mappedLength;
+      }
+    }
+    buff += runLength * STORAGE_BLOCK_SIZE;
+    sector += runLength;
+    count -= runLength;
+  }
+  return BLOCK_DEVICE_OK;
+}
+
+/* Private clone functions ---------------------------------------------------------*/
+
+/*******************************************************************************
+* Description    : Creates id of the new clone from the time stamps.
+* Input          : None.
+* Output         : None.
+* Return         : Not zero clone id.
+*******************************************************************************/
+uint32_t createCloneId(void) {
+  uint32_t cloneId = getTimeStamp() ^ (HAL_GetTick() << 16);
+  return cloneId != 0 ? cloneId : 1;
+}
+
+/*******************************************************************************
+* Description    : Finds the remapped block by binary search.
+* Input          : block - block of the clone.
+* Output         : None.
+* Return         : Index of the block in the remap table or NO_CLONE_BLOCK.
+*******************************************************************************/
+int32_t findCloneBlock(uint32_t block) {
+  int32_t low = 0;
+  int32_t high = cloneRemap.remapNumber - 1;
+  while (low <= high) {
+    int32_t middle = (low + high) / 2;
+    if (cloneRemap.cloneBlocks[middle] == block) {
+      return middle;
+    }
+    if (cloneRemap.cloneBlocks[middle] < block) {
+      low = middle + 1;
+    } else {
+      high = middle - 1;
+    }
+  }
+  return NO_CLONE_BLOCK;
+}
+
+/*******************************************************************************
+* Description    : Adds the block to the remap table keeping the ascending order.
+* Input          : block - block of the clone
+*                  poolBlock - block of the pool with the clone data.
+* Output         : None.
+* Return         : None.
+*******************************************************************************/
+void insertCloneBlock(uint32_t block, uint16_t poolBlock) {
+  uint16_t position = cloneRemap.remapNumber;
+  while ((position > 0) && (cloneRemap.cloneBlocks[position - 1] > block)) {
+    cloneRemap.cloneBlocks[position] = cloneRemap.cloneBlocks[position - 1];
+    cloneRemap.poolBlocks[position] = cloneRemap.poolBlocks[position - 1];
+    position--;
+  }
+  cloneRemap.cloneBlocks[position] = block;
+  cloneRemap.poolBlocks[position] = poolBlock;
+  cloneRemap.remapNumber++;
+}
+
+/*******************************************************************************
+* Description    : Calculates volume sector of the clone sector through the remap table.
+* Input          : sector - clone sector
+*                  runLength - number of the desired sectors.
+* Output         : runLength - number of the sectors till the end of the block or the extent.
+* Return         : Volume sector of the clone sector.
+*******************************************************************************/
+uint64_t getCloneSector(uint64_t sector, UINT *runLength) {
+  uint32_t offset = sector % CLONE_BLOCK_SECTORS;
+  UINT extentLength;
+  uint64_t volumeSector;
+  uint32_t startStamp = getTimeStamp();
+  int32_t index = findCloneBlock(sector / CLONE_BLOCK_SECTORS);
+  deviceStatistics.remapLookupCycles += getTimeStamp() - startStamp;
+  deviceStatistics.remapLookupCount++;
+  if (index != NO_CLONE_BLOCK) {
+    volumeSector = translateExtentSector(&cloneRemap.clone, &cloneRemap.cloneIndex,
+        CLONE_META_SECTORS + (uint64_t) cloneRemap.poolBlocks[index] * CLONE_BLOCK_SECTORS + offset, &extentLength);
+  } else {
+    volumeSector = translateExtentSector(&cloneRemap.source, &cloneRemap.sourceIndex, sector, &extentLength);
+  }
+  *runLength = CLONE_BLOCK_SECTORS - offset < *runLength ? CLONE_BLOCK_SECTORS - offset : *runLength;
+  *runLength = extentLength < *runLength ? extentLength : *runLength;
+  return volumeSector;
+}
+
+/*******************************************************************************
+* Description    : Copies sectors of the source to the pool. The source and the clone
+*                    have the same key, so the data is copied as stored.
+* Input          : from - first sector of the source
+*                  to - sector after the last copied one
+*                  poolSector - pool sector for the first sector.
+* Output         : None.
+* Return         : BLOCK_DEVICE_OK if success.
+*******************************************************************************/
+uint8_t copySourceSectors(uint64_t from, uint64_t to, uint64_t poolSector) {
+  to = to < cloneRemap.source.sectorNumber ? to : cloneRemap.source.sectorNumber;
+  while (from < to) {
+    UINT count = to - from < CLONE_COPY_SECTORS ? to - from : CLONE_COPY_SECTORS;
+    if ((readPartitionExtents(&cloneRemap.source, &cloneRemap.sourceIndex, (BYTE*) cloneBuffer, from, count)
+            != BLOCK_DEVICE_OK)
+        || (writePartitionExtents(&cloneRemap.clone, &cloneRemap.cloneIndex, (BYTE*) cloneBuffer, poolSector, count)
+            != BLOCK_DEVICE_OK)) {
+      return BLOCK_DEVICE_ERROR;
+    }
+    from += count;
+    poolSector += count;
+  }
+  return BLOCK_DEVICE_OK;
+}
+
+/*******************************************************************************
+* Description    : Copies the block to the next pool block with the written sectors
+*                    in it. Block is remapped only after all its data is in the pool.
+* Input          : buff - data to write
+*                  block - block of the clone
+*                  offset - first written sector of the block
+*                  count - number of the written sectors.
+* Output         : None.
+* Return         : BLOCK_DEVICE_OK if success.
+*******************************************************************************/
+uint8_t copyOnWrite(BYTE *buff, uint32_t block, uint32_t offset, UINT count) {
+  uint16_t poolBlock = cloneRemap.usedPoolBlocks;
+  uint64_t blockStart = (uint64_t) block * CLONE_BLOCK_SECTORS;
+  uint64_t poolStart = CLONE_META_SECTORS + (uint64_t) poolBlock * CLONE_BLOCK_SECTORS;
+  if (poolBlock >= cloneRemap.poolCapacity) {
+    return BLOCK_DEVICE_ERROR;                                // Pool of the clone is full
+  }
+  if ((copySourceSectors(blockStart, blockStart + offset, poolStart) != BLOCK_DEVICE_OK)
+      || (copySourceSectors(blockStart + offset + count, blockStart + CLONE_BLOCK_SECTORS,
+          poolStart + offset + count) != BLOCK_DEVICE_OK)
+      || (writePartitionExtents(&cloneRemap.clone, &cloneRemap.cloneIndex, buff, poolStart + offset, count)
+          != BLOCK_DEVICE_OK)) {
+    return BLOCK_DEVICE_ERROR;
+  }
+  deviceStatistics.cloneCopyCount++;
+  return commitCloneBlock(block, poolBlock);
+}
+
+/*******************************************************************************
+* Description    : Appends the block to the remap log and then counts it in the header.
+*                    Power loss before the header update loses only the new block.
+* Input          : block - block of the clone
+*                  poolBlock - block of the pool with the clone data.
+* Output         : None.
+* Return         : BLOCK_DEVICE_OK if success.
+*******************************************************************************/
+uint8_t commitCloneBlock(uint32_t block, uint16_t poolBlock) {
+  BYTE *sector = (BYTE*) cloneBuffer;
+  CloneHeader header;
+  uint64_t logSector = CLONE_HEADER_SECTORS + poolBlock / CLONE_LOG_ENTRIES_PER_SECTOR;
+  if (readPartitionExtents(&cloneRemap.clone, &cloneRemap.cloneIndex, sector, logSector, 1) != BLOCK_DEVICE_OK) {
+    return BLOCK_DEVICE_ERROR;
+  }
+  cipherCloneMeta(sector);
+  ((uint32_t*) sector)[poolBlock % CLONE_LOG_ENTRIES_PER_SECTOR] = block;
+  cipherCloneMeta(sector);
+  if (writePartitionExtents(&cloneRemap.clone, &cloneRemap.cloneIndex, sector, logSector, 1) != BLOCK_DEVICE_OK) {
+    return BLOCK_DEVICE_ERROR;
+  }
+  header.magic = CLONE_MAGIC;
+  header.cloneId = cloneRemap.clone.cloneId;
+  header.usedPoolBlocks = poolBlock + 1;
+  memset(sector, 0, STORAGE_BLOCK_SIZE);
+  memcpy(sector, &header, sizeof(header));
+  cipherCloneMeta(sector);
+  if (writePartitionExtents(&cloneRemap.clone, &cloneRemap.cloneIndex, sector, 0, CLONE_HEADER_SECTORS)
+      != BLOCK_DEVICE_OK) {
+    return BLOCK_DEVICE_ERROR;
+  }
+  cloneRemap.usedPoolBlocks = poolBlock + 1;
+  insertCloneBlock(block, poolBlock);
+  return BLOCK_DEVICE_OK;
+}
+
+/*******************************************************************************
+* Description    : Reads the remap header and the remap log of the clone pool.
+* Input          : None.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t loadRemapLog(void) {
+  BYTE *sector = (BYTE*) cloneBuffer;
+  CloneHeader header;
+  cloneRemap.remapNumber = 0;
+  cloneRemap.usedPoolBlocks = 0;
+  if (readPartitionExtents(&cloneRemap.clone, &cloneRemap.cloneIndex, sector, 0, CLONE_HEADER_SECTORS)
+      != BLOCK_DEVICE_OK) {
+    return 1;
+  }
+  cipherCloneMeta(sector);
+  memcpy(&header, sector, sizeof(header));
+  if ((header.magic != CLONE_MAGIC) || (header.cloneId != cloneRemap.clone.cloneId)) {
+    return 0;                                                 // New clone, the pool keeps old data
+  }
+  cloneRemap.usedPoolBlocks = header.usedPoolBlocks < cloneRemap.poolCapacity
+      ? header.usedPoolBlocks : cloneRemap.poolCapacity;      // Blocks of the shrunk pool are lost
+  for (uint16_t poolBlock = 0; poolBlock < cloneRemap.usedPoolBlocks; ++poolBlock) {
+    if ((poolBlock % CLONE_LOG_ENTRIES_PER_SECTOR == 0)
+        && ((readPartitionExtents(&cloneRemap.clone, &cloneRemap.cloneIndex, sector,
+            CLONE_HEADER_SECTORS + poolBlock / CLONE_LOG_ENTRIES_PER_SECTOR, 1) != BLOCK_DEVICE_OK))) {
+      return 1;
+    }
+    if (poolBlock % CLONE_LOG_ENTRIES_PER_SECTOR == 0) {
+      cipherCloneMeta(sector);
+    }
+    uint32_t block = ((uint32_t*) sector)[poolBlock % CLONE_LOG_ENTRIES_PER_SECTOR];
+    if (findCloneBlock(block) == NO_CLONE_BLOCK) {
+      insertCloneBlock(block, poolBlock);
+    }
+  }
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Encrypts or decrypts the remap sector of the private clone
+*                    by the partition key like the partition data.
+* Input          : sector - the remap sector.
+* Output         : sector - encrypted or decrypted sector.
+* Return         : None.
+*******************************************************************************/
+void cipherCloneMeta(BYTE *sector) {
+#if  CIPHER_MOD == 0
+  if (cloneRemap.clone.partitionType == PRIVATE) {
+    encryptMemory(sector, cloneRemap.xorKey, STORAGE_BLOCK_SIZE);
+  }
+#endif
+}
@@ -0,0 +1,212 @@
+/**
+  ******************************************************************************
+  * @file           : COMMAND_READER
+  * @version        : v1.0
+  * @brief          : Chunked reader and tokenizer of the command file
+  ******************************************************************************
+  * MIT License
+  *
+  * Copyright (c) 2017 Oleksandr Borysov
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+ ******************************************************************************
+*/
+
+
+
+
+/* Includes ------------------------------------------------------------------*/
+#include "command_reader.h"
+#include "device_stats.h"
+#include <string.h>
+
+/* Private reader function prototypes -----------------------------------------------*/
+int16_t takeCommandSymbol(CommandReader*);
+uint8_t isWordSeparator(int16_t);
+uint8_t isLineSeparator(int16_t);
+
+/* Public reader functions ---------------------------------------------------------*/
+
+/*******************************************************************************
+* Description    : Starts reading of the opened command file.
+* Input          : file - the opened command file
+*                  chunk - buffer of the file chunks
+*                  chunkSize - bytes of the buffer.
+* Output         : reader - the reader at the file start.
+* Return         : None.
+*******************************************************************************/
+void beginCommandReader(CommandReader *reader, FIL *file, char *chunk, uint32_t chunkSize) {
+  reader->file = file;
+  reader->chunk = chunk;
+  reader->chunkSize = chunkSize;
+  reader->size = 0;
+  reader->position = 0;
+  reader->isFailed = 0;
+  deviceStatistics.commandFileBytes = 0;
+  deviceStatistics.commandReadTime = 0;
+}
+
+/*******************************************************************************
+* Description    : Gets the next symbol without taking it. The next chunk is read
+*                    when the chunk ends.
+* Input          : reader - the command file reader.
+* Output         : None.
+* Return         : The symbol or COMMAND_READER_END.
+*******************************************************************************/
+int16_t peekCommandSymbol(CommandReader *reader) {
+  UINT bytesRead;
+  uint32_t startStamp;
+  if ((reader->position == reader->size) && !reader->isFailed) {
+    startStamp = getTimeStamp();
+    if (f_read(reader->file, reader->chunk, reader->chunkSize, &bytesRead) != FR_OK) {
+      bytesRead = 0;
+      reader->isFailed = 1;
+    }
+    deviceStatistics.commandReadTime += getElapsedMicros(startStamp);
+    deviceStatistics.commandFileBytes += bytesRead;
+    reader->size = bytesRead;
+    reader->position = 0;
+  }
+  return reader->position < reader->size ? (uint8_t) reader->chunk[reader->position] : COMMAND_READER_END;
+}
+
+/*******************************************************************************
+* Description    : Checks the reader to be at the line end or at the file end.
+* Input          : reader - the command file reader.
+* Output         : None.
+* Return         : True if no symbols left in the line.
+*******************************************************************************/
+uint8_t isCommandLineEnd(CommandReader *reader) {
+  int16_t symbol = peekCommandSymbol(reader);
+  return ((symbol == COMMAND_READER_END) || isLineSeparator(symbol)) ? 1 : 0;
+}
+
+/*******************************************************************************
+* Description    : Skips the rest of the line with its separator. Works with Windows
+*                    and Unix line separators.
+* Input          : reader - the command file reader.
+* Output         : None.
+* Return         : 0 if success or 1 if the file has already ended.
+*******************************************************************************/
+uint8_t skipCommandLine(CommandReader *reader) {
+  int16_t symbol = peekCommandSymbol(reader);
+  if (symbol == COMMAND_READER_END) {
+    return 1;
+  }
+  while ((symbol != COMMAND_READER_END) && !isLineSeparator(symbol)) {
+    reader->position++;                                 // Symbol is peeked, so it is in the chunk
+    symbol = peekCommandSymbol(reader);
+  }
+  if ((takeCommandSymbol(reader) == '\r') && (peekCommandSymbol(reader) == '\n')) {
+    takeCommandSymbol(reader);
+  }
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Reads the rest of the line and skips its separator. Like strncpy
+*                    the line longer than lineSize is cut and the shorter line is
+*                    padded with '\0'.
+* Input          : reader - the command file reader
+*                  lineSize - bytes of the line buffer.
+* Output         : line - the line text.
+* Return         : 0 if success or 1 if the file has already ended.
+*******************************************************************************/
+uint8_t readCommandLine(CommandReader *reader, char *line, uint16_t lineSize) {
+  uint16_t size = 0;
+  int16_t symbol = peekCommandSymbol(reader);
+  memset(line, '\0', lineSize);
+  if (symbol == COMMAND_READER_END) {
+    return 1;
+  }
+  while ((symbol != COMMAND_READER_END) && !isLineSeparator(symbol)) {
+    if (size < lineSize) {
+      line[size++] = (char) symbol;
+    }
+    reader->position++;
+    symbol = peekCommandSymbol(reader);
+  }
+  skipCommandLine(reader);
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Reads the next word of the line. Spaces and tabs separate words,
+*                    the word is cut and padded like the line of readCommandLine.
+* Input          : reader - the command file reader
+*                  wordSize - bytes of the word buffer.
+* Output         : word - the word text.
+* Return         : 0 if success or 1 if no words left in the line.
+*******************************************************************************/
+uint8_t readCommandWord(CommandReader *reader, char *word, uint16_t wordSize) {
+  uint16_t size = 0;
+  int16_t symbol = peekCommandSymbol(reader);
+  memset(word, '\0', wordSize);
+  while (isWordSeparator(symbol)) {
+    reader->position++;
+    symbol = peekCommandSymbol(reader);
+  }
+  if ((symbol == COMMAND_READER_END) || isLineSeparator(symbol)) {
+    return 1;
+  }
+  while ((symbol != COMMAND_READER_END) && !isLineSeparator(symbol) && !isWordSeparator(symbol)) {
+    if (size < wordSize) {
+      word[size++] = (char) symbol;
+    }
+    reader->position++;
+    symbol = peekCommandSymbol(reader);
+  }
+  return 0;
+}
+
+/* Private reader functions ---------------------------------------------------------*/
+
+/*******************************************************************************
+* Description    : Takes the current symbol and moves to the next one.
+* Input          : reader - the command file reader.
+* Output         : None.
+* Return         : The taken symbol or COMMAND_READER_END.
+*******************************************************************************/
+int16_t takeCommandSymbol(CommandReader *reader) {
+  int16_t symbol = peekCommandSymbol(reader);
+  if (symbol != COMMAND_READER_END) {
+    reader->position++;
+  }
+  return symbol;
+}
+
+/*******************************************************************************
+* Description    : Checks the symbol to separate words.
+* Input          : symbol - the symbol.
+* Output         : None.
+* Return         : True if the symbol is a space or a tab.
+*******************************************************************************/
+uint8_t isWordSeparator(int16_t symbol) {
+  return ((symbol == ' ') || (symbol == '\t')) ? 1 : 0;
+}
+
+/*******************************************************************************
+* Description    : Checks the symbol to end the line.
+* Input          : symbol - the symbol.
+* Output         : None.
+* Return         : True if the symbol is a carriage return or a line feed.
+*******************************************************************************/
+uint8_t isLineSeparator(int16_t symbol) {
+  return ((symbol == '\r') || (symbol == '\n')) ? 1 : 0;
+}
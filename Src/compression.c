@@ -0,0 +1,616 @@
+/**
+  ******************************************************************************
+  * @file           : COMPRESSION
+  * @version        : v1.0
+  * @brief          : This file implements transparent compression of the partitions
+  ******************************************************************************
+  * MIT License
+  *
+  * Copyright (c) 2017 Oleksandr Borysov
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+ ******************************************************************************
+*/
+
+
+
+/* Includes ------------------------------------------------------------------*/
+#include "compression.h"
+#include "lz_codec.h"
+#include "partition_table.h"
+#include "relocation.h"
+#include "clone_remap.h"
+#include "device_stats.h"
+#include <string.h>
+
+/* Private define ------------------------------------------------------------*/
+#define COMPRESS_MAGIC                   0x32435A4Cu    // "LZC2", map entries keep the places of the chunks
+#define CHUNK_BYTES                      (COMPRESS_CHUNK_SECTORS * STORAGE_BLOCK_SIZE)
+#define CHUNK_SIZE_BYTES                 2              // Stored chunk starts with the size of the compressed data
+#define ZERO_CHUNK                       0              // Chunk of zeros is not stored
+#define RAW_CHUNK                        COMPRESS_CHUNK_SECTORS     // Chunk which is not compressible is stored as it is
+#define NO_MAP_SECTOR                    0xFFFFFFFFu
+#define MAP_ENTRY_OFFSET                 4              // Map sector starts with the generation
+#define ENTRY_SECTORS_MASK               0x0F           // Stored sectors of the chunk
+#define ENTRY_PLACE_SHIFT                4              // Place of the chunk counted from its own place, zeroed
+                                                        // map keeps each chunk at its own place
+#define GROUP_PLACES                     (COMPRESS_MAP_ENTRIES + 1)   // Chunks of the map sector and the spare place
+
+/* Private typedef -----------------------------------------------------------*/
+// First sector of the compressed partition
+typedef struct {
+   uint32_t magic;                                        // COMPRESS_MAGIC if the chunk map was started
+   uint32_t generation;                                   // Map sectors of other generation have only zero chunks
+   uint64_t sectorNumber;                                 // Partition of other size starts the new map
+} CompressedHeader;
+// Compressed partition of the logical unit
+typedef struct {
+   Partition partition;
+   ExtentIndex extentIndex;
+   const char *xorKey;                                    // Key of the logical unit
+   uint32_t generation;
+   uint32_t mapSectors;
+   uint32_t chunkNumber;
+   BYTE mapSector[STORAGE_BLOCK_SIZE];                    // Decrypted map sector, it is written through
+   uint32_t mapSectorNumber;                              // Map sector in the buffer or NO_MAP_SECTOR
+   uint16_t sparePlace;                                   // Place of the map sector chunks which is not used
+   uint8_t isOpen;
+} CompressedStore;
+// Decompressed chunk kept for the reads and the partial writes
+typedef struct {
+   BYTE data[CHUNK_BYTES];
+   uint32_t chunk;
+   uint32_t lastUse;                                      // Least recently used chunk is replaced
+   uint8_t lun;
+   uint8_t isValid;
+} ChunkCacheEntry;
+
+/* Private variables ---------------------------------------------------------*/
+CompressedStore compressedStores[MAX_LUN_NUMBER];
+ChunkCacheEntry chunkCache[COMPRESS_CACHE_CHUNKS];
+uint32_t chunkCacheClock;
+uint32_t storedChunk[CHUNK_BYTES / 4];                    // Chunk as it is stored on the card, word aligned for DMA
+uint32_t storedMapSector[STORAGE_BLOCK_SIZE / 4];         // Encrypted copy of the map sector or the header
+
+/* Private compression function prototypes -----------------------------------------------*/
+ChunkCacheEntry* getCachedChunk(uint8_t, uint32_t, uint8_t);
+uint8_t loadChunk(CompressedStore*, uint32_t, BYTE*);
+uint8_t storeChunk(CompressedStore*, uint32_t, const BYTE*);
+uint8_t getChunkEntry(CompressedStore*, uint32_t, uint8_t*, uint16_t*);
+uint8_t setChunkEntry(CompressedStore*, uint32_t, uint8_t, uint16_t);
+uint8_t loadChunkMapSector(CompressedStore*, uint32_t);
+uint8_t findSparePlace(CompressedStore*);
+uint16_t getEntryPlace(const CompressedStore*, uint32_t);
+uint32_t getGroupPlaces(const CompressedStore*, uint32_t);
+uint8_t isZeroChunk(const BYTE*);
+void cipherStoredSectors(const CompressedStore*, BYTE*, uint32_t);
+void getCompressedLayout(const Partition*, uint32_t*, uint32_t*);
+uint64_t getPlaceSector(const CompressedStore*, uint32_t, uint16_t);
+
+/* Public compression functions ---------------------------------------------------------*/
+
+/*******************************************************************************
+* Description    : Checks the partition to keep its chunks compressed.
+* Input          : partition - the partition.
+* Output         : None.
+* Return         : True if the partition is compressed.
+*******************************************************************************/
+uint8_t isCompressedPartition(const Partition *partition) {
+  return partition->isCompressed ? 1 : 0;
+}
+
+/*******************************************************************************
+* Description    : Checks compressed partitions of the new partition table. Zero partition
+*                    is read by the device file system and is never compressed, clones
+*                    copy the stored sectors, so they and their sources are not compressed.
+* Input          : conf - new device configurations with the indexed table.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t checkCompressedPartitions(const PartitionsStructure *conf) {
+  Partition partition;
+  Partition source;
+  for (uint16_t i = 0; i < conf->partitionsNumber; ++i) {
+    if (getConfPartition(conf, i, &partition) != 0) {
+      return 1;
+    }
+    if (isClonePartition(&partition) && (findPartitionEntry(partition.sourceName, &source) >= 0)
+        && isCompressedPartition(&source)) {
+      return 1;
+    }
+    if (isCompressedPartition(&partition)
+        && ((i == 0) || isClonePartition(&partition) || (getCompressedSectorNumber(&partition) == 0)
+            || isPartitionCloned(conf, partition.name))) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Returns size of the compressed partition seen by the host.
+*                    The header and the chunk map take the start of the partition.
+* Input          : partition - the compressed partition.
+* Output         : None.
+* Return         : Number of the partition sectors for the host.
+*******************************************************************************/
+uint64_t getCompressedSectorNumber(const Partition *partition) {
+  uint32_t mapSectors;
+  uint32_t chunkNumber;
+  getCompressedLayout(partition, &mapSectors, &chunkNumber);
+  return (uint64_t) chunkNumber * COMPRESS_CHUNK_SECTORS;
+}
+
+/*******************************************************************************
+* Description    : Opens the compressed partition for the logical unit. Partition
+*                    without the header or with other size starts the new chunk map,
+*                    its map sectors are not cleared, they are of the old generation.
+* Input          : lun - the logical unit
+*                  partition - the compressed partition
+*                  xorKey - key of the logical unit for the private partition.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t openCompressedStore(uint8_t lun, const Partition *partition, const char *xorKey) {
+  CompressedStore *store = &compressedStores[lun];
+  CompressedHeader header;
+  BYTE *sector = (BYTE*) storedMapSector;
+  closeCompressedStore(lun);
+  store->partition = *partition;
+  store->xorKey = xorKey;
+  store->mapSectorNumber = NO_MAP_SECTOR;
+  buildExtentIndex(&store->partition, &store->extentIndex);
+  getCompressedLayout(partition, &store->mapSectors, &store->chunkNumber);
+  if ((store->chunkNumber == 0)
+      || (readPartitionExtents(&store->partition, &store->extentIndex, sector, 0, 1) != BLOCK_DEVICE_OK)) {
+    return 1;
+  }
+  cipherStoredSectors(store, sector, 1);
+  memcpy(&header, sector, sizeof(header));
+  if ((header.magic != COMPRESS_MAGIC) || (header.sectorNumber != partition->sectorNumber)) {
+    header.magic = COMPRESS_MAGIC;
+    header.generation = getTimeStamp() | 1;               // Cleared map sector never matches the generation
+    header.sectorNumber = partition->sectorNumber;
+    memset(sector, 0, STORAGE_BLOCK_SIZE);
+    memcpy(sector, &header, sizeof(header));
+    cipherStoredSectors(store, sector, 1);
+    if (writePartitionExtents(&store->partition, &store->extentIndex, sector, 0, 1) != BLOCK_DEVICE_OK) {
+      return 1;
+    }
+  }
+  store->generation = header.generation;
+  store->isOpen = 1;
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Closes the compressed partition of the logical unit and drops its cached chunks.
+* Input          : lun - the logical unit.
+* Output         : None.
+* Return         : None.
+*******************************************************************************/
+void closeCompressedStore(uint8_t lun) {
+  compressedStores[lun].isOpen = 0;
+  for (uint8_t i = 0; i < COMPRESS_CACHE_CHUNKS; ++i) {
+    if (chunkCache[i].lun == lun) {
+      chunkCache[i].isValid = 0;
+    }
+  }
+}
+
+/*******************************************************************************
+* Description    : Reads sectors of the compressed partition through the chunk cache.
+* Input          : lun - the logical unit
+*                  sector - first partition sector
+*                  count - number of the sectors.
+* Output         : buff - read data.
+* Return         : BLOCK_DEVICE_OK if success.
+*******************************************************************************/
+uint8_t readCompressedSectors(uint8_t lun, BYTE *buff, uint64_t sector, UINT count) {
+  if (!compressedStores[lun].isOpen) {
+    return BLOCK_DEVICE_ERROR;
+  }
+  while (count != 0) {
+    uint32_t chunk = sector / COMPRESS_CHUNK_SECTORS;
+    uint32_t offset = sector % COMPRESS_CHUNK_SECTORS;
+    UINT runLength = COMPRESS_CHUNK_SECTORS - offset < count ? COMPRESS_CHUNK_SECTORS - offset : count;
+    ChunkCacheEntry *entry = getCachedChunk(lun, chunk, 1);
+    if (entry == NULL) {
+      return BLOCK_DEVICE_ERROR;
+    }
+    memcpy(buff, entry->data + offset * STORAGE_BLOCK_SIZE, runLength * STORAGE_BLOCK_SIZE);
+    buff += runLength * STORAGE_BLOCK_SIZE;
+    sector += runLength;
+    count -= runLength;
+  }
+  return BLOCK_DEVICE_OK;
+}
+
+/*******************************************************************************
+* Description    : Writes sectors of the compressed partition. Part of the chunk is
+*                    merged with the chunk data, each written chunk is compressed and
+*                    stored to the spare place before its map entry is switched to it.
+* Input          : lun - the logical unit
+*                  buff - data to write
+*                  sector - first partition sector
+*                  count - number of the sectors.
+* Output         : None.
+* Return         : BLOCK_DEVICE_OK if success.
+*******************************************************************************/
+uint8_t writeCompressedSectors(uint8_t lun, const BYTE *buff, uint64_t sector, UINT count) {
+  CompressedStore *store = &compressedStores[lun];
+  if (!store->isOpen) {
+    return BLOCK_DEVICE_ERROR;
+  }
+  while (count != 0) {
+    uint32_t chunk = sector / COMPRESS_CHUNK_SECTORS;
+    uint32_t offset = sector % COMPRESS_CHUNK_SECTORS;
+    UINT runLength = COMPRESS_CHUNK_SECTORS - offset < count ? COMPRESS_CHUNK_SECTORS - offset : count;
+    ChunkCacheEntry *entry = getCachedChunk(lun, chunk, runLength != COMPRESS_CHUNK_SECTORS);
+    if (entry == NULL) {
+      return BLOCK_DEVICE_ERROR;
+    }
+    memcpy(entry->data + offset * STORAGE_BLOCK_SIZE, buff, runLength * STORAGE_BLOCK_SIZE);
+    if (storeChunk(store, chunk, entry->data) != 0) {
+      entry->isValid = 0;                                         // Cache must not show data which is not stored
+      return BLOCK_DEVICE_ERROR;
+    }
+    deviceStatistics.compressedSectors += runLength;
+    buff += runLength * STORAGE_BLOCK_SIZE;
+    sector += runLength;
+    count -= runLength;
+  }
+  return BLOCK_DEVICE_OK;
+}
+
+/* Private compression functions ---------------------------------------------------------*/
+
+/*******************************************************************************
+* Description    : Finds the decompressed chunk in the cache. Missed chunk replaces
+*                    the least recently used one.
+* Input          : lun - the logical unit
+*                  chunk - number of the chunk
+*                  isLoaded - 0 if the chunk is overwritten whole and isn't read.
+* Output         : None.
+* Return         : The cache entry or NULL if the chunk can't be read.
+*******************************************************************************/
+ChunkCacheEntry* getCachedChunk(uint8_t lun, uint32_t chunk, uint8_t isLoaded) {
+  ChunkCacheEntry *entry = &chunkCache[0];
+  for (uint8_t i = 0; i < COMPRESS_CACHE_CHUNKS; ++i) {
+    if (chunkCache[i].isValid && (chunkCache[i].lun == lun) && (chunkCache[i].chunk == chunk)) {
+      chunkCache[i].lastUse = ++chunkCacheClock;
+      deviceStatistics.chunkCacheHits++;
+      return &chunkCache[i];
+    }
+    if (!chunkCache[i].isValid || (entry->isValid && (chunkCache[i].lastUse < entry->lastUse))) {
+      entry = &chunkCache[i];
+    }
+  }
+  deviceStatistics.chunkCacheMisses++;
+  entry->isValid = 0;
+  if (isLoaded && (loadChunk(&compressedStores[lun], chunk, entry->data) != 0)) {
+    return NULL;
+  }
+  entry->lun = lun;
+  entry->chunk = chunk;
+  entry->lastUse = ++chunkCacheClock;
+  entry->isValid = 1;
+  return entry;
+}
+
+/*******************************************************************************
+* Description    : Reads the stored chunk and decompresses it.
+* Input          : store - the compressed partition
+*                  chunk - number of the chunk.
+* Output         : data - the chunk data.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t loadChunk(CompressedStore *store, uint32_t chunk, BYTE *data) {
+  BYTE *stored = (BYTE*) storedChunk;
+  uint8_t storedSectors;
+  uint16_t place;
+  if ((chunk >= store->chunkNumber) || (getChunkEntry(store, chunk, &storedSectors, &place) != 0)
+      || (storedSectors > RAW_CHUNK)) {
+    return 1;
+  }
+  if (storedSectors == ZERO_CHUNK) {
+    memset(data, 0, CHUNK_BYTES);
+    return 0;
+  }
+  if (readPartitionExtents(&store->partition, &store->extentIndex, stored,
+      getPlaceSector(store, chunk / COMPRESS_MAP_ENTRIES, place), storedSectors) != BLOCK_DEVICE_OK) {
+    return 1;
+  }
+  cipherStoredSectors(store, stored, storedSectors);
+  if (storedSectors == RAW_CHUNK) {
+    memcpy(data, stored, CHUNK_BYTES);
+    return 0;
+  }
+  uint32_t startStamp = getTimeStamp();
+  uint32_t size = stored[0] | (stored[1] << 8);
+  if ((size + CHUNK_SIZE_BYTES > storedSectors * STORAGE_BLOCK_SIZE)
+      || (decompressLZ(stored + CHUNK_SIZE_BYTES, size, data, CHUNK_BYTES) != CHUNK_BYTES)) {
+    return 1;
+  }
+  deviceStatistics.decompressCycles += getTimeStamp() - startStamp;
+  deviceStatistics.decompressCount++;
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Compresses the chunk and writes it to the spare place of its map
+*                    sector, then switches the map entry to it. The old place keeps
+*                    the old chunk till the map sector is written, so a power loss
+*                    leaves the old or the new chunk. Chunk of zeros is only marked
+*                    in the map, chunk which doesn't save a sector is stored as it is.
+* Input          : store - the compressed partition
+*                  chunk - number of the chunk
+*                  data - the chunk data.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t storeChunk(CompressedStore *store, uint32_t chunk, const BYTE *data) {
+  BYTE *stored = (BYTE*) storedChunk;
+  uint8_t storedSectors = ZERO_CHUNK;
+  uint32_t mapSectorNumber = chunk / COMPRESS_MAP_ENTRIES;
+  uint16_t place;
+  if ((chunk >= store->chunkNumber) || (loadChunkMapSector(store, mapSectorNumber) != 0)) {
+    return 1;
+  }
+  place = getEntryPlace(store, chunk % COMPRESS_MAP_ENTRIES);   // Zero chunk keeps its place
+  if (!isZeroChunk(data)) {
+    uint32_t startStamp = getTimeStamp();
+    uint32_t size = compressLZ(data, CHUNK_BYTES, stored + CHUNK_SIZE_BYTES,
+        (RAW_CHUNK - 1) * STORAGE_BLOCK_SIZE - CHUNK_SIZE_BYTES);
+    deviceStatistics.compressCycles += getTimeStamp() - startStamp;
+    deviceStatistics.compressCount++;
+    if (size != 0) {
+      stored[0] = size & 0xFF;
+      stored[1] = size >> 8;
+      storedSectors = (size + CHUNK_SIZE_BYTES + STORAGE_BLOCK_SIZE - 1) / STORAGE_BLOCK_SIZE;
+      memset(stored + CHUNK_SIZE_BYTES + size, 0, storedSectors * STORAGE_BLOCK_SIZE - CHUNK_SIZE_BYTES - size);
+    } else {
+      memcpy(stored, data, CHUNK_BYTES);
+      storedSectors = RAW_CHUNK;
+    }
+    cipherStoredSectors(store, stored, storedSectors);
+    place = store->sparePlace;
+    if (writePartitionExtents(&store->partition, &store->extentIndex, stored,
+        getPlaceSector(store, mapSectorNumber, place), storedSectors) != BLOCK_DEVICE_OK) {
+      return 1;
+    }
+    deviceStatistics.storedSectors += storedSectors;
+  }
+  return setChunkEntry(store, chunk, storedSectors, place);
+}
+
+/*******************************************************************************
+* Description    : Reads the map entry of the chunk.
+* Input          : store - the compressed partition
+*                  chunk - number of the chunk.
+* Output         : storedSectors - stored sectors of the chunk
+*                  place - place of the chunk among the places of its map sector.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t getChunkEntry(CompressedStore *store, uint32_t chunk, uint8_t *storedSectors, uint16_t *place) {
+  uint32_t index = chunk % COMPRESS_MAP_ENTRIES;
+  if (loadChunkMapSector(store, chunk / COMPRESS_MAP_ENTRIES) != 0) {
+    return 1;
+  }
+  *storedSectors = store->mapSector[MAP_ENTRY_OFFSET + index * 2] & ENTRY_SECTORS_MASK;
+  *place = getEntryPlace(store, index);
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Updates the map entry of the chunk. The map sector is written
+*                    only when the entry changes, the place left by the chunk
+*                    becomes the spare place after the write.
+* Input          : store - the compressed partition
+*                  chunk - number of the chunk
+*                  storedSectors - stored sectors of the chunk
+*                  place - place of the chunk among the places of its map sector.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t setChunkEntry(CompressedStore *store, uint32_t chunk, uint8_t storedSectors, uint16_t place) {
+  BYTE *sector = (BYTE*) storedMapSector;
+  uint32_t mapSectorNumber = chunk / COMPRESS_MAP_ENTRIES;
+  uint32_t index = chunk % COMPRESS_MAP_ENTRIES;
+  uint32_t places;
+  uint16_t entry;
+  uint16_t oldPlace;
+  if (loadChunkMapSector(store, mapSectorNumber) != 0) {
+    return 1;
+  }
+  places = getGroupPlaces(store, mapSectorNumber);
+  oldPlace = getEntryPlace(store, index);
+  entry = storedSectors | (((place + places - index) % places) << ENTRY_PLACE_SHIFT);
+  if ((store->mapSector[MAP_ENTRY_OFFSET + index * 2] | (store->mapSector[MAP_ENTRY_OFFSET + index * 2 + 1] << 8))
+      == entry) {
+    return 0;
+  }
+  store->mapSector[MAP_ENTRY_OFFSET + index * 2] = entry & 0xFF;
+  store->mapSector[MAP_ENTRY_OFFSET + index * 2 + 1] = entry >> 8;
+  memcpy(sector, store->mapSector, STORAGE_BLOCK_SIZE);
+  cipherStoredSectors(store, sector, 1);
+  if (writePartitionExtents(&store->partition, &store->extentIndex, sector,
+      COMPRESS_HEADER_SECTORS + mapSectorNumber, 1) != BLOCK_DEVICE_OK) {
+    store->mapSectorNumber = NO_MAP_SECTOR;                       // Buffer doesn't match the card anymore
+    return 1;
+  }
+  if (place != oldPlace) {
+    store->sparePlace = oldPlace;
+  }
+  deviceStatistics.storedSectors++;
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Loads the chunk map sector to the buffer of the partition. Sector
+*                    of other generation is taken as the sector of zero chunks.
+* Input          : store - the compressed partition
+*                  mapSectorNumber - number of the map sector.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t loadChunkMapSector(CompressedStore *store, uint32_t mapSectorNumber) {
+  uint32_t generation;
+  if (store->mapSectorNumber == mapSectorNumber) {
+    return 0;
+  }
+  if (readPartitionExtents(&store->partition, &store->extentIndex, store->mapSector,
+      COMPRESS_HEADER_SECTORS + mapSectorNumber, 1) != BLOCK_DEVICE_OK) {
+    store->mapSectorNumber = NO_MAP_SECTOR;
+    return 1;
+  }
+  cipherStoredSectors(store, store->mapSector, 1);
+  memcpy(&generation, store->mapSector, sizeof(generation));
+  if (generation != store->generation) {
+    memset(store->mapSector, 0, STORAGE_BLOCK_SIZE);
+    memcpy(store->mapSector, &store->generation, sizeof(store->generation));
+  }
+  store->mapSectorNumber = mapSectorNumber;
+  if (findSparePlace(store) != 0) {
+    store->mapSectorNumber = NO_MAP_SECTOR;
+    return 1;
+  }
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Finds the place of the map sector which no chunk uses. Each chunk
+*                    of the map sector has its own place, so one place is left.
+* Input          : store - the compressed partition with the loaded map sector.
+* Output         : None.
+* Return         : 0 if success or 1 if the map sector is corrupted.
+*******************************************************************************/
+uint8_t findSparePlace(CompressedStore *store) {
+  uint8_t isUsed[(GROUP_PLACES + 7) / 8];
+  uint32_t places = getGroupPlaces(store, store->mapSectorNumber);
+  memset(isUsed, 0, sizeof(isUsed));
+  for (uint32_t i = 0; i + 1 < places; ++i) {
+    uint16_t place = getEntryPlace(store, i);
+    if (isUsed[place / 8] & (1 << (place % 8))) {
+      return 1;
+    }
+    isUsed[place / 8] |= 1 << (place % 8);
+  }
+  for (uint32_t place = 0; place < places; ++place) {
+    if (!(isUsed[place / 8] & (1 << (place % 8)))) {
+      store->sparePlace = place;
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/*******************************************************************************
+* Description    : Gets place of the chunk from its entry in the loaded map sector.
+* Input          : store - the compressed partition
+*                  index - the chunk in the map sector.
+* Output         : None.
+* Return         : Place among the places of the map sector.
+*******************************************************************************/
+uint16_t getEntryPlace(const CompressedStore *store, uint32_t index) {
+  uint16_t entry = store->mapSector[MAP_ENTRY_OFFSET + index * 2] | (store->mapSector[MAP_ENTRY_OFFSET + index * 2 + 1] << 8);
+  return (index + (entry >> ENTRY_PLACE_SHIFT)) % getGroupPlaces(store, store->mapSectorNumber);
+}
+
+/*******************************************************************************
+* Description    : Counts places of the map sector chunks, the last map sector can
+*                    have less chunks than others.
+* Input          : store - the compressed partition
+*                  mapSectorNumber - number of the map sector.
+* Output         : None.
+* Return         : Number of the places with the spare place.
+*******************************************************************************/
+uint32_t getGroupPlaces(const CompressedStore *store, uint32_t mapSectorNumber) {
+  uint32_t chunks = store->chunkNumber - mapSectorNumber * COMPRESS_MAP_ENTRIES;
+  return (chunks < COMPRESS_MAP_ENTRIES ? chunks : COMPRESS_MAP_ENTRIES) + 1;
+}
+
+/*******************************************************************************
+* Description    : Checks the chunk to have only zeros.
+* Input          : data - the chunk data, word aligned.
+* Output         : None.
+* Return         : True if all bytes are zero.
+*******************************************************************************/
+uint8_t isZeroChunk(const BYTE *data) {
+  for (uint32_t i = 0; i < CHUNK_BYTES / 4; ++i) {
+    if (((const uint32_t*) data)[i] != 0) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/*******************************************************************************
+* Description    : Encrypts or decrypts stored sectors of the private partition
+*                    by the partition key like the sectors of other partitions.
+* Input          : store - the compressed partition
+*                  buff - the sectors
+*                  count - number of the sectors.
+* Output         : buff - encrypted or decrypted sectors.
+* Return         : None.
+*******************************************************************************/
+void cipherStoredSectors(const CompressedStore *store, BYTE *buff, uint32_t count) {
+#if  CIPHER_MOD == 0
+  if (store->partition.partitionType == PRIVATE) {
+    encryptMemory(buff, store->xorKey, count * STORAGE_BLOCK_SIZE);
+  }
+#endif
+}
+
+/*******************************************************************************
+* Description    : Places the chunk map and the chunks in the partition. Each map sector
+*                    has the places of COMPRESS_CHUNK_SECTORS sectors for its chunks and
+*                    one spare place after the map.
+* Input          : partition - the compressed partition.
+* Output         : mapSectors - sectors of the chunk map
+*                  chunkNumber - number of the chunks.
+* Return         : None.
+*******************************************************************************/
+void getCompressedLayout(const Partition *partition, uint32_t *mapSectors, uint32_t *chunkNumber) {
+  const uint64_t groupSectors = 1 + (uint64_t) GROUP_PLACES * COMPRESS_CHUNK_SECTORS;
+  uint64_t sectors = partition->sectorNumber > COMPRESS_HEADER_SECTORS
+      ? partition->sectorNumber - COMPRESS_HEADER_SECTORS : 0;
+  uint64_t maps = sectors / groupSectors;
+  uint64_t rest = sectors % groupSectors;
+  uint64_t chunks = maps * COMPRESS_MAP_ENTRIES;
+  if (rest >= 1 + 2 * COMPRESS_CHUNK_SECTORS) {                  // Last map sector has less chunks
+    chunks += (rest - 1) / COMPRESS_CHUNK_SECTORS - 1;
+    maps++;
+  }
+  *mapSectors = maps;
+  *chunkNumber = chunks;
+}
+
+/*******************************************************************************
+* Description    : Returns the first partition sector of the chunk place.
+* Input          : store - the compressed partition
+*                  mapSectorNumber - map sector of the chunk
+*                  place - place among the places of the map sector.
+* Output         : None.
+* Return         : Partition sector of the place.
+*******************************************************************************/
+uint64_t getPlaceSector(const CompressedStore *store, uint32_t mapSectorNumber, uint16_t place) {
+  return COMPRESS_HEADER_SECTORS + store->mapSectors
+      + ((uint64_t) mapSectorNumber * GROUP_PLACES + place) * COMPRESS_CHUNK_SECTORS;
+}
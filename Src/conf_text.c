@@ -0,0 +1,232 @@
+/**
+  ******************************************************************************
+  * @file           : CONF_TEXT
+  * @version        : v1.0
+  * @brief          : Sector buffered text of the configurations file
+  ******************************************************************************
+  * MIT License
+  *
+  * Copyright (c) 2017 Oleksandr Borysov
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+ ******************************************************************************
+*/
+
+
+
+
+/* Includes ------------------------------------------------------------------*/
+#include "conf_text.h"
+#include <stdarg.h>
+#include <stddef.h>
+
+/* Private define ------------------------------------------------------------*/
+#define NUMBER_TEXT_LENGTH               12             // Fits sign and decimal 32-bit number
+
+/* Private conf text function prototypes -----------------------------------------------*/
+void putConfSymbol(ConfText*, char);
+void putConfField(ConfText*, const char*, uint32_t, uint8_t, uint8_t);
+void flushConfText(ConfText*);
+
+/* Public conf text functions ---------------------------------------------------------*/
+
+/*******************************************************************************
+* Description    : Starts the text output to the opened file.
+* Input          : file - the file opened for writing
+*                  buffer - CONF_TEXT_BUFFER_SIZE bytes of the text buffer.
+* Output         : text - the empty text output.
+* Return         : None.
+*******************************************************************************/
+void beginConfText(ConfText *text, FIL *file, char *buffer) {
+  text->file = file;
+  text->buffer = buffer;
+  text->size = 0;
+  text->windowStart = 0;
+  text->windowSize = 0;
+  text->length = 0;
+  text->writeCount = 0;
+  text->isFailed = 0;
+}
+
+/*******************************************************************************
+* Description    : Starts the text output to the buffer. The text is formatted from
+*                    its start, only bytes of the window are kept.
+* Input          : buffer - buffer of the window
+*                  windowStart - the first kept byte of the text
+*                  windowSize - bytes of the buffer.
+* Output         : text - the empty text output.
+* Return         : None.
+*******************************************************************************/
+void beginConfTextWindow(ConfText *text, char *buffer, uint32_t windowStart, uint32_t windowSize) {
+  beginConfText(text, NULL, buffer);
+  text->windowStart = windowStart;
+  text->windowSize = windowSize;
+}
+
+/*******************************************************************************
+* Description    : Formats the text like f_printf. Supported conversions are %s, %c,
+*                    %d, %u and %%, with the flags '-' and '0' and the field width.
+* Input          : text - the text output
+*                  format - the format of the text.
+* Output         : None.
+* Return         : None.
+*******************************************************************************/
+void printConfText(ConfText *text, const char *format, ...) {
+  va_list args;
+  char number[NUMBER_TEXT_LENGTH];
+  char *digit;
+  uint32_t width;
+  uint32_t value;
+  uint8_t isLeft;
+  uint8_t isZeroFilled;
+  uint8_t isNegative;
+
+  va_start(args, format);
+  for (; *format != '\0'; ++format) {
+    if (*format != '%') {
+      putConfSymbol(text, *format);
+      continue;
+    }
+    ++format;
+    isLeft = (*format == '-') ? 1 : 0;
+    format += isLeft;
+    isZeroFilled = (*format == '0') ? 1 : 0;
+    format += isZeroFilled;
+    for (width = 0; (*format >= '0') && (*format <= '9'); ++format) {
+      width = width * 10 + *format - '0';
+    }
+    switch (*format) {
+      case 's': {
+        putConfField(text, va_arg(args, const char*), width, isLeft, 0);
+        break;
+      }
+      case 'c': {
+        number[0] = (char) va_arg(args, int);
+        number[1] = '\0';
+        putConfField(text, number, width, isLeft, 0);
+        break;
+      }
+      case 'd':
+      case 'u': {
+        value = va_arg(args, uint32_t);
+        isNegative = ((*format == 'd') && ((int32_t) value < 0)) ? 1 : 0;
+        value = isNegative ? (uint32_t) -(int32_t) value : value;
+        digit = number + sizeof(number) - 1;
+        *digit = '\0';
+        do {
+          *--digit = '0' + value % 10;
+          value /= 10;
+        } while (value != 0);
+        if (isNegative) {
+          *--digit = '-';
+        }
+        putConfField(text, digit, width, isLeft, isZeroFilled);
+        break;
+      }
+      case '\0': {
+        --format;                                         // Format ends by the single '%'
+        break;
+      }
+      default: {
+        putConfSymbol(text, *format);                     // "%%" and unknown conversions are written as they are
+      }
+    }
+  }
+  va_end(args);
+}
+
+/*******************************************************************************
+* Description    : Writes the rest of the text to the file.
+* Input          : text - the text output.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t endConfText(ConfText *text) {
+  flushConfText(text);
+  return text->isFailed;
+}
+
+/* Private conf text functions ---------------------------------------------------------*/
+
+/*******************************************************************************
+* Description    : Adds the symbol to the buffer, the full buffer is written to the file.
+*                    Without the file symbols out of the window are only counted.
+* Input          : text - the text output
+*                  symbol - the symbol.
+* Output         : None.
+* Return         : None.
+*******************************************************************************/
+void putConfSymbol(ConfText *text, char symbol) {
+  if (text->file == NULL) {
+    if ((text->length >= text->windowStart) && (text->length - text->windowStart < text->windowSize)) {
+      text->buffer[text->size++] = symbol;
+    }
+  } else {
+    text->buffer[text->size++] = symbol;
+    if (text->size == CONF_TEXT_BUFFER_SIZE) {
+      flushConfText(text);
+    }
+  }
+  ++text->length;
+}
+
+/*******************************************************************************
+* Description    : Adds the string aligned in the field of the given width.
+* Input          : text - the text output
+*                  str - the string
+*                  width - min symbols of the field
+*                  isLeft - the string is aligned to the left
+*                  isZeroFilled - the field is filled by '0' instead of spaces.
+* Output         : None.
+* Return         : None.
+*******************************************************************************/
+void putConfField(ConfText *text, const char *str, uint32_t width, uint8_t isLeft, uint8_t isZeroFilled) {
+  uint32_t length = 0;
+  while (str[length] != '\0') {
+    ++length;
+  }
+  for (; !isLeft && (width > length); --width) {
+    putConfSymbol(text, isZeroFilled ? '0' : ' ');
+  }
+  while (*str != '\0') {
+    putConfSymbol(text, *str++);
+  }
+  for (; width > length; --width) {
+    putConfSymbol(text, ' ');
+  }
+}
+
+/*******************************************************************************
+* Description    : Writes the buffered text to the file.
+* Input          : text - the text output.
+* Output         : None.
+* Return         : None.
+*******************************************************************************/
+void flushConfText(ConfText *text) {
+  UINT bytesWritten;
+  if (text->file == NULL) {
+    return;                                               // Window stays in the buffer
+  }
+  if ((text->size != 0) && !text->isFailed) {
+    text->isFailed = ((f_write(text->file, text->buffer, text->size, &bytesWritten) != FR_OK)
+        || (bytesWritten != text->size)) ? 1 : 0;
+    ++text->writeCount;
+  }
+  text->size = 0;
+}
@@ -0,0 +1,69 @@
+/**
+  ******************************************************************************
+  * @file           : DEVICE_STATS
+  * @version        : v1.0
+  * @brief          : This file implements the device_stats
+  ******************************************************************************
+  * MIT License
+  *
+  * Copyright (c) 2017 Oleksandr Borysov
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+ ******************************************************************************
+*/
+
+
+#include "device_stats.h"
+#include "stm32f4xx_hal.h"
+
+/* Private variables ---------------------------------------------------------*/
+DeviceStatistics deviceStatistics;                        // Measurements shown by the ShowConf command
+
+/*******************************************************************************
+* Description    : Enables the core cycle counter used for time measurements.
+* Input          : None.
+* Output         : None.
+* Return         : None.
+*******************************************************************************/
+void initTimeMeasure(void) {
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CYCCNT = 0;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+/*******************************************************************************
+* Description    : Gets current time stamp.
+* Input          : None.
+* Output         : None.
+* Return         : Value of the core cycle counter.
+*******************************************************************************/
+uint32_t getTimeStamp(void) {
+  return DWT->CYCCNT;
+}
+
+/*******************************************************************************
+* Description    : Calculates time passed since the time stamp.
+*                    The cycle counter overflows each 23 seconds at 180 MHz.
+* Input          : startStamp - time stamp of the measurement start.
+* Output         : None.
+* Return         : Elapsed time in us.
+*******************************************************************************/
+uint32_t getElapsedMicros(uint32_t startStamp) {
+  return (DWT->CYCCNT - startStamp) / (SystemCoreClock / 1000000);
+}
@@ -0,0 +1,232 @@
+/**
+  ******************************************************************************
+  * @file           : LZ_CODEC
+  * @version        : v1.0
+  * @brief          : This file implements LZ compression of the partition chunks
+  ******************************************************************************
+  * MIT License
+  *
+  * Copyright (c) 2017 Oleksandr Borysov
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+ ******************************************************************************
+*/
+
+
+
+/* Includes ------------------------------------------------------------------*/
+#include "lz_codec.h"
+#include <string.h>
+
+/* Private define ------------------------------------------------------------*/
+#define LZ_HASH_BITS                     10             // Hash table of the last positions of 4 byte sequences
+#define LZ_HASH_MULTIPLIER               2654435761u
+#define LZ_MIN_MATCH                     4
+#define LZ_LAST_LITERALS                 5              // Block ends by literals like LZ4 block
+#define LZ_LENGTH_MASK                   15             // Length of the token nibble, longer lengths continue in bytes
+#define LZ_LENGTH_BYTE_MAX               255
+
+/* Private variables ---------------------------------------------------------*/
+uint16_t lzHashTable[1 << LZ_HASH_BITS];
+
+/* Private LZ codec function prototypes -----------------------------------------------*/
+uint8_t putSequence(uint8_t*, uint32_t, uint32_t*, const uint8_t*, uint32_t, uint32_t, uint32_t);
+void putLength(uint8_t*, uint32_t*, uint32_t);
+uint8_t getLength(const uint8_t*, uint32_t, uint32_t*, uint32_t*);
+uint32_t readSequence(const uint8_t*);
+
+/* Public LZ codec functions ---------------------------------------------------------*/
+
+/*******************************************************************************
+* Description    : Compresses the data. Matches are found by one hash probe,
+*                    so the speed doesn't depend on the data.
+* Input          : src - the data
+*                  srcSize - size of the data, up to LZ_MAX_INPUT
+*                  dstCapacity - size of the output buffer.
+* Output         : dst - compressed data.
+* Return         : Size of the compressed data or 0 if it doesn't fit the buffer.
+*******************************************************************************/
+uint32_t compressLZ(const uint8_t *src, uint32_t srcSize, uint8_t *dst, uint32_t dstCapacity) {
+  uint32_t position = 0;
+  uint32_t anchor = 0;                                            // Start of the literals not written yet
+  uint32_t dstSize = 0;
+  if (srcSize > LZ_MAX_INPUT) {
+    return 0;
+  }
+  memset(lzHashTable, 0, sizeof(lzHashTable));
+  while (position + LZ_MIN_MATCH + LZ_LAST_LITERALS <= srcSize) {
+    uint32_t sequence = readSequence(src + position);
+    uint32_t hash = (sequence * LZ_HASH_MULTIPLIER) >> (32 - LZ_HASH_BITS);
+    uint32_t candidate = lzHashTable[hash];
+    lzHashTable[hash] = position;
+    if ((candidate >= position) || (readSequence(src + candidate) != sequence)) {
+      position++;
+      continue;
+    }
+    uint32_t matchLength = LZ_MIN_MATCH;
+    while ((position + matchLength < srcSize - LZ_LAST_LITERALS) && (src[candidate + matchLength] == src[position + matchLength])) {
+      matchLength++;
+    }
+    if (putSequence(dst, dstCapacity, &dstSize, src + anchor, position - anchor, position - candidate, matchLength) != 0) {
+      return 0;
+    }
+    position += matchLength;
+    anchor = position;
+  }
+  if (putSequence(dst, dstCapacity, &dstSize, src + anchor, srcSize - anchor, 0, 0) != 0) {
+    return 0;
+  }
+  return dstSize;
+}
+
+/*******************************************************************************
+* Description    : Decompresses the data. Corrupted data never writes out of the buffer.
+* Input          : src - compressed data
+*                  srcSize - size of compressed data
+*                  dstSize - size of the output buffer.
+* Output         : dst - the data.
+* Return         : Size of the data or 0 if compressed data is corrupted.
+*******************************************************************************/
+uint32_t decompressLZ(const uint8_t *src, uint32_t srcSize, uint8_t *dst, uint32_t dstSize) {
+  uint32_t position = 0;
+  uint32_t size = 0;
+  while (position < srcSize) {
+    uint8_t token = src[position++];
+    uint32_t length = token >> 4;
+    if ((getLength(src, srcSize, &position, &length) != 0)
+        || (position + length > srcSize) || (size + length > dstSize)) {
+      return 0;
+    }
+    memcpy(dst + size, src + position, length);
+    position += length;
+    size += length;
+    if (position == srcSize) {
+      break;                                                      // Last sequence has literals only
+    }
+    if (position + 2 > srcSize) {
+      return 0;
+    }
+    uint32_t offset = src[position] | (src[position + 1] << 8);
+    position += 2;
+    length = token & LZ_LENGTH_MASK;
+    if (getLength(src, srcSize, &position, &length) != 0) {
+      return 0;
+    }
+    length += LZ_MIN_MATCH;
+    if ((offset == 0) || (offset > size) || (size + length > dstSize)) {
+      return 0;
+    }
+    for (uint32_t i = 0; i < length; ++i, ++size) {               // Match can overlap its own output
+      dst[size] = dst[size - offset];
+    }
+  }
+  return size;
+}
+
+/* Private LZ codec functions ---------------------------------------------------------*/
+
+/*******************************************************************************
+* Description    : Writes the sequence of the literals and the match.
+* Input          : dst - output buffer
+*                  dstCapacity - size of the output buffer
+*                  dstSize - written size
+*                  literals - the literals
+*                  literalLength - number of the literals
+*                  offset - distance to the match
+*                  matchLength - length of the match or 0 for the last sequence.
+* Output         : dstSize - written size.
+* Return         : 0 if success or 1 if the sequence doesn't fit.
+*******************************************************************************/
+uint8_t putSequence(uint8_t *dst, uint32_t dstCapacity, uint32_t *dstSize, const uint8_t *literals,
+    uint32_t literalLength, uint32_t offset, uint32_t matchLength) {
+  uint32_t maxSize = 1 + literalLength / LZ_LENGTH_BYTE_MAX + 1 + literalLength
+      + (matchLength != 0 ? 2 + matchLength / LZ_LENGTH_BYTE_MAX + 1 : 0);
+  if (*dstSize + maxSize > dstCapacity) {
+    return 1;
+  }
+  uint8_t *token = dst + (*dstSize)++;
+  *token = (literalLength < LZ_LENGTH_MASK ? literalLength : LZ_LENGTH_MASK) << 4;
+  putLength(dst, dstSize, literalLength);
+  memcpy(dst + *dstSize, literals, literalLength);
+  *dstSize += literalLength;
+  if (matchLength == 0) {
+    return 0;
+  }
+  dst[(*dstSize)++] = offset & 0xFF;
+  dst[(*dstSize)++] = offset >> 8;
+  matchLength -= LZ_MIN_MATCH;
+  *token |= matchLength < LZ_LENGTH_MASK ? matchLength : LZ_LENGTH_MASK;
+  putLength(dst, dstSize, matchLength);
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Writes the length bytes which follow the full token nibble.
+* Input          : dst - output buffer
+*                  dstSize - written size
+*                  length - the length.
+* Output         : dstSize - written size.
+* Return         : None.
+*******************************************************************************/
+void putLength(uint8_t *dst, uint32_t *dstSize, uint32_t length) {
+  if (length < LZ_LENGTH_MASK) {
+    return;
+  }
+  for (length -= LZ_LENGTH_MASK; length >= LZ_LENGTH_BYTE_MAX; length -= LZ_LENGTH_BYTE_MAX) {
+    dst[(*dstSize)++] = LZ_LENGTH_BYTE_MAX;
+  }
+  dst[(*dstSize)++] = length;
+}
+
+/*******************************************************************************
+* Description    : Reads the length bytes which follow the full token nibble.
+* Input          : src - compressed data
+*                  srcSize - size of compressed data
+*                  position - position of the length bytes
+*                  length - length from the token.
+* Output         : position - position after the length bytes
+*                  length - the length.
+* Return         : 0 if success or 1 if the data ends.
+*******************************************************************************/
+uint8_t getLength(const uint8_t *src, uint32_t srcSize, uint32_t *position, uint32_t *length) {
+  uint8_t value = LZ_LENGTH_BYTE_MAX;
+  if (*length != LZ_LENGTH_MASK) {
+    return 0;
+  }
+  while (value == LZ_LENGTH_BYTE_MAX) {
+    if (*position >= srcSize) {
+      return 1;
+    }
+    value = src[(*position)++];
+    *length += value;
+  }
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Reads 4 bytes of the data which can be not aligned.
+* Input          : src - the data.
+* Output         : None.
+* Return         : The bytes as the number.
+*******************************************************************************/
+uint32_t readSequence(const uint8_t *src) {
+  uint32_t sequence;
+  memcpy(&sequence, src, sizeof(sequence));
+  return sequence;
+}
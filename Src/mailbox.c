@@ -0,0 +1,137 @@
+/**
+  ******************************************************************************
+  * @file           : MAILBOX
+  * @version        : v1.0
+  * @brief          : Requests of the host through the vendor SCSI commands
+  ******************************************************************************
+  * MIT License
+  *
+  * Copyright (c) 2017 Oleksandr Borysov
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+ ******************************************************************************
+*/
+
+
+
+
+/* Includes ------------------------------------------------------------------*/
+#include "mailbox.h"
+#include "sd_io_controller.h"
+#include "task_scheduler.h"
+#include "device_stats.h"
+#include "stm32f4xx_hal.h"
+#include <string.h>
+
+#if (MAILBOX_ROOT_KEY_LENGTH != ROOT_KEY_LENGHT) || (MAILBOX_CONF_KEY_LENGTH != CONF_KEY_LENGHT) \
+    || (MAILBOX_NAME_LENGTH != PART_NAME_LENGHT) || (MAILBOX_PART_KEY_LENGTH != PART_KEY_LENGHT)
+#error "Mailbox sizes don't match the device configurations"
+#endif
+
+/* Private variables ---------------------------------------------------------*/
+MailboxRequest mailboxRequest;                            // The last request of the host
+MailboxResponse mailboxResponse;                          // Response to the last request
+uint8_t mailboxLun;                                       // Logical unit of the last request, only it reads the response
+uint32_t requestTime;                                     // Tick of the last request
+
+/* Public mailbox functions ---------------------------------------------------------*/
+
+/*******************************************************************************
+* Description    : Takes the data of the vendor write command as the request. Called
+*                    by the USB interrupt, the request runs as the task. The request
+*                    is refused while the previous one is not done.
+* Input          : lun - logical unit of the command
+*                  data - the data of the command
+*                  length - bytes of the data.
+* Output         : None.
+* Return         : 0 if the request is taken or 1 if not.
+*******************************************************************************/
+uint8_t writeMailbox(uint8_t lun, const uint8_t *data, uint32_t length) {
+  const MailboxRequest *request = (const MailboxRequest*) data;
+  if ((length != sizeof(MailboxRequest)) || (request->magic != MAILBOX_MAGIC) || (request->version != MAILBOX_VERSION)
+      || ((mailboxResponse.magic == MAILBOX_MAGIC) && (mailboxResponse.status == MAILBOX_PENDING))) {
+    return 1;
+  }
+  memcpy(&mailboxRequest, request, sizeof(mailboxRequest));
+  mailboxLun = lun;
+  memset(&mailboxResponse, 0, sizeof(mailboxResponse));
+  mailboxResponse.magic = MAILBOX_MAGIC;
+  mailboxResponse.version = MAILBOX_VERSION;
+  mailboxResponse.status = MAILBOX_PENDING;
+  mailboxResponse.sequence = request->sequence;
+  requestTime = HAL_GetTick();
+  ++deviceStatistics.mailboxRequestCount;
+  postTask(MAILBOX_TASK);
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Gives the response to the vendor read command of the logical unit
+*                    of the request. Called by the USB interrupt. The done response is
+*                    given once, then it is dropped.
+* Input          : lun - logical unit of the command.
+* Output         : data - the response, MAILBOX_RESPONSE_SIZE bytes.
+* Return         : 0 if the response was given or 1 if the logical unit has no response.
+*******************************************************************************/
+uint8_t readMailbox(uint8_t lun, uint8_t *data) {
+  if ((mailboxResponse.magic != MAILBOX_MAGIC) || (lun != mailboxLun)) {
+    return 1;
+  }
+  memcpy(data, &mailboxResponse, sizeof(mailboxResponse));
+  if (mailboxResponse.status != MAILBOX_PENDING) {
+    memset(&mailboxResponse, 0, sizeof(mailboxResponse));   // Keys and data of the response are not kept
+  }
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Gets the last request of the host.
+* Input          : None.
+* Output         : None.
+* Return         : The request.
+*******************************************************************************/
+MailboxRequest* getMailboxRequest(void) {
+  return &mailboxRequest;
+}
+
+/*******************************************************************************
+* Description    : Gets the response to the last request, the task fills its data.
+* Input          : None.
+* Output         : None.
+* Return         : The response.
+*******************************************************************************/
+MailboxResponse* getMailboxResponse(void) {
+  return &mailboxResponse;
+}
+
+/*******************************************************************************
+* Description    : Ends the request, the host reads the response.
+* Input          : res - 0 if the request was done or 1 if not.
+* Output         : None.
+* Return         : None.
+*******************************************************************************/
+void completeMailboxRequest(uint8_t res) {
+  if (res != 0) {
+    mailboxResponse.length = 0;                           // Failed request gives no data
+    mailboxResponse.total = 0;
+  }
+  deviceStatistics.mailboxServiceTime = HAL_GetTick() - requestTime;
+  memset(&mailboxRequest, 0, sizeof(mailboxRequest));     // Keys of the request are not kept
+  mailboxResponse.status = res == 0 ? MAILBOX_DONE : MAILBOX_FAILED;
+}
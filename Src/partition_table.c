@@ -0,0 +1,430 @@
+/**
+  ******************************************************************************
+  * @file           : PARTITION_TABLE
+  * @version        : v1.0
+  * @brief          : This file implements the on-card partition table and its name index
+  ******************************************************************************
+  * MIT License
+  *
+  * Copyright (c) 2017 Oleksandr Borysov
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+ ******************************************************************************
+*/
+
+
+#include "partition_table.h"
+#include <string.h>
+
+/* Private typedef -----------------------------------------------------------*/
+// Hash index of the partition names, open addressing with linear probing
+typedef struct {
+   uint16_t entries[PART_INDEX_SIZE];                     // Entry number + 1, NO_ENTRY marks a free slot
+   uint16_t tags[PART_INDEX_SIZE];                        // High half of the name hash, skips reading foreign entries
+   uint8_t table;                                         // Table of the indexed entries
+   char rootKey[ROOT_KEY_LENGHT];                         // Key of the indexed table
+} PartitionIndex;
+// Table which is written entry by entry
+typedef struct {
+   BYTE sector[STORAGE_BLOCK_SIZE];                       // Entries which are not flushed to the card yet
+   uint8_t table;
+   char rootKey[ROOT_KEY_LENGHT];
+   uint16_t entryNumber;
+   uint64_t roundSectors[MAX_PART_EXTENTS];               // Sectors allocated in each round of the layout
+   uint8_t status;                                        // 0 while all entries are correct
+} TableWriter;
+// The last read sector of the table
+typedef struct {
+   BYTE sector[STORAGE_BLOCK_SIZE];
+   uint64_t cardSector;
+   char rootKey[ROOT_KEY_LENGHT];
+   uint8_t isValid;
+} TableCache;
+
+/* Private define ------------------------------------------------------------*/
+#define NO_ENTRY                         0
+#define NAME_HASH_BASIS                  2166136261u    // FNV-1a hash of the partition name
+#define NAME_HASH_PRIME                  16777619u
+
+/* Private variables ---------------------------------------------------------*/
+PartitionIndex partitionIndex;                            // Name index of the live partition table
+TableWriter tableWriter;                                  // Writer of the new partition table
+TableCache tableCache;                                    // Decrypted sector of the table
+
+/* Private partition table function prototypes -----------------------------------------------*/
+uint32_t getNameHash(const char*);
+void clearPartitionIndex(uint8_t, const char*);
+void insertPartitionIndex(const char*, uint16_t);
+uint8_t loadTableSector(BYTE*, uint8_t, uint16_t, const char*);
+uint8_t storeTableSector(BYTE*, uint8_t, uint16_t, const char*);
+uint8_t readTableSector(uint8_t, uint16_t, const char*);
+uint64_t getExtentSize(const Partition*, uint8_t);
+uint64_t getPartitionTableSector(uint8_t, uint16_t);
+
+/* Public partition table functions ---------------------------------------------------------*/
+
+/*******************************************************************************
+* Description    : Starts writing of the new partition table. The live table and
+*                    its index stay untouched till the new table is ended.
+* Input          : table - table area for the new entries
+*                  rootKey - key to encrypt the new table.
+* Output         : None.
+* Return         : None.
+*******************************************************************************/
+void beginPartitionTable(uint8_t table, const char *rootKey) {
+  memset(&tableWriter, 0, sizeof(tableWriter));
+  tableWriter.table = table;
+  strncpy(tableWriter.rootKey, rootKey, ROOT_KEY_LENGHT);
+}
+
+/*******************************************************************************
+* Description    : Checks the partition and appends it to the new partition table.
+*                    Only sizes are accumulated here, extents are placed when the table is ended.
+* Input          : partition - the partition with size and requested number of extents.
+* Output         : partition - the partition with corrected number of extents.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t addPartitionEntry(Partition *partition) {
+  uint16_t number = tableWriter.entryNumber;
+  if ((number == 0) || (partition->extentNumber == 0)) {
+    partition->extentNumber = 1;                            // Zero partition is always solid
+  }
+  if (partition->extentNumber > MAX_PART_EXTENTS) {
+    partition->extentNumber = MAX_PART_EXTENTS;
+  }
+  if (partition->sectorNumber < partition->extentNumber) {
+    partition->extentNumber = partition->sectorNumber != 0 ? partition->sectorNumber : 1;
+  }
+  if ((tableWriter.status != 0) || (number >= MAX_PART_NUMBER)
+      || (partition->name[0] == '\0') || (partition->key[0] == '\0') || (partition->sectorNumber == 0)
+      || ((partition->partitionType == PUBLIC)
+          && (strncmp(partition->key, PUBLIC_PARTITION_KEY, PART_KEY_LENGHT) != 0))) {
+    tableWriter.status = 1;
+    return 1;
+  }
+  for (uint8_t round = 0; round < partition->extentNumber; ++round) {
+    tableWriter.roundSectors[round] += getExtentSize(partition, round);
+  }
+  memset(partition->extents, 0, sizeof(partition->extents));
+  memcpy(tableWriter.sector + (number % PART_ENTRIES_PER_SECTOR) * PART_ENTRY_SIZE, partition, sizeof(*partition));
+  tableWriter.entryNumber++;
+  if ((tableWriter.entryNumber % PART_ENTRIES_PER_SECTOR == 0)    // Sector is full
+      && (storeTableSector(tableWriter.sector, tableWriter.table, number / PART_ENTRIES_PER_SECTOR,
+          tableWriter.rootKey) != 0)) {
+    tableWriter.status = 1;
+  }
+  return tableWriter.status;
+}
+
+/*******************************************************************************
+* Description    : Ends the new partition table. Partitions are placed on the volume in rounds,
+*                    one extent of each partition per round, so pieces of the partitions alternate.
+*                    The name index is rebuilt for the new table.
+* Input          : None.
+* Output         : partitionsNumber - number of the partitions in the new table
+*                  usedSectors - volume sectors taken by the partitions.
+* Return         : 0 if success or 1 if the table is not correct or doesn't fit the volume.
+*******************************************************************************/
+uint8_t endPartitionTable(uint16_t *partitionsNumber, uint64_t *usedSectors) {
+  uint64_t roundCursors[MAX_PART_EXTENTS];
+  uint64_t cursor = 0;
+  Partition partition;
+  Partition foundPartition;
+  if ((tableWriter.status == 0) && (tableWriter.entryNumber % PART_ENTRIES_PER_SECTOR != 0)
+      && (storeTableSector(tableWriter.sector, tableWriter.table, tableWriter.entryNumber / PART_ENTRIES_PER_SECTOR,
+          tableWriter.rootKey) != 0)) {
+    tableWriter.status = 1;
+  }
+  if ((tableWriter.status != 0) || (tableWriter.entryNumber == 0)) {
+    return 1;
+  }
+  for (uint8_t round = 0; round < MAX_PART_EXTENTS; ++round) {
+    roundCursors[round] = cursor;
+    cursor += tableWriter.roundSectors[round];
+  }
+  if (cursor > getVolumeSectorNumber()) {
+    return 1;
+  }
+  clearPartitionIndex(tableWriter.table, tableWriter.rootKey);
+  for (uint16_t sector = 0; sector * PART_ENTRIES_PER_SECTOR < tableWriter.entryNumber; ++sector) {
+    if (loadTableSector(tableWriter.sector, tableWriter.table, sector, tableWriter.rootKey) != 0) {
+      return 1;
+    }
+    for (uint16_t number = sector * PART_ENTRIES_PER_SECTOR;
+        (number < (sector + 1) * PART_ENTRIES_PER_SECTOR) && (number < tableWriter.entryNumber); ++number) {
+      BYTE *entry = tableWriter.sector + (number % PART_ENTRIES_PER_SECTOR) * PART_ENTRY_SIZE;
+      memcpy(&partition, entry, sizeof(partition));
+      if (findPartitionEntry(partition.name, &foundPartition) >= 0) {
+        return 1;                                           // The name is already used by other partition
+      }
+      for (uint8_t round = 0; round < partition.extentNumber; ++round) {
+        partition.extents[round].startSector = roundCursors[round];
+        partition.extents[round].sectorNumber = getExtentSize(&partition, round);
+        roundCursors[round] += partition.extents[round].sectorNumber;
+      }
+      memcpy(entry, &partition, sizeof(partition));
+      insertPartitionIndex(partition.name, number);
+    }
+    if (storeTableSector(tableWriter.sector, tableWriter.table, sector, tableWriter.rootKey) != 0) {
+      return 1;
+    }
+  }
+  *partitionsNumber = tableWriter.entryNumber;
+  *usedSectors = cursor;
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Builds the name index of the stored partition table. Table is streamed
+*                    sector by sector, so the whole table is never kept in RAM.
+* Input          : table - table area of the entries
+*                  partitionsNumber - number of the entries
+*                  rootKey - key to decrypt the table.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t buildPartitionIndex(uint8_t table, uint16_t partitionsNumber, const char *rootKey) {
+  Partition partition;
+  clearPartitionIndex(table, rootKey);
+  for (uint16_t i = 0; i < partitionsNumber; ++i) {
+    if (readPartitionEntry(table, i, rootKey, &partition) != 0) {
+      clearPartitionIndex(table, rootKey);
+      return 1;
+    }
+    insertPartitionIndex(partition.name, i);
+  }
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Reads the partition entry from the stored partition table.
+* Input          : table - table area of the entry
+*                  number - number of the entry
+*                  rootKey - key to decrypt the table.
+* Output         : partition - the partition configurations.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t readPartitionEntry(uint8_t table, uint16_t number, const char *rootKey, Partition *partition) {
+  if ((number >= MAX_PART_NUMBER) || (readTableSector(table, number / PART_ENTRIES_PER_SECTOR, rootKey) != 0)) {
+    return 1;
+  }
+  memcpy(partition, tableCache.sector + (number % PART_ENTRIES_PER_SECTOR) * PART_ENTRY_SIZE, sizeof(*partition));
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Finds the partition of the indexed table by name. Only entries
+*                    with the same name hash are read from the card.
+* Input          : name - name of the partition.
+* Output         : partition - the partition configurations.
+* Return         : Number of the partition or -1 if it is not found.
+*******************************************************************************/
+int32_t findPartitionEntry(const char *name, Partition *partition) {
+  uint32_t hash = getNameHash(name);
+  uint16_t slot = hash & (PART_INDEX_SIZE - 1);
+  for (uint16_t probe = 0; (probe < PART_INDEX_SIZE) && (partitionIndex.entries[slot] != NO_ENTRY); ++probe) {
+    if ((partitionIndex.tags[slot] == (uint16_t) (hash >> 16))
+        && (readPartitionEntry(partitionIndex.table, partitionIndex.entries[slot] - 1,
+            partitionIndex.rootKey, partition) == 0)
+        && (strncmp(name, partition->name, PART_NAME_LENGHT) == 0)) {
+      return partitionIndex.entries[slot] - 1;
+    }
+    slot = (slot + 1) & (PART_INDEX_SIZE - 1);
+  }
+  return -1;
+}
+
+/*******************************************************************************
+* Description    : Builds the extent index of the partition.
+* Input          : partition - the partition.
+* Output         : extentIndex - ends of the partition extents.
+* Return         : None.
+*******************************************************************************/
+void buildExtentIndex(const Partition *partition, ExtentIndex *extentIndex) {
+  uint64_t extentEnd = 0;
+  extentIndex->extentNumber = partition->extentNumber;
+  for (uint8_t i = 0; i < extentIndex->extentNumber; ++i) {
+    extentEnd += partition->extents[i].sectorNumber;
+    extentIndex->extentEnds[i] = extentEnd;
+  }
+}
+
+/*******************************************************************************
+* Description    : Calculates volume sector of the partition sector. The extent is
+*                    found by binary search in the extent index.
+* Input          : partition - the partition
+*                  extentIndex - extent index of the partition
+*                  sector - desired sector.
+* Output         : runLength - number of the partition sectors till the end of the extent.
+* Return         : Volume sector of the desired sector.
+*******************************************************************************/
+uint64_t translateExtentSector(const Partition *partition, const ExtentIndex *extentIndex,
+    uint64_t sector, UINT *runLength) {
+  uint8_t low = 0;
+  uint8_t high = extentIndex->extentNumber - 1;
+  while (low < high) {                                        // Find the first extent which ends after the sector
+    uint8_t middle = (low + high) / 2;
+    if (extentIndex->extentEnds[middle] > sector) {
+      high = middle;
+    } else {
+      low = middle + 1;
+    }
+  }
+  uint64_t extentStart = extentIndex->extentEnds[low] - partition->extents[low].sectorNumber;
+  *runLength = extentIndex->extentEnds[low] - sector < UINT32_MAX ? extentIndex->extentEnds[low] - sector : UINT32_MAX;
+  return partition->extents[low].startSector + (sector - extentStart);
+}
+
+/* Private partition table functions ---------------------------------------------------------*/
+
+/*******************************************************************************
+* Description    : Calculates FNV-1a hash of the partition name.
+* Input          : name - name of the partition.
+* Output         : None.
+* Return         : Hash of the name.
+*******************************************************************************/
+uint32_t getNameHash(const char *name) {
+  uint32_t hash = NAME_HASH_BASIS;
+  for (uint8_t i = 0; (i < PART_NAME_LENGHT) && (name[i] != '\0'); ++i) {
+    hash = (hash ^ (uint8_t) name[i]) * NAME_HASH_PRIME;
+  }
+  return hash;
+}
+
+/*******************************************************************************
+* Description    : Removes all entries from the name index.
+* Input          : table - table area which will be indexed
+*                  rootKey - key of the table.
+* Output         : None.
+* Return         : None.
+*******************************************************************************/
+void clearPartitionIndex(uint8_t table, const char *rootKey) {
+  memset(&partitionIndex, 0, sizeof(partitionIndex));
+  partitionIndex.table = table;
+  strncpy(partitionIndex.rootKey, rootKey, ROOT_KEY_LENGHT);
+}
+
+/*******************************************************************************
+* Description    : Adds the partition to the name index. Index has twice more slots
+*                    than partitions, so free slot is always found.
+* Input          : name - name of the partition
+*                  number - number of the partition entry.
+* Output         : None.
+* Return         : None.
+*******************************************************************************/
+void insertPartitionIndex(const char *name, uint16_t number) {
+  uint32_t hash = getNameHash(name);
+  uint16_t slot = hash & (PART_INDEX_SIZE - 1);
+  while (partitionIndex.entries[slot] != NO_ENTRY) {
+    slot = (slot + 1) & (PART_INDEX_SIZE - 1);
+  }
+  partitionIndex.entries[slot] = number + 1;
+  partitionIndex.tags[slot] = (uint16_t) (hash >> 16);
+}
+
+/*******************************************************************************
+* Description    : Reads and decrypts the table sector.
+* Input          : table - table area
+*                  sector - sector of the table
+*                  rootKey - key to decrypt the table.
+* Output         : buff - the decrypted sector.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t loadTableSector(BYTE *buff, uint8_t table, uint16_t sector, const char *rootKey) {
+  if (cardReadSectors(buff, getPartitionTableSector(table, sector), 1) != MSD_OK) {
+    return 1;
+  }
+#if  CIPHER_MOD == 0
+  decryptMemoryAES(buff, rootKey, STORAGE_BLOCK_SIZE);
+#endif
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Encrypts and writes the table sector.
+* Input          : buff - the sector, it is encrypted in place
+*                  table - table area
+*                  sector - sector of the table
+*                  rootKey - key to encrypt the table.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t storeTableSector(BYTE *buff, uint8_t table, uint16_t sector, const char *rootKey) {
+  uint8_t res = 1;
+  tableCache.isValid = 0;
+#if  CIPHER_MOD == 0
+  encryptMemoryAES(buff, rootKey, STORAGE_BLOCK_SIZE);
+#endif
+  if (cardWriteSectors(buff, getPartitionTableSector(table, sector), 1) == MSD_OK) {
+    res = 0;
+  }
+  memset(buff, 0, STORAGE_BLOCK_SIZE);
+  return res;
+}
+
+/*******************************************************************************
+* Description    : Reads the table sector to the table cache.
+* Input          : table - table area
+*                  sector - sector of the table
+*                  rootKey - key to decrypt the table.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t readTableSector(uint8_t table, uint16_t sector, const char *rootKey) {
+  uint64_t cardSector = getPartitionTableSector(table, sector);
+  if (tableCache.isValid && (tableCache.cardSector == cardSector)
+      && (strncmp(tableCache.rootKey, rootKey, ROOT_KEY_LENGHT) == 0)) {
+    return 0;
+  }
+  tableCache.isValid = 0;
+  if (loadTableSector(tableCache.sector, table, sector, rootKey) != 0) {
+    return 1;
+  }
+  tableCache.cardSector = cardSector;
+  strncpy(tableCache.rootKey, rootKey, ROOT_KEY_LENGHT);
+  tableCache.isValid = 1;
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Calculates size of the partition extent. The last extent takes the rest.
+* Input          : partition - the partition
+*                  round - number of the extent.
+* Output         : None.
+* Return         : Number of the extent sectors.
+*******************************************************************************/
+uint64_t getExtentSize(const Partition *partition, uint8_t round) {
+  uint64_t extentSize = partition->sectorNumber / partition->extentNumber;
+  if (round == partition->extentNumber - 1) {
+    extentSize += partition->sectorNumber % partition->extentNumber;
+  }
+  return extentSize;
+}
+
+/*******************************************************************************
+* Description    : Calculates the card sector of the table sector. Tables follow
+*                    the configuration header at the end of the first card.
+* Input          : table - table area
+*                  sector - sector of the table.
+* Output         : None.
+* Return         : Sector of the first card.
+*******************************************************************************/
+uint64_t getPartitionTableSector(uint8_t table, uint16_t sector) {
+  return getConfSector() + CONF_HEADER_SECTORS + (uint64_t) table * PART_TABLE_SECTORS + sector;
+}
@@ -0,0 +1,635 @@
+/**
+  ******************************************************************************
+  * @file           : QUICK_FORMAT
+  * @version        : v1.0
+  * @brief          : This file implements on-device quick format of the partitions
+  ******************************************************************************
+  * MIT License
+  *
+  * Copyright (c) 2017 Oleksandr Borysov
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+ ******************************************************************************
+*/
+
+
+
+/* Includes ------------------------------------------------------------------*/
+#include "quick_format.h"
+#include "partition_table.h"
+#include "relocation.h"
+#include "clone_remap.h"
+#include "compression.h"
+#include "device_stats.h"
+#include "work_arena.h"
+#include <string.h>
+
+/* Private typedef -----------------------------------------------------------*/
+// Partition which file system is written after the configurations update
+typedef struct {
+   char name[PART_NAME_LENGHT];
+   uint16_t partNumber;                                   // Number in the new table, its logical unit waits
+   FormatType type;
+} FormatRequest;
+// Partition being formatted, it is not visible through the logical units
+typedef struct {
+   Partition partition;
+   ExtentIndex extentIndex;
+   char xorKey[STORAGE_BLOCK_SIZE];
+} FormatTarget;
+// Layout of the exFAT volume
+typedef struct {
+   uint32_t clusterSectors;
+   uint32_t fatSectors;
+   uint32_t heapSector;                                   // First sector of the cluster heap
+   uint32_t clusterNumber;
+   uint32_t bitmapBytes;
+   uint32_t bitmapClusters;                               // Allocation bitmap, up-case table and root directory
+   uint32_t upcaseClusters;                               // take the first clusters of the heap
+   uint32_t upcaseBytes;
+   uint32_t upcaseChecksum;
+} ExfatLayout;
+// Writer of the up-case table, the table is built twice to know its size first
+typedef struct {
+   uint64_t sector;                                       // Partition sector of the buffer
+   uint32_t position;                                     // Bytes in the buffer
+   uint32_t tableBytes;
+   uint32_t checksum;
+   uint8_t isWritten;
+   uint8_t status;
+} UpcaseWriter;
+
+/* Private define ------------------------------------------------------------*/
+#define FORMAT_BUFFER_SECTORS            8              // Sectors written at once (4 KB)
+#define MAX_FORMAT_VOLUME_SECTORS        0xFFFFFFFFu    // Volume sectors are 32-bit in the boot sector
+#define FAT32_RESERVED_SECTORS           32
+#define FAT32_FSINFO_SECTOR              1
+#define FAT32_BACKUP_SECTOR              6              // Boot sector and FSInfo copies
+#define FAT32_ROOT_CLUSTER               2
+#define FAT32_MIN_CLUSTERS               0xFFF6         // Volume with less clusters is FAT16
+#define FAT32_MAX_CLUSTERS               0x0FFFFFF5
+#define FAT32_MAX_CLUSTER_SECTORS        64
+#define FAT32_CLUSTER_STEP_SECTORS       0x1000000      // Cluster doubles each 8 GB like host formatters do
+#define EXFAT_MIN_SECTORS                0x1000
+#define EXFAT_BOOT_SECTORS               12             // Main boot region, the backup region follows it
+#define EXFAT_EXTENDED_BOOT_SECTORS      8
+#define EXFAT_FAT_SECTOR                 32
+#define EXFAT_MAX_CLUSTERS               0x7FFFFFFD
+#define EXFAT_FIRST_CLUSTER              2
+#define UPCASE_MIN_RUN                   128            // Shorter runs of the same characters are not compressed
+#define UPCASE_RUN_MARK                  0xFFFF
+#define DIR_ENTRY_SIZE                   32
+#define FAT_END_OF_CHAIN                 0xFFFFFFFFu
+
+/* Private variables ---------------------------------------------------------*/
+FormatRequest formatRequests[MAX_FORMAT_REQUESTS];      // Formats requested by the last configurations update
+uint8_t formatRequestNumber;
+FormatTarget formatTarget;
+BYTE *formatBuffer;                                       // Taken from the work arena while the formats are written
+extern PartitionsStructure partitionsStructure;
+
+/* Private quick format function prototypes -----------------------------------------------*/
+uint8_t formatPartition(const FormatRequest*);
+uint8_t writeFat32Volume(uint64_t);
+uint8_t writeExfatVolume(uint64_t);
+uint8_t writeExfatBootRegion(const ExfatLayout*, uint64_t);
+uint8_t writeExfatBitmap(const ExfatLayout*);
+uint8_t writeExfatFat(const ExfatLayout*);
+uint8_t writeExfatRoot(const ExfatLayout*);
+uint8_t writeUpcaseTable(uint64_t, uint32_t*, uint32_t*, uint8_t);
+void putUpcaseEntry(UpcaseWriter*, WCHAR);
+uint8_t writeFormatSectors(BYTE*, uint64_t, UINT);
+uint8_t writeZeroSectors(uint64_t, uint64_t);
+uint32_t addChecksumByte(uint32_t, BYTE);
+void storeWord(BYTE*, uint16_t);
+void storeDword(BYTE*, uint32_t);
+void storeQword(BYTE*, uint64_t);
+
+/* Public quick format functions ---------------------------------------------------------*/
+
+/*******************************************************************************
+* Description    : Drops formats requested by the configurations update which didn't apply.
+* Input          : None.
+* Output         : None.
+* Return         : None.
+*******************************************************************************/
+void resetFormatRequests(void) {
+  formatRequestNumber = 0;
+}
+
+/*******************************************************************************
+* Description    : Requests the file system for the partition of the new configurations.
+*                    Only the new partition or the partition with the new size is
+*                    formatted, the kept partition keeps its file system.
+* Input          : partNumber - number of the partition in the new table
+*                  partition - the partition, the live table is still indexed
+*                  type - the file system.
+* Output         : None.
+* Return         : 0 if success or 1 if the partition can't be formatted.
+*******************************************************************************/
+uint8_t requestPartitionFormat(uint16_t partNumber, const Partition *partition, FormatType type) {
+  Partition oldPartition;
+  if ((partNumber == 0) || isClonePartition(partition)            // Zero partition keeps the command file
+      || isCompressedPartition(partition) || (formatRequestNumber >= MAX_FORMAT_REQUESTS)) {
+    return 1;
+  }
+  if ((findPartitionEntry(partition->name, &oldPartition) >= 0)
+      && (oldPartition.sectorNumber == partition->sectorNumber)) {
+    return 0;
+  }
+  strncpy(formatRequests[formatRequestNumber].name, partition->name, PART_NAME_LENGHT);
+  formatRequests[formatRequestNumber].partNumber = partNumber;
+  formatRequests[formatRequestNumber].type = type;
+  formatRequestNumber++;
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Checks the partition to wait for its format. Called by the USB interrupt too.
+* Input          : partNumber - number of the partition in the live table.
+* Output         : None.
+* Return         : True if the partition is not formatted yet.
+*******************************************************************************/
+uint8_t isPartitionFormatPending(uint16_t partNumber) {
+  for (uint8_t i = 0; i < formatRequestNumber; ++i) {
+    if (formatRequests[i].partNumber == partNumber) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Formats the requested partitions. Called in the idle time when the new
+*                    configurations are live, the memory they freed is erased and no data
+*                    is moved anymore. Host requests are served between the format writes,
+*                    logical units don't show the requested partitions till the formats end.
+*                    The format buffer is taken from the work arena till the formats end.
+* Input          : None.
+* Output         : None.
+* Return         : None.
+*******************************************************************************/
+void formatRequestedPartitions(void) {
+  uint32_t startTime = HAL_GetTick();
+  if (formatRequestNumber == 0) {
+    return;
+  }
+  deviceStatistics.formatSectors = 0;
+  deviceStatistics.formatFailCount = 0;
+  formatBuffer = allocWorkBuffer(FORMAT_BUFFER_SECTORS * STORAGE_BLOCK_SIZE);
+  for (uint8_t i = 0; i < formatRequestNumber; ++i) {
+    if ((formatBuffer == NULL) || (formatPartition(&formatRequests[i]) != 0)) {
+      deviceStatistics.formatFailCount++;                         // Host formats the partition itself
+    }
+  }
+  releaseWorkBuffer(formatBuffer);
+  formatBuffer = NULL;
+  formatRequestNumber = 0;
+  deviceStatistics.formatTime = HAL_GetTick() - startTime;
+}
+
+/* Private quick format functions ---------------------------------------------------------*/
+
+/*******************************************************************************
+* Description    : Writes the requested file system to the partition. The partition
+*                    must not be visible and its sectors must not be shared by clones.
+* Input          : request - the requested format.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t formatPartition(const FormatRequest *request) {
+  Partition *partition = &formatTarget.partition;
+  int32_t partNumber = findPartitionEntry(request->name, partition);
+  if ((partNumber <= 0) || isPartitionShown(partNumber) || isPartitionCloned(&partitionsStructure, request->name)
+      || (partition->sectorNumber > MAX_FORMAT_VOLUME_SECTORS)) {
+    return 1;
+  }
+  buildExtentIndex(partition, &formatTarget.extentIndex);
+#if  CIPHER_MOD == 0
+  createKeyWithSpecLength(partition->key, formatTarget.xorKey, STORAGE_BLOCK_SIZE);
+#endif
+  return request->type == FORMAT_EXFAT ? writeExfatVolume(partition->sectorNumber)
+      : writeFat32Volume(partition->sectorNumber);
+}
+
+/*******************************************************************************
+* Description    : Writes FAT32 volume without the partition table. The whole FAT is
+*                    written because free clusters are zero entries, the data clusters
+*                    are not touched.
+* Input          : volumeSectors - sectors of the partition.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t writeFat32Volume(uint64_t volumeSectors) {
+  BYTE *buff = formatBuffer;
+  uint32_t clusterSectors = 8;                                    // 4 KB clusters till 8 GB
+  uint32_t fatSectors = 0;
+  uint32_t clusterNumber = 0;
+  if (volumeSectors < FAT32_RESERVED_SECTORS + FAT32_MIN_CLUSTERS) {
+    return 1;
+  }
+  while ((clusterSectors < FAT32_MAX_CLUSTER_SECTORS)
+      && (volumeSectors > (uint64_t) clusterSectors / 8 * FAT32_CLUSTER_STEP_SECTORS)) {
+    clusterSectors *= 2;
+  }
+  for (; clusterSectors != 0; clusterSectors /= 2) {             // Small volumes take smaller clusters
+    fatSectors = (((volumeSectors - FAT32_RESERVED_SECTORS) / clusterSectors + 2) * 4 + STORAGE_BLOCK_SIZE - 1)
+        / STORAGE_BLOCK_SIZE;
+    clusterNumber = (volumeSectors - FAT32_RESERVED_SECTORS - fatSectors) / clusterSectors;
+    if (clusterNumber >= FAT32_MIN_CLUSTERS) {
+      break;
+    }
+  }
+  if ((clusterSectors == 0) || (clusterNumber > FAT32_MAX_CLUSTERS)) {
+    return 1;
+  }
+  // Boot sector and FSInfo, their copies follow them
+  memset(buff, 0, FORMAT_BUFFER_SECTORS * STORAGE_BLOCK_SIZE);
+  memcpy(buff, "\xEB\x58\x90" "MSDOS5.0", 11);
+  storeWord(buff + 11, STORAGE_BLOCK_SIZE);
+  buff[13] = clusterSectors;
+  storeWord(buff + 14, FAT32_RESERVED_SECTORS);
+  buff[16] = 1;                                                   // One FAT
+  buff[21] = 0xF8;                                                // Fixed media
+  storeWord(buff + 24, 63);                                       // Sectors per track and heads are not used
+  storeWord(buff + 26, 255);
+  storeDword(buff + 32, volumeSectors);
+  storeDword(buff + 36, fatSectors);
+  storeDword(buff + 44, FAT32_ROOT_CLUSTER);
+  storeWord(buff + 48, FAT32_FSINFO_SECTOR);
+  storeWord(buff + 50, FAT32_BACKUP_SECTOR);
+  buff[64] = 0x80;
+  buff[66] = 0x29;
+  storeDword(buff + 67, getTimeStamp());                          // Volume serial number
+  memcpy(buff + 71, "NO NAME    " "FAT32   ", 19);
+  storeWord(buff + 510, 0xAA55);
+  BYTE *fsInfo = buff + FAT32_FSINFO_SECTOR * STORAGE_BLOCK_SIZE;
+  storeDword(fsInfo, 0x41615252);
+  storeDword(fsInfo + 484, 0x61417272);
+  storeDword(fsInfo + 488, clusterNumber - 1);                    // Root directory takes one cluster
+  storeDword(fsInfo + 492, FAT32_ROOT_CLUSTER);
+  storeWord(fsInfo + 510, 0xAA55);
+  memcpy(buff + FAT32_BACKUP_SECTOR * STORAGE_BLOCK_SIZE, buff, 2 * STORAGE_BLOCK_SIZE);
+  if (writeFormatSectors(buff, 0, FAT32_BACKUP_SECTOR + 2) != 0) {
+    return 1;
+  }
+  // FAT starts with the media entry and the end of the root directory chain
+  memset(buff, 0, STORAGE_BLOCK_SIZE);
+  storeDword(buff, 0x0FFFFFF8);
+  storeDword(buff + 4, FAT_END_OF_CHAIN);
+  storeDword(buff + 8, FAT_END_OF_CHAIN);
+  if ((writeFormatSectors(buff, FAT32_RESERVED_SECTORS, 1) != 0)
+      || (writeZeroSectors(FAT32_RESERVED_SECTORS + 1, fatSectors - 1) != 0)) {
+    return 1;
+  }
+  return writeZeroSectors(FAT32_RESERVED_SECTORS + fatSectors, clusterSectors);    // Empty root directory
+}
+
+/*******************************************************************************
+* Description    : Writes exFAT volume without the partition table. Clusters are free
+*                    by the allocation bitmap, so the FAT is written only for the chains
+*                    of the bitmap, the up-case table and the root directory.
+* Input          : volumeSectors - sectors of the partition.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t writeExfatVolume(uint64_t volumeSectors) {
+  ExfatLayout layout;
+  if (volumeSectors < EXFAT_MIN_SECTORS) {
+    return 1;
+  }
+  layout.clusterSectors = volumeSectors >= 0x4000000 ? 256 : (volumeSectors >= 0x80000 ? 64 : 8);
+  layout.fatSectors = ((volumeSectors / layout.clusterSectors + 2) * 4 + STORAGE_BLOCK_SIZE - 1)
+      / STORAGE_BLOCK_SIZE;
+  layout.heapSector = (EXFAT_FAT_SECTOR + layout.fatSectors + layout.clusterSectors - 1)
+      / layout.clusterSectors * layout.clusterSectors;            // Heap is aligned to the cluster
+  if (layout.heapSector >= volumeSectors) {
+    return 1;
+  }
+  layout.clusterNumber = (volumeSectors - layout.heapSector) / layout.clusterSectors;
+  uint32_t clusterBytes = layout.clusterSectors * STORAGE_BLOCK_SIZE;
+  layout.bitmapBytes = (layout.clusterNumber + 7) / 8;
+  layout.bitmapClusters = (layout.bitmapBytes + clusterBytes - 1) / clusterBytes;
+  writeUpcaseTable(0, &layout.upcaseBytes, &layout.upcaseChecksum, 0);       // Size of the table only
+  layout.upcaseClusters = (layout.upcaseBytes + clusterBytes - 1) / clusterBytes;
+  if ((layout.clusterNumber > EXFAT_MAX_CLUSTERS)
+      || (layout.clusterNumber < layout.bitmapClusters + layout.upcaseClusters + 1)) {
+    return 1;
+  }
+  uint64_t upcaseSector = layout.heapSector + (uint64_t) layout.bitmapClusters * layout.clusterSectors;
+  if ((writeExfatBitmap(&layout) != 0)
+      || (writeUpcaseTable(upcaseSector, &layout.upcaseBytes, &layout.upcaseChecksum, 1) != 0)
+      || (writeExfatRoot(&layout) != 0)
+      || (writeExfatFat(&layout) != 0)) {
+    return 1;
+  }
+  return writeExfatBootRegion(&layout, volumeSectors);          // Volume is valid when the boot sector is written
+}
+
+/*******************************************************************************
+* Description    : Writes the main and the backup boot regions of exFAT volume.
+* Input          : layout - the volume layout
+*                  volumeSectors - sectors of the partition.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t writeExfatBootRegion(const ExfatLayout *layout, uint64_t volumeSectors) {
+  BYTE *buff = formatBuffer;
+  BYTE *copy = buff + STORAGE_BLOCK_SIZE;                         // Sectors are encrypted when they are written
+  uint32_t checksum = 0;
+  uint8_t clusterShift = 0;
+  while ((1u << clusterShift) < layout->clusterSectors) {
+    clusterShift++;
+  }
+  for (uint8_t i = 0; i < EXFAT_BOOT_SECTORS; ++i) {
+    memset(buff, 0, STORAGE_BLOCK_SIZE);
+    if (i == 0) {
+      memcpy(buff, "\xEB\x76\x90" "EXFAT   ", 11);
+      storeQword(buff + 72, volumeSectors);
+      storeDword(buff + 80, EXFAT_FAT_SECTOR);
+      storeDword(buff + 84, layout->fatSectors);
+      storeDword(buff + 88, layout->heapSector);
+      storeDword(buff + 92, layout->clusterNumber);
+      storeDword(buff + 96, EXFAT_FIRST_CLUSTER + layout->bitmapClusters + layout->upcaseClusters);
+      storeDword(buff + 100, getTimeStamp());                     // Volume serial number
+      storeWord(buff + 104, 0x0100);                              // File system revision 1.0
+      buff[108] = 9;                                              // 512 bytes sector
+      buff[109] = clusterShift;
+      buff[110] = 1;                                              // One FAT
+      buff[111] = 0x80;
+      buff[112] = 0xFF;                                           // Percent in use is not known
+      storeWord(buff + 120, 0xFEEB);                              // Boot code loops
+    }
+    if (i <= EXFAT_EXTENDED_BOOT_SECTORS) {                     // Boot sector and the extended boot sectors
+      storeWord(buff + 510, 0xAA55);
+    }
+    if (i == EXFAT_BOOT_SECTORS - 1) {                            // Checksum sector repeats the checksum
+      for (uint16_t j = 0; j < STORAGE_BLOCK_SIZE; j += 4) {
+        storeDword(buff + j, checksum);
+      }
+    } else {
+      for (uint16_t j = 0; j < STORAGE_BLOCK_SIZE; ++j) {
+        if ((i != 0) || ((j != 106) && (j != 107) && (j != 112))) { // Volume flags and percent in use change
+          checksum = addChecksumByte(checksum, buff[j]);
+        }
+      }
+    }
+    memcpy(copy, buff, STORAGE_BLOCK_SIZE);
+    if ((writeFormatSectors(copy, i + EXFAT_BOOT_SECTORS, 1) != 0)      // Backup region first
+        || (writeFormatSectors(buff, i, 1) != 0)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Writes the allocation bitmap with the clusters of the bitmap, the up-case
+*                    table and the root directory allocated.
+* Input          : layout - the volume layout.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t writeExfatBitmap(const ExfatLayout *layout) {
+  BYTE *buff = formatBuffer;
+  uint32_t usedClusters = layout->bitmapClusters + layout->upcaseClusters + 1;
+  uint64_t sector = layout->heapSector;
+  uint32_t bitmapSectors = (layout->bitmapBytes + STORAGE_BLOCK_SIZE - 1) / STORAGE_BLOCK_SIZE;
+  for (uint32_t done = 0; done < bitmapSectors;) {
+    UINT chunkSectors = bitmapSectors - done < FORMAT_BUFFER_SECTORS ? bitmapSectors - done : FORMAT_BUFFER_SECTORS;
+    uint32_t firstBit = done * STORAGE_BLOCK_SIZE * 8;
+    memset(buff, 0, chunkSectors * STORAGE_BLOCK_SIZE);
+    for (uint32_t bit = firstBit; (bit < usedClusters) && (bit < firstBit + chunkSectors * STORAGE_BLOCK_SIZE * 8); ++bit) {
+      buff[(bit - firstBit) / 8] |= 1 << (bit % 8);
+    }
+    if (writeFormatSectors(buff, sector, chunkSectors) != 0) {
+      return 1;
+    }
+    sector += chunkSectors;
+    done += chunkSectors;
+  }
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Writes the FAT sectors with the chains of the first clusters. Other
+*                    entries are not read for the free clusters, they are left as they are.
+* Input          : layout - the volume layout.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t writeExfatFat(const ExfatLayout *layout) {
+  BYTE *buff = formatBuffer;
+  uint32_t chainEnds[3];                                          // Last cluster of each chain
+  chainEnds[0] = EXFAT_FIRST_CLUSTER + layout->bitmapClusters - 1;
+  chainEnds[1] = chainEnds[0] + layout->upcaseClusters;
+  chainEnds[2] = chainEnds[1] + 1;
+  uint32_t fatSectors = ((chainEnds[2] + 1) * 4 + STORAGE_BLOCK_SIZE - 1) / STORAGE_BLOCK_SIZE;
+  for (uint32_t done = 0; done < fatSectors;) {
+    UINT chunkSectors = fatSectors - done < FORMAT_BUFFER_SECTORS ? fatSectors - done : FORMAT_BUFFER_SECTORS;
+    uint32_t firstEntry = done * STORAGE_BLOCK_SIZE / 4;
+    memset(buff, 0, chunkSectors * STORAGE_BLOCK_SIZE);
+    for (uint32_t entry = firstEntry; (entry <= chainEnds[2]) && (entry < firstEntry + chunkSectors * STORAGE_BLOCK_SIZE / 4);
+        ++entry) {
+      uint32_t value = entry + 1;
+      if (entry == 0) {
+        value = 0xFFFFFFF8;                                       // Media entry
+      } else if ((entry == 1) || (entry == chainEnds[0]) || (entry == chainEnds[1]) || (entry == chainEnds[2])) {
+        value = FAT_END_OF_CHAIN;
+      }
+      storeDword(buff + (entry - firstEntry) * 4, value);
+    }
+    if (writeFormatSectors(buff, EXFAT_FAT_SECTOR + done, chunkSectors) != 0) {
+      return 1;
+    }
+    done += chunkSectors;
+  }
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Writes the root directory cluster with the volume label, the allocation
+*                    bitmap and the up-case table entries. Directory ends by the zero entry.
+* Input          : layout - the volume layout.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t writeExfatRoot(const ExfatLayout *layout) {
+  BYTE *buff = formatBuffer;
+  uint64_t sector = layout->heapSector
+      + (uint64_t) (layout->bitmapClusters + layout->upcaseClusters) * layout->clusterSectors;
+  memset(buff, 0, STORAGE_BLOCK_SIZE);
+  buff[0] = 0x83;                                                 // Empty volume label
+  buff[DIR_ENTRY_SIZE] = 0x81;                                    // Allocation bitmap
+  storeDword(buff + DIR_ENTRY_SIZE + 20, EXFAT_FIRST_CLUSTER);
+  storeQword(buff + DIR_ENTRY_SIZE + 24, layout->bitmapBytes);
+  buff[2 * DIR_ENTRY_SIZE] = 0x82;                                // Up-case table
+  storeDword(buff + 2 * DIR_ENTRY_SIZE + 4, layout->upcaseChecksum);
+  storeDword(buff + 2 * DIR_ENTRY_SIZE + 20, EXFAT_FIRST_CLUSTER + layout->bitmapClusters);
+  storeQword(buff + 2 * DIR_ENTRY_SIZE + 24, layout->upcaseBytes);
+  if (writeFormatSectors(buff, sector, 1) != 0) {
+    return 1;
+  }
+  return writeZeroSectors(sector + 1, layout->clusterSectors - 1); // Entries after the end are unused
+}
+
+/*******************************************************************************
+* Description    : Builds the compressed up-case table from the FatFs case conversion,
+*                    runs of characters without the case are compressed.
+* Input          : sector - first sector of the table
+*                  isWritten - 0 to count the size and the checksum only.
+* Output         : tableBytes - size of the table
+*                  checksum - checksum of the table.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t writeUpcaseTable(uint64_t sector, uint32_t *tableBytes, uint32_t *checksum, uint8_t isWritten) {
+  UpcaseWriter writer;
+  uint32_t symbol = 0;
+  memset(&writer, 0, sizeof(writer));
+  writer.sector = sector;
+  writer.isWritten = isWritten;
+  while ((symbol <= 0xFFFF) && (writer.status == 0)) {
+    uint32_t run = 0;
+    while ((symbol + run <= 0xFFFF) && (ff_wtoupper(symbol + run) == symbol + run)) {
+      run++;
+    }
+    if (run >= UPCASE_MIN_RUN) {
+      putUpcaseEntry(&writer, UPCASE_RUN_MARK);
+      putUpcaseEntry(&writer, run);
+      symbol += run;
+    } else if (run != 0) {
+      for (; run != 0; --run, ++symbol) {
+        putUpcaseEntry(&writer, symbol);
+      }
+    } else {
+      putUpcaseEntry(&writer, ff_wtoupper(symbol));
+      symbol++;
+    }
+  }
+  if ((writer.position != 0) && writer.isWritten && (writer.status == 0)) {   // Last sector is padded by zeros
+    BYTE *buff = formatBuffer;
+    UINT sectors = (writer.position + STORAGE_BLOCK_SIZE - 1) / STORAGE_BLOCK_SIZE;
+    memset(buff + writer.position, 0, sectors * STORAGE_BLOCK_SIZE - writer.position);
+    writer.status = writeFormatSectors(buff, writer.sector, sectors);
+  }
+  *tableBytes = writer.tableBytes;
+  *checksum = writer.checksum;
+  return writer.status;
+}
+
+/*******************************************************************************
+* Description    : Adds the entry to the up-case table. Full buffer is written.
+* Input          : writer - the table writer
+*                  entry - the up-case character or the compression entry.
+* Output         : writer - the table writer.
+* Return         : None.
+*******************************************************************************/
+void putUpcaseEntry(UpcaseWriter *writer, WCHAR entry) {
+  BYTE *buff = formatBuffer;
+  if (writer->status != 0) {
+    return;
+  }
+  buff[writer->position] = entry & 0xFF;
+  buff[writer->position + 1] = entry >> 8;
+  writer->checksum = addChecksumByte(addChecksumByte(writer->checksum, entry & 0xFF), entry >> 8);
+  writer->position += 2;
+  writer->tableBytes += 2;
+  if (writer->position == FORMAT_BUFFER_SECTORS * STORAGE_BLOCK_SIZE) {
+    if (writer->isWritten) {
+      writer->status = writeFormatSectors(buff, writer->sector, FORMAT_BUFFER_SECTORS);
+    }
+    writer->sector += FORMAT_BUFFER_SECTORS;
+    writer->position = 0;
+  }
+}
+
+/*******************************************************************************
+* Description    : Writes sectors of the formatted partition. Sectors of the private
+*                    partition are encrypted by the partition key in place.
+* Input          : buff - data to write
+*                  sector - first partition sector
+*                  count - number of the sectors.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t writeFormatSectors(BYTE *buff, uint64_t sector, UINT count) {
+#if  CIPHER_MOD == 0
+  if (formatTarget.partition.partitionType == PRIVATE) {
+    encryptMemory(buff, formatTarget.xorKey, count * STORAGE_BLOCK_SIZE);
+  }
+#endif
+  if (writePartitionExtents(&formatTarget.partition, &formatTarget.extentIndex, buff, sector, count)
+      != BLOCK_DEVICE_OK) {
+    return 1;
+  }
+  deviceStatistics.formatSectors += count;
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Writes zero sectors to the formatted partition.
+* Input          : sector - first partition sector
+*                  count - number of the sectors.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t writeZeroSectors(uint64_t sector, uint64_t count) {
+  while (count != 0) {
+    UINT chunkSectors = count < FORMAT_BUFFER_SECTORS ? count : FORMAT_BUFFER_SECTORS;
+    memset(formatBuffer, 0, chunkSectors * STORAGE_BLOCK_SIZE);
+    if (writeFormatSectors(formatBuffer, sector, chunkSectors) != 0) {
+      return 1;
+    }
+    sector += chunkSectors;
+    count -= chunkSectors;
+  }
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Adds the byte to exFAT checksum of the boot region or the up-case table.
+* Input          : checksum - the checksum
+*                  value - the byte.
+* Output         : None.
+* Return         : The new checksum.
+*******************************************************************************/
+uint32_t addChecksumByte(uint32_t checksum, BYTE value) {
+  return ((checksum & 1) ? 0x80000000u : 0) + (checksum >> 1) + value;
+}
+
+/*******************************************************************************
+* Description    : Stores little-endian numbers of the file system structures.
+* Input          : value - the number.
+* Output         : buff - the number bytes.
+* Return         : None.
+*******************************************************************************/
+void storeWord(BYTE *buff, uint16_t value) {
+  buff[0] = value & 0xFF;
+  buff[1] = value >> 8;
+}
+
+void storeDword(BYTE *buff, uint32_t value) {
+  storeWord(buff, value & 0xFFFF);
+  storeWord(buff + 2, value >> 16);
+}
+
+void storeQword(BYTE *buff, uint64_t value) {
+  storeDword(buff, value & 0xFFFFFFFFu);
+  storeDword(buff + 4, value >> 32);
+}
@@ -0,0 +1,188 @@
+/**
+  ******************************************************************************
+  * @file           : READ_CACHE
+  * @version        : v1.0
+  * @brief          : This file implements the cache of the read-only partitions
+  ******************************************************************************
+  * MIT License
+  *
+  * Copyright (c) 2017 Oleksandr Borysov
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+ ******************************************************************************
+*/
+
+
+
+/* Includes ------------------------------------------------------------------*/
+#include "read_cache.h"
+#include "device_stats.h"
+#include <string.h>
+
+/* Private define ------------------------------------------------------------*/
+#define LINE_BYTES                       (READ_CACHE_LINE_SECTORS * STORAGE_BLOCK_SIZE)
+#define NO_LINE_SECTOR                   0xFFFFFFFFFFFFFFFFull
+
+/* Private typedef -----------------------------------------------------------*/
+// Aligned sectors of the logical unit
+typedef struct {
+   uint32_t data[LINE_BYTES / 4];                         // Decrypted sectors, word aligned for DMA
+   uint64_t firstSector;
+   uint32_t lastUse;                                      // Least recently used line is replaced
+   uint16_t sectorNumber;                                 // The last line of the logical unit can be shorter
+   uint8_t lun;
+   uint8_t isValid;
+} ReadCacheLine;
+
+/* Private variables ---------------------------------------------------------*/
+ReadCacheLine readCacheLines[READ_CACHE_LINES];
+uint32_t readCacheClock;
+uint64_t lastMissSectors[MAX_LUN_NUMBER];                 // Line after the last read line, the next miss there is sequential
+
+/* Private read cache function prototypes -----------------------------------------------*/
+ReadCacheLine* findCacheLine(uint8_t, uint64_t);
+ReadCacheLine* loadCacheLine(uint8_t, uint64_t, uint64_t, uint8_t (*)(BYTE, BYTE*, DWORD, UINT));
+
+/* Public read cache functions ---------------------------------------------------------*/
+
+/*******************************************************************************
+* Description    : Drops cached lines of the logical unit. The partition of the unit is switched.
+* Input          : lun - the logical unit.
+* Output         : None.
+* Return         : None.
+*******************************************************************************/
+void resetReadCache(uint8_t lun) {
+  for (uint8_t i = 0; i < READ_CACHE_LINES; ++i) {
+    if (readCacheLines[i].lun == lun) {
+      readCacheLines[i].isValid = 0;
+    }
+  }
+  lastMissSectors[lun] = NO_LINE_SECTOR;
+}
+
+/*******************************************************************************
+* Description    : Reads sectors of the read-only logical unit through the cache. The
+*                    miss reads the whole line, the miss right after the read lines
+*                    reads READ_AHEAD_LINES lines. Long read which starts at the missed
+*                    line reads its whole lines at once past the cache, the lines would
+*                    only split it in short card reads.
+* Input          : lun - the logical unit
+*                  sector - first sector of the logical unit
+*                  count - number of the sectors
+*                  lunSectors - size of the logical unit
+*                  loadSectors - reads and decrypts sectors of the logical unit.
+* Output         : buff - read data.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t readCachedSectors(uint8_t lun, BYTE *buff, uint64_t sector, UINT count, uint64_t lunSectors,
+    uint8_t (*loadSectors)(BYTE, BYTE*, DWORD, UINT)) {
+  while (count != 0) {
+    uint64_t lineSector = sector - sector % READ_CACHE_LINE_SECTORS;
+    ReadCacheLine *line = findCacheLine(lun, lineSector);
+    if ((line == NULL) && (sector == lineSector) && (count >= READ_CACHE_DIRECT_SECTORS)) {
+      UINT directLength = count - count % READ_CACHE_LINE_SECTORS;
+      if (loadSectors(lun, buff, sector, directLength) != 0) {
+        return 1;
+      }
+      deviceStatistics.readDirectSectors += directLength;
+      lastMissSectors[lun] = sector + directLength;         // Next short miss there reads ahead
+      buff += directLength * STORAGE_BLOCK_SIZE;
+      sector += directLength;
+      count -= directLength;
+      continue;
+    }
+    if (line != NULL) {
+      deviceStatistics.readCacheHits++;
+    } else {
+      uint8_t aheadLines = lineSector == lastMissSectors[lun] ? READ_AHEAD_LINES : 1;
+      deviceStatistics.readCacheMisses++;
+      if ((line = loadCacheLine(lun, lineSector, lunSectors, loadSectors)) == NULL) {
+        return 1;
+      }
+      lastMissSectors[lun] = lineSector + READ_CACHE_LINE_SECTORS;
+      for (uint8_t i = 1; (i < aheadLines) && (lastMissSectors[lun] < lunSectors); ++i) {
+        if ((findCacheLine(lun, lastMissSectors[lun]) == NULL)
+            && (loadCacheLine(lun, lastMissSectors[lun], lunSectors, loadSectors) == NULL)) {
+          break;                                              // Host reads the line itself
+        }
+        deviceStatistics.readAheadSectors += READ_CACHE_LINE_SECTORS;
+        lastMissSectors[lun] += READ_CACHE_LINE_SECTORS;
+      }
+    }
+    uint32_t offset = sector - lineSector;
+    UINT runLength = line->sectorNumber - offset < count ? line->sectorNumber - offset : count;
+    memcpy(buff, (BYTE*) line->data + offset * STORAGE_BLOCK_SIZE, runLength * STORAGE_BLOCK_SIZE);
+    buff += runLength * STORAGE_BLOCK_SIZE;
+    sector += runLength;
+    count -= runLength;
+  }
+  return 0;
+}
+
+/* Private read cache functions ---------------------------------------------------------*/
+
+/*******************************************************************************
+* Description    : Finds the cached line of the logical unit.
+* Input          : lun - the logical unit
+*                  lineSector - first sector of the line.
+* Output         : None.
+* Return         : The line or NULL if it is not cached.
+*******************************************************************************/
+ReadCacheLine* findCacheLine(uint8_t lun, uint64_t lineSector) {
+  for (uint8_t i = 0; i < READ_CACHE_LINES; ++i) {
+    if (readCacheLines[i].isValid && (readCacheLines[i].lun == lun) && (readCacheLines[i].firstSector == lineSector)) {
+      readCacheLines[i].lastUse = ++readCacheClock;
+      return &readCacheLines[i];
+    }
+  }
+  return NULL;
+}
+
+/*******************************************************************************
+* Description    : Reads the line to the least recently used line of the cache.
+* Input          : lun - the logical unit
+*                  lineSector - first sector of the line
+*                  lunSectors - size of the logical unit
+*                  loadSectors - reads and decrypts sectors of the logical unit.
+* Output         : None.
+* Return         : The line or NULL if it can't be read.
+*******************************************************************************/
+ReadCacheLine* loadCacheLine(uint8_t lun, uint64_t lineSector, uint64_t lunSectors,
+    uint8_t (*loadSectors)(BYTE, BYTE*, DWORD, UINT)) {
+  ReadCacheLine *line = &readCacheLines[0];
+  for (uint8_t i = 1; i < READ_CACHE_LINES; ++i) {
+    if (!line->isValid) {
+      break;
+    }
+    if (!readCacheLines[i].isValid || (readCacheLines[i].lastUse < line->lastUse)) {
+      line = &readCacheLines[i];
+    }
+  }
+  line->isValid = 0;
+  line->sectorNumber = lunSectors - lineSector < READ_CACHE_LINE_SECTORS
+      ? lunSectors - lineSector : READ_CACHE_LINE_SECTORS;
+  if (loadSectors(lun, (BYTE*) line->data, lineSector, line->sectorNumber) != 0) {
+    return NULL;
+  }
+  line->firstSector = lineSector;
+  line->lun = lun;
+  line->lastUse = ++readCacheClock;
+  line->isValid = 1;
+  return line;
+}
@@ -0,0 +1,913 @@
+/**
+  ******************************************************************************
+  * @file           : RELOCATION
+  * @version        : v1.0
+  * @brief          : This file implements the relocation of the partition data
+  ******************************************************************************
+  * MIT License
+  *
+  * Copyright (c) 2017 Oleksandr Borysov
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+ ******************************************************************************
+*/
+
+
+/* Includes ------------------------------------------------------------------*/
+#include "relocation.h"
+#include "partition_table.h"
+#include "wear_leveling.h"
+#include "task_scheduler.h"
+#include <string.h>
+
+/* Private typedef -----------------------------------------------------------*/
+// Copying of the partition piece from the old volume sectors to the new ones
+typedef struct {
+   uint64_t srcSector;
+   uint64_t dstSector;
+   uint64_t sectorNumber;
+   char oldKey[PART_KEY_LENGHT + 1];                      // Cipher key of the source data, empty for the public partition
+   char newKey[PART_KEY_LENGHT + 1];
+   uint8_t isTransformed;                                 // Data is encrypted again with the new key
+} RelocationMove;
+// Journal header, moves follow it in the next journal sectors
+typedef struct {
+   uint32_t magic;                                        // RELOCATION_MAGIC while moves are not finished
+   uint8_t newTable;                                      // Live table of the configurations which the moves were planned for
+   uint8_t oldTable;                                      // Old table is read to erase the freed memory at the end
+   uint16_t oldPartitionsNumber;
+   char oldRootKey[ROOT_KEY_LENGHT];
+   uint8_t moveNumber;
+   uint8_t currentMove;
+   uint64_t movedSectors;                                 // Copied sectors of the current move
+   uint64_t doneSectors;                                  // Copied sectors of all moves
+   uint64_t totalSectors;
+   uint8_t chunkSectors;                                  // Sectors of the chunk which is written in place, 0 if none
+   uint32_t chunkChecks[RELOCATION_CHUNK_SECTORS];        // Checksums of the chunk sectors written in place
+} RelocationJournal;
+// State of the relocation
+typedef struct {
+   RelocationJournal journal;
+   RelocationMove moves[MAX_RELOCATION_MOVES];
+   char rootKey[ROOT_KEY_LENGHT];                         // Key of the journal
+   uint8_t isActive;
+   uint8_t savedChunks;                                   // Chunks copied since the last journal update
+} Relocation;
+
+/* Private define ------------------------------------------------------------*/
+#define RELOCATION_MAGIC                 0x4D4F5645u    // "MOVE"
+#define CHECK_POLYNOMIAL                 0xEDB88320u    // CRC-32 of the sectors written in place
+#define KEY_STREAM_WORDS                 (STORAGE_BLOCK_SIZE / 4)
+
+/* Private variables ---------------------------------------------------------*/
+Relocation relocation;                                    // Moves of the last configurations update
+RelocationProgress relocationProgress;
+uint32_t relocationStartTime;                             // Tick when the copying started
+uint32_t chunkBuffer[RELOCATION_CHUNK_SECTORS * KEY_STREAM_WORDS];  // Copied chunk, word aligned for DMA
+uint32_t transformKey[KEY_STREAM_WORDS];                  // Old key stream XOR new key stream of the move
+int8_t transformKeyMove = NO_TRANSFORM_MOVE;              // Move of the transform key
+
+/* Private relocation function prototypes -----------------------------------------------*/
+uint8_t addPartitionMoves(const Partition*, const Partition*);
+uint8_t addMove(uint64_t, uint64_t, uint64_t, const Partition*, const Partition*, uint8_t);
+uint8_t orderMoves(void);
+uint8_t isRangesOverlap(uint64_t, uint64_t, uint64_t, uint64_t);
+uint8_t isMoveDescending(const RelocationMove*);
+uint32_t getChunkSectors(const RelocationMove*, uint64_t);
+void getPendingRange(uint8_t, uint8_t, uint64_t*, uint64_t*);
+uint8_t findMoveRange(uint64_t, UINT*, uint8_t);
+uint8_t forEachUncoveredRange(uint64_t, uint64_t, uint8_t, uint8_t (*)(uint64_t, uint64_t));
+uint8_t copyChunk(void);
+uint8_t completeChunkInPlace(void);
+uint8_t advanceMove(uint32_t, uint8_t);
+void setTransformKey(int8_t);
+uint32_t getSectorCheck(const BYTE*);
+uint8_t saveJournal(uint8_t);
+uint8_t loadJournal(void);
+uint64_t getJournalSector(void);
+
+/* Public relocation functions ---------------------------------------------------------*/
+
+/*******************************************************************************
+* Description    : Plans moves of the partition data to the new layout. Partitions
+*                    of the old table are found in the new table by the name index,
+*                    only their pieces which changed the place or the key are moved.
+* Input          : oldConf - previous device configurations.
+* Output         : None.
+* Return         : 0 if success or 1 if the moves don't fit the journal or can't be ordered.
+*******************************************************************************/
+uint8_t planRelocation(const PartitionsStructure *oldConf) {
+  Partition oldPart;
+  Partition newPart;
+  resetRelocation();
+  for (uint16_t i = 0; i < oldConf->partitionsNumber; ++i) {
+    if (readPartitionEntry(oldConf->activeTable, i, oldConf->rootKey, &oldPart) != 0) {
+      return 1;
+    }
+    if ((findPartitionEntry(oldPart.name, &newPart) >= 0) && (addPartitionMoves(&oldPart, &newPart) != 0)) {
+      return 1;
+    }
+  }
+  return orderMoves();
+}
+
+/*******************************************************************************
+* Description    : Drops the planned or unfinished moves from RAM.
+* Input          : None.
+* Output         : None.
+* Return         : None.
+*******************************************************************************/
+void resetRelocation(void) {
+  relocation.isActive = 0;                                // Host requests stop using the moves first
+  memset(&relocation, 0, sizeof(relocation));
+  transformKeyMove = NO_TRANSFORM_MOVE;
+  if (relocationProgress.status == RELOCATION_IN_PROGRESS) {
+    relocationProgress.status = RELOCATION_FAILED;        // Moves were abandoned
+  }
+}
+
+/*******************************************************************************
+* Description    : Writes the planned moves to the journal. The journal is written
+*                    even without moves, so the journal always belongs to the saved header.
+* Input          : oldConf - previous device configurations
+*                  newConf - new configurations which will be saved next.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t prepareRelocation(const PartitionsStructure *oldConf, const PartitionsStructure *newConf) {
+  RelocationJournal *journal = &relocation.journal;
+  strncpy(relocation.rootKey, newConf->rootKey, ROOT_KEY_LENGHT);
+  journal->magic = journal->moveNumber != 0 ? RELOCATION_MAGIC : 0;
+  journal->newTable = newConf->activeTable;
+  journal->oldTable = oldConf->activeTable;
+  journal->oldPartitionsNumber = oldConf->partitionsNumber;
+  strncpy(journal->oldRootKey, oldConf->rootKey, ROOT_KEY_LENGHT);
+  return saveJournal(RELOCATION_JOURNAL_SECTORS);
+}
+
+/*******************************************************************************
+* Description    : Starts serving the new layout through the pending moves. Called
+*                    when the logical units don't show the old layout anymore.
+* Input          : None.
+* Output         : None.
+* Return         : None.
+*******************************************************************************/
+void startRelocation(void) {
+  if (relocation.journal.moveNumber == 0) {
+    return;
+  }
+  relocationProgress.totalSectors = relocation.journal.totalSectors;
+  relocationProgress.movedSectors = 0;
+  relocationProgress.relocationTime = 0;
+  relocationProgress.moveNumber = relocation.journal.moveNumber;
+  relocationProgress.status = RELOCATION_IN_PROGRESS;
+  relocationStartTime = HAL_GetTick();
+  relocation.isActive = 1;
+}
+
+/*******************************************************************************
+* Description    : Continues the relocation which was interrupted by power loss.
+* Input          : conf - the loaded device configurations.
+* Output         : None.
+* Return         : 0 if success or 1 if the journal can't be read.
+*******************************************************************************/
+uint8_t resumeRelocation(const PartitionsStructure *conf) {
+  RelocationJournal *journal = &relocation.journal;
+  resetRelocation();
+  strncpy(relocation.rootKey, conf->rootKey, ROOT_KEY_LENGHT);
+  if (loadJournal() != 0) {
+    return 1;
+  }
+  if ((journal->magic != RELOCATION_MAGIC) || (journal->newTable != conf->activeTable)
+      || (journal->moveNumber > MAX_RELOCATION_MOVES) || (journal->currentMove > journal->moveNumber)
+      || (journal->chunkSectors > RELOCATION_CHUNK_SECTORS)) {
+    memset(journal, 0, sizeof(*journal));                 // Journal of the finished or not saved update
+    return 0;
+  }
+  startRelocation();
+  relocationProgress.movedSectors = journal->doneSectors;
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Copies chunks of the pending moves during the given time. The host
+*                    interrupt is masked while one chunk is copied, so the host never
+*                    sees the chunk half copied.
+* Input          : stepTime - copying time in ms.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t runRelocationStep(uint32_t stepTime) {
+  uint32_t stepStart = HAL_GetTick();
+  uint8_t res = 0;
+  while (relocation.isActive && !isRelocationFinished() && (res == 0) && (HAL_GetTick() - stepStart < stepTime)) {
+    holdHostRequests();
+    res = relocation.journal.chunkSectors != 0 ? completeChunkInPlace() : copyChunk();
+    releaseHostRequests();
+  }
+  relocationProgress.relocationTime = HAL_GetTick() - relocationStartTime;
+  relocationProgress.status = res == 0 ? RELOCATION_IN_PROGRESS : RELOCATION_FAILED;   // Failed step is retried
+  return res;
+}
+
+/*******************************************************************************
+* Description    : Checks the relocation to have moves which are served or copied.
+* Input          : None.
+* Output         : None.
+* Return         : True if the relocation is not finished.
+*******************************************************************************/
+uint8_t isRelocationActive(void) {
+  return relocation.isActive;
+}
+
+/*******************************************************************************
+* Description    : Checks all moves to be copied.
+* Input          : None.
+* Output         : None.
+* Return         : True if no data is left at the old place.
+*******************************************************************************/
+uint8_t isRelocationFinished(void) {
+  return relocation.journal.currentMove >= relocation.journal.moveNumber ? 1 : 0;
+}
+
+/*******************************************************************************
+* Description    : Gives the previous configurations to erase the memory they freed.
+* Input          : None.
+* Output         : oldConf - the previous configurations, only the table is set.
+* Return         : None.
+*******************************************************************************/
+void getRelocationOldConf(PartitionsStructure *oldConf) {
+  memset(oldConf, 0, sizeof(*oldConf));
+  oldConf->activeTable = relocation.journal.oldTable;
+  oldConf->partitionsNumber = relocation.journal.oldPartitionsNumber;
+  strncpy(oldConf->rootKey, relocation.journal.oldRootKey, ROOT_KEY_LENGHT);
+  oldConf->initializeStatus = INITIALIZED;
+}
+
+/*******************************************************************************
+* Description    : Ends the relocation and clears the journal.
+* Input          : None.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t finishRelocation(void) {
+  relocation.isActive = 0;
+  relocation.journal.magic = 0;
+  relocationProgress.relocationTime = HAL_GetTick() - relocationStartTime;
+  relocationProgress.status = RELOCATION_DONE;
+  return saveJournal(1);
+}
+
+/*******************************************************************************
+* Description    : Finds the place of the volume sector data during the relocation. Sectors
+*                    which moves didn't reach yet are read and written at the move source.
+*                    Sources which didn't become destinations stay blocked till the end
+*                    of the relocation, when they are erased.
+* Input          : sector - volume sector of the new layout
+*                  runLength - number of the sectors.
+* Output         : sector - volume sector which keeps the data
+*                  runLength - number of the sectors with the same state
+*                  transformMove - move which encrypts the data again or NO_TRANSFORM_MOVE.
+* Return         : SECTOR_DIRECT, SECTOR_RELOCATED or SECTOR_BLOCKED.
+*******************************************************************************/
+uint8_t lookupRelocatedSector(uint64_t *sector, UINT *runLength, int8_t *transformMove) {
+  uint64_t start;
+  uint64_t end;
+  *transformMove = NO_TRANSFORM_MOVE;
+  if (!relocation.isActive) {
+    return SECTOR_DIRECT;
+  }
+  for (uint8_t i = relocation.journal.currentMove; i < relocation.journal.moveNumber; ++i) {
+    getPendingRange(i, 0, &start, &end);
+    if ((*sector >= start) && (*sector < end)) {
+      *runLength = end - *sector < *runLength ? end - *sector : *runLength;
+      *sector = relocation.moves[i].srcSector + (*sector - relocation.moves[i].dstSector);
+      *transformMove = relocation.moves[i].isTransformed ? i : NO_TRANSFORM_MOVE;
+      return SECTOR_RELOCATED;
+    }
+    if ((start > *sector) && (start < *sector + *runLength)) {
+      *runLength = start - *sector;
+    }
+  }
+  if (findMoveRange(*sector, runLength, 0)) {               // Copied destination
+    return SECTOR_DIRECT;
+  }
+  return findMoveRange(*sector, runLength, 1) ? SECTOR_BLOCKED : SECTOR_DIRECT;
+}
+
+/*******************************************************************************
+* Description    : Encrypts data of the move source with the new partition key.
+*                    XOR of both key streams turns the old cipher text to the new one
+*                    and back.
+* Input          : buff - data of the sectors
+*                  move - the move or NO_TRANSFORM_MOVE
+*                  count - number of the sectors.
+* Output         : buff - transformed data.
+* Return         : None.
+*******************************************************************************/
+void transformRelocatedSectors(BYTE *buff, int8_t move, uint32_t count) {
+  if (move == NO_TRANSFORM_MOVE) {
+    return;
+  }
+  setTransformKey(move);
+  for (uint32_t i = 0; i < count * KEY_STREAM_WORDS; ++i) {
+    ((uint32_t*) buff)[i] ^= transformKey[i % KEY_STREAM_WORDS];
+  }
+}
+
+/*******************************************************************************
+* Description    : Reads volume sectors of the new layout. Sectors which are not
+*                    copied yet are read at the move source, blocked sectors read as zeros.
+* Input          : sector - first volume sector
+*                  count - number of the sectors.
+* Output         : buff - read data.
+* Return         : BLOCK_DEVICE_OK if success.
+*******************************************************************************/
+uint8_t readRelocatedSectors(BYTE *buff, uint64_t sector, UINT count) {
+  int8_t transformMove;
+  while (count != 0) {
+    uint64_t dataSector = sector;
+    UINT runLength = count;
+    if (lookupRelocatedSector(&dataSector, &runLength, &transformMove) == SECTOR_BLOCKED) {
+      memset(buff, 0, runLength * STORAGE_BLOCK_SIZE);      // Memory is not vacated by the relocation yet
+    } else if (wearReadSectors(buff, dataSector, runLength) != BLOCK_DEVICE_OK) {
+      return BLOCK_DEVICE_ERROR;
+    } else {
+      transformRelocatedSectors(buff, transformMove, runLength);
+    }
+    buff += runLength * STORAGE_BLOCK_SIZE;
+    sector += runLength;
+    count -= runLength;
+  }
+  return BLOCK_DEVICE_OK;
+}
+
+/*******************************************************************************
+* Description    : Writes volume sectors of the new layout. Sectors which are not
+*                    copied yet are written at the move source with the old key.
+* Input          : buff - data to write, it is encrypted again in place for the move source
+*                  sector - first volume sector
+*                  count - number of the sectors.
+* Output         : None.
+* Return         : BLOCK_DEVICE_OK if success or BLOCK_DEVICE_ERROR for the blocked sectors.
+*******************************************************************************/
+uint8_t writeRelocatedSectors(BYTE *buff, uint64_t sector, UINT count) {
+  int8_t transformMove;
+  while (count != 0) {
+    uint64_t dataSector = sector;
+    UINT runLength = count;
+    if (lookupRelocatedSector(&dataSector, &runLength, &transformMove) == SECTOR_BLOCKED) {
+      return BLOCK_DEVICE_ERROR;                              // Write would destroy data of the pending move
+    }
+    transformRelocatedSectors(buff, transformMove, runLength);
+    if (wearWriteSectors(buff, dataSector, runLength) != BLOCK_DEVICE_OK) {
+      return BLOCK_DEVICE_ERROR;
+    }
+    buff += runLength * STORAGE_BLOCK_SIZE;
+    sector += runLength;
+    count -= runLength;
+  }
+  return BLOCK_DEVICE_OK;
+}
+
+/*******************************************************************************
+* Description    : Reads stored sectors of the partition which is not visible.
+* Input          : partition - the partition
+*                  extentIndex - extent index of the partition
+*                  sector - first partition sector
+*                  count - number of the sectors.
+* Output         : buff - read data.
+* Return         : BLOCK_DEVICE_OK if success.
+*******************************************************************************/
+uint8_t readPartitionExtents(const Partition *partition, const ExtentIndex *extentIndex,
+    BYTE *buff, uint64_t sector, UINT count) {
+  UINT runLength;
+  while (count != 0) {
+    uint64_t volumeSector = translateExtentSector(partition, extentIndex, sector, &runLength);
+    runLength = runLength < count ? runLength : count;
+    if (readRelocatedSectors(buff, volumeSector, runLength) != BLOCK_DEVICE_OK) {
+      return BLOCK_DEVICE_ERROR;
+    }
+    buff += runLength * STORAGE_BLOCK_SIZE;
+    sector += runLength;
+    count -= runLength;
+  }
+  return BLOCK_DEVICE_OK;
+}
+
+/*******************************************************************************
+* Description    : Writes stored sectors of the partition which is not visible.
+* Input          : partition - the partition
+*                  extentIndex - extent index of the partition
+*                  buff - data to write
+*                  sector - first partition sector
+*                  count - number of the sectors.
+* Output         : None.
+* Return         : BLOCK_DEVICE_OK if success.
+*******************************************************************************/
+uint8_t writePartitionExtents(const Partition *partition, const ExtentIndex *extentIndex,
+    BYTE *buff, uint64_t sector, UINT count) {
+  UINT runLength;
+  while (count != 0) {
+    uint64_t volumeSector = translateExtentSector(partition, extentIndex, sector, &runLength);
+    runLength = runLength < count ? runLength : count;
+    if (writeRelocatedSectors(buff, volumeSector, runLength) != BLOCK_DEVICE_OK) {
+      return BLOCK_DEVICE_ERROR;
+    }
+    buff += runLength * STORAGE_BLOCK_SIZE;
+    sector += runLength;
+    count -= runLength;
+  }
+  return BLOCK_DEVICE_OK;
+}
+
+/*******************************************************************************
+* Description    : Walks parts of the sector range which are not sources of the moves.
+* Input          : sector - first volume sector
+*                  count - number of the sectors
+*                  action - function called for each sector range.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t forEachRangeOutsideMoves(uint64_t sector, uint64_t count, uint8_t (*action)(uint64_t, uint64_t)) {
+  return forEachUncoveredRange(sector, sector + count, 1, action);
+}
+
+/*******************************************************************************
+* Description    : Walks move sources which didn't become destinations of other moves.
+* Input          : usedSectors - sectors of the new layout, sources behind it are skipped
+*                  action - function called for each sector range.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t forEachVacatedRange(uint64_t usedSectors, uint8_t (*action)(uint64_t, uint64_t)) {
+  for (uint8_t i = 0; i < relocation.journal.moveNumber; ++i) {
+    uint64_t end = relocation.moves[i].srcSector + relocation.moves[i].sectorNumber;
+    if (forEachUncoveredRange(relocation.moves[i].srcSector, end < usedSectors ? end : usedSectors, 0, action) != 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Returns progress of the relocation.
+* Input          : None.
+* Output         : None.
+* Return         : Progress of the last relocation.
+*******************************************************************************/
+const RelocationProgress* getRelocationProgress(void) {
+  return &relocationProgress;
+}
+
+/* Private relocation functions ---------------------------------------------------------*/
+
+/*******************************************************************************
+* Description    : Adds moves of the partition data which is carried to the new layout.
+*                    Sectors are walked in pieces which are solid in both layouts.
+* Input          : oldPart - the partition of the old table
+*                  newPart - the partition with the same name in the new table.
+* Output         : None.
+* Return         : 0 if success or 1 if the moves don't fit the journal.
+*******************************************************************************/
+uint8_t addPartitionMoves(const Partition *oldPart, const Partition *newPart) {
+  uint64_t carriedSectors = oldPart->sectorNumber < newPart->sectorNumber ? oldPart->sectorNumber : newPart->sectorNumber;
+  uint64_t oldOffset = 0;
+  uint64_t newOffset = 0;
+  uint8_t i = 0;
+  uint8_t j = 0;
+  uint8_t isTransformed = 0;
+#if  CIPHER_MOD == 0
+  isTransformed = (oldPart->partitionType != newPart->partitionType)
+      || (strncmp(oldPart->key, newPart->key, PART_KEY_LENGHT) != 0) ? 1 : 0;
+#endif
+  while (carriedSectors != 0) {
+    uint64_t oldRest = oldPart->extents[i].sectorNumber - oldOffset;
+    uint64_t newRest = newPart->extents[j].sectorNumber - newOffset;
+    uint64_t run = oldRest < newRest ? oldRest : newRest;
+    run = run < carriedSectors ? run : carriedSectors;
+    uint64_t srcSector = oldPart->extents[i].startSector + oldOffset;
+    uint64_t dstSector = newPart->extents[j].startSector + newOffset;
+    if (((srcSector != dstSector) || isTransformed)
+        && (addMove(srcSector, dstSector, run, oldPart, newPart, isTransformed) != 0)) {
+      return 1;
+    }
+    carriedSectors -= run;
+    oldOffset += run;
+    newOffset += run;
+    if (oldOffset == oldPart->extents[i].sectorNumber) {
+      i++;
+      oldOffset = 0;
+    }
+    if (newOffset == newPart->extents[j].sectorNumber) {
+      j++;
+      newOffset = 0;
+    }
+  }
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Appends the move to the plan. Neighbour partitions shifted by the
+*                    same distance are joined to one move.
+* Input          : srcSector - first volume sector of the old place
+*                  dstSector - first volume sector of the new place
+*                  sectorNumber - number of the sectors
+*                  oldPart - the partition of the old table
+*                  newPart - the partition of the new table
+*                  isTransformed - 1 if the data is encrypted again.
+* Output         : None.
+* Return         : 0 if success or 1 if the plan is full.
+*******************************************************************************/
+uint8_t addMove(uint64_t srcSector, uint64_t dstSector, uint64_t sectorNumber,
+    const Partition *oldPart, const Partition *newPart, uint8_t isTransformed) {
+  RelocationJournal *journal = &relocation.journal;
+  RelocationMove *move;
+  journal->totalSectors += sectorNumber;
+  if (journal->moveNumber != 0) {
+    move = &relocation.moves[journal->moveNumber - 1];
+    if (!isTransformed && !move->isTransformed
+        && (move->srcSector + move->sectorNumber == srcSector)
+        && (move->dstSector + move->sectorNumber == dstSector)) {
+      move->sectorNumber += sectorNumber;
+      return 0;
+    }
+  }
+  if (journal->moveNumber >= MAX_RELOCATION_MOVES) {
+    return 1;
+  }
+  move = &relocation.moves[journal->moveNumber++];
+  memset(move, 0, sizeof(*move));
+  move->srcSector = srcSector;
+  move->dstSector = dstSector;
+  move->sectorNumber = sectorNumber;
+  move->isTransformed = isTransformed;
+  if (isTransformed && (oldPart->partitionType == PRIVATE)) {
+    strncpy(move->oldKey, oldPart->key, PART_KEY_LENGHT);
+  }
+  if (isTransformed && (newPart->partitionType == PRIVATE)) {
+    strncpy(move->newKey, newPart->key, PART_KEY_LENGHT);
+  }
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Orders moves so that no move overwrites the source of the move
+*                    which is not copied yet. The move can overlap its own source.
+* Input          : None.
+* Output         : None.
+* Return         : 0 if success or 1 if moves overwrite sources of each other in a cycle.
+*******************************************************************************/
+uint8_t orderMoves(void) {
+  RelocationMove *moves = relocation.moves;
+  uint8_t moveNumber = relocation.journal.moveNumber;
+  RelocationMove move;
+  for (uint8_t k = 0; k < moveNumber; ++k) {
+    uint8_t ready = moveNumber;
+    for (uint8_t p = k; (p < moveNumber) && (ready == moveNumber); ++p) {
+      ready = p;
+      for (uint8_t q = k; q < moveNumber; ++q) {
+        if ((q != p) && isRangesOverlap(moves[p].dstSector, moves[p].sectorNumber,
+            moves[q].srcSector, moves[q].sectorNumber)) {
+          ready = moveNumber;
+          break;
+        }
+      }
+    }
+    if (ready == moveNumber) {
+      return 1;
+    }
+    move = moves[k];
+    moves[k] = moves[ready];
+    moves[ready] = move;
+  }
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Checks two sector ranges to have common sectors.
+* Input          : firstStart - start of the first range
+*                  firstNumber - sectors of the first range
+*                  secondStart - start of the second range
+*                  secondNumber - sectors of the second range.
+* Output         : None.
+* Return         : True if the ranges overlap.
+*******************************************************************************/
+uint8_t isRangesOverlap(uint64_t firstStart, uint64_t firstNumber, uint64_t secondStart, uint64_t secondNumber) {
+  return (firstStart < secondStart + secondNumber) && (secondStart < firstStart + firstNumber) ? 1 : 0;
+}
+
+/*******************************************************************************
+* Description    : Checks the move to be copied from its end. The move to the higher
+*                    sectors would overwrite its own source if it was copied from the start.
+* Input          : move - the move.
+* Output         : None.
+* Return         : True if the move is copied from the end.
+*******************************************************************************/
+uint8_t isMoveDescending(const RelocationMove *move) {
+  return move->dstSector > move->srcSector ? 1 : 0;
+}
+
+/*******************************************************************************
+* Description    : Calculates size of the next chunk. Chunk of the move which overlaps
+*                    itself is not longer than the move distance, so the chunk never
+*                    overwrites its own source and can be copied again after power loss.
+* Input          : move - the move
+*                  restSectors - sectors of the move which are not copied yet.
+* Output         : None.
+* Return         : Number of the chunk sectors.
+*******************************************************************************/
+uint32_t getChunkSectors(const RelocationMove *move, uint64_t restSectors) {
+  uint64_t distance = isMoveDescending(move) ? move->dstSector - move->srcSector : move->srcSector - move->dstSector;
+  uint64_t chunkSectors = RELOCATION_CHUNK_SECTORS;
+  if ((distance != 0) && (distance < chunkSectors)) {
+    chunkSectors = distance;
+  }
+  return restSectors < chunkSectors ? restSectors : chunkSectors;
+}
+
+/*******************************************************************************
+* Description    : Calculates the part of the move which is not copied yet.
+* Input          : move - number of the move
+*                  isSource - 1 for the source sectors or 0 for the destination sectors.
+* Output         : start - first pending sector
+*                  end - sector after the last pending sector.
+* Return         : None.
+*******************************************************************************/
+void getPendingRange(uint8_t move, uint8_t isSource, uint64_t *start, uint64_t *end) {
+  const RelocationMove *pendingMove = &relocation.moves[move];
+  uint64_t firstSector = isSource ? pendingMove->srcSector : pendingMove->dstSector;
+  uint64_t movedSectors = move == relocation.journal.currentMove ? relocation.journal.movedSectors : 0;
+  if (isMoveDescending(pendingMove)) {
+    *start = firstSector;
+    *end = firstSector + pendingMove->sectorNumber - movedSectors;
+  } else {
+    *start = firstSector + movedSectors;
+    *end = firstSector + pendingMove->sectorNumber;
+  }
+}
+
+/*******************************************************************************
+* Description    : Finds the move source or destination which has the sector.
+* Input          : sector - volume sector
+*                  runLength - number of the sectors
+*                  isSource - 1 for the sources or 0 for the destinations.
+* Output         : runLength - number of the sectors with the same state.
+* Return         : True if a move has the sector.
+*******************************************************************************/
+uint8_t findMoveRange(uint64_t sector, UINT *runLength, uint8_t isSource) {
+  for (uint8_t i = 0; i < relocation.journal.moveNumber; ++i) {
+    uint64_t start = isSource ? relocation.moves[i].srcSector : relocation.moves[i].dstSector;
+    uint64_t end = start + relocation.moves[i].sectorNumber;
+    if ((sector >= start) && (sector < end)) {
+      *runLength = end - sector < *runLength ? end - sector : *runLength;
+      return 1;
+    }
+    if ((start > sector) && (start < sector + *runLength)) {
+      *runLength = start - sector;
+    }
+  }
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Walks parts of the sector range which no move source or destination covers.
+* Input          : start - first volume sector
+*                  end - sector after the range
+*                  isSource - 1 to skip the sources or 0 to skip the destinations
+*                  action - function called for each sector range.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t forEachUncoveredRange(uint64_t start, uint64_t end, uint8_t isSource, uint8_t (*action)(uint64_t, uint64_t)) {
+  while (start < end) {
+    uint64_t next = end;
+    uint8_t isCovered = 0;
+    for (uint8_t i = 0; i < relocation.journal.moveNumber; ++i) {
+      uint64_t rangeStart = isSource ? relocation.moves[i].srcSector : relocation.moves[i].dstSector;
+      uint64_t rangeEnd = rangeStart + relocation.moves[i].sectorNumber;
+      if ((start >= rangeStart) && (start < rangeEnd)) {
+        isCovered = 1;
+        next = rangeEnd < end ? rangeEnd : end;
+        break;
+      }
+      if ((rangeStart > start) && (rangeStart < next)) {
+        next = rangeStart;
+      }
+    }
+    if (!isCovered && (action(start, next - start) != 0)) {
+      return 1;
+    }
+    start = next;
+  }
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Copies the next chunk of the current move. Checksums of the chunk
+*                    which is written in place are journaled before the write.
+* Input          : None.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t copyChunk(void) {
+  RelocationJournal *journal = &relocation.journal;
+  const RelocationMove *move = &relocation.moves[journal->currentMove];
+  BYTE *chunk = (BYTE*) chunkBuffer;
+  uint64_t restSectors = move->sectorNumber - journal->movedSectors;
+  uint32_t chunkSectors = getChunkSectors(move, restSectors);
+  uint64_t offset = isMoveDescending(move) ? restSectors - chunkSectors : journal->movedSectors;
+  uint8_t isInPlace = move->srcSector == move->dstSector ? 1 : 0;
+  if (volumeReadSectors(chunk, move->srcSector + offset, chunkSectors) != BLOCK_DEVICE_OK) {
+    return 1;
+  }
+  transformRelocatedSectors(chunk, move->isTransformed ? journal->currentMove : NO_TRANSFORM_MOVE, chunkSectors);
+  if (isInPlace) {                                        // Source is lost by the write
+    for (uint32_t i = 0; i < chunkSectors; ++i) {
+      journal->chunkChecks[i] = getSectorCheck(chunk + i * STORAGE_BLOCK_SIZE);
+    }
+    journal->chunkSectors = chunkSectors;
+    if (saveJournal(1) != 0) {
+      journal->chunkSectors = 0;
+      return 1;
+    }
+  }
+  if (volumeWriteSectors(chunk, move->dstSector + offset, chunkSectors) != BLOCK_DEVICE_OK) {
+    return 1;                                             // Chunk in place is completed by the checksums
+  }
+  journal->chunkSectors = 0;
+  return advanceMove(chunkSectors, isRangesOverlap(move->srcSector, move->sectorNumber,
+      move->dstSector, move->sectorNumber));
+}
+
+/*******************************************************************************
+* Description    : Completes the chunk which was written in place when the power was lost.
+*                    Sectors which don't match the journaled checksums are written again.
+* Input          : None.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t completeChunkInPlace(void) {
+  RelocationJournal *journal = &relocation.journal;
+  const RelocationMove *move = &relocation.moves[journal->currentMove];
+  BYTE *sector = (BYTE*) chunkBuffer;
+  uint32_t chunkSectors = journal->chunkSectors;
+  for (uint32_t i = 0; i < chunkSectors; ++i) {
+    uint64_t volumeSector = move->dstSector + journal->movedSectors + i;
+    if (volumeReadSectors(sector, volumeSector, 1) != BLOCK_DEVICE_OK) {
+      return 1;
+    }
+    if (getSectorCheck(sector) != journal->chunkChecks[i]) {
+      transformRelocatedSectors(sector, journal->currentMove, 1);
+      if (volumeWriteSectors(sector, volumeSector, 1) != BLOCK_DEVICE_OK) {
+        return 1;
+      }
+    }
+  }
+  journal->chunkSectors = 0;
+  return advanceMove(chunkSectors, 1);
+}
+
+/*******************************************************************************
+* Description    : Counts the copied chunk and updates the journal. Chunks which can be
+*                    copied again from their intact source are journaled in groups,
+*                    the end of the move is always journaled before the next move starts.
+* Input          : chunkSectors - sectors of the copied chunk
+*                  isSaveNeeded - 1 to journal the chunk now.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t advanceMove(uint32_t chunkSectors, uint8_t isSaveNeeded) {
+  RelocationJournal *journal = &relocation.journal;
+  journal->movedSectors += chunkSectors;
+  journal->doneSectors += chunkSectors;
+  relocationProgress.movedSectors = journal->doneSectors;
+  relocation.savedChunks++;
+  if (journal->movedSectors == relocation.moves[journal->currentMove].sectorNumber) {
+    journal->currentMove++;
+    journal->movedSectors = 0;
+    isSaveNeeded = 1;
+  }
+  if (isSaveNeeded || (relocation.savedChunks >= RELOCATION_SAVE_CHUNKS)) {
+    relocation.savedChunks = 0;
+    return saveJournal(1);
+  }
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Prepares the transform key of the move.
+* Input          : move - number of the move.
+* Output         : None.
+* Return         : None.
+*******************************************************************************/
+void setTransformKey(int8_t move) {
+  uint32_t keyStream[KEY_STREAM_WORDS];
+  if (transformKeyMove == move) {
+    return;
+  }
+  createKeyWithSpecLength(relocation.moves[move].oldKey, (char*) transformKey, STORAGE_BLOCK_SIZE);
+  createKeyWithSpecLength(relocation.moves[move].newKey, (char*) keyStream, STORAGE_BLOCK_SIZE);
+  for (uint16_t i = 0; i < KEY_STREAM_WORDS; ++i) {
+    transformKey[i] ^= keyStream[i];
+  }
+  transformKeyMove = move;
+}
+
+/*******************************************************************************
+* Description    : Calculates CRC-32 of the sector.
+* Input          : sector - data of the sector.
+* Output         : None.
+* Return         : Checksum of the sector.
+*******************************************************************************/
+uint32_t getSectorCheck(const BYTE *sector) {
+  uint32_t check = 0xFFFFFFFFu;
+  for (uint16_t i = 0; i < STORAGE_BLOCK_SIZE; ++i) {
+    check ^= sector[i];
+    for (uint8_t bit = 0; bit < 8; ++bit) {
+      check = (check >> 1) ^ (CHECK_POLYNOMIAL & (0u - (check & 1)));
+    }
+  }
+  return ~check;
+}
+
+/*******************************************************************************
+* Description    : Encrypts and writes the first sectors of the journal. The first
+*                    sector is the journal header, moves follow it.
+* Input          : sectorNumber - number of the journal sectors to write.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t saveJournal(uint8_t sectorNumber) {
+  BYTE sector[STORAGE_BLOCK_SIZE];
+  for (uint8_t i = 0; i < sectorNumber; ++i) {
+    uint32_t offset = (i - 1) * STORAGE_BLOCK_SIZE;
+    memset(sector, 0, sizeof(sector));
+    if (i == 0) {
+      memcpy(sector, &relocation.journal, sizeof(relocation.journal));
+    } else if (offset < sizeof(relocation.moves)) {
+      uint32_t size = sizeof(relocation.moves) - offset;
+      memcpy(sector, (BYTE*) relocation.moves + offset, size < STORAGE_BLOCK_SIZE ? size : STORAGE_BLOCK_SIZE);
+    }
+#if  CIPHER_MOD == 0
+    encryptMemoryAES(sector, relocation.rootKey, sizeof(sector));
+#endif
+    if (cardWriteSectors(sector, getJournalSector() + i, 1) != MSD_OK) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Reads and decrypts the journal.
+* Input          : None.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t loadJournal(void) {
+  BYTE sector[STORAGE_BLOCK_SIZE];
+  for (uint8_t i = 0; i < RELOCATION_JOURNAL_SECTORS; ++i) {
+    uint32_t offset = (i - 1) * STORAGE_BLOCK_SIZE;
+    if (cardReadSectors(sector, getJournalSector() + i, 1) != MSD_OK) {
+      return 1;
+    }
+#if  CIPHER_MOD == 0
+    decryptMemoryAES(sector, relocation.rootKey, sizeof(sector));
+#endif
+    if (i == 0) {
+      memcpy(&relocation.journal, sector, sizeof(relocation.journal));
+    } else if (offset < sizeof(relocation.moves)) {
+      uint32_t size = sizeof(relocation.moves) - offset;
+      memcpy((BYTE*) relocation.moves + offset, sector, size < STORAGE_BLOCK_SIZE ? size : STORAGE_BLOCK_SIZE);
+    }
+  }
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Calculates the card sector of the journal. Journal follows
+*                    the partition tables at the end of the first card.
+* Input          : None.
+* Output         : None.
+* Return         : Sector of the first card.
+*******************************************************************************/
+uint64_t getJournalSector(void) {
+  return getConfSector() + CONF_HEADER_SECTORS + 2 * PART_TABLE_SECTORS;
+}
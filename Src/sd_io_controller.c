@@ -32,17 +32,99 @@
 
 /* Includes ------------------------------------------------------------------*/
 #include "sd_io_controller.h"
+#include "partition_table.h"
+#include "relocation.h"
+#include "clone_remap.h"
+#include "change_tracking.h"
+#include "quick_format.h"
+#include "compression.h"
+#include "wear_leveling.h"
+#include "read_cache.h"
+#include "work_arena.h"
+#include "task_scheduler.h"
+#include <stddef.h>
 #include <string.h>
 #include "ff_gen_drv.h"
 #include "usbd_storage_if.h"
 #include "aes.h"
+#include "device_stats.h"
 
 /* Private typedef -----------------------------------------------------------*/
+// Medium change of the logical unit, the host sees not ready medium before the partition is swapped
+typedef enum {
+  MEDIA_READY = 0,
+  MEDIA_CHANGE_STAGED,                                    // New partition waits for the host to see not ready medium
+  MEDIA_CHANGE_REPORTED                                   // Host saw not ready medium, partition is swapped on the next check
+} MediaState;
+// Partition exposed to the host as the logical unit
+typedef struct {
+   Partition partition;
+   ExtentIndex extentIndex;                               // Extents of the partition for the sector translation
+   char longPartXORkey[STORAGE_BLOCK_SIZE];               // The password key for XOR cipher
+   uint16_t partitionNumber;                              // Number of the partition in the partition table
+   uint8_t isOpen;
+   uint8_t isClone;                                       // Sectors are translated by the clone remap table
+   uint8_t isReadOnly;                                    // Clones share sectors of the partition
+   uint8_t isCompressed;                                  // Sectors are kept in the compressed chunks
+   uint8_t isCapacityKnown;                               // Size was taken from the boot sector of the file system
+   volatile MediaState mediaState;
+} LunContext;
+// Partition which replaces the partition of the logical unit after the medium change
+typedef struct {
+   Partition partition;
+   Partition source;                                      // Source of the clone partition
+   uint16_t partitionNumber;
+   uint8_t isOpen;                                        // 0 if the logical unit is closed by the change
+   uint8_t isReadOnly;
+   uint32_t stageTime;                                    // Tick when the change was requested
+} StagedPartition;
+// Sectors of the command unit which host writes are checked
+typedef struct {
+   SectorRange ranges[COMMAND_WATCH_RANGES];              // Root directory sectors
+   uint8_t rangeNumber;
+   uint8_t isOverflowed;                                  // Root directory doesn't fit the ranges, every write is checked
+   const FATFS *fs;                                       // Mounted file system of the unit, NULL if it isn't known
+   volatile uint8_t changes;                              // Changes written by the host since the last check
+   uint32_t changeTime;                                   // Tick of the first change since the last check
+} CommandWatch;
+// Stored configurations header, the valid slot with the highest sequence is live
+typedef struct {
+   PartitionsStructure conf;
+   uint32_t sequence;
+   uint32_t check;                                        // CRC-32 of the slot bytes before the check
+} ConfSlot;
+// Geometry of the default partition, the file system is not read to restore it
+typedef struct {
+   uint64_t volumeSectors;                                // Volume of the record, other cards don't use it
+   uint64_t sectorNumber;                                 // Capacity of the default partition
+   uint32_t check;                                        // CRC-32 of the record bytes before the check
+} BootRecord;
 
 /* Private define ------------------------------------------------------------*/
-/* Block Size in Bytes */
-#define STORAGE_BLOCK_SIZE               512
-#define STORAGE_LUN_NBR                  0  
+#define STORAGE_LUN_NBR                  COMMAND_LUN
+                                                        // Parts of the freed memory
+#define FREED_FRESH                      0x01           // New partitions and grown parts, erased before the host sees them
+#define FREED_VACATED                    0x02           // Memory left by the old layout, erased when the moves end
+#define NO_FRESH_PART                    -1             // Walked range is not fresh memory of a partition
+#define CONF_CHECK_POLYNOMIAL            0xEDB88320u    // CRC-32 of the header slot
+                                                        // Boot sector fields read for the file system size
+#define BOOT_SIGNATURE_OFFSET            510
+#define BOOT_SIGNATURE                   0xAA55
+#define MBR_FIRST_ENTRY_OFFSET           446            // Partition entry of the host partitioned medium
+#define MBR_ENTRY_START_OFFSET           8
+#define BPB_CLUSTER_SECTORS_OFFSET       13
+#define BPB_RESERVED_SECTORS_OFFSET      14
+#define BPB_FAT_NUMBER_OFFSET            16
+#define BPB_ROOT_ENTRIES_OFFSET          17
+#define BPB_SECTORS16_OFFSET             19
+#define BPB_FAT_SECTORS16_OFFSET         22
+#define BPB_SECTORS32_OFFSET             32
+#define BPB_FAT_SECTORS32_OFFSET         36
+#define EXFAT_NAME_OFFSET                3
+#define EXFAT_HEAP_OFFSET                88
+#define EXFAT_CLUSTER_COUNT_OFFSET       92
+#define EXFAT_CLUSTER_SHIFT_OFFSET       109
+#define DIR_ENTRY_BYTES                  32
 
 #define ECB                              1              // Enable both ECB
                                                         // Define length of AES encryption key
@@ -64,44 +146,107 @@
 
 /* Private variables ---------------------------------------------------------*/
 PartitionsStructure partitionsStructure;                  // Contains current device configurations
-char longPartXORkey[STORAGE_BLOCK_SIZE];                  // The password key for XOR cipher
+LunContext lunContexts[MAX_LUN_NUMBER];                   // Partitions visible to the host
+StagedPartition stagedPartitions[MAX_LUN_NUMBER];         // Partitions waiting for the medium change
+EraseProgress eraseProgress;                              // Progress of the last freed memory erasing
+uint32_t eraseStartTime;                                  // Tick when the freed memory erasing started
+PartitionsStructure eraseOldConf;                         // Configurations which had the freed memory
+uint8_t eraseParts;                                       // Parts of the freed memory being erased
+uint32_t eraseStepStart;                                  // Tick when the erase step started
+uint32_t eraseStepBatches;                                // Batches erased by the erase step
+uint64_t eraseWalkedSectors;                              // Freed sectors walked by the erase step
+uint8_t isEraseStepOver;                                  // Erase step stopped the walk, next step goes on
+int32_t walkedPartNumber;                                 // New partition of the walked fresh range
+int32_t erasingPartNumber;                                // New partition of the last erased fresh range
+uint8_t countedFreshParts[MAX_PART_NUMBER / 8];           // New partitions with fresh memory found by the count
+volatile uint8_t pendingFreshParts[MAX_PART_NUMBER / 8];  // Staged partitions wait till their fresh memory is erased
+uint32_t confSequence;                                    // Sequence of the live header slot, 0 if it isn't known
+uint64_t bootRecordSectors;                               // Capacity kept in the boot record, 0 if it is not valid
+CommandWatch commandWatch;                                // Host writes of the command unit which can change the command file
 /* Disk status */
 static volatile DSTATUS Stat = STA_NOINIT;
 
 extern HAL_SD_CardInfoTypedef SDCardInfo;
+extern SD_HandleTypeDef hsd;
 // Timer interrupt for the command file scan
 extern TIM_HandleTypeDef htim14;
 
 /* Private controller function prototypes -----------------------------------------------*/
 // Operations with current partition
-DWORD getPartitionSector(DWORD);
-uint8_t isPartitionContainsMemorySectors(DWORD, UINT);
-Partition* getPartition(void);
-void decryptMemoryAES(BYTE*, const char*, const uint32_t);
-void encryptMemoryAES(BYTE*, const char*, const uint32_t);
-void decryptMemory(BYTE*, const char*, const uint32_t);
-void encryptMemory(BYTE*, const char*, const uint32_t);
+uint64_t getPartitionSector(BYTE, DWORD, UINT*);
+uint8_t isPartitionContainsMemorySectors(BYTE, DWORD, UINT);
+uint8_t readPartitionSectors(BYTE, BYTE*, DWORD, UINT);
+uint8_t writePartitionSectors(BYTE, const BYTE*, DWORD, UINT);
+uint8_t loadLunSectors(BYTE, BYTE*, DWORD, UINT);
+void updateExtentIndex(BYTE);
+void setLunPartition(BYTE, uint16_t, const Partition*, const Partition*, uint8_t);
+void stageLunPartition(BYTE, uint16_t, const Partition*);
+void swapLunPartition(BYTE);
+void closeOtherLuns(void);
+uint8_t isLunOpen(BYTE);
+uint8_t isPartitionOnOtherLun(BYTE, uint16_t);
+uint8_t isCloneOnOtherLun(BYTE);
+Partition* getPartition(BYTE);
+uint64_t getLunSectorNumber(BYTE);
 void cipherXOR(BYTE*, const char*, const uint32_t);
-void createKeyWithSpecLength(const char*, char*, const uint16_t);
 uint8_t checkNewPartitionsStructure(const PartitionsStructure*);
+uint8_t isStripeGeometryActual(const StripeGeometry*);
 uint8_t saveConf(const PartitionsStructure*);
+uint32_t getConfCheck(const BYTE*, uint32_t);
+uint8_t applyConf(PartitionsStructure*, PartitionsStructure*, uint8_t);
+uint8_t forEachFreedRange(const PartitionsStructure*, const PartitionsStructure*, uint8_t, uint8_t (*)(uint64_t, uint64_t));
+uint8_t forEachFreshPartitionRange(const Partition*, uint64_t, uint8_t (*)(uint64_t, uint64_t));
+uint8_t countFreedRange(uint64_t, uint64_t);
+uint8_t eraseFreedRange(uint64_t, uint64_t);
+void startFreedErase(const PartitionsStructure*, uint8_t);
+void endFreedErase(EraseStatus);
+uint8_t isFreedEraseActive(void);
+uint8_t isFreshMemoryPending(uint16_t);
+uint8_t isStagedPartitionHeld(BYTE);
+uint8_t getFileSystemSectors(BYTE, uint64_t*);
+uint8_t loadBootRecord(uint64_t*);
+uint8_t saveBootRecord(uint64_t);
+uint64_t getBootRecordSector(void);
+void markCommandChanges(DWORD, UINT);
+void addCommandChanges(uint8_t);
+void countHostRequest(uint32_t);
+uint8_t getBootSectorSize(const BYTE*, uint64_t*);
+uint16_t loadWord(const BYTE*);
+uint32_t loadDword(const BYTE*);
 void resetTimerInerrupt(void);
 
 /* Private SD Card function prototypes -----------------------------------------------*/
+uint8_t cardEraseSectors(uint64_t, uint64_t);
+uint8_t sdCardStartRead(uint8_t*, uint64_t, uint32_t);
+uint8_t sdCardStartWrite(const uint8_t*, uint64_t, uint32_t);
+uint8_t sdCardWaitRead(void);
+uint8_t sdCardWaitWrite(void);
 DSTATUS SD_initialize (BYTE);
 DSTATUS SD_status (BYTE);
 DRESULT SD_read (BYTE, BYTE*, DWORD, UINT);
 DRESULT SD_write (BYTE, const BYTE*, DWORD, UINT);
 DRESULT SD_ioctl (BYTE, BYTE, void*);
+DRESULT fsRead (BYTE, BYTE*, DWORD, UINT);
+DRESULT fsWrite (BYTE, const BYTE*, DWORD, UINT);
   
-Diskio_drvTypeDef  SD_Driver =
+Diskio_drvTypeDef  SD_Driver =                            // FatFs of the device, host requests use SD_read/SD_write
 {
   SD_initialize,
   SD_status,
-  SD_read, 
-  SD_write,
+  fsRead, 
+  fsWrite,
   SD_ioctl,
 };
+// The SDIO card is the first device of the volume
+const BlockDevice sdCardDevice =
+{
+  sdCardStartRead,
+  sdCardStartWrite,
+  sdCardWaitRead,
+  sdCardWaitWrite,
+  cardEraseSectors,
+  getCardSectorNumber
+};
 
 /* SD card controller logic ---------------------------------------------------------*/
 
@@ -135,7 +280,7 @@ DSTATUS SD_status(BYTE lun) {
 
 /**
   * @brief  Reads Sector(s)
-  * @param  lun : not used
+  * @param  lun : logical unit of the partition
   * @param  *buff: Data buffer to store read data
   * @param  sector: Sector address (LBA)
   * @param  count: Number of sectors to read (1..128)
@@ -144,25 +289,41 @@ DSTATUS SD_status(BYTE lun) {
 DRESULT SD_read(BYTE lun, BYTE *buff, DWORD sector, UINT count) {
   DRESULT res = RES_ERROR;
   
-  DWORD shiftedSector = getPartitionSector(sector);
-  if (isPartitionContainsMemorySectors(shiftedSector, count)
-    && (BSP_SD_ReadBlocks_DMA((uint32_t*) buff, 
-          (uint64_t) (shiftedSector * STORAGE_BLOCK_SIZE), 
-          STORAGE_BLOCK_SIZE, count * SDCardInfo.CardBlockSize / STORAGE_BLOCK_SIZE) == MSD_OK)) {
-#if  CIPHER_MOD == 0
-    if (getPartition()->partitionType == PRIVATE) {
-      decryptMemory(buff, longPartXORkey, count * SDCardInfo.CardBlockSize);
+  if (!isPartitionContainsMemorySectors(lun, sector, count)) {
+    return res;
+  }
+  if (lunContexts[lun].isReadOnly) {                          // Sectors of the read-only partition never change
+    if (readCachedSectors(lun, buff, sector, count, getLunSectorNumber(lun), loadLunSectors) == 0) {
+      res = RES_OK;
     }
-#endif
+  } else if (loadLunSectors(lun, buff, sector, count) == 0) {
     res = RES_OK;
   }
   
   return res;
 }
 
+/**
+  * @brief  Reads Sector(s) for FatFs of the device. Host request can't start
+  *         the card transfer in the middle of it
+  * @param  lun : logical unit of the partition
+  * @param  *buff: Data buffer to store read data
+  * @param  sector: Sector address (LBA)
+  * @param  count: Number of sectors to read (1..128)
+  * @retval DRESULT: Operation result
+  */
+DRESULT fsRead(BYTE lun, BYTE *buff, DWORD sector, UINT count) {
+  DRESULT res;
+  deviceStatistics.fileSystemReads += count;
+  holdHostRequests();
+  res = SD_read(lun, buff, sector, count);
+  releaseHostRequests();
+  return res;
+}
+
 /**
   * @brief  Writes Sector(s)
-  * @param  lun : not used
+  * @param  lun : logical unit of the partition
   * @param  *buff: Data to be written
   * @param  sector: Sector address (LBA)
   * @param  count: Number of sectors to write (1..128)
@@ -172,27 +333,48 @@ DRESULT SD_read(BYTE lun, BYTE *buff, DWORD sector, UINT count) {
 DRESULT SD_write(BYTE lun, const BYTE *buff, DWORD sector, UINT count) {
   DRESULT res = RES_ERROR;
   
-  DWORD shiftedSector = getPartitionSector(sector);
+  if (!isPartitionContainsMemorySectors(lun, sector, count)) {
+    return res;
+  }
+  if (lunContexts[lun].isReadOnly) {
+    return RES_WRPRT;                                         // Read-only partition or clones share its sectors
+  }
+  if (markChangedSectors(lun, lunContexts[lun].partitionNumber, getPartition(lun), sector, count) != 0) {
+    return res;                                               // Export would miss the written sectors
+  }
 #if  CIPHER_MOD == 0
-  if (getPartition()->partitionType == PRIVATE) {
-    encryptMemory((BYTE*) buff, longPartXORkey, count * SDCardInfo.CardBlockSize);
+  if ((getPartition(lun)->partitionType == PRIVATE) && !lunContexts[lun].isCompressed) {
+    encryptMemory((BYTE*) buff, lunContexts[lun].longPartXORkey, count * STORAGE_BLOCK_SIZE);
   }
 #endif
-  if (isPartitionContainsMemorySectors(shiftedSector, count)
-    && (BSP_SD_WriteBlocks_DMA((uint32_t*) buff,
-          (uint64_t) (shiftedSector * STORAGE_BLOCK_SIZE), 
-          STORAGE_BLOCK_SIZE, count * SDCardInfo.CardBlockSize / STORAGE_BLOCK_SIZE) == MSD_OK)) {
-            
+  if (writePartitionSectors(lun, buff, sector, count) == BLOCK_DEVICE_OK) {
     res = RES_OK;
   }
   
   return res;
 }
+
+/**
+  * @brief  Writes Sector(s) for FatFs of the device
+  * @param  lun : logical unit of the partition
+  * @param  *buff: Data to be written
+  * @param  sector: Sector address (LBA)
+  * @param  count: Number of sectors to write (1..128)
+  * @retval DRESULT: Operation result
+  */
+DRESULT fsWrite(BYTE lun, const BYTE *buff, DWORD sector, UINT count) {
+  DRESULT res;
+  ++deviceStatistics.fileSystemWrites;
+  holdHostRequests();
+  res = SD_write(lun, buff, sector, count);
+  releaseHostRequests();
+  return res;
+}
 #endif /* _USE_WRITE == 1 */
 
 /**
   * @brief  I/O control operation
-  * @param  lun : not used
+  * @param  lun : logical unit of the partition
   * @param  cmd: Control code
   * @param  *buff: Buffer to send/receive control data
   * @retval DRESULT: Operation result
@@ -214,7 +396,7 @@ DRESULT SD_ioctl(BYTE lun, BYTE cmd, void *buff) {
   /* Get number of sectors on the disk (DWORD) */
   case GET_SECTOR_COUNT :
     //BSP_SD_GetCardInfo(&CardInfo);
-    *(DWORD*)buff = getPartition()->sectorNumber;
+    *(DWORD*)buff = (DWORD) getLunSectorNumber(lun);              // FatFs LBA is 32-bit (2 TB)
     res = RES_OK;
     break;
   
@@ -239,26 +421,40 @@ DRESULT SD_ioctl(BYTE lun, BYTE cmd, void *buff) {
 /* USB interface logic ---------------------------------------------------------*/
 
 /*******************************************************************************
-* Description    : Gets capacity of currently visible partition.
-* Input          : None.
+* Description    : Gets capacity of the visible partition.
+* Input          : lun - logical unit of the partition.
 * Output         : block_num - number of the memory blocks
 *                  block_size - size of the memory block.
 * Return         : 0 if success or error code.
 *******************************************************************************/
-int8_t currentPartitionCapacity(uint32_t *block_num, uint16_t *block_size) {
+int8_t currentPartitionCapacity(uint8_t lun, uint32_t *block_num, uint16_t *block_size) {
   resetTimerInerrupt();
   *block_size = STORAGE_BLOCK_SIZE;
-  if (partitionsStructure.initializeStatus == INITIALIZED) {
-    *block_num = getPartition()->sectorNumber;
+  if (!isLunOpen(lun)) {
+    return USBD_FAIL;
+  }
+  ++deviceStatistics.capacityQueryCount;
+  if (deviceStatistics.enumerationStartTime == 0) {
+    deviceStatistics.enumerationStartTime = HAL_GetTick();          // Host asks the capacity first on enumeration
+  }
+  if ((partitionsStructure.initializeStatus == INITIALIZED) || (lun != STORAGE_LUN_NBR)
+      || lunContexts[lun].isCapacityKnown) {
+    *block_num = (uint32_t) getLunSectorNumber(lun);
   } else {                                                           // If the configurations not initialized
-     FATFS *fs;
-     DWORD fre_clust;
-     if (f_getfree((TCHAR const*)SD_Path, &fre_clust, &fs) == FR_OK) {
-       *block_num = (fs->n_fatent - 2) * fs->csize;                  // Trying to get capacity by FatFs
-       getPartition()->sectorNumber = *block_num;
-       getPartition()->lastSector = *block_num - 1;
+     uint64_t sectorNumber;
+     uint32_t startStamp = getTimeStamp();
+     if (getFileSystemSectors(lun, &sectorNumber) == 0) {           // Trying to get capacity by the boot sector
+       deviceStatistics.capacityQueryTime = getElapsedMicros(startStamp);
+       *block_num = (uint32_t) sectorNumber;
+       getPartition(lun)->sectorNumber = sectorNumber;
+       getPartition(lun)->extents[0].sectorNumber = sectorNumber;
+       updateExtentIndex(lun);
+       lunContexts[lun].isCapacityKnown = 1;                         // Kept till the partition is replaced
+       if (sectorNumber != bootRecordSectors) {
+         saveBootRecord(sectorNumber);                               // Next start restores it without the read
+       }
      } else {
-       *block_num = SDCardInfo.CardCapacity / STORAGE_BLOCK_SIZE - 1;// Get capacity of SD card
+       *block_num = (uint32_t) getVolumeSectorNumber();             // Get capacity of SD card(s)
      }
   }
   return USBD_OK;
@@ -266,284 +462,1556 @@ int8_t currentPartitionCapacity(uint32_t *block_num, uint16_t *block_size) {
 
 /*******************************************************************************
 * Description    : Reads data from the storage.
-* Input          : sector - start address of the memory
+* Input          : lun - logical unit of the partition
+*                  sector - start address of the memory
 *                  count - number of the memory blocks to read.
 * Output         : buff - a part of the memory.
 * Return         : 0 if success or error code.
 *******************************************************************************/
-int8_t currentPartitionRead(BYTE *buff, DWORD sector, UINT count) {
+int8_t currentPartitionRead(uint8_t lun, BYTE *buff, DWORD sector, UINT count) {
+  DRESULT res;
+  uint32_t startStamp = getTimeStamp();
   resetTimerInerrupt();                                              // Reset Timer for the command file scan
-  return SD_read(STORAGE_LUN_NBR, buff, sector, count);
+  if (!isLunOpen(lun)) {
+    return USBD_FAIL;
+  }
+  res = SD_read(lun, buff, sector, count);
+  countHostRequest(getElapsedMicros(startStamp));
+  return res;
 }
 
 /*******************************************************************************
 * Description    : Writes data from the storage.
-* Input          : sector - start address of the memory
+* Input          : lun - logical unit of the partition
+*                  sector - start address of the memory
 *                  count - number of the memory blocks to write
 *                  buff - memory to write.
 * Output         : None.
 * Return         : 0 if success or error code.
 *******************************************************************************/
-int8_t currentPartitionWrite(BYTE *buff, DWORD sector, UINT count) {
+int8_t currentPartitionWrite(uint8_t lun, BYTE *buff, DWORD sector, UINT count) {
+  DRESULT res;
+  uint32_t startStamp = getTimeStamp();
   resetTimerInerrupt();                                            // Reset Timer for the command file scan
-  return SD_write(STORAGE_LUN_NBR, buff, sector, count);
+  if (!isLunOpen(lun)) {
+    return USBD_FAIL;
+  }
+  res = SD_write(lun, buff, sector, count);
+  if ((res == RES_OK) && (lun == COMMAND_LUN)) {
+    markCommandChanges(sector, count);                             // Command file is looked up only after such writes
+  }
+  countHostRequest(getElapsedMicros(startStamp));
+  return res;
 }
 
 /*******************************************************************************
 * Description    : Initializes current partition.
-* Input          : None.
+* Input          : lun - logical unit of the partition.
 * Output         : None.
 * Return         : 0.
 *******************************************************************************/
-int8_t currentPartitionInit(void) {
+int8_t currentPartitionInit(uint8_t lun) {
   resetTimerInerrupt();                                           // Reset Timer for the command file scan
   return USBD_OK;
 }
 
 /*******************************************************************************
-* Description    : Returns the partition status.
-* Input          : None.
+* Description    : Returns the partition status. Logical units without partition
+*                    report that medium is not present. The check starts each SCSI
+*                    command, so the staged partition is swapped between commands
+*                    after the host was told once that the medium is not ready.
+* Input          : lun - logical unit of the partition.
 * Output         : None.
-* Return         : 0.
+* Return         : 0 if the partition is open or error code.
 *******************************************************************************/
-int8_t currentPartitionisReady(void) {
+int8_t currentPartitionisReady(uint8_t lun) {
   resetTimerInerrupt();                                          // Reset Timer for the command file scan
-  return USBD_OK;
+  if (lun >= MAX_LUN_NUMBER) {
+    return USBD_FAIL;
+  }
+  switch (lunContexts[lun].mediaState) {
+    case MEDIA_CHANGE_STAGED: {                                  // Host drops cached data of the old partition
+      lunContexts[lun].mediaState = MEDIA_CHANGE_REPORTED;
+      return USBD_FAIL;
+    }
+    case MEDIA_CHANGE_REPORTED: {
+      if (isStagedPartitionHeld(lun)) {
+        return USBD_FAIL;                                        // Memory of the partition is erased or formatted
+      }
+      swapLunPartition(lun);
+      break;
+    }
+    default: {
+      // do nothing
+    }
+  }
+  return isLunOpen(lun) ? USBD_OK : USBD_FAIL;
 }
 
 /*******************************************************************************
-* Description    : Returns the partition protection status.
-* Input          : None.
+* Description    : Returns the partition protection status. Partition which sectors
+*                    are shared by clones is read only.
+* Input          : lun - logical unit of the partition.
 * Output         : None.
-* Return         : 0.
+* Return         : 0 if the partition is writable or error code.
 *******************************************************************************/
-int8_t currentPartitionIsWriteProtected(void) {
+int8_t currentPartitionIsWriteProtected(uint8_t lun) {
   resetTimerInerrupt();                                         // Reset Timer for the command file scan
-  return USBD_OK;
+  return isLunOpen(lun) && lunContexts[lun].isReadOnly ? USBD_FAIL : USBD_OK;
 }
   
 /*******************************************************************************
 * Description    : Returns the number of LUN.
 * Input          : None.
 * Output         : None.
-* Return         : 0.
+* Return         : The last logical unit.
 *******************************************************************************/
 int8_t currentPartitionMaxLun(void) {
   resetTimerInerrupt();                                        // Reset Timer for the command file scan
-  return STORAGE_LUN_NBR;
+  return MAX_LUN_NUMBER - 1;
 }
 //-------------------------------------------------------------------------------------------------
 // Controller partition logic
 
 /*******************************************************************************
 * Description    : Init SD Card and initialized the device with default configuration.
+*                    USB is started before it, logical units report that medium is
+*                    not present till the command unit is opened at the end.
 * Input          : None.
 * Output         : None.
 * Return         : 0 id success or 1 if not.
 *******************************************************************************/
 DSTATUS initSDCard(void) {
   DSTATUS res = RES_ERROR;
+  uint64_t sectorNumber;
+  initTimeMeasure();
   if (SD_initialize(STORAGE_LUN_NBR) == RES_OK) {
+    initVolume(&sdCardDevice, STRIPE_UNIT_SECTORS, STORAGE_SECTOR_NUMBER + WEAR_POOL_SECTORS);   // Other cards are
+                                                              // registered by the board code, the configurations and
+                                                              // the hot sector pool are kept at the end of the SD card
+    if (initWearPool() != 0) {
+      return res;                                             // Hot sectors in the pool would be read stale
+    }
                                                               // Default configuration
     partitionsStructure.partitionsNumber = 1;
     partitionsStructure.currPartitionNumber = 0;
-    strcpy(getPartition()->name, "partDefault");
-    getPartition()->startSector = 0x0;
-    getPartition()->lastSector = SDCardInfo.CardCapacity / STORAGE_BLOCK_SIZE - STORAGE_SECTOR_NUMBER - 2;
-    getPartition()->sectorNumber = getPartition()->lastSector + 1;
+    strcpy(getPartition(STORAGE_LUN_NBR)->name, "partDefault");
+    getPartition(STORAGE_LUN_NBR)->extentNumber = 1;
+    getPartition(STORAGE_LUN_NBR)->extents[0].startSector = 0x0;
+    getPartition(STORAGE_LUN_NBR)->extents[0].sectorNumber = getVolumeSectorNumber() - 1;
+    if (loadBootRecord(&sectorNumber) == 0) {                 // Capacity is known before the host asks it
+      getPartition(STORAGE_LUN_NBR)->extents[0].sectorNumber = sectorNumber;
+      lunContexts[STORAGE_LUN_NBR].isCapacityKnown = 1;
+      deviceStatistics.isBootRecordUsed = 1;
+    }
+    getPartition(STORAGE_LUN_NBR)->sectorNumber = getPartition(STORAGE_LUN_NBR)->extents[0].sectorNumber;
+    updateExtentIndex(STORAGE_LUN_NBR);
+    __disable_irq();                                          // USB interrupt sees the unit only when it is built
+    lunContexts[STORAGE_LUN_NBR].isOpen = 1;                  // Other logical units are opened by ChangePart
+    __enable_irq();
     res = RES_OK;
   }
+  deviceStatistics.cardInitTime = HAL_GetTick();
   return res;
 }
 
 /*******************************************************************************
-* Description    : Switch current visible partition to another.
-* Input          : partName - name of the partition that will set to be visible
+* Description    : Switch visible partition of the logical unit to another. The partition is
+*                    found by the name index of the partition table. Partition can be
+*                    visible only through one logical unit.
+* Input          : lun - logical unit of the partition
+*                  partName - name of the partition that will set to be visible
 *                  partKey - the partition key.
 * Output         : None.
 * Return         : 0 id success or 1 if not.
 *******************************************************************************/
-uint8_t changePartition(const char *partName, const char *partKey) {
-  uint8_t res = 1;
-  for (uint8_t partNmb = 0; partNmb < partitionsStructure.partitionsNumber; ++partNmb) {
-    if ((strncmp(partName, partitionsStructure.partitions[partNmb].name, PART_NAME_LENGHT) == 0)
-        && ((partitionsStructure.partitions[partNmb].partitionType == PUBLIC)
-            || (strncmp(partKey, partitionsStructure.partitions[partNmb].key, PART_KEY_LENGHT) == 0))) {
-      partitionsStructure.currPartitionNumber = partNmb;
-#if  CIPHER_MOD == 0
-      createKeyWithSpecLength(getPartition()->key, longPartXORkey, STORAGE_BLOCK_SIZE);
-#endif
-      res = 0;
-      break;
+uint8_t changePartition(uint8_t lun, const char *partName, const char *partKey) {
+  Partition partition;
+  int32_t partNmb = findPartitionEntry(partName, &partition);
+  if ((lun >= MAX_LUN_NUMBER) || (partNmb < 0)
+      || ((partition.partitionType != PUBLIC)
+          && (strncmp(partKey, partition.key, PART_KEY_LENGHT) != 0))) {
+    return 1;
+  }
+  if (isPartitionOnOtherLun(lun, partNmb)) {
+    return 1;                                                 // Two logical units would corrupt file system
+  }
+  if (isClonePartition(&partition) && isCloneOnOtherLun(lun)) {
+    return 1;                                                 // Remap table is kept for one clone
+  }
+  if (partition.isReadOnly && (lun == COMMAND_LUN)) {
+    return 1;                                                 // Device writes the command results to the unit
+  }
+  if (lun == STORAGE_LUN_NBR) {
+    partitionsStructure.currPartitionNumber = partNmb;
+  }
+  stageLunPartition(lun, partNmb, &partition);
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Makes the host to read the partition of the logical unit again
+*                    through the medium change.
+* Input          : lun - the logical unit.
+* Output         : None.
+* Return         : None.
+*******************************************************************************/
+void notifyMediaChange(uint8_t lun) {
+  if (isLunOpen(lun) && (lunContexts[lun].mediaState == MEDIA_READY)) {
+    stageLunPartition(lun, lunContexts[lun].partitionNumber, getPartition(lun));
+  }
+}
+
+/*******************************************************************************
+* Description    : Swaps all staged partitions without waiting for the host.
+*                    Uses when no host is connected to see the medium change. Partitions
+*                    which are erased or formatted yet stay staged.
+* Input          : None.
+* Output         : None.
+* Return         : None.
+*******************************************************************************/
+void completeMediaChange(void) {
+  for (uint8_t i = 0; i < MAX_LUN_NUMBER; ++i) {
+    if ((lunContexts[i].mediaState != MEDIA_READY) && !isStagedPartitionHeld(i)) {
+      swapLunPartition(i);
     }
   }
-  return res;
 }
 
 /*******************************************************************************
-* Description    : Sets new configurations to the device configuration.
+* Description    : Checks the logical unit to have no pending medium change.
+* Input          : lun - the logical unit.
+* Output         : None.
+* Return         : True if the partition of the logical unit is not going to change.
+*******************************************************************************/
+uint8_t isLunReady(uint8_t lun) {
+  return (lun < MAX_LUN_NUMBER) && (lunContexts[lun].mediaState == MEDIA_READY) ? 1 : 0;
+}
+
+/*******************************************************************************
+* Description    : Returns the partition visible through the logical unit.
+* Input          : lun - the logical unit.
+* Output         : None.
+* Return         : The partition or NULL if the logical unit has no partition.
+*******************************************************************************/
+const Partition* getLunPartition(uint8_t lun) {
+  return isLunOpen(lun) ? getPartition(lun) : NULL;
+}
+
+/*******************************************************************************
+* Description    : Checks the partition to be visible or staged on some logical unit.
+*                    Partitions which the host was told to drop and staged partitions
+*                    which wait for the erase or the format are not counted.
+* Input          : partNumber - number of the partition in the live table.
+* Output         : None.
+* Return         : True if the host sees the partition or will see it.
+*******************************************************************************/
+uint8_t isPartitionShown(uint16_t partNumber) {
+  for (uint8_t i = 0; i < MAX_LUN_NUMBER; ++i) {
+    if ((lunContexts[i].isOpen && (lunContexts[i].mediaState == MEDIA_READY)
+            && (lunContexts[i].partitionNumber == partNumber))
+        || ((lunContexts[i].mediaState != MEDIA_READY) && stagedPartitions[i].isOpen
+            && (stagedPartitions[i].partitionNumber == partNumber) && !isStagedPartitionHeld(i))) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Starts new configurations. The new partition table is written
+*                    beside the live one, partitions are added by addConfPartition.
+* Input          : oldConf - current device configurations
+*                  newConf - new configurations with keys.
+* Output         : newConf - new configurations without partitions.
+* Return         : None.
+*******************************************************************************/
+void beginConf(const PartitionsStructure *oldConf, PartitionsStructure *newConf) {
+  newConf->activeTable = oldConf->initializeStatus == INITIALIZED ? oldConf->activeTable ^ 1 : 0;
+  newConf->partitionsNumber = 0;
+  resetFormatRequests();
+  beginPartitionTable(newConf->activeTable, newConf->rootKey);
+}
+
+/*******************************************************************************
+* Description    : Adds the next partition to the new configurations.
+* Input          : partition - the partition with size and requested number of extents.
+* Output         : None.
+* Return         : 0 id success or 1 if not.
+*******************************************************************************/
+uint8_t addConfPartition(Partition *partition) {
+  if (isRelocationActive() || isFreedEraseActive()) {
+    return 1;                                                 // Table which is not live is the relocation or erase source
+  }
+  prepareClonePartition(partition);
+  return addPartitionEntry(partition);
+}
+
+/*******************************************************************************
+* Description    : Sets new configurations to the device configuration. Data of the partitions
+*                    which keep their names is moved to the new layout in background.
 * Input          : oldConf - name of the device configuration structure
 *                  newConf - name of the new configuration for the device.
 * Output         : None.
 * Return         : 0 id success or 1 if not.
 *******************************************************************************/
-uint8_t setConf(PartitionsStructure *oldConf, const PartitionsStructure *newConf) {
-  uint8_t res = checkNewPartitionsStructure(newConf);
-  if (res == 0) {
-    *oldConf = *newConf;
-    oldConf->initializeStatus = INITIALIZED;
-    res = saveConf(oldConf);
+uint8_t setConf(PartitionsStructure *oldConf, PartitionsStructure *newConf) {
+  if (isRelocationActive() || isFreedEraseActive()) {
+    return 1;                                                 // Data of the previous update is still moved or erased
   }
-  return res;
+  return applyConf(oldConf, newConf, 1);
+}
+
+/*******************************************************************************
+* Description    : Reads the partition of the device configurations.
+* Input          : conf - the device configurations
+*                  number - number of the partition.
+* Output         : partition - the partition configurations.
+* Return         : 0 id success or 1 if not.
+*******************************************************************************/
+uint8_t getConfPartition(const PartitionsStructure *conf, uint16_t number, Partition *partition) {
+  if (number >= conf->partitionsNumber) {
+    return 1;
+  }
+  return readPartitionEntry(conf->activeTable, number, conf->rootKey, partition);
+}
+
+/*******************************************************************************
+* Description    : Returns progress of the freed memory erasing.
+* Input          : None.
+* Output         : None.
+* Return         : Progress of the last erasing.
+*******************************************************************************/
+const EraseProgress* getEraseProgress(void) {
+  return &eraseProgress;
+}
+
+/*******************************************************************************
+* Description    : Continues erasing memory freed by the configurations update. The freed
+*                    ranges are walked again from the start, the erased sectors are skipped.
+*                    When the erase ends, memory left by the moves is given to the host.
+* Input          : None.
+* Output         : None.
+* Return         : None.
+*******************************************************************************/
+void continueFreedErase(void) {
+  uint8_t res;
+  if (!isFreedEraseActive()) {
+    return;
+  }
+  eraseStepStart = HAL_GetTick();
+  eraseStepBatches = 0;
+  eraseWalkedSectors = 0;
+  erasingPartNumber = NO_FRESH_PART;
+  isEraseStepOver = 0;
+  res = forEachFreedRange(&eraseOldConf, &partitionsStructure, eraseParts, eraseFreedRange);
+  eraseProgress.eraseTime = HAL_GetTick() - eraseStartTime;
+  if (isEraseStepOver) {
+    return;
+  }
+  endFreedErase(res == 0 ? ERASE_DONE : ERASE_FAILED);
+  if ((eraseParts & FREED_VACATED) && isRelocationActive()) {
+    finishRelocation();
+  }
+}
+
+/*******************************************************************************
+* Description    : Formats the requested partitions in the idle time when no data
+*                    is left to move or erase.
+* Input          : None.
+* Output         : None.
+* Return         : None.
+*******************************************************************************/
+void continueFormats(void) {
+  if (!isFreedEraseActive() && !isRelocationActive()) {
+    formatRequestedPartitions();
+  }
+}
+
+/*******************************************************************************
+* Description    : Continues moving data of the partitions after the configurations update.
+*                    Moves wait for the erase of the fresh memory. Memory left by the moves
+*                    is erased when all moves are copied, then the relocation ends.
+* Input          : None.
+* Output         : None.
+* Return         : None.
+*******************************************************************************/
+void continueRelocation(void) {
+  PartitionsStructure oldConf;
+  if (isFreedEraseActive() || !isRelocationActive() || (runRelocationStep(RELOCATION_STEP_TIME) != 0)
+      || !isRelocationFinished()) {
+    return;
+  }
+  getRelocationOldConf(&oldConf);
+  startFreedErase(&oldConf, FREED_VACATED);                   // Vacated memory stays blocked for the host
+}
+
+/*******************************************************************************
+* Description    : Starts watching host writes of the command unit again. Areas of
+*                    the file system are taken from its mount, the root directory
+*                    is added by the scan.
+* Input          : fs - the mounted file system, NULL if it is not known, then every
+*                    write changes the volume.
+* Output         : None.
+* Return         : None.
+*******************************************************************************/
+void resetCommandWatch(const FATFS *fs) {
+  __disable_irq();                                            // USB interrupt checks the ranges
+  commandWatch.rangeNumber = 0;
+  commandWatch.isOverflowed = 0;
+  commandWatch.fs = fs;
+  __enable_irq();
+}
+
+/*******************************************************************************
+* Description    : Adds sectors of the root directory to the watched ranges.
+*                    Directory is added in its order, so the range is merged with
+*                    the last one when they touch.
+* Input          : sector - first sector of the command unit
+*                  count - number of the sectors.
+* Output         : None.
+* Return         : None.
+*******************************************************************************/
+void addCommandWatch(uint32_t sector, uint32_t count) {
+  SectorRange *last = &commandWatch.ranges[commandWatch.rangeNumber != 0 ? commandWatch.rangeNumber - 1 : 0];
+  __disable_irq();
+  if ((commandWatch.rangeNumber != 0) && (sector >= last->startSector)
+      && (sector <= last->startSector + last->sectorNumber)) {
+    if (sector + count > last->startSector + last->sectorNumber) {
+      last->sectorNumber = sector + count - last->startSector;
+    }
+  } else if (commandWatch.rangeNumber < COMMAND_WATCH_RANGES) {
+    commandWatch.ranges[commandWatch.rangeNumber].startSector = sector;
+    commandWatch.ranges[commandWatch.rangeNumber].sectorNumber = count;
+    ++commandWatch.rangeNumber;
+  } else {
+    commandWatch.isOverflowed = 1;
+  }
+  __enable_irq();
+}
+
+/*******************************************************************************
+* Description    : Takes changes written by the host since the last call.
+* Input          : None.
+* Output         : changeTime - tick of the first change.
+* Return         : COMMAND_CHANGE_* flags or 0 if the host didn't write the watched sectors.
+*******************************************************************************/
+uint8_t takeCommandChanges(uint32_t *changeTime) {
+  uint8_t changes;
+  __disable_irq();
+  changes = commandWatch.changes;
+  *changeTime = commandWatch.changeTime;
+  commandWatch.changes = 0;
+  __enable_irq();
+  return changes;
 }
 
 /* Private controller functions ---------------------------------------------------------*/
 
 /*******************************************************************************
-* Description    : Saves configuration to the storage.
+* Description    : Marks changes of the command file written by the host.
+* Input          : sector - first written sector of the command unit
+*                  count - number of the sectors.
+* Output         : None.
+* Return         : None.
+*******************************************************************************/
+void markCommandChanges(DWORD sector, UINT count) {
+  const FATFS *fs = commandWatch.fs;
+  uint8_t changes = 0;
+  if (fs == NULL) {
+    addCommandChanges(COMMAND_CHANGE_VOLUME);
+    return;
+  }
+  for (uint8_t i = 0; (i < commandWatch.rangeNumber) && (changes == 0); ++i) {
+    if ((sector < commandWatch.ranges[i].startSector + commandWatch.ranges[i].sectorNumber)
+        && (sector + count > commandWatch.ranges[i].startSector)) {
+      changes = COMMAND_CHANGE_ENTRY;
+    }
+  }
+  if ((changes == 0) && commandWatch.isOverflowed) {
+    changes = COMMAND_CHANGE_ENTRY;
+  }
+  if (sector < fs->fatbase) {
+    changes |= COMMAND_CHANGE_VOLUME;                         // Boot sector, FSInfo or the partition table
+  } else if ((changes == 0) && (sector < fs->database)) {
+    changes |= COMMAND_CHANGE_LAYOUT;
+  }
+  if ((fs->winsect >= sector) && (fs->winsect - sector < count)) {
+    changes |= COMMAND_CHANGE_WINDOW;
+  }
+  addCommandChanges(changes);
+}
+
+/*******************************************************************************
+* Description    : Adds changes of the command unit and posts the command task.
+* Input          : changes - COMMAND_CHANGE_* flags.
+* Output         : None.
+* Return         : None.
+*******************************************************************************/
+void addCommandChanges(uint8_t changes) {
+  if (changes != 0) {
+    if (commandWatch.changes == 0) {
+      commandWatch.changeTime = HAL_GetTick();
+    }
+    commandWatch.changes |= changes;
+    postTask(COMMAND_TASK);                                   // Runs when the host is idle
+  }
+}
+
+/*******************************************************************************
+* Description    : Accumulates service time of the host read and write requests.
+* Input          : time - time of the request in us.
+* Output         : None.
+* Return         : None.
+*******************************************************************************/
+void countHostRequest(uint32_t time) {
+  ++deviceStatistics.hostRequestCount;
+  deviceStatistics.hostRequestTime += time;
+  if (time > deviceStatistics.hostRequestMaxTime) {
+    deviceStatistics.hostRequestMaxTime = time;
+  }
+}
+
+/*******************************************************************************
+* Description    : Saves configuration header to the slot which is not live. Header
+*                    switches the live partition table, torn write leaves the live slot.
+*                    The first save doesn't know the slots, so it writes both of them
+*                    and an older header of the same root key can't win.
 * Input          : partitionsStructure - the device configuration to save on storage.
 * Output         : None.
 * Return         : 0 id success or 1 if not.
 *******************************************************************************/
 uint8_t saveConf(const PartitionsStructure *partitionsStructure) {
-  uint8_t res = 1;
-  uint32_t memorySize = STORAGE_BLOCK_SIZE * STORAGE_SECTOR_NUMBER;
-  uint64_t storageAddr = SDCardInfo.CardCapacity - STORAGE_SECTOR_NUMBER * STORAGE_BLOCK_SIZE;
-  BYTE alignMemory[memorySize];
-  memcpy(alignMemory, partitionsStructure, sizeof(*partitionsStructure));
+  uint8_t res = 0;
+  uint32_t startStamp = getTimeStamp();
+  uint32_t sequence = confSequence + 1;
+  BYTE *alignMemory = allocWorkBuffer(STORAGE_BLOCK_SIZE);
+  ConfSlot *slot = (ConfSlot*) alignMemory;                   // Slot is built in the sector
+  if (alignMemory == NULL) {
+    return 1;
+  }
+  memset(alignMemory, 0, STORAGE_BLOCK_SIZE);
+  memcpy(&slot->conf, partitionsStructure, sizeof(*partitionsStructure));
+  slot->sequence = sequence;
+  slot->check = getConfCheck(alignMemory, offsetof(ConfSlot, check));
 #if  CIPHER_MOD == 0
-  encryptMemoryAES(alignMemory, partitionsStructure->rootKey, memorySize);
+  encryptMemoryAES(alignMemory, partitionsStructure->rootKey, STORAGE_BLOCK_SIZE);
 #endif
   
-  if (BSP_SD_WriteBlocks_DMA((uint32_t*) alignMemory,
-      storageAddr, STORAGE_BLOCK_SIZE, 
-      STORAGE_SECTOR_NUMBER * SDCardInfo.CardBlockSize / STORAGE_BLOCK_SIZE) == MSD_OK) {
-    res = 0;
+  for (uint8_t i = 0; (i < CONF_HEADER_SECTORS) && (res == 0); ++i) {
+    if ((confSequence == 0) || (i == sequence % CONF_HEADER_SECTORS)) {
+      res = cardWriteSectors(alignMemory, getConfSector() + i, 1) == MSD_OK ? 0 : 1;
+    }
+  }
+  if (res == 0) {
+    confSequence = sequence;
   }
+  releaseWorkBuffer(alignMemory);
+  deviceStatistics.confSaveTime = getElapsedMicros(startStamp);
   return res;
 }
 
 /*******************************************************************************
-* Description    : Loads the device configuration from the storage.
+* Description    : Calculates CRC-32 of the header slot.
+* Input          : data - bytes of the slot
+*                  size - number of the bytes.
+* Output         : None.
+* Return         : Checksum of the slot.
+*******************************************************************************/
+uint32_t getConfCheck(const BYTE *data, uint32_t size) {
+  uint32_t check = 0xFFFFFFFFu;
+  for (uint32_t i = 0; i < size; ++i) {
+    check ^= data[i];
+    for (uint8_t bit = 0; bit < 8; ++bit) {
+      check = (check >> 1) ^ (CONF_CHECK_POLYNOMIAL & (0u - (check & 1)));
+    }
+  }
+  return ~check;
+}
+
+/*******************************************************************************
+* Description    : Loads the device configuration from the storage and indexes
+*                    names of the partition table.
 * Input          : rootKey - root key to encrypt the device configuration.
 * Output         : partitionsStructure - the device configuration.
 * Return         : 0 id success or 1 if not.
 *******************************************************************************/
 uint8_t loadConf(PartitionsStructure *partitionsStructure, const char *rootKey) {
-  PartitionsStructure newConfStructure;
+  Partition partition;
   uint8_t res = 1;
-  uint32_t memorySize = STORAGE_BLOCK_SIZE * STORAGE_SECTOR_NUMBER;
-  uint64_t storageAddr = SDCardInfo.CardCapacity - STORAGE_SECTOR_NUMBER * STORAGE_BLOCK_SIZE;
-  BYTE alignMemory[memorySize];
+  uint32_t startStamp = getTimeStamp();
+  uint32_t sequence = 0;
+  PartitionsStructure *newConfStructure = allocWorkBuffer(sizeof(PartitionsStructure));
+  BYTE *alignMemory = newConfStructure != NULL ? allocWorkBuffer(STORAGE_BLOCK_SIZE) : NULL;
+  const ConfSlot *slot = (const ConfSlot*) alignMemory;
+  if (alignMemory == NULL) {
+    releaseWorkBuffer(newConfStructure);                    // NULL is ignored
+    return res;
+  }
   
-  if (BSP_SD_ReadBlocks_DMA((uint32_t*) alignMemory, storageAddr, 
-      STORAGE_BLOCK_SIZE, STORAGE_SECTOR_NUMBER * SDCardInfo.CardBlockSize / STORAGE_BLOCK_SIZE) == MSD_OK) {
+  for (uint8_t i = 0; i < CONF_HEADER_SECTORS; ++i) {       // Only the header slots are read to find the live one
+    if (cardReadSectors(alignMemory, getConfSector() + i, 1) != MSD_OK) {
+      continue;
+    }
 #if  CIPHER_MOD == 0
-    decryptMemoryAES(alignMemory, rootKey, memorySize);
+    decryptMemoryAES(alignMemory, rootKey, STORAGE_BLOCK_SIZE);
 #endif
-    memcpy((void*) &newConfStructure, alignMemory, sizeof(newConfStructure));
+    if ((slot->check == getConfCheck(alignMemory, offsetof(ConfSlot, check))) && (slot->sequence > sequence)) {
+      sequence = slot->sequence;
+      *newConfStructure = slot->conf;
+    }
+  }
+  if (sequence != 0) {
     // Check data correctness
-    if (strncmp(newConfStructure.rootKey, rootKey, ROOT_KEY_LENGHT) == 0) {
-      res = 0;
-      *partitionsStructure = newConfStructure;
+    if ((newConfStructure->formatVersion == CONF_FORMAT_VERSION)
+        && (strncmp(newConfStructure->rootKey, rootKey, ROOT_KEY_LENGHT) == 0)
+        && isStripeGeometryActual(&newConfStructure->stripeGeometry)
+        && (newConfStructure->partitionsNumber <= MAX_PART_NUMBER)
+        && (newConfStructure->currPartitionNumber < newConfStructure->partitionsNumber)
+        && (buildPartitionIndex(newConfStructure->activeTable, newConfStructure->partitionsNumber, rootKey) == 0)
+        && (getConfPartition(newConfStructure, newConfStructure->currPartitionNumber, &partition) == 0)) {
+      holdHostRequests();                                     // Host requests don't see the resumed moves before the partitions
+      if (resumeRelocation(newConfStructure) == 0) {
+        res = 0;
+        *partitionsStructure = *newConfStructure;
+        confSequence = sequence;
+        closeOtherLuns();
+        stageLunPartition(STORAGE_LUN_NBR, newConfStructure->currPartitionNumber, &partition);
+      }
+      releaseHostRequests();
     }
   }
+  releaseWorkBuffer(newConfStructure);
+  deviceStatistics.confLoadTime = getElapsedMicros(startStamp);
   return res;
 }
 
 /*******************************************************************************
-* Description    : Checks the device new configurations for errors.
-* Input          : partitionStructure - the device configuration which will be checked for correctness.
+* Description    : Ends the new partition table and makes it live. Moves of the kept
+*                    partitions are journaled before the header switches the tables.
+*                    Host requests wait from the wear pool flush till the logical units
+*                    are staged. Memory freed by the update is erased in the idle time,
+*                    the logical units show the new partitions when their memory is erased.
+*                    Requested formats are written in the idle time when no data is left
+*                    to move or erase.
+* Input          : oldConf - name of the device configuration structure
+*                  newConf - name of the new configuration for the device
+*                  isDataKept - 1 to move data of the partitions with the same names.
 * Output         : None.
 * Return         : 0 id success or 1 if not.
 *******************************************************************************/
-uint8_t checkNewPartitionsStructure(const PartitionsStructure *partitionStructure) {
-  uint32_t blockUsed = 0;
-  if ((partitionStructure->confKey[0] == '\0') 
-      || (partitionStructure->rootKey[0] == '\0')) {
-    return 1;
+uint8_t applyConf(PartitionsStructure *oldConf, PartitionsStructure *newConf, uint8_t isDataKept) {
+  PartitionsStructure prevConf = *oldConf;
+  Partition partition;
+  uint8_t res = endPartitionTable(&newConf->partitionsNumber, &newConf->usedSectors);
+  if (res == 0) {
+    res = checkNewPartitionsStructure(newConf);
   }
-  for (uint8_t i = 0; i < partitionStructure->partitionsNumber; ++i) {
-    if ((partitionStructure->partitions[i].name[0] == '\0') 
-      || (partitionStructure->partitions[i].key[0] == '\0')
-      || ((partitionStructure->partitions[i].partitionType == PUBLIC)
-          && (strncmp(partitionStructure->partitions[i].key,
-              PUBLIC_PARTITION_KEY, PART_KEY_LENGHT) != 0))
-      || (partitionStructure->partitions[i].lastSector != partitionStructure->partitions[i].startSector 
-          + partitionStructure->partitions[i].sectorNumber - 1)) {
-            return 1;
-          }
-      blockUsed += partitionStructure->partitions[i].sectorNumber;
-    }
-  if (blockUsed > SDCardInfo.CardCapacity / SDCardInfo.CardBlockSize - STORAGE_SECTOR_NUMBER) {
-    return 1;
+  if (res == 0) {
+    res = checkClonePartitions(newConf);
   }
-  return 0;
+  if (res == 0) {
+    res = checkCompressedPartitions(newConf);
+  }
+  holdHostRequests();                                         // Host requests see the old or the new layout as a whole
+  if (res == 0) {
+    res = flushWearPool();                                    // Moves and the erasing use the home sectors
+  }
+  if (res == 0) {
+    resetRelocation();
+    if (isDataKept && (oldConf->initializeStatus == INITIALIZED)) {
+      res = planRelocation(oldConf);
+    }
+  }
+  if (res == 0) {
+    newConf->formatVersion = CONF_FORMAT_VERSION;
+    newConf->currPartitionNumber = 0;
+    getStripeGeometry(&newConf->stripeGeometry);
+    newConf->initializeStatus = INITIALIZED;
+    res = getConfPartition(newConf, 0, &partition);
+  }
+  if (res == 0) {
+    res = prepareRelocation(oldConf, newConf);
+  }
+  if (res == 0) {
+    res = saveConf(newConf);
+  }
+  if ((res == 0) && (bootRecordSectors != 0)) {
+    saveBootRecord(0);                                        // Default partition may cover other file system now
+  }
+  if (res == 0) {
+    *oldConf = *newConf;
+    if (isDataKept && (prevConf.initializeStatus == INITIALIZED)) {
+      memset((uint8_t*) pendingFreshParts, 0xFF, sizeof(pendingFreshParts));   // Till the fresh memory is counted
+    }
+    closeOtherLuns();                                         // Partitions of the logical units are moved
+    stageLunPartition(STORAGE_LUN_NBR, 0, &partition);
+    startRelocation();
+  }
+  releaseHostRequests();
+  if (res == 0) {
+    if (isDataKept && (prevConf.initializeStatus == INITIALIZED)) {
+      startFreedErase(&prevConf, FREED_FRESH | (isRelocationFinished() ? FREED_VACATED : 0));
+    }
+  } else {                                                    // Live table stays, index it again
+    resetRelocation();
+    resetFormatRequests();
+    buildPartitionIndex(oldConf->activeTable,
+        oldConf->initializeStatus == INITIALIZED ? oldConf->partitionsNumber : 0, oldConf->rootKey);
+  }
+  return res;
 }
 
 /*******************************************************************************
-* Description    : Initializes starting configurations for device .
-* Input          : None.
+* Description    : Checks the device new configurations for errors. Partitions
+*                    are checked when they are added to the partition table.
+* Input          : partitionStructure - the device configuration which will be checked for correctness.
 * Output         : None.
 * Return         : 0 id success or 1 if not.
 *******************************************************************************/
-uint8_t initStartConf() {
-  partitionsStructure.partitionsNumber = 2;
-  partitionsStructure.currPartitionNumber = 0;
-  strcpy(partitionsStructure.partitions[0].name, "part0");
-  partitionsStructure.partitions[0].startSector = 0x0;
-  partitionsStructure.partitions[0].lastSector = (SDCardInfo.CardCapacity / STORAGE_BLOCK_SIZE) / 2;
-  partitionsStructure.partitions[0].sectorNumber = partitionsStructure.partitions[0].lastSector + 1;
-  partitionsStructure.partitions[0].partitionType = PUBLIC;
-
-  memset(partitionsStructure.partitions[1].name, '\0', sizeof(partitionsStructure.partitions[1].name));
-  memset(partitionsStructure.partitions[1].key, '\0', sizeof(partitionsStructure.partitions[1].key));
-  strcpy(partitionsStructure.partitions[1].name, "part1");
-  strcpy(partitionsStructure.partitions[1].key, "part1Key");
-  partitionsStructure.partitions[1].startSector = partitionsStructure.partitions[0].lastSector + 1;
-  partitionsStructure.partitions[1].lastSector = SDCardInfo.CardCapacity / STORAGE_BLOCK_SIZE
-      - STORAGE_SECTOR_NUMBER - 1;
-  partitionsStructure.partitions[1].sectorNumber = partitionsStructure.partitions[1].lastSector
-      - partitionsStructure.partitions[1].startSector + 1;
-  partitionsStructure.partitions[1].partitionType = PRIVATE;
-
-  strcpy(partitionsStructure.confKey, "confKey");
-  strcpy(partitionsStructure.rootKey, "rootKey");
-
-  partitionsStructure.initializeStatus = INITIALIZED;
-  return saveConf(&partitionsStructure);
+uint8_t checkNewPartitionsStructure(const PartitionsStructure *partitionStructure) {
+  Partition partition;
+  return ((partitionStructure->confKey[0] == '\0') 
+      || (partitionStructure->rootKey[0] == '\0')
+      || (partitionStructure->partitionsNumber == 0)
+      || (getConfPartition(partitionStructure, 0, &partition) != 0)
+      || partition.isReadOnly) ? 1 : 0;                      // Device writes the command results to zero partition
 }
 
 /*******************************************************************************
-* Description    : Calculates sector address with respect to the currently visible partition.
-* Input          : sector - desired sector.
+* Description    : Walks memory which the new configurations freed. Partitions keep their
+*                    data if they keep the name. Fresh memory is the grown part of the kept
+*                    partitions and the new partitions except sources of the moves. Vacated
+*                    memory is behind all new partitions and at the move sources which
+*                    didn't become destinations. Old table is streamed, partitions of
+*                    the new table are found by the name index. Fresh ranges of one
+*                    partition follow each other, walkedPartNumber tells the partition.
+* Input          : oldConf - previous device configurations
+*                  newConf - the new device configurations
+*                  parts - FREED_FRESH and/or FREED_VACATED
+*                  action - function called for each freed sector range.
 * Output         : None.
-* Return         : Sector with respect of current visible partition.
+* Return         : 0 if success or 1 if not.
 *******************************************************************************/
-DWORD getPartitionSector(DWORD sector) {
-  return sector + getPartition()->startSector;
+uint8_t forEachFreedRange(const PartitionsStructure *oldConf, const PartitionsStructure *newConf,
+    uint8_t parts, uint8_t (*action)(uint64_t, uint64_t)) {
+  Partition oldPart;
+  Partition newPart;
+  uint8_t keptParts[MAX_PART_NUMBER / 8];                     // New partitions which have the old data
+  memset(keptParts, 0, sizeof(keptParts));
+  for (uint16_t i = 0; i < oldConf->partitionsNumber; ++i) {
+    if (getConfPartition(oldConf, i, &oldPart) != 0) {
+      return 1;
+    }
+    int32_t newNumber = findPartitionEntry(oldPart.name, &newPart);
+    if (newNumber >= 0) {
+      keptParts[newNumber / 8] |= 1 << (newNumber % 8);
+      walkedPartNumber = newNumber;
+      if ((parts & FREED_FRESH) && (newPart.sectorNumber > oldPart.sectorNumber)
+          && (forEachFreshPartitionRange(&newPart, oldPart.sectorNumber, action) != 0)) {
+        return 1;
+      }
+    }
+    walkedPartNumber = NO_FRESH_PART;
+    for (uint8_t j = 0; (parts & FREED_VACATED) && (j < oldPart.extentNumber); ++j) {
+      uint64_t extentEnd = oldPart.extents[j].startSector + oldPart.extents[j].sectorNumber;
+      uint64_t freedStart = oldPart.extents[j].startSector > newConf->usedSectors
+          ? oldPart.extents[j].startSector : newConf->usedSectors;
+      if ((freedStart < extentEnd) && (action(freedStart, extentEnd - freedStart) != 0)) {
+        return 1;
+      }
+    }
+  }
+  for (uint16_t i = 0; (parts & FREED_FRESH) && (i < newConf->partitionsNumber); ++i) {
+    if (keptParts[i / 8] & (1 << (i % 8))) {
+      continue;
+    }
+    walkedPartNumber = i;
+    if ((getConfPartition(newConf, i, &newPart) != 0) || (forEachFreshPartitionRange(&newPart, 0, action) != 0)) {
+      return 1;
+    }
+  }
+  walkedPartNumber = NO_FRESH_PART;
+  if (parts & FREED_VACATED) {
+    return forEachVacatedRange(newConf->usedSectors, action);
+  }
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Walks volume sector ranges of the partition which are not sources of the moves.
+* Input          : partition - the partition
+*                  fromSector - first partition sector of the walk
+*                  action - function called for each sector range.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t forEachFreshPartitionRange(const Partition *partition, uint64_t fromSector,
+    uint8_t (*action)(uint64_t, uint64_t)) {
+  for (uint8_t i = 0; i < partition->extentNumber; ++i) {
+    if (fromSector >= partition->extents[i].sectorNumber) {
+      fromSector -= partition->extents[i].sectorNumber;
+      continue;
+    }
+    if (forEachRangeOutsideMoves(partition->extents[i].startSector + fromSector,
+        partition->extents[i].sectorNumber - fromSector, action) != 0) {
+      return 1;
+    }
+    fromSector = 0;
+  }
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Adds the freed sector range to the erase progress.
+* Input          : sector - first volume sector
+*                  count - number of the sectors.
+* Output         : None.
+* Return         : 0.
+*******************************************************************************/
+uint8_t countFreedRange(uint64_t sector, uint64_t count) {
+  eraseProgress.freedSectors += count;
+  if (walkedPartNumber != NO_FRESH_PART) {
+    countedFreshParts[walkedPartNumber / 8] |= 1 << (walkedPartNumber % 8);
+  }
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Erases the freed sector range by the card erase commands in large batches.
+*                    Sectors erased by the previous steps are skipped. The step stops
+*                    before the next batch when its time is over.
+* Input          : sector - first volume sector
+*                  count - number of the sectors.
+* Output         : None.
+* Return         : 0 if success or 1 if not or the step is over.
+*******************************************************************************/
+uint8_t eraseFreedRange(uint64_t sector, uint64_t count) {
+  uint64_t erasedSectors = eraseProgress.erasedSectors - eraseWalkedSectors;
+  if (walkedPartNumber != erasingPartNumber) {
+    if (erasingPartNumber != NO_FRESH_PART) {                 // All fresh ranges of the partition are erased
+      pendingFreshParts[erasingPartNumber / 8] &= ~(1 << (erasingPartNumber % 8));
+    }
+    erasingPartNumber = walkedPartNumber;
+  }
+  erasedSectors = erasedSectors < count ? erasedSectors : count;
+  sector += erasedSectors;
+  count -= erasedSectors;
+  eraseWalkedSectors += erasedSectors;
+  while (count != 0) {
+    uint64_t batchSectors = count < ERASE_BATCH_SECTORS ? count : ERASE_BATCH_SECTORS;
+    uint8_t res;
+    if ((eraseStepBatches != 0) && (HAL_GetTick() - eraseStepStart >= ERASE_STEP_TIME)) {
+      isEraseStepOver = 1;
+      return 1;
+    }
+    holdHostRequests();                                       // Host requests run between the batches
+    res = volumeEraseSectors(sector, batchSectors);
+    releaseHostRequests();
+    if (res != BLOCK_DEVICE_OK) {
+      return 1;
+    }
+    sector += batchSectors;
+    count -= batchSectors;
+    eraseWalkedSectors += batchSectors;
+    eraseProgress.erasedSectors += batchSectors;
+    eraseStepBatches++;
+  }
+  return 0;
 }
 
 /*******************************************************************************
-* Description    : Checks desired memory to be in the currently visible partition.
-* Input          : shiftedSector - start sector of the desired memory
+* Description    : Starts erasing memory freed by the new configurations. Erased memory
+*                    can't be restored and it is faster to program later. The freed
+*                    sectors are counted now and erased in the idle time, staged
+*                    partitions with fresh memory are not swapped till it is erased.
+* Input          : oldConf - previous device configurations
+*                  parts - parts of the freed memory to erase.
+* Output         : None.
+* Return         : None.
+*******************************************************************************/
+void startFreedErase(const PartitionsStructure *oldConf, uint8_t parts) {
+  eraseOldConf = *oldConf;
+  eraseParts = parts;
+  eraseStartTime = HAL_GetTick();
+  eraseProgress.freedSectors = 0;
+  eraseProgress.erasedSectors = 0;
+  eraseProgress.eraseTime = 0;
+  memset(countedFreshParts, 0, sizeof(countedFreshParts));
+  forEachFreedRange(&eraseOldConf, &partitionsStructure, eraseParts, countFreedRange);   // Failed walk fails the erase
+  memcpy((uint8_t*) pendingFreshParts, countedFreshParts, sizeof(countedFreshParts));
+  eraseProgress.status = ERASE_IN_PROGRESS;
+}
+
+/*******************************************************************************
+* Description    : Ends erasing of the freed memory. Staged partitions are shown
+*                    even if the erase failed.
+* Input          : status - the erase result.
+* Output         : None.
+* Return         : None.
+*******************************************************************************/
+void endFreedErase(EraseStatus status) {
+  memset((uint8_t*) pendingFreshParts, 0, sizeof(pendingFreshParts));
+  eraseProgress.status = status;
+  eraseProgress.eraseTime = HAL_GetTick() - eraseStartTime;
+}
+
+/*******************************************************************************
+* Description    : Checks the freed memory to be erased now.
+* Input          : None.
+* Output         : None.
+* Return         : True if the erase is not finished.
+*******************************************************************************/
+uint8_t isFreedEraseActive(void) {
+  return eraseProgress.status == ERASE_IN_PROGRESS ? 1 : 0;
+}
+
+/*******************************************************************************
+* Description    : Checks the staged partition of the logical unit to wait for the erase
+*                    of its fresh memory or for its format. Called by the USB interrupt too.
+* Input          : lun - the logical unit.
+* Output         : None.
+* Return         : True if the staged partition can't be swapped yet.
+*******************************************************************************/
+uint8_t isStagedPartitionHeld(BYTE lun) {
+  const StagedPartition *staged = &stagedPartitions[lun];
+  return staged->isOpen && (isFreshMemoryPending(staged->partitionNumber)
+      || isPartitionFormatPending(staged->partitionNumber)) ? 1 : 0;
+}
+
+/*******************************************************************************
+* Description    : Checks the partition to have fresh memory which is not erased yet.
+*                    Called by the USB interrupt too.
+* Input          : partNumber - number of the partition in the live table.
+* Output         : None.
+* Return         : True if the host can't see the partition yet.
+*******************************************************************************/
+uint8_t isFreshMemoryPending(uint16_t partNumber) {
+  return (partNumber < MAX_PART_NUMBER) && (pendingFreshParts[partNumber / 8] & (1 << (partNumber % 8))) ? 1 : 0;
+}
+
+/*******************************************************************************
+* Description    : Checks that the configurations were made for the cards of the device.
+* Input          : geometry - the stripe geometry of the configurations.
+* Output         : None.
+* Return         : True if the geometry matches the device cards.
+*******************************************************************************/
+uint8_t isStripeGeometryActual(const StripeGeometry *geometry) {
+  StripeGeometry actualGeometry;
+  getStripeGeometry(&actualGeometry);
+  return (geometry->deviceNumber == actualGeometry.deviceNumber)
+      && (geometry->stripeUnit == actualGeometry.stripeUnit) ? 1 : 0;
+}
+
+/*******************************************************************************
+* Description    : Initializes starting configurations for device .
+* Input          : None.
+* Output         : None.
+* Return         : 0 id success or 1 if not.
+*******************************************************************************/
+uint8_t initStartConf() {
+  PartitionsStructure *newConf = allocWorkBuffer(sizeof(PartitionsStructure));
+  Partition partition;
+  uint64_t zeroPartSectors = getVolumeSectorNumber() / 2 + 1;
+  uint8_t res;
+  if (newConf == NULL) {
+    return 1;
+  }
+  memset(newConf, 0, sizeof(*newConf));
+  strcpy(newConf->confKey, "confKey");
+  strcpy(newConf->rootKey, "rootKey");
+  resetRelocation();                                          // Data of the old partitions is not kept
+  if (isFreedEraseActive()) {
+    endFreedErase(ERASE_FAILED);
+  }
+  beginConf(&partitionsStructure, newConf);
+
+  memset(&partition, 0, sizeof(partition));
+  strcpy(partition.name, "part0");
+  strcpy(partition.key, PUBLIC_PARTITION_KEY);
+  partition.extentNumber = 1;
+  partition.sectorNumber = zeroPartSectors;
+  partition.partitionType = PUBLIC;
+  addConfPartition(&partition);
+
+  memset(&partition, 0, sizeof(partition));
+  strcpy(partition.name, "part1");
+  strcpy(partition.key, "part1Key");
+  partition.extentNumber = 1;
+  partition.sectorNumber = getVolumeSectorNumber() - zeroPartSectors;
+  partition.partitionType = PRIVATE;
+  addConfPartition(&partition);
+
+  res = applyConf(&partitionsStructure, newConf, 0);
+  releaseWorkBuffer(newConf);
+  return res;
+}
+
+/*******************************************************************************
+* Description    : Calculates sector address with respect to the visible partition.
+* Input          : lun - logical unit of the partition
+*                  sector - desired sector.
+* Output         : runLength - number of the partition sectors till the end of the extent.
+* Return         : Volume sector of the desired sector.
+*******************************************************************************/
+uint64_t getPartitionSector(BYTE lun, DWORD sector, UINT *runLength) {
+  return translateExtentSector(getPartition(lun), &lunContexts[lun].extentIndex, sector, runLength);
+}
+
+/*******************************************************************************
+* Description    : Rebuilds the extent index of the visible partition.
+* Input          : lun - logical unit of the partition.
+* Output         : None.
+* Return         : None.
+*******************************************************************************/
+void updateExtentIndex(BYTE lun) {
+  buildExtentIndex(getPartition(lun), &lunContexts[lun].extentIndex);
+}
+
+/*******************************************************************************
+* Description    : Makes the partition visible through the logical unit. Remap table
+*                    of the clone is loaded from its pool.
+* Input          : lun - the logical unit
+*                  partNumber - number of the partition in the partition table
+*                  partition - configurations of the partition
+*                  source - source of the clone partition
+*                  isReadOnly - 1 if clones share sectors of the partition.
+* Output         : None.
+* Return         : None.
+*******************************************************************************/
+void setLunPartition(BYTE lun, uint16_t partNumber, const Partition *partition, const Partition *source,
+    uint8_t isReadOnly) {
+  LunContext *context = &lunContexts[lun];
+  context->partition = *partition;
+  context->partitionNumber = partNumber;
+  context->isReadOnly = isReadOnly;
+  context->isCapacityKnown = 0;
+  updateExtentIndex(lun);
+#if  CIPHER_MOD == 0
+  createKeyWithSpecLength(context->partition.key, context->longPartXORkey, STORAGE_BLOCK_SIZE);
+#endif
+  closeCloneRemap(lun);
+  closeChangeMap(lun);
+  closeCompressedStore(lun);
+  resetReadCache(lun);
+  context->isClone = isClonePartition(partition);
+  context->isCompressed = isCompressedPartition(partition);
+  context->isOpen = !context->isClone || (openCloneRemap(lun, partition, source, context->longPartXORkey) == 0);
+  if (context->isCompressed) {
+    context->isOpen = openCompressedStore(lun, partition, context->longPartXORkey) == 0;
+  }
+}
+
+/*******************************************************************************
+* Description    : Stages the partition for the logical unit. The partition is swapped
+*                    when the host saw the medium change.
+* Input          : lun - the logical unit
+*                  partNumber - number of the partition in the partition table
+*                  partition - configurations of the partition or NULL to close the logical unit.
+* Output         : None.
+* Return         : None.
+*******************************************************************************/
+void stageLunPartition(BYTE lun, uint16_t partNumber, const Partition *partition) {
+  StagedPartition *staged = &stagedPartitions[lun];
+  Partition source;
+  uint8_t isReadOnly = 0;
+  memset(&source, 0, sizeof(source));
+  if ((partition != NULL) && isClonePartition(partition) && (findPartitionEntry(partition->sourceName, &source) < 0)) {
+    partition = NULL;                                         // Clone without the source can't be shown
+  }
+  if ((partition != NULL) && (partNumber != 0)) {            // Zero partition is never cloned
+    isReadOnly = isPartitionCloned(&partitionsStructure, partition->name);
+  }
+  if (partition != NULL) {
+    isReadOnly |= partition->isReadOnly;
+  }
+  __disable_irq();                                            // USB interrupt can't swap half written partition
+  staged->isOpen = partition != NULL ? 1 : 0;
+  if (partition != NULL) {
+    staged->partition = *partition;
+    staged->source = source;
+    staged->partitionNumber = partNumber;
+    staged->isReadOnly = isReadOnly;
+  }
+  staged->stageTime = HAL_GetTick();
+  lunContexts[lun].mediaState = MEDIA_CHANGE_STAGED;
+  __enable_irq();
+}
+
+/*******************************************************************************
+* Description    : Replaces the partition of the logical unit by the staged partition.
+* Input          : lun - the logical unit.
+* Output         : None.
+* Return         : None.
+*******************************************************************************/
+void swapLunPartition(BYTE lun) {
+  StagedPartition *staged = &stagedPartitions[lun];
+  if (staged->isOpen) {
+    setLunPartition(lun, staged->partitionNumber, &staged->partition, &staged->source, staged->isReadOnly);
+  } else {
+    closeCloneRemap(lun);
+    closeChangeMap(lun);
+    closeCompressedStore(lun);
+    resetReadCache(lun);
+    lunContexts[lun].isOpen = 0;
+  }
+  lunContexts[lun].mediaState = MEDIA_READY;
+  deviceStatistics.partitionSwitchTime = HAL_GetTick() - staged->stageTime;
+  if (lun == COMMAND_LUN) {
+    addCommandChanges(COMMAND_CHANGE_VOLUME);                 // Mounted file system belongs to the old partition
+  }
+}
+
+/*******************************************************************************
+* Description    : Hides partitions of all logical units except the unit with the command file.
+* Input          : None.
+* Output         : None.
+* Return         : None.
+*******************************************************************************/
+void closeOtherLuns(void) {
+  for (uint8_t i = 0; i < MAX_LUN_NUMBER; ++i) {
+    if ((i != STORAGE_LUN_NBR) && (lunContexts[i].isOpen || (lunContexts[i].mediaState != MEDIA_READY))) {
+      stageLunPartition(i, 0, NULL);
+    }
+  }
+}
+
+/*******************************************************************************
+* Description    : Checks the partition to be visible or staged on other logical unit.
+* Input          : lun - the logical unit for the partition
+*                  partNumber - number of the partition.
+* Output         : None.
+* Return         : True if other logical unit has the partition.
+*******************************************************************************/
+uint8_t isPartitionOnOtherLun(BYTE lun, uint16_t partNumber) {
+  for (uint8_t i = 0; i < MAX_LUN_NUMBER; ++i) {
+    if ((i != lun)
+        && ((lunContexts[i].isOpen && (lunContexts[i].partitionNumber == partNumber))
+            || ((lunContexts[i].mediaState != MEDIA_READY) && stagedPartitions[i].isOpen
+                && (stagedPartitions[i].partitionNumber == partNumber)))) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Checks the clone to be visible or staged on other logical unit.
+* Input          : lun - the logical unit for the clone.
+* Output         : None.
+* Return         : True if other logical unit has the clone.
+*******************************************************************************/
+uint8_t isCloneOnOtherLun(BYTE lun) {
+  for (uint8_t i = 0; i < MAX_LUN_NUMBER; ++i) {
+    if ((i != lun)
+        && ((lunContexts[i].isOpen && lunContexts[i].isClone)
+            || ((lunContexts[i].mediaState != MEDIA_READY) && stagedPartitions[i].isOpen
+                && isClonePartition(&stagedPartitions[i].partition)))) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Checks the logical unit to have the visible partition.
+* Input          : lun - the logical unit.
+* Output         : None.
+* Return         : True if the logical unit is open.
+*******************************************************************************/
+uint8_t isLunOpen(BYTE lun) {
+  return (lun < MAX_LUN_NUMBER) && lunContexts[lun].isOpen ? 1 : 0;
+}
+
+/*******************************************************************************
+* Description    : Reads sectors of the visible partition. Requests that
+*                    straddle extents are split on the extent borders. During the
+*                    relocation not copied sectors are read at the move source.
+* Input          : lun - logical unit of the partition
+*                  sector - first partition sector
+*                  count - number of the sectors.
+* Output         : buff - read data.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t readPartitionSectors(BYTE lun, BYTE *buff, DWORD sector, UINT count) {
+  UINT runLength;
+  if (lunContexts[lun].isClone) {
+    return readCloneSectors(buff, sector, count);           // Not copied blocks are read from the source
+  }
+  if (lunContexts[lun].isCompressed) {
+    return readCompressedSectors(lun, buff, sector, count);  // Chunks are decompressed and decrypted
+  }
+  while (count != 0) {
+    uint32_t startStamp = getTimeStamp();
+    uint64_t volumeSector = getPartitionSector(lun, sector, &runLength);
+    deviceStatistics.translationCycles += getTimeStamp() - startStamp;
+    deviceStatistics.translationCount++;
+    if (runLength < count) {
+      deviceStatistics.splitRequestCount++;
+    }
+    runLength = runLength < count ? runLength : count;
+    if (readRelocatedSectors(buff, volumeSector, runLength) != BLOCK_DEVICE_OK) {
+      return BLOCK_DEVICE_ERROR;
+    }
+    buff += runLength * STORAGE_BLOCK_SIZE;
+    sector += runLength;
+    count -= runLength;
+  }
+  return BLOCK_DEVICE_OK;
+}
+
+/*******************************************************************************
+* Description    : Writes sectors of the visible partition. Requests that
+*                    straddle extents are split on the extent borders. During the
+*                    relocation not copied sectors are written at the move source.
+* Input          : lun - logical unit of the partition
+*                  buff - data to write
+*                  sector - first partition sector
+*                  count - number of the sectors.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t writePartitionSectors(BYTE lun, const BYTE *buff, DWORD sector, UINT count) {
+  UINT runLength;
+  if (lunContexts[lun].isClone) {
+    return writeCloneSectors((BYTE*) buff, sector, count);   // Written blocks are copied to the clone pool
+  }
+  if (lunContexts[lun].isCompressed) {
+    return writeCompressedSectors(lun, buff, sector, count);  // Chunks are compressed before the encryption
+  }
+  while (count != 0) {
+    uint32_t startStamp = getTimeStamp();
+    uint64_t volumeSector = getPartitionSector(lun, sector, &runLength);
+    deviceStatistics.translationCycles += getTimeStamp() - startStamp;
+    deviceStatistics.translationCount++;
+    if (runLength < count) {
+      deviceStatistics.splitRequestCount++;
+    }
+    runLength = runLength < count ? runLength : count;
+    if (writeRelocatedSectors((BYTE*) buff, volumeSector, runLength) != BLOCK_DEVICE_OK) {
+      return BLOCK_DEVICE_ERROR;
+    }
+    buff += runLength * STORAGE_BLOCK_SIZE;
+    sector += runLength;
+    count -= runLength;
+  }
+  return BLOCK_DEVICE_OK;
+}
+
+/*******************************************************************************
+* Description    : Reads sectors of the visible partition and decrypts them.
+* Input          : lun - logical unit of the partition
+*                  sector - first partition sector
+*                  count - number of the sectors.
+* Output         : buff - read data.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t loadLunSectors(BYTE lun, BYTE *buff, DWORD sector, UINT count) {
+  if (readPartitionSectors(lun, buff, sector, count) != BLOCK_DEVICE_OK) {
+    return 1;
+  }
+#if  CIPHER_MOD == 0
+  if ((getPartition(lun)->partitionType == PRIVATE) && !lunContexts[lun].isCompressed) {
+    decryptMemory(buff, lunContexts[lun].longPartXORkey, count * STORAGE_BLOCK_SIZE);
+  }
+#endif
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Checks desired memory to be in the visible partition.
+* Input          : lun - logical unit of the partition
+*                  sector - start sector of the desired memory in the partition
 *                  count - number of memory blocks.
 * Output         : None.
-* Return         : True if requested sector contains in current visible partition.
+* Return         : True if requested sector contains in the visible partition.
+*******************************************************************************/
+uint8_t isPartitionContainsMemorySectors(BYTE lun, DWORD sector, UINT count) {
+  return (count != 0) && ((uint64_t) sector + count <= getLunSectorNumber(lun)) ? 1 : 0;
+}
+
+/*******************************************************************************
+* Description    : Calculates number of the SD card sectors.
+*                    SDHC/SDXC capacity is calculated from CSD in 64-bit arithmetic
+*                    because 32-bit byte capacity overflows above 4 GB.
+* Input          : None.
+* Output         : None.
+* Return         : Number of the card sectors.
+*******************************************************************************/
+uint64_t getCardSectorNumber(void) {
+  if (SDCardInfo.CardType == HIGH_CAPACITY_SD_CARD) {
+    return ((uint64_t) SDCardInfo.SD_csd.DeviceSize + 1) * 1024;    // C_SIZE counts 512 KB units
+  }
+  return SDCardInfo.CardCapacity / STORAGE_BLOCK_SIZE;
+}
+
+/*******************************************************************************
+* Description    : Calculates the first sector of the stored device configurations.
+* Input          : None.
+* Output         : None.
+* Return         : Sector of the device configurations.
+*******************************************************************************/
+uint64_t getConfSector(void) {
+  return getCardSectorNumber() - STORAGE_SECTOR_NUMBER;
+}
+
+/*******************************************************************************
+* Description    : Reads sectors of the SD card by block address. Host requests
+*                    wait till the transfer ends.
+* Input          : sector - first card sector
+*                  count - number of the sectors.
+* Output         : buff - read data.
+* Return         : MSD_OK if success.
+*******************************************************************************/
+uint8_t cardReadSectors(BYTE *buff, uint64_t sector, uint32_t count) {
+  uint8_t res;
+  holdHostRequests();
+  res = BSP_SD_ReadBlocks_DMA((uint32_t*) buff, sector * STORAGE_BLOCK_SIZE, STORAGE_BLOCK_SIZE, count);
+  releaseHostRequests();
+  return res;
+}
+
+/*******************************************************************************
+* Description    : Writes sectors of the SD card by block address. Host requests
+*                    wait till the transfer ends.
+* Input          : buff - data to write
+*                  sector - first card sector
+*                  count - number of the sectors.
+* Output         : None.
+* Return         : MSD_OK if success.
+*******************************************************************************/
+uint8_t cardWriteSectors(const BYTE *buff, uint64_t sector, uint32_t count) {
+  uint8_t res;
+  holdHostRequests();
+  res = BSP_SD_WriteBlocks_DMA((uint32_t*) buff, sector * STORAGE_BLOCK_SIZE, STORAGE_BLOCK_SIZE, count);
+  releaseHostRequests();
+  return res;
+}
+
+/*******************************************************************************
+* Description    : Starts reading of the SD card sectors by DMA.
+* Input          : sector - first card sector
+*                  count - number of the sectors.
+* Output         : buff - read data after sdCardWaitRead.
+* Return         : BLOCK_DEVICE_OK if success.
+*******************************************************************************/
+uint8_t sdCardStartRead(uint8_t *buff, uint64_t sector, uint32_t count) {
+  return HAL_SD_ReadBlocks_DMA(&hsd, (uint32_t*) buff, sector * STORAGE_BLOCK_SIZE, STORAGE_BLOCK_SIZE, count) == SD_OK
+      ? BLOCK_DEVICE_OK : BLOCK_DEVICE_ERROR;
+}
+
+/*******************************************************************************
+* Description    : Starts writing of the SD card sectors by DMA.
+* Input          : buff - data to write
+*                  sector - first card sector
+*                  count - number of the sectors.
+* Output         : None.
+* Return         : BLOCK_DEVICE_OK if success.
+*******************************************************************************/
+uint8_t sdCardStartWrite(const uint8_t *buff, uint64_t sector, uint32_t count) {
+  return HAL_SD_WriteBlocks_DMA(&hsd, (uint32_t*) buff, sector * STORAGE_BLOCK_SIZE, STORAGE_BLOCK_SIZE, count) == SD_OK
+      ? BLOCK_DEVICE_OK : BLOCK_DEVICE_ERROR;
+}
+
+/*******************************************************************************
+* Description    : Waits for the end of the SD card reading.
+* Input          : None.
+* Output         : None.
+* Return         : BLOCK_DEVICE_OK if success.
 *******************************************************************************/
-uint8_t isPartitionContainsMemorySectors(DWORD shiftedSector, UINT count) {
-  shiftedSector += count;
-  return (shiftedSector >= getPartition()->startSector) && (shiftedSector <= getPartition()->lastSector) ? 1 : 0;
+uint8_t sdCardWaitRead(void) {
+  return HAL_SD_CheckReadOperation(&hsd, SD_DATATIMEOUT) == SD_OK ? BLOCK_DEVICE_OK : BLOCK_DEVICE_ERROR;
 }
 
 /*******************************************************************************
-* Description    : Checks desired memory to be in the currently visible partition.
+* Description    : Waits for the end of the SD card writing.
 * Input          : None.
 * Output         : None.
-* Return         : Current visible partition configurations.
+* Return         : BLOCK_DEVICE_OK if success.
+*******************************************************************************/
+uint8_t sdCardWaitWrite(void) {
+  return HAL_SD_CheckWriteOperation(&hsd, SD_DATATIMEOUT) == SD_OK ? BLOCK_DEVICE_OK : BLOCK_DEVICE_ERROR;
+}
+
+/*******************************************************************************
+* Description    : Erases sectors of the SD card by block address.
+* Input          : sector - first card sector
+*                  count - number of the sectors.
+* Output         : None.
+* Return         : MSD_OK if success.
 *******************************************************************************/
-Partition* getPartition() {
-  return &partitionsStructure.partitions[partitionsStructure.currPartitionNumber];
+uint8_t cardEraseSectors(uint64_t sector, uint64_t count) {
+  return BSP_SD_Erase(sector * STORAGE_BLOCK_SIZE, (sector + count - 1) * STORAGE_BLOCK_SIZE);
+}
+
+/*******************************************************************************
+* Description    : Returns the visible partition of the logical unit.
+* Input          : lun - the logical unit.
+* Output         : None.
+* Return         : The visible partition configurations.
+*******************************************************************************/
+Partition* getPartition(BYTE lun) {
+  return &lunContexts[lun].partition;
+}
+
+/*******************************************************************************
+* Description    : Returns size of the logical unit. Clone has the size of its source,
+*                    compressed partition is smaller by its chunk map.
+* Input          : lun - the logical unit.
+* Output         : None.
+* Return         : Number of the logical unit sectors.
+*******************************************************************************/
+uint64_t getLunSectorNumber(BYTE lun) {
+  if (lunContexts[lun].isClone) {
+    return getCloneSectorNumber();
+  }
+  return lunContexts[lun].isCompressed ? getCompressedSectorNumber(getPartition(lun)) : getPartition(lun)->sectorNumber;
+}
+
+/*******************************************************************************
+* Description    : Calculates size of the file system of the logical unit from its
+*                    boot sector, so the allocation table is not scanned. Medium
+*                    partitioned by the host is sized by its first partition.
+* Input          : lun - the logical unit.
+* Output         : sectorNumber - sectors till the end of the data area.
+* Return         : 0 if success or 1 if the file system is not found or
+*                    it is larger than the volume.
+*******************************************************************************/
+uint8_t getFileSystemSectors(BYTE lun, uint64_t *sectorNumber) {
+  BYTE alignMemory[STORAGE_BLOCK_SIZE];
+  uint32_t volumeStart;
+  if ((SD_read(lun, alignMemory, 0, 1) != RES_OK)
+      || (loadWord(alignMemory + BOOT_SIGNATURE_OFFSET) != BOOT_SIGNATURE)) {
+    return 1;
+  }
+  if (getBootSectorSize(alignMemory, sectorNumber) != 0) {
+    volumeStart = loadDword(alignMemory + MBR_FIRST_ENTRY_OFFSET + MBR_ENTRY_START_OFFSET);
+    if ((volumeStart == 0) || (SD_read(lun, alignMemory, volumeStart, 1) != RES_OK)
+        || (loadWord(alignMemory + BOOT_SIGNATURE_OFFSET) != BOOT_SIGNATURE)
+        || (getBootSectorSize(alignMemory, sectorNumber) != 0)) {
+      return 1;
+    }
+    *sectorNumber += volumeStart;
+  }
+  if ((*sectorNumber == 0) || (*sectorNumber >= getVolumeSectorNumber())) {
+    return 1;                                         // Same bound as the boot record, the host sees the card size
+  }
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Loads the boot record of the volume.
+* Input          : None.
+* Output         : sectorNumber - capacity of the default partition.
+* Return         : 0 if success or 1 if the record is not valid.
+*******************************************************************************/
+uint8_t loadBootRecord(uint64_t *sectorNumber) {
+  BYTE alignMemory[STORAGE_BLOCK_SIZE];
+  BootRecord record;
+  if (cardReadSectors(alignMemory, getBootRecordSector(), BOOT_RECORD_SECTORS) != MSD_OK) {
+    return 1;
+  }
+#if  CIPHER_MOD == 0
+  decryptMemoryAES(alignMemory, DEVICE_UNIQUE_ID, sizeof(alignMemory));
+#endif
+  memcpy(&record, alignMemory, sizeof(record));
+  if ((record.check != getConfCheck((BYTE*) &record, offsetof(BootRecord, check)))
+      || (record.volumeSectors != getVolumeSectorNumber()) || (record.sectorNumber == 0)
+      || (record.sectorNumber >= getVolumeSectorNumber())) {
+    return 1;
+  }
+  bootRecordSectors = record.sectorNumber;
+  *sectorNumber = record.sectorNumber;
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Saves the boot record of the volume. The record is encrypted by
+*                    the device key, so it looks like the rest of the configurations.
+* Input          : sectorNumber - capacity of the default partition, 0 makes the record not valid.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t saveBootRecord(uint64_t sectorNumber) {
+  BYTE alignMemory[STORAGE_BLOCK_SIZE];
+  BootRecord record;
+  memset(&record, 0, sizeof(record));
+  record.volumeSectors = getVolumeSectorNumber();
+  record.sectorNumber = sectorNumber;
+  record.check = getConfCheck((BYTE*) &record, offsetof(BootRecord, check));
+  memset(alignMemory, 0, sizeof(alignMemory));
+  memcpy(alignMemory, &record, sizeof(record));
+#if  CIPHER_MOD == 0
+  encryptMemoryAES(alignMemory, DEVICE_UNIQUE_ID, sizeof(alignMemory));
+#endif
+  if (cardWriteSectors(alignMemory, getBootRecordSector(), BOOT_RECORD_SECTORS) != MSD_OK) {
+    return 1;
+  }
+  bootRecordSectors = sectorNumber;
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Calculates sector of the boot record, it ends the configurations.
+* Input          : None.
+* Output         : None.
+* Return         : Sector of the boot record.
+*******************************************************************************/
+uint64_t getBootRecordSector(void) {
+  return getConfSector() + STORAGE_SECTOR_NUMBER - BOOT_RECORD_SECTORS;
+}
+
+/*******************************************************************************
+* Description    : Calculates end of the data area of the FAT or exFAT volume the
+*                    same way FatFs does on the mount.
+* Input          : bootSector - the boot sector of the volume.
+* Output         : sectorNumber - sectors of the volume till the end of the data area.
+* Return         : 0 if success or 1 if the sector is not a boot sector.
+*******************************************************************************/
+uint8_t getBootSectorSize(const BYTE *bootSector, uint64_t *sectorNumber) {
+  uint32_t totalSectors;
+  uint32_t fatSectors;
+  uint32_t dataStart;
+  uint8_t clusterSectors = bootSector[BPB_CLUSTER_SECTORS_OFFSET];
+  if (memcmp(bootSector + EXFAT_NAME_OFFSET, "EXFAT   ", 8) == 0) {
+    *sectorNumber = loadDword(bootSector + EXFAT_HEAP_OFFSET)
+        + ((uint64_t) loadDword(bootSector + EXFAT_CLUSTER_COUNT_OFFSET) << bootSector[EXFAT_CLUSTER_SHIFT_OFFSET]);
+    return 0;
+  }
+  if (((bootSector[0] != 0xEB) && (bootSector[0] != 0xE9) && (bootSector[0] != 0xE8))
+      || (clusterSectors == 0) || ((clusterSectors & (clusterSectors - 1)) != 0)
+      || (loadWord(bootSector + BPB_RESERVED_SECTORS_OFFSET) == 0) || (bootSector[BPB_FAT_NUMBER_OFFSET] == 0)) {
+    return 1;                                                 // Jump instruction and BPB checked like FatFs does
+  }
+  totalSectors = loadWord(bootSector + BPB_SECTORS16_OFFSET);
+  if (totalSectors == 0) {
+    totalSectors = loadDword(bootSector + BPB_SECTORS32_OFFSET);
+  }
+  fatSectors = loadWord(bootSector + BPB_FAT_SECTORS16_OFFSET);
+  if (fatSectors == 0) {
+    fatSectors = loadDword(bootSector + BPB_FAT_SECTORS32_OFFSET);
+  }
+  dataStart = loadWord(bootSector + BPB_RESERVED_SECTORS_OFFSET) + bootSector[BPB_FAT_NUMBER_OFFSET] * fatSectors
+      + (loadWord(bootSector + BPB_ROOT_ENTRIES_OFFSET) * DIR_ENTRY_BYTES + STORAGE_BLOCK_SIZE - 1) / STORAGE_BLOCK_SIZE;
+  if (totalSectors <= dataStart) {
+    return 1;
+  }
+  *sectorNumber = dataStart + (totalSectors - dataStart) / clusterSectors * clusterSectors;
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Loads little-endian numbers of the file system structures.
+* Input          : buff - the number bytes.
+* Output         : None.
+* Return         : The number.
+*******************************************************************************/
+uint16_t loadWord(const BYTE *buff) {
+  return buff[0] | (buff[1] << 8);
+}
+
+uint32_t loadDword(const BYTE *buff) {
+  return loadWord(buff) | ((uint32_t) loadWord(buff + 2) << 16);
 }
 
 /*******************************************************************************
@@ -654,6 +2122,7 @@ void cipherXOR(BYTE *buff, const char *key, const uint32_t size) {
 *******************************************************************************/
 void resetTimerInerrupt(void) {
   htim14.Instance->CNT = 0;
+  noteHostRequest();                                          // Main loop tasks wait for the idle host too
 }
 #endif /* _USE_IOCTL == 1 */
 
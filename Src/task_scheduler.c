@@ -0,0 +1,119 @@
+/**
+  ******************************************************************************
+  * @file           : TASK_SCHEDULER
+  * @version        : v1.0
+  * @brief          : Run-to-completion tasks of the main loop
+  ******************************************************************************
+  * MIT License
+  *
+  * Copyright (c) 2017 Oleksandr Borysov
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+ ******************************************************************************
+*/
+
+
+
+
+/* Includes ------------------------------------------------------------------*/
+#include "task_scheduler.h"
+#include "user_interface.h"
+#include "stm32f4xx_hal.h"
+
+/* Private variables ---------------------------------------------------------*/
+volatile uint32_t pendingTasks;                           // Bit of the task is set when it is posted
+volatile uint32_t lastHostRequestTime;                    // Tick of the last host request
+uint8_t hostHoldDepth;                                    // Nested holds of the host requests
+// Functions of the tasks in order of Task
+void (*const taskFunctions[TASK_NUMBER])(void) = {
+  doMailboxRequest,
+  doIdleWork,
+  checkConfFiles
+};
+
+/* Public task scheduler functions ---------------------------------------------------------*/
+
+/*******************************************************************************
+* Description    : Posts the task, it runs once however many times it was posted.
+* Input          : task - the task.
+* Output         : None.
+* Return         : None.
+*******************************************************************************/
+void postTask(Task task) {
+  __disable_irq();                                        // Interrupts post tasks too
+  pendingTasks |= 1u << task;
+  __enable_irq();
+}
+
+/*******************************************************************************
+* Description    : Marks the host request, tasks wait till the host is idle.
+* Input          : None.
+* Output         : None.
+* Return         : None.
+*******************************************************************************/
+void noteHostRequest(void) {
+  lastHostRequestTime = HAL_GetTick();
+}
+
+/*******************************************************************************
+* Description    : Runs the posted tasks in order of their priority. Called by the
+*                    main loop, a task is not interrupted by other tasks. Urgent tasks
+*                    are answers to the host, so they don't wait for the idle host.
+* Input          : None.
+* Output         : None.
+* Return         : None.
+*******************************************************************************/
+void runTasks(void) {
+  for (uint8_t task = 0; task < TASK_NUMBER; ++task) {
+    if (!(URGENT_TASKS & (1u << task)) && (HAL_GetTick() - lastHostRequestTime < HOST_IDLE_TIME)) {
+      return;                                             // Tasks stay posted till the host is idle
+    }
+    if (pendingTasks & (1u << task)) {
+      __disable_irq();
+      pendingTasks &= ~(1u << task);
+      __enable_irq();
+      taskFunctions[task]();
+    }
+  }
+}
+
+/*******************************************************************************
+* Description    : Masks the USB interrupt, so the host requests wait and don't use
+*                    the card meanwhile. Holds nest, the USB interrupt is unmasked
+*                    by the last release.
+* Input          : None.
+* Output         : None.
+* Return         : None.
+*******************************************************************************/
+void holdHostRequests(void) {
+  HAL_NVIC_DisableIRQ(OTG_FS_IRQn);
+  ++hostHoldDepth;
+}
+
+/*******************************************************************************
+* Description    : Releases the hold of the host requests.
+* Input          : None.
+* Output         : None.
+* Return         : None.
+*******************************************************************************/
+void releaseHostRequests(void) {
+  if ((hostHoldDepth != 0) && (--hostHoldDepth == 0)) {
+    HAL_NVIC_EnableIRQ(OTG_FS_IRQn);
+  }
+}
@@ -32,22 +32,53 @@
 #include <string.h>
 #include <stdlib.h>
 #include "sd_io_controller.h"
+#include "relocation.h"
+#include "change_tracking.h"
+#include "quick_format.h"
+#include "wear_leveling.h"
+#include "work_arena.h"
+#include "command_reader.h"
+#include "conf_text.h"
+#include "mailbox.h"
+#include "task_scheduler.h"
 #include "usbd_core.h"
+#include "device_stats.h"
+
+#if !defined(_FS_EXFAT) || (_FS_EXFAT == 0)                 // FatFs before R0.12 has no exFAT
+#error "exFAT partitions need FatFs R0.12 or newer with _FS_EXFAT = 1 and _USE_LFN != 0"
+#endif
 
 #define COMMAND_FILE_NAME               "COMMAND_.TXT"
 #define COMMAND_FILE_NAME_FAILED        "COMMANDF.TXT"
 
 #define DEVICE_CONFIGS                  "CONFIGS_.TXT"
+#define EXPORT_FILE_NAME                "CHANGES_.BIN"      // Changed sectors of the exported partition
+#define EXPORT_MAGIC                    0x54504543u         // "CEPT"
+#define EXPORT_VERSION                  1
+#define EXPORT_CHUNK_SECTORS            8                   // Sectors read and written to the file at once
+                                                            // State of the FatFs mount dropped after host writes
+#define INVALID_WINDOW_SECTOR           0xFFFFFFFFu         // Window is read again by the next access
+#define INVALID_CLUSTER                 0xFFFFFFFFu         // Free clusters are not known
+#define FSINFO_DISABLED                 0x80
 
 #define COMMAND_MAX_LENGTH              10          
 
-#define USB_REINIT_DELAY                2000
+#define PART_OPTION_LENGTH              32
+#define EXTENTS_OPTION                  "extents="          // Number of the partition pieces on the card
+#define CLONE_OPTION                    "clone="            // Partition which sectors the clone shares
+#define FORMAT_OPTION                   "format="           // File system written by the device to the new partition
+#define FAT32_OPTION_VALUE              "fat32"
+#define EXFAT_OPTION_VALUE              "exfat"
+#define COMPRESS_OPTION                 "compress"          // Chunks of the partition are stored compressed
+#define READ_ONLY_OPTION                "readonly"          // Host can't write the partition
 // Supported user commands
 typedef enum {
   CHANGE_PARTITION = 0,  
   UPDATE_ROOT_CONFIGURATIONS,
   SHOW_ROOT_CONFIGURATIONS,
   INIT_DEVICE_CONFIGURATIONS,
+  CLONE_PARTITION,
+  EXPORT_PARTITION,
   // Add new commands here
   NO_COMMAND
 } Command;
@@ -59,10 +90,52 @@ const static struct {
     {CHANGE_PARTITION,            "ChangePart"},
     {UPDATE_ROOT_CONFIGURATIONS,  "UpdateConf"},
     {SHOW_ROOT_CONFIGURATIONS,    "ShowConf"},
-    {INIT_DEVICE_CONFIGURATIONS,  "InitConf"}
+    {INIT_DEVICE_CONFIGURATIONS,  "InitConf"},
+    {CLONE_PARTITION,             "ClonePart"},
+    {EXPORT_PARTITION,            "ExportPart"}
     // Add new commands here
 };
 
+// Header of the export file, the changed ranges follow it
+typedef struct {
+   uint32_t magic;                                      // EXPORT_MAGIC
+   uint32_t version;                                    // EXPORT_VERSION
+   uint64_t sectorNumber;                               // Sectors of the partition image
+   uint32_t unitSectors;                                // Tracked unit of the partition
+   uint32_t rangeNumber;
+   char name[PART_NAME_LENGHT];
+} ExportHeader;
+// Changed range of the export file, the sectors follow it as they are stored on the card
+typedef struct {
+   uint64_t startSector;
+   uint64_t sectorNumber;
+} ExportRange;
+
+// Names of the freed memory erase statuses
+const static char *eraseStatusNames[] = {
+    "None",
+    "In progress",
+    "Done",
+    "Failed"
+};
+
+// Names of the partition relocation statuses
+const static char *relocationStatusNames[] = {
+    "None",
+    "InProgress",
+    "Done",
+    "Failed"
+};
+
+// Names of the FatFs file system types
+const static char *fileSystemNames[] = {
+    "Unknown",
+    "FAT12",
+    "FAT16",
+    "FAT32",
+    "exFAT"
+};
+
 /* Private variables -----------------------------------------------*/
 FATFS SDFatFs;                                          // File system object for SD card logical drive
 WORD commandFileLastModifTime = 0;                      // Last modified time of command file
@@ -70,87 +143,310 @@ extern HAL_SD_CardInfoTypedef SDCardInfo;
 extern PartitionsStructure partitionsStructure;
 extern USBD_HandleTypeDef hUsbDeviceFS;
 
-PartitionsStructure newConfStructure;                   // Contains new configuration for the device
+// State of the partition export
+FIL exportFile;
+ExportHeader exportHeader;
+Partition exportPartition;
+ExtentIndex exportIndex;
+BYTE *exportBuffer;                                     // Exported sectors, taken from the work arena by the export
 
 /*
  * The partition should be scanned for containing command file.
  * If you delete this check the infinity loop can be created by switching partitions.
 */
 uint8_t isPartitionScanned;        
+uint8_t isScanFailed;                                   // File system was not found, it is looked for after host writes
+uint8_t isMounted;                                      // File system of the command partition stays mounted between checks
+uint8_t isRootChanged;                                  // The device changed the root directory, it is scanned again
+// New configurations streamed by the mailbox requests, taken from the work arena till the update ends
+PartitionsStructure *mailboxConf;
+uint16_t mailboxPartNumber;                             // Partitions added to the new configurations
 /* Private user interface function prototypes -----------------------------------------------*/
 // Executes command
 void executeCommandFile(void);
+void runCommandFile(char*);
+FRESULT mountFileSystem(void);
+void dropHostChanges(uint8_t);
+FRESULT scanRootDirectory(uint8_t*);
+FRESULT lookupCommandFile(uint8_t*);
+void watchDirectorySector(DWORD);
 // Command executors
-uint8_t doRootConfig(const char*, const uint32_t*, const uint32_t*);
-uint8_t doPartConfig(const char*, const uint32_t*, const uint32_t*);
+uint8_t doRootConfig(CommandReader*);
+uint8_t doPartConfig(CommandReader*);
 uint8_t doShowConfig(const char*, const PartitionsStructure*);
+uint8_t doCloneConfig(CommandReader*);
+uint8_t setCloneConfig(PartitionsStructure*, const char*, const char*, Partition*);
+uint8_t doExportConfig(CommandReader*);
+uint8_t exportChangedRange(uint64_t, uint64_t);
+uint8_t isPartitionVisible(const char*);
+// Mailbox request executors
+uint8_t queryMailboxPartitions(uint32_t, MailboxResponse*);
+uint8_t readMailboxStats(uint32_t, MailboxResponse*);
+uint8_t beginMailboxUpdate(const MailboxRequest*);
+uint8_t addMailboxPartition(const MailboxRequest*);
+uint8_t commitMailboxUpdate(void);
+void endMailboxUpdate(void);
 // Parsers
-uint8_t parsePartConfig(const char*, const uint32_t*, const uint32_t*, char*, char*);
-uint8_t parseRootConfig(const char*, const uint32_t*, const uint32_t*, PartitionsStructure*);
+uint8_t parsePartConfig(CommandReader*, char*, char*, uint8_t*);
+uint8_t parseRootConfig(CommandReader*, PartitionsStructure*);
+uint8_t parsePartOptions(CommandReader*, Partition*, FormatType*);
+uint8_t parseCloneConfig(CommandReader*, char*, char*, Partition*);
 
-void getCommand(const char*, const uint32_t*, uint32_t*, Command*);
-void getRootPassword(const char*, const uint32_t*, uint32_t*, char*);
+void getCommand(CommandReader*, Command*);
+void getRootPassword(CommandReader*, char*);
 
 uint8_t initDeviceConf(void);
-int8_t isNewLineOrEnd(const char*, const uint32_t*, const uint32_t*);
-void formConfFileText(FIL*, const PartitionsStructure*);
+uint8_t openRootConf(const char*);
+void formConfFileText(ConfText*, const PartitionsStructure*, uint8_t);
 uint8_t isCommandFileUpdated(const FILINFO*, const char*, const WORD*);
-uint8_t scrollToLineEnd(const char*, const uint32_t*, uint32_t*);
-uint8_t findWordBeforeSpace(const char*, const uint32_t*, uint32_t*, uint8_t*);
-void formConfFileText(FIL*, const PartitionsStructure*);
 void commandExecutionResult(uint8_t);
-void getLine(const char*, const uint32_t*, uint32_t*, char*, uint8_t);
-uint8_t changePartAndReinitUSB(const char*, const char*);
+char* formatUInt64(char*, uint64_t);
+uint8_t changePartAndNotifyHost(uint8_t, const char*, const char*);
 /* Public user interface functions ---------------------------------------------------------*/
 
+/*******************************************************************************
+* Description    : Does the background work of the device while the host is idle.
+* Input          : None.
+* Output         : None.
+* Return         : None.
+*******************************************************************************/
+void doIdleWork() {
+  if (hUsbDeviceFS.dev_state != USBD_STATE_CONFIGURED) {
+    completeMediaChange();                              // No host to see the medium change
+  }
+  continueFreedErase();                                 // Memory freed by the update is erased in slices
+  continueRelocation();                                 // Partition data is moved while the host is idle
+  continueFormats();                                    // Formats wait for the moves and the erase
+  collectWearPool(WEAR_COLLECT_STEP_TIME);              // Segments of the hot sector log are freed in idle time too
+}
+
 /*******************************************************************************
 * Description    : Scans root directory of the currently visible partition for the command file
 *                      Command file - the file that contains commands to device and have name COMMAND_FILE_NAME.
+*                      Runs as the main loop task, so FatFs is never used by an interrupt.
 * Input          : None.
 * Output         : None.
 * Return         : None.
 *******************************************************************************/
 void checkConfFiles() {
   FRESULT res;
-  DIR dir;
-  FILINFO fno;
+  uint32_t changeTime;
+  uint8_t changes;
+  uint8_t isUpdated = 0;
   
-  res = f_mount(&SDFatFs, (TCHAR const*)SD_Path, 0);    // Mount and remount file system
+  if (!isLunReady(COMMAND_LUN)) {
+    return;                                             // Host didn't see the change of the partition yet
+  }
+  changes = takeCommandChanges(&changeTime);
+  if (((changes & ~COMMAND_CHANGE_WINDOW) == 0) && !isRootChanged && (isPartitionScanned || isScanFailed)) {
+    dropHostChanges(changes);
+    return;                                             // Host didn't write the root directory, nothing to look up
+  }
+  if (!isMounted || (changes & COMMAND_CHANGE_VOLUME)) {
+    res = mountFileSystem();
+  } else {
+    dropHostChanges(changes);                           // Mount stays, only the changed state is read again
+    res = FR_OK;
+  }
   if (res == FR_OK) {
-    res = f_opendir(&dir, SD_Path);                     // Open the directory 
-    if (res == FR_OK) {
-      for (;;) {
-        res = f_readdir(&dir, &fno);                    // Read a directory item 
-        if ((res != FR_OK) || (fno.fname[0] == 0)) {                 
-          break;                                        // Break on error or end of dir 
-        }
-        if (!(fno.fattrib & AM_DIR)) {                  // It is a file 
-                                                        // Check for the command file
-          if (isCommandFileUpdated(&fno, COMMAND_FILE_NAME, &commandFileLastModifTime)) {
-            commandFileLastModifTime = fno.ftime;       // Remember time when the command file was updated
-            if (isPartitionScanned != 0) {              // First scan of root dir shouldn't executes commands
-              executeCommandFile();
-              f_closedir(&dir);
-              return;
-            }
-          } 
-        }
-      }
-      f_closedir(&dir);
-    } 
-  }  
+    if (!isPartitionScanned || isRootChanged
+        || (changes & (COMMAND_CHANGE_LAYOUT | COMMAND_CHANGE_VOLUME))) {
+      res = scanRootDirectory(&isUpdated);              // Root directory could grow, its sectors are watched again
+    } else {
+      res = lookupCommandFile(&isUpdated);
+    }
+  }
+  isRootChanged = 0;
+  if ((res == FR_OK) && isUpdated && (isPartitionScanned != 0)) {   // First scan of root dir shouldn't executes commands
+    deviceStatistics.commandDetectTime = HAL_GetTick() - changeTime;
+    executeCommandFile();
+    isRootChanged = 1;                                  // The device changed the root directory itself
+    postTask(COMMAND_TASK);
+    return;
+  }
   if (res == FR_OK) {
     isPartitionScanned = 1;                             // Partition scanned
+    isScanFailed = 0;
     commandExecutionResult(0);
   } else {
     isPartitionScanned = 0;                             // Try to reinit file system and try to scan again
+    isScanFailed = 1;                                   // after the host writes the partition
+    isMounted = 0;
+    resetCommandWatch(NULL);
   }
-  
-  //f_mount(0, (TCHAR const*)SD_Path, 0);                 // Unmount
+}
+
+/*******************************************************************************
+* Description    : Runs the request of the mailbox command. The host waits for the response,
+*                    so the request runs without waiting for the idle host. The host reads
+*                    the pending response till the request ends.
+* Input          : None.
+* Output         : None.
+* Return         : None.
+*******************************************************************************/
+void doMailboxRequest() {
+  const MailboxRequest *request = getMailboxRequest();
+  MailboxResponse *response = getMailboxResponse();
+  uint8_t res = 1;
+
+  if ((openRootConf(request->rootKey) == 0)
+      && ((request->operation == MAILBOX_CHANGE_PARTITION)
+          || (strncmp(partitionsStructure.confKey, request->confKey, CONF_KEY_LENGHT) == 0))) {
+    switch (request->operation) {
+      case MAILBOX_CHANGE_PARTITION: {
+        res = request->lun < MAX_LUN_NUMBER ? changePartAndNotifyHost(request->lun, request->name, request->key) : 1;
+        break;
+      }
+      case MAILBOX_QUERY_CONFIG: {
+        res = queryMailboxPartitions(request->offset, response);
+        break;
+      }
+      case MAILBOX_UPDATE_BEGIN: {
+        res = beginMailboxUpdate(request);
+        break;
+      }
+      case MAILBOX_UPDATE_ADD: {
+        res = addMailboxPartition(request);
+        break;
+      }
+      case MAILBOX_UPDATE_COMMIT: {
+        res = commitMailboxUpdate();
+        break;
+      }
+      case MAILBOX_READ_STATS: {
+        res = readMailboxStats(request->offset, response);
+        break;
+      }
+      default: {
+        // do nothing
+      }
+    }
+  }
+  completeMailboxRequest(res);
 }
 
 /* Private controller functions ---------------------------------------------------------*/
 
+/*******************************************************************************
+* Description    : Mounts file system of the command partition. The mount is kept
+*                    till the host writes the boot sectors or the partition is switched.
+* Input          : None.
+* Output         : None.
+* Return         : Result of the mount.
+*******************************************************************************/
+FRESULT mountFileSystem(void) {
+  uint32_t startStamp = getTimeStamp();
+  FRESULT res = f_mount(&SDFatFs, (TCHAR const*)SD_Path, 1);    // Mount and remount file system (FAT or exFAT)
+  isMounted = res == FR_OK ? 1 : 0;
+  if (res == FR_OK) {
+    ++deviceStatistics.mountCount;
+    deviceStatistics.mountTime = getElapsedMicros(startStamp);
+    deviceStatistics.fileSystemType = SDFatFs.fs_type;
+    if ((deviceStatistics.enumerationTime == 0) && (deviceStatistics.enumerationStartTime != 0)) {
+      deviceStatistics.enumerationTime = HAL_GetTick() - deviceStatistics.enumerationStartTime;
+    }
+    if (deviceStatistics.bootMountTime == 0) {
+      deviceStatistics.bootMountTime = HAL_GetTick();
+    }
+  }
+  return res;
+}
+
+/*******************************************************************************
+* Description    : Drops the state of the mounted file system written by the host.
+*                    Window of FatFs is read again, the free clusters are counted again
+*                    and FSInfo is not updated till the next mount.
+* Input          : changes - COMMAND_CHANGE_* flags.
+* Output         : None.
+* Return         : None.
+*******************************************************************************/
+void dropHostChanges(uint8_t changes) {
+  if (!isMounted) {
+    return;
+  }
+  if ((changes & COMMAND_CHANGE_WINDOW) && !SDFatFs.wflag) {   // Device writes are flushed by the end of the command
+    SDFatFs.winsect = INVALID_WINDOW_SECTOR;
+    ++deviceStatistics.windowDropCount;
+  }
+  if (changes & COMMAND_CHANGE_LAYOUT) {
+    SDFatFs.free_clst = INVALID_CLUSTER;
+    SDFatFs.last_clst = INVALID_CLUSTER;
+    SDFatFs.fsi_flag |= FSINFO_DISABLED;
+  }
+}
+
+/*******************************************************************************
+* Description    : Scans root directory for the command file and watches sectors of
+*                    the directory for the host writes.
+* Input          : None.
+* Output         : isUpdated - 1 if the command file was updated.
+* Return         : Result of the scan.
+*******************************************************************************/
+FRESULT scanRootDirectory(uint8_t *isUpdated) {
+  DIR dir;
+  FILINFO fno;
+  FRESULT res = f_opendir(&dir, SD_Path);               // Open the directory 
+  ++deviceStatistics.rootScanCount;
+  resetCommandWatch(&SDFatFs);
+  if (res == FR_OK) {
+    for (;;) {
+      watchDirectorySector(dir.sect);                   // Sector of the next item, free items are the tail
+      res = f_readdir(&dir, &fno);                      // Read a directory item 
+      if ((res != FR_OK) || (fno.fname[0] == 0)) {                 
+        break;                                          // Break on error or end of dir 
+      }
+      if (!(fno.fattrib & AM_DIR)) {                    // It is a file 
+                                                        // Check for the command file
+        if (isCommandFileUpdated(&fno, COMMAND_FILE_NAME, &commandFileLastModifTime)) {
+          commandFileLastModifTime = fno.ftime;         // Remember time when the command file was updated
+          *isUpdated = 1;
+        } 
+      }
+    }
+    f_closedir(&dir);
+  }
+  return res;
+}
+
+/*******************************************************************************
+* Description    : Looks up the command file without the directory scan. Host wrote
+*                    only items of the root directory.
+* Input          : None.
+* Output         : isUpdated - 1 if the command file was updated.
+* Return         : Result of the lookup.
+*******************************************************************************/
+FRESULT lookupCommandFile(uint8_t *isUpdated) {
+  FILINFO fno;
+  FRESULT res = f_stat(COMMAND_FILE_NAME, &fno);
+  ++deviceStatistics.commandLookupCount;
+  if (res == FR_NO_FILE) {
+    return FR_OK;                                       // Other files were written
+  }
+  if ((res == FR_OK) && isCommandFileUpdated(&fno, COMMAND_FILE_NAME, &commandFileLastModifTime)) {
+    commandFileLastModifTime = fno.ftime;
+    *isUpdated = 1;
+  }
+  return res;
+}
+
+/*******************************************************************************
+* Description    : Watches the root directory sector till the end of its cluster,
+*                    new items are written to the free tail of the cluster.
+* Input          : sector - sector of the root directory, 0 at the end of the directory.
+* Output         : None.
+* Return         : None.
+*******************************************************************************/
+void watchDirectorySector(DWORD sector) {
+  if (sector == 0) {
+    return;
+  }
+  if (sector < SDFatFs.database) {                      // FAT12/16 root directory is placed before the data area
+    addCommandWatch(sector, SDFatFs.database - sector);
+  } else {
+    addCommandWatch(sector, SDFatFs.csize - (sector - SDFatFs.database) % SDFatFs.csize);
+  }
+}
+
 /*******************************************************************************
 * Description    : Executes user command from the command file.
 * Input          : None.
@@ -158,42 +454,51 @@ void checkConfFiles() {
 * Return         : None.
 *******************************************************************************/
 void executeCommandFile() {
+  char *buff;
+  beginWorkMeasure();
+  buff = allocWorkBuffer(COMMAND_CHUNK_SIZE);           // Chunk of the command file lives till the command ends
+  if (buff != NULL) {
+    runCommandFile(buff);
+    releaseWorkBuffer(buff);
+  }
+  endWorkMeasure();
+}
+
+/*******************************************************************************
+* Description    : Reads user command from the command file and runs it. The file
+*                    is parsed by chunks while the command runs.
+* Input          : buff - buffer of the command file chunk.
+* Output         : None.
+* Return         : None.
+*******************************************************************************/
+void runCommandFile(char *buff) {
   FIL commandFile;                                      // File object
-  char buff[1000];
-  uint32_t bytesRead;                                   // File write/read counts
+  CommandReader reader;                                 // Uses for the command file parsing
   Command command;                                      // Command that should be executed
   char password[ROOT_KEY_LENGHT];
-  memset(password, '\0', ROOT_KEY_LENGHT);
-  uint32_t shiftPosition = 0;                           // Uses for the command file parsing
   uint8_t commandResult = 1;
 
-  if ((f_open(&commandFile, COMMAND_FILE_NAME, FA_READ) == FR_OK) 
-      && (f_read(&commandFile, buff, sizeof(buff), (UINT*) &bytesRead) == FR_OK)) {
-    if (bytesRead != 0) {
+  if (f_open(&commandFile, COMMAND_FILE_NAME, FA_READ) == FR_OK) {
+    beginCommandReader(&reader, &commandFile, buff, COMMAND_CHUNK_SIZE);
+    if (peekCommandSymbol(&reader) != COMMAND_READER_END) {
                                                         // Get command and root password from the command file
-      getCommand(buff, &bytesRead, &shiftPosition, &command);
-      getRootPassword(buff, &bytesRead, &shiftPosition, password);
+      getCommand(&reader, &command);
+      getRootPassword(&reader, password);
                                                         // Init or Reinit the device with previous settings
       if ((command == INIT_DEVICE_CONFIGURATIONS)
           && (strncmp(DEVICE_UNIQUE_ID, password, ROOT_KEY_LENGHT) == 0)) {
         commandExecutionResult(initDeviceConf());
         f_close(&commandFile);
         return;
-      }
-                                                        // Load configurations
-      if ((partitionsStructure.initializeStatus == NOT_INITIALIZED)
-          && (loadConf(&partitionsStructure, password) != 0)) {
-        f_close(&commandFile);
-        return;
       }
                                                         // If password not matches then stop method execution
-      if (strncmp(partitionsStructure.rootKey, password, ROOT_KEY_LENGHT) != 0) {
+      if (openRootConf(password) != 0) {
         f_close(&commandFile);
         return;
       }
       switch (command) {                                // Executor of the command
         case SHOW_ROOT_CONFIGURATIONS: {                // Shows current device configurations
-          getLine(buff, &bytesRead, &shiftPosition, password, sizeof(password));
+          readCommandLine(&reader, password, sizeof(password));
           f_close(&commandFile);
           if (strncmp(partitionsStructure.confKey, password, CONF_KEY_LENGHT) == 0) {
               commandResult = doShowConfig(DEVICE_CONFIGS, &partitionsStructure);
@@ -201,14 +506,28 @@ void executeCommandFile() {
           break;
         }
         case UPDATE_ROOT_CONFIGURATIONS: {              // Updates the device configurations
-          getLine(buff, &bytesRead, &shiftPosition, password, sizeof(password));
+          readCommandLine(&reader, password, sizeof(password));
           if (strncmp(partitionsStructure.confKey, password, CONF_KEY_LENGHT) == 0) {
-            commandResult = doRootConfig(buff, &bytesRead, &shiftPosition);
+            commandResult = doRootConfig(&reader);
           }
           break;
         }
         case CHANGE_PARTITION: {                        // Changes current visible partition
-          commandResult = doPartConfig(buff, &bytesRead, &shiftPosition);
+          commandResult = doPartConfig(&reader);
+          break;
+        }
+        case CLONE_PARTITION: {                         // Adds the clone of the partition
+          readCommandLine(&reader, password, sizeof(password));
+          if (strncmp(partitionsStructure.confKey, password, CONF_KEY_LENGHT) == 0) {
+            commandResult = doCloneConfig(&reader);
+          }
+          break;
+        }
+        case EXPORT_PARTITION: {                        // Exports changed sectors of the partition
+          readCommandLine(&reader, password, sizeof(password));
+          if (strncmp(partitionsStructure.confKey, password, CONF_KEY_LENGHT) == 0) {
+            commandResult = doExportConfig(&reader);
+          }
           break;
         }
         default: {
@@ -224,26 +543,38 @@ void executeCommandFile() {
 }
 
 /*******************************************************************************
-* Description    : Changed visible partition and reinit USB connection
-* Input          : partName - name of the partition to be set visible
+* Description    : Changed visible partition. The host sees the medium change of the logical
+*                    unit and reads the new partition without USB reconnection.
+* Input          : lun - logical unit of the partition
+*                  partName - name of the partition to be set visible
 *                  partKey - key of the partition to be set visible.
 * Output         : None.
 * Return         : 0 if success or 1 if not.
 *******************************************************************************/
-uint8_t changePartAndReinitUSB(const char *partName, const char *partKey) {
-  uint8_t res = 1;
-  if (USBD_Stop(&hUsbDeviceFS) == USBD_OK) {
-    res = changePartition(partName, partKey);
-    if (res == 0) {
-      // Init new partition and scan it
-      isPartitionScanned = 0;
-    }
-    HAL_Delay(USB_REINIT_DELAY);            // Time delay for host to recognize detachment of the stick
-    USBD_Start(&hUsbDeviceFS);
+uint8_t changePartAndNotifyHost(uint8_t lun, const char *partName, const char *partKey) {
+  uint8_t res = changePartition(lun, partName, partKey);
+  if ((res == 0) && (lun == COMMAND_LUN)) {
+    // Init new partition and scan it
+    isPartitionScanned = 0;
+    isScanFailed = 0;
   }
   return res;
 }
 
+/*******************************************************************************
+* Description    : Loads the configurations if they are not loaded and checks the root key.
+* Input          : password - root key of the device.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t openRootConf(const char *password) {
+  if ((partitionsStructure.initializeStatus == NOT_INITIALIZED)
+      && (loadConf(&partitionsStructure, password) != 0)) {
+    return 1;
+  }
+  return (strncmp(partitionsStructure.rootKey, password, ROOT_KEY_LENGHT) != 0) ? 1 : 0;
+}
+
 /*******************************************************************************
 * Description    : Init the device with beginning configurations.
 * Input          : None.
@@ -251,23 +582,24 @@ uint8_t changePartAndReinitUSB(const char *partName, const char *partKey) {
 * Return         : 0 if success or 1 if not.
 *******************************************************************************/
 uint8_t initDeviceConf() {
+  Partition partition;
   initStartConf();
-  return changePartAndReinitUSB(partitionsStructure.partitions[0].name, partitionsStructure.partitions[0].key);
+  if (getConfPartition(&partitionsStructure, 0, &partition) != 0) {
+    return 1;
+  }
+  return changePartAndNotifyHost(COMMAND_LUN, partition.name, partition.key);
 }
 
 /*******************************************************************************
 * Description    : Gets user command from the command file
-* Input          : buff - the command file
-*                  bytesRead - byte size of the command file
-*                  shift - position to start search of user command.
+* Input          : reader - reader at the command line.
 * Output         : command - user command.
 * Return         : None.
 *******************************************************************************/
-void getCommand(const char *buff, const uint32_t *bytesRead, uint32_t *shift, Command *command) {
+void getCommand(CommandReader *reader, Command *command) {
   char commandS[COMMAND_MAX_LENGTH];
-  memset(commandS, '\0', COMMAND_MAX_LENGTH);
 
-  getLine(buff, bytesRead, shift, commandS, COMMAND_MAX_LENGTH);    // Get command line text
+  readCommandLine(reader, commandS, COMMAND_MAX_LENGTH);           // Get command line text
                                                                     // Get command status
   for (uint8_t i = 0;  i < sizeof (conversion) / sizeof (conversion[0]); ++i) {
     if (strncmp(commandS, conversion[i].str, COMMAND_MAX_LENGTH) == 0) {
@@ -280,254 +612,557 @@ void getCommand(const char *buff, const uint32_t *bytesRead, uint32_t *shift, Co
 
 /*******************************************************************************
 * Description    : Gets root password from the command file.
-* Input          : buff - the command file
-*                  bytesRead - byte size of the command file
-*                  shift - position to start search of root password.
+* Input          : reader - reader at the root password line.
 * Output         : password - root password.
 * Return         : None.
 *******************************************************************************/
-void getRootPassword(const char *buff, const uint32_t *bytesRead, uint32_t *shift, char *password) {
-  getLine(buff, bytesRead, shift, password, ROOT_KEY_LENGHT);      // Get password line text
+void getRootPassword(CommandReader *reader, char *password) {
+  readCommandLine(reader, password, ROOT_KEY_LENGHT);              // Get password line text
 }
 
 /*******************************************************************************
-* Description    : Gets line from the command file.
-* Input          : buff - the command file
-*                  bytesRead - byte size of the command file
-*                  shift - position of the line in the file
-*                  lineMaxSize - max length of the line.
-* Output         : line - the file line or part of the file line(depends on lineMaxSize).
-* Return         : None.
+* Description    : Executes realization of UPDATE_ROOT_CONFIGURATIONS command
+* Input          : reader - reader at the new configurations.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
 *******************************************************************************/
-void getLine(const char *buff, const uint32_t *bytesRead, uint32_t *shift, char *line, uint8_t lineMaxSize) {
-  int8_t shiftEndOfLine;
-  int8_t actLineSize;
-  for (uint32_t j = *shift; j < *bytesRead; ++j) {
-    shiftEndOfLine = isNewLineOrEnd(buff, &j, bytesRead);
-    if (shiftEndOfLine != -1) {
-      actLineSize = j - *shift - shiftEndOfLine + 1;
-      strncpy(line, buff + *shift, actLineSize < lineMaxSize ? actLineSize : lineMaxSize);
-      *shift = j + shiftEndOfLine + 1;
-      break;
+uint8_t doRootConfig(CommandReader *reader) {
+  Partition partition;
+  PartitionsStructure *newConfStructure = allocWorkBuffer(sizeof(PartitionsStructure));
+  uint8_t res = 1;                                      // New configurations, partitions are streamed to the card
+  if (newConfStructure == NULL) {
+    return res;
+  }
+  res = parseRootConfig(reader, newConfStructure);
+  if (res == 0) {
+    res = setConf(&partitionsStructure, newConfStructure);
+    if (res == 0) {
+      res = getConfPartition(&partitionsStructure, 0, &partition);
+    }
+    if (res == 0) {
+      res = changePartAndNotifyHost(COMMAND_LUN, partition.name, partition.key);
     }
   }
+  releaseWorkBuffer(newConfStructure);
+  return res;
 }
 
 /*******************************************************************************
-* Description    : Executes realization of UPDATE_ROOT_CONFIGURATIONS command
-* Input          : buff - the command file
-*                  bytesRead - byte size of the command file
-*                  shift - position to start search of root password.
+* Description    : Executes realization of CHANGE_PARTITION command
+* Input          : reader - reader at the partition line.
 * Output         : None.
 * Return         : 0 if success or 1 if not.
 *******************************************************************************/
-uint8_t doRootConfig(const char *buff, const uint32_t *bytesRead, const uint32_t *shift) {
-  uint8_t res = parseRootConfig(buff, bytesRead, shift, &newConfStructure);
+uint8_t doPartConfig(CommandReader *reader) {
+  char partName[PART_NAME_LENGHT];
+  char partKey[PART_KEY_LENGHT];
+  uint8_t lun;
+  memset(partName, '\0', PART_NAME_LENGHT);
+  memset(partKey, '\0', PART_KEY_LENGHT);
+  uint8_t res = parsePartConfig(reader, partName, partKey, &lun);
   if (res == 0) {
-    res = setConf(&partitionsStructure, &newConfStructure);
-    if (res == 0) {
-      res = changePartAndReinitUSB(partitionsStructure.partitions[0].name, partitionsStructure.partitions[0].key);
-    }
+    res = changePartAndNotifyHost(lun, partName, partKey);
   }
   return res;
 }
 
 /*******************************************************************************
-* Description    : Executes realization of CHANGE_PARTITION command
-* Input          : buff - the command file
-*                  bytesRead - byte size of the command file
-*                  shift - position to start search of root password.
+* Description    : Executes realization of CLONE_PARTITION command. The table is written
+*                    again with the clone at its end, the clone shares sectors of the
+*                    source, so no data is copied.
+* Input          : reader - reader at the clone line.
 * Output         : None.
 * Return         : 0 if success or 1 if not.
 *******************************************************************************/
-uint8_t doPartConfig(const char *buff, const uint32_t *bytesRead, const uint32_t *shift) {
+uint8_t doCloneConfig(CommandReader *reader) {
+  char sourceName[PART_NAME_LENGHT + 1];
+  char sourceKey[PART_KEY_LENGHT + 1];
+  Partition partition;
+  Partition clone;
+  PartitionsStructure *newConfStructure;
+  uint8_t res;
+  memset(sourceName, '\0', sizeof(sourceName));
+  memset(sourceKey, '\0', sizeof(sourceKey));
+  memset(&clone, '\0', sizeof(clone));
+  if (parseCloneConfig(reader, sourceName, sourceKey, &clone) != 0) {
+    return 1;
+  }
+  newConfStructure = allocWorkBuffer(sizeof(PartitionsStructure));
+  if (newConfStructure == NULL) {
+    return 1;
+  }
+  res = setCloneConfig(newConfStructure, sourceName, sourceKey, &clone);
+  releaseWorkBuffer(newConfStructure);
+  if ((res != 0) || (getConfPartition(&partitionsStructure, 0, &partition) != 0)) {
+    return 1;
+  }
+  return changePartAndNotifyHost(COMMAND_LUN, partition.name, partition.key);
+}
+
+/*******************************************************************************
+* Description    : Writes the partition table again with the clone at its end and
+*                    sets it to the device.
+* Input          : newConfStructure - buffer of the new configurations
+*                  sourceName - name of the cloned partition
+*                  sourceKey - key of the cloned partition
+*                  clone - the clone partition.
+* Output         : clone - the clone with the cipher of the source.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t setCloneConfig(PartitionsStructure *newConfStructure, const char *sourceName, const char *sourceKey,
+    Partition *clone) {
+  Partition partition;
+  uint8_t isSourceFound = 0;
+  memcpy(newConfStructure, &partitionsStructure, sizeof(*newConfStructure));
+  beginConf(&partitionsStructure, newConfStructure);
+  for (uint16_t i = 0; i < partitionsStructure.partitionsNumber; ++i) {
+    if (getConfPartition(&partitionsStructure, i, &partition) != 0) {
+      return 1;
+    }
+    if (strncmp(partition.name, sourceName, PART_NAME_LENGHT) == 0) {
+      if ((partition.partitionType != PUBLIC) && (strncmp(partition.key, sourceKey, PART_KEY_LENGHT) != 0)) {
+        return 1;
+      }
+      isSourceFound = 1;
+      memcpy(clone->key, partition.key, PART_KEY_LENGHT);   // Clone shares the cipher of the source
+      clone->partitionType = partition.partitionType;
+    }
+    if (addConfPartition(&partition) != 0) {
+      return 1;
+    }
+  }
+  strncpy(clone->sourceName, sourceName, PART_NAME_LENGHT);
+  clone->extentNumber = 1;
+  if (!isSourceFound || (addConfPartition(clone) != 0) || (setConf(&partitionsStructure, newConfStructure) != 0)) {
+    return 1;
+  }
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Executes realization of EXPORT_PARTITION command. Sectors of the partition
+*                    changed since the last export are written to the export file as they
+*                    are stored on the card, then the export becomes the new checkpoint.
+* Input          : reader - reader at the partition line.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t doExportConfig(CommandReader *reader) {
   char partName[PART_NAME_LENGHT];
   char partKey[PART_KEY_LENGHT];
+  uint8_t lun;
+  int32_t partNumber = -1;
+  UINT bytesWritten;
+  uint32_t startTime = HAL_GetTick();
   memset(partName, '\0', PART_NAME_LENGHT);
   memset(partKey, '\0', PART_KEY_LENGHT);
-  uint8_t res = parsePartConfig(buff, bytesRead, shift, partName, partKey);
+  if (parsePartConfig(reader, partName, partKey, &lun) != 0) {
+    return 1;
+  }
+  for (uint16_t i = 1; (i < partitionsStructure.partitionsNumber) && (partNumber < 0); ++i) {
+    if (getConfPartition(&partitionsStructure, i, &exportPartition) != 0) {
+      return 1;
+    }
+    if (strncmp(exportPartition.name, partName, PART_NAME_LENGHT) == 0) {
+      partNumber = i;
+    }
+  }
+  if ((partNumber < 0)                                  // Zero partition keeps the export file
+      || ((exportPartition.partitionType != PUBLIC) && (strncmp(exportPartition.key, partKey, PART_KEY_LENGHT) != 0))
+      || (exportPartition.sourceName[0] != '\0')        // Clones are not tracked
+      || exportPartition.isCompressed                   // Stored sectors of the compressed partition are not tracked
+      || isPartitionVisible(exportPartition.name)) {     // The host would change the partition during the export
+    return 1;
+  }
+  buildExtentIndex(&exportPartition, &exportIndex);
+  memset(&exportHeader, 0, sizeof(exportHeader));
+  exportHeader.magic = EXPORT_MAGIC;
+  exportHeader.version = EXPORT_VERSION;
+  exportHeader.sectorNumber = exportPartition.sectorNumber;
+  exportHeader.unitSectors = getChangeUnitSectors(&exportPartition);
+  strncpy(exportHeader.name, exportPartition.name, PART_NAME_LENGHT);
+  deviceStatistics.exportSectors = 0;
+  exportBuffer = allocWorkBuffer(EXPORT_CHUNK_SECTORS * STORAGE_BLOCK_SIZE);
+  if ((exportBuffer == NULL) || (f_open(&exportFile, EXPORT_FILE_NAME, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK)) {
+    releaseWorkBuffer(exportBuffer);
+    return 1;
+  }
+  uint8_t res = (f_write(&exportFile, &exportHeader, sizeof(exportHeader), &bytesWritten) != FR_OK)
+      || (bytesWritten != sizeof(exportHeader)) ? 1 : 0;
   if (res == 0) {
-    res = changePartAndReinitUSB(partName, partKey);
+    res = forEachChangedRange(partNumber, &exportPartition, exportChangedRange);
+  }
+  if (res == 0) {                                       // Header gets the number of the ranges
+    res = (f_lseek(&exportFile, 0) != FR_OK)
+        || (f_write(&exportFile, &exportHeader, sizeof(exportHeader), &bytesWritten) != FR_OK)
+        || (bytesWritten != sizeof(exportHeader)) ? 1 : 0;
   }
+  res = (f_close(&exportFile) != FR_OK) ? 1 : res;
+  releaseWorkBuffer(exportBuffer);
+  if (res != 0) {
+    return 1;
+  }
+  res = resetChangeMap(partNumber, &exportPartition);
+  deviceStatistics.exportTime = HAL_GetTick() - startTime;
+  notifyMediaChange(COMMAND_LUN);                       // Host reads the file system with the new file
   return res;
 }
 
 /*******************************************************************************
-* Description    : Gets name and key of the partition
-* Input          : buff - the command file
-*                  bytesRead - byte size of the command file
-*                  shift - position to start search of root password.
-* Output         : partName - the partition name
-*                  partKey - the partition key.
+* Description    : Writes the changed sector range of the exported partition to the export file.
+* Input          : sector - first sector of the range
+*                  count - number of the sectors.
+* Output         : None.
 * Return         : 0 if success or 1 if not.
 *******************************************************************************/
-uint8_t parsePartConfig(const char *buff, const uint32_t *bytesRead, const uint32_t *shift,
-    char *partName, char *partKey) {
-  uint8_t res = 1;
-  int8_t shiftEndOfLine;
-  for (uint32_t i = *shift; i < *bytesRead; ++i) {
-    if (buff[i] == ' ') {
-      strncpy(partName, buff + *shift, i - *shift);
-      for (uint32_t j = i + 1; j < *bytesRead; ++j) {
-        shiftEndOfLine = isNewLineOrEnd(buff, &j, bytesRead);
-        if (shiftEndOfLine != -1) {
-          strncpy(partKey, buff + i + 1, j - i - 1);
-          //*shift = j + shiftEndOfLine + 1;
-          res = 0;
-          break;
-        }
+uint8_t exportChangedRange(uint64_t sector, uint64_t count) {
+  ExportRange range;
+  UINT bytesWritten;
+  range.startSector = sector;
+  range.sectorNumber = count;
+  if ((f_write(&exportFile, &range, sizeof(range), &bytesWritten) != FR_OK) || (bytesWritten != sizeof(range))) {
+    return 1;
+  }
+  while (count != 0) {
+    UINT chunkSectors = count < EXPORT_CHUNK_SECTORS ? count : EXPORT_CHUNK_SECTORS;
+    if ((readPartitionExtents(&exportPartition, &exportIndex, exportBuffer, sector, chunkSectors)
+            != BLOCK_DEVICE_OK)
+        || (f_write(&exportFile, exportBuffer, chunkSectors * STORAGE_BLOCK_SIZE, &bytesWritten) != FR_OK)
+        || (bytesWritten != chunkSectors * STORAGE_BLOCK_SIZE)) {
+      return 1;                                         // Partition 0 has no space for the export
+    }
+    sector += chunkSectors;
+    count -= chunkSectors;
+    deviceStatistics.exportSectors += chunkSectors;
+  }
+  exportHeader.rangeNumber++;
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Checks the partition to be visible through some logical unit.
+* Input          : name - name of the partition.
+* Output         : None.
+* Return         : True if the host sees the partition.
+*******************************************************************************/
+uint8_t isPartitionVisible(const char *name) {
+  for (uint8_t lun = 0; lun < MAX_LUN_NUMBER; ++lun) {
+    const Partition *lunPartition = getLunPartition(lun);
+    if ((lunPartition != NULL) && (strncmp(lunPartition->name, name, PART_NAME_LENGHT) == 0)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Gives the partitions of the device to the mailbox response.
+* Input          : offset - the first partition of the response.
+* Output         : response - the partitions and their total number.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t queryMailboxPartitions(uint32_t offset, MailboxResponse *response) {
+  Partition partition;
+  MailboxPartition entry;
+  uint32_t number = 0;
+  for (uint32_t i = offset; (i < partitionsStructure.partitionsNumber) && (number < MAILBOX_PARTITIONS_PER_RESPONSE);
+      ++i, ++number) {
+    if (getConfPartition(&partitionsStructure, i, &partition) != 0) {
+      return 1;
+    }
+    memset(&entry, 0, sizeof(entry));
+    entry.sectorNumber = partition.sectorNumber;
+    memcpy(entry.name, partition.name, PART_NAME_LENGHT);
+    memcpy(entry.sourceName, partition.sourceName, PART_NAME_LENGHT);
+    entry.extentNumber = partition.extentNumber;
+    entry.flags = (partition.isCompressed ? MAILBOX_PART_COMPRESSED : 0)
+        | (partition.isReadOnly ? MAILBOX_PART_READ_ONLY : 0)
+        | (partition.partitionType == PRIVATE ? MAILBOX_PART_PRIVATE : 0);
+    entry.lun = MAILBOX_NO_LUN;
+    for (uint8_t lun = 0; lun < MAX_LUN_NUMBER; ++lun) {
+      const Partition *lunPartition = getLunPartition(lun);
+      if ((lunPartition != NULL) && (strncmp(lunPartition->name, partition.name, PART_NAME_LENGHT) == 0)) {
+        entry.lun = lun;
       }
-      break;
     }
+    memcpy(response->data + number * sizeof(entry), &entry, sizeof(entry));   // Data is not aligned for 64-bit
   }
-  return res;
+  response->length = number * sizeof(entry);
+  response->total = partitionsStructure.partitionsNumber;
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Gives the part of the configurations file text to the mailbox response.
+*                    The text has no keys, the response passes through the host.
+* Input          : offset - the first text byte of the response.
+* Output         : response - the text and its total length.
+* Return         : 0.
+*******************************************************************************/
+uint8_t readMailboxStats(uint32_t offset, MailboxResponse *response) {
+  ConfText text;
+  beginConfTextWindow(&text, (char*) response->data, offset, MAILBOX_DATA_SIZE);
+  formConfFileText(&text, &partitionsStructure, 0);
+  response->length = text.size;
+  response->total = text.length;
+  return 0;
 }
 
 /*******************************************************************************
-* Description    : Finds position of the line end
-* Input          : buff - the command file
-*                  bytesRead - byte size of the command file
-*                  shift - position to start search of root password.
+* Description    : Starts new configurations of the mailbox requests, the partitions
+*                    are streamed to the new partition table by the next requests.
+* Input          : request - the request with new keys.
 * Output         : None.
 * Return         : 0 if success or 1 if not.
 *******************************************************************************/
-uint8_t scrollToLineEnd(const char *buff, const uint32_t *bytesRead, uint32_t *shift) {
+uint8_t beginMailboxUpdate(const MailboxRequest *request) {
+  endMailboxUpdate();
+  if ((request->newRootKey[0] == '\0') || (request->newConfKey[0] == '\0')) {
+    return 1;
+  }
+  mailboxConf = allocWorkBuffer(sizeof(PartitionsStructure));   // Commands between the requests take buffers after it
+  if (mailboxConf == NULL) {
+    return 1;
+  }
+  memset(mailboxConf, 0, sizeof(PartitionsStructure));
+  memcpy(mailboxConf->rootKey, request->newRootKey, ROOT_KEY_LENGHT);
+  memcpy(mailboxConf->confKey, request->newConfKey, CONF_KEY_LENGHT);
+  beginConf(&partitionsStructure, mailboxConf);
+  mailboxPartNumber = 0;
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Adds the partition of the mailbox request to new configurations.
+*                    Partitions are added in order of their numbers like UpdateConf lines.
+* Input          : request - the request with the partition.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t addMailboxPartition(const MailboxRequest *request) {
+  Partition partition;
+  if ((mailboxConf == NULL) || (request->offset != mailboxPartNumber) || (mailboxPartNumber >= MAX_PART_NUMBER)
+      || (request->extentNumber > MAX_PART_EXTENTS) || (request->formatType > FORMAT_EXFAT)) {
+    endMailboxUpdate();
+    return 1;
+  }
+  memset(&partition, '\0', sizeof(partition));
+  memcpy(partition.name, request->name, PART_NAME_LENGHT);
+  memcpy(partition.key, request->key, PART_KEY_LENGHT);
+  memcpy(partition.sourceName, request->sourceName, PART_NAME_LENGHT);
+  partition.sectorNumber = request->sectorNumber;
+  partition.extentNumber = request->extentNumber != 0 ? request->extentNumber : 1;
+  partition.isCompressed = (request->flags & MAILBOX_PART_COMPRESSED) ? 1 : 0;
+  partition.isReadOnly = (request->flags & MAILBOX_PART_READ_ONLY) ? 1 : 0;
+  partition.partitionType = ((mailboxPartNumber == 0)
+      || (strncmp(partition.key, PUBLIC_PARTITION_KEY, PART_KEY_LENGHT) == 0)) ? PUBLIC : PRIVATE;
+  if ((addConfPartition(&partition) != 0)
+      || ((request->formatType != FORMAT_NONE)
+          && (requestPartitionFormat(mailboxPartNumber, &partition, (FormatType) request->formatType) != 0))) {
+    endMailboxUpdate();
+    return 1;
+  }
+  ++mailboxPartNumber;
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Sets new configurations of the mailbox requests to the device, the
+*                    zero partition becomes visible like after UpdateConf.
+* Input          : None.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t commitMailboxUpdate() {
+  Partition partition;
   uint8_t res = 1;
-  int8_t newLineStat;
-  for (uint32_t i = *shift; i < *bytesRead; ++i) {
-    newLineStat = isNewLineOrEnd(buff, &i, bytesRead);
-    if (newLineStat != -1) {
-      *shift = i + newLineStat + 1;
-      res = 0;
-      break;
+  if ((mailboxConf != NULL) && (mailboxPartNumber > 1)) {
+    res = setConf(&partitionsStructure, mailboxConf);
+    if (res == 0) {
+      res = getConfPartition(&partitionsStructure, 0, &partition);
+    }
+    if (res == 0) {
+      res = changePartAndNotifyHost(COMMAND_LUN, partition.name, partition.key);
     }
   }
+  endMailboxUpdate();
   return res;
 }
 
 /*******************************************************************************
-* Description    : Finds size of the word. Space is words separator.
-* Input          : buff - the command file
-*                  bytesRead - byte size of the command file
-*                  shift - position to start search of root password.
-* Output         : size - the size of the word.
+* Description    : Drops new configurations of the mailbox requests and gives their
+*                    buffer back to the work arena.
+* Input          : None.
+* Output         : None.
+* Return         : None.
+*******************************************************************************/
+void endMailboxUpdate(void) {
+  releaseWorkBuffer(mailboxConf);
+  mailboxConf = NULL;
+}
+
+/*******************************************************************************
+* Description    : Gets source name and key, the clone name and the clone pool size.
+* Input          : reader - reader at the clone line.
+* Output         : sourceName - name of the cloned partition
+*                  sourceKey - key of the cloned partition
+*                  clone - the clone with name and pool size.
 * Return         : 0 if success or 1 if not.
 *******************************************************************************/
-uint8_t findWordBeforeSpace(const char *buff, const uint32_t *bytesRead, uint32_t *start, uint8_t *size) {
-  uint8_t res = 1;
-  for (uint32_t i = *start; i < *bytesRead; ++i) {
-    if ((buff[i] != ' ') && (buff[i] != '\t')) {
-      *start = i;
-      for (; i < *bytesRead; ++i) {
-        if ((buff[i] == ' ') || (buff[i] == '\t')) {
-          *size = i - *start;
-          res = 0;
-          break;
-        }
-      }
-      break;
+uint8_t parseCloneConfig(CommandReader *reader, char *sourceName, char *sourceKey, Partition *clone) {
+  char buffer[21];                                      // Fits decimal 64-bit sector number
+  char *end;
+  memset(buffer, '\0', sizeof(buffer));
+  if ((readCommandWord(reader, sourceName, PART_NAME_LENGHT) != 0)
+      || (readCommandWord(reader, sourceKey, PART_KEY_LENGHT) != 0)
+      || (readCommandWord(reader, clone->name, PART_NAME_LENGHT) != 0)
+      || (readCommandWord(reader, buffer, sizeof(buffer) - 1) != 0)) {
+    return 1;
+  }
+  clone->sectorNumber = strtoull(buffer, &end, 10);
+  return ((end == buffer) || (*end != '\0')) ? 1 : 0;
+}
+
+/*******************************************************************************
+* Description    : Gets name and key of the partition and optional logical unit
+* Input          : reader - reader at the partition line.
+* Output         : partName - the partition name
+*                  partKey - the partition key
+*                  lun - logical unit of the partition, COMMAND_LUN if it is not set.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t parsePartConfig(CommandReader *reader, char *partName, char *partKey, uint8_t *lun) {
+  char lunS[4];
+  char *end;
+  *lun = COMMAND_LUN;
+  memset(lunS, '\0', sizeof(lunS));
+  if ((readCommandWord(reader, partName, PART_NAME_LENGHT) != 0)
+      || (readCommandWord(reader, partKey, PART_KEY_LENGHT) != 0)) {
+    return 1;
+  }
+  if (readCommandWord(reader, lunS, sizeof(lunS) - 1) == 0) {    // Logical unit follows the key
+    *lun = strtol(lunS, &end, 10);
+    if ((end == lunS) || (*end != '\0') || (*lun >= MAX_LUN_NUMBER)) {
+      return 1;
     }
   }
-  return res;
+  return 0;
 }
 
 /*******************************************************************************
-* Description    : Parsers the file with new device configurations
-* Input          : buff - the command file
-*                  bytesRead - byte size of the command file
-*                  shift - position to start search of root password.
+* Description    : Parsers the file with new device configurations. Partitions are
+*                    streamed one by one to the new partition table while the file
+*                    is read, so the number of partition lines is not limited by RAM.
+* Input          : reader - reader at the new configurations.
 * Output         : newPartitionsStructure - converted new device configurations.
 * Return         : 0 if success or 1 if not.
 *******************************************************************************/
-uint8_t parseRootConfig(const char *buff, const uint32_t *bytesRead, const uint32_t *shift,
-    PartitionsStructure *newPartitionsStructure) {
-  uint8_t res = 1;
-  uint32_t start = *shift;
-  uint8_t size;
+uint8_t parseRootConfig(CommandReader *reader, PartitionsStructure *newPartitionsStructure) {
   char *end;
-  char buffer[10];
-  // Get password for configuration
-  if (findWordBeforeSpace(buff, bytesRead, &start, &size) == 0) {
-    strncpy(newPartitionsStructure->confKey, buff + start, size);    
-    start += size;
-    if (scrollToLineEnd(buff, bytesRead, &start) == 0) {
-      // Get root password
-      if (findWordBeforeSpace(buff, bytesRead, &start, &size) == 0) {
-        strncpy(newPartitionsStructure->rootKey, buff + start, size);    
-        start += size;
-        // Miss one line
-        if ((scrollToLineEnd(buff, bytesRead, &start) == 0) 
-          && (scrollToLineEnd(buff, bytesRead, &start) == 0)) {
-          // Get partition configuration
-          uint8_t i = 0;
-          uint8_t partNumber = 0;
-          for (uint8_t part; i < MAX_PART_NUMBER; ++i) {
-            // Get partition number
-            if (findWordBeforeSpace(buff, bytesRead, &start, &size) != 0) {
-              break;
-            }
-            memset(buffer, '\0', sizeof(buffer));
-            strncpy(buffer, buff + start, size);    
-            start += size;
-            part = strtol(buffer, &end, 10); 
-            if ((end == buffer) || (*end != '\0')) {
-              break;
-            }
-            // Get partition name
-            if (findWordBeforeSpace(buff, bytesRead, &start, &size) != 0) {
-              break;
-            }
-            strncpy(newPartitionsStructure->partitions[part].name, buff + start, size);    
-            start += size;
-            // Get partition key
-            if (findWordBeforeSpace(buff, bytesRead, &start, &size) != 0) {
-              break;
-            }
-            strncpy(newPartitionsStructure->partitions[part].key, buff + start, size);    
-            start += size;
-            // Set partition type (encrypted ot not)
-            if ((part == 0) 
-                || (strncmp(newPartitionsStructure->partitions[part].key,
-                    PUBLIC_PARTITION_KEY,
-                    PART_KEY_LENGHT) == 0)) {
-              newPartitionsStructure->partitions[part].partitionType = PUBLIC;
-            } else {
-              newPartitionsStructure->partitions[part].partitionType = PRIVATE;
-            }
-            // Get partition number of sectors
-            if (findWordBeforeSpace(buff, bytesRead, &start, &size) != 0) {
-              break;
-            }
-            if (part != 0) {
-              newPartitionsStructure->partitions[part]
-                  .startSector = newPartitionsStructure->partitions[part - 1].lastSector + 1;
-            } else {
-              newPartitionsStructure->partitions[part].startSector = 0;
-            }
-            memset(buffer, '\0', sizeof(buffer));
-            strncpy(buffer, buff + start, size);
-            start += size;
-            newPartitionsStructure->partitions[part].sectorNumber = strtol(buffer, &end, 10); 
-            if ((end == buffer) || (*end != '\0')) {
-              break;
-            }
-            newPartitionsStructure->partitions[part].lastSector = newPartitionsStructure->partitions[part]
-                .startSector + newPartitionsStructure->partitions[part].sectorNumber - 1;
-            if (scrollToLineEnd(buff, bytesRead, &start) != 0) {
-              break;
-            }
-            partNumber++;
-          }
-          if (partNumber > 1) {
-            newPartitionsStructure->partitionsNumber = partNumber;
-            res = 0;
-          }
-        }
+  char buffer[21];                                      // Fits decimal 64-bit sector number
+  Partition partition;
+  FormatType formatType;
+  uint16_t partNumber = 0;
+  memset(newPartitionsStructure, 0, sizeof(*newPartitionsStructure));
+  memset(buffer, '\0', sizeof(buffer));
+  // Get password for configuration and root password, miss the header line
+  if ((readCommandWord(reader, newPartitionsStructure->confKey, CONF_KEY_LENGHT) != 0)
+      || (skipCommandLine(reader) != 0)
+      || (readCommandWord(reader, newPartitionsStructure->rootKey, ROOT_KEY_LENGHT) != 0)
+      || (skipCommandLine(reader) != 0)
+      || (skipCommandLine(reader) != 0)) {
+    return 1;
+  }
+  // Get partition configuration
+  beginConf(&partitionsStructure, newPartitionsStructure);
+  for (uint32_t part; partNumber < MAX_PART_NUMBER; ++partNumber) {
+    memset(&partition, '\0', sizeof(partition));
+    // Get partition number
+    if (readCommandWord(reader, buffer, sizeof(buffer) - 1) != 0) {
+      break;
+    }
+    part = strtoul(buffer, &end, 10);
+    if ((end == buffer) || (*end != '\0') || (part != partNumber)) {
+      break;                                            // Partitions are numbered in order
+    }
+    // Get partition name and key
+    if ((readCommandWord(reader, partition.name, PART_NAME_LENGHT) != 0)
+        || (readCommandWord(reader, partition.key, PART_KEY_LENGHT) != 0)) {
+      break;
+    }
+    // Set partition type (encrypted ot not)
+    if ((part == 0)
+        || (strncmp(partition.key,
+            PUBLIC_PARTITION_KEY,
+            PART_KEY_LENGHT) == 0)) {
+      partition.partitionType = PUBLIC;
+    } else {
+      partition.partitionType = PRIVATE;
+    }
+    // Get partition number of sectors
+    if (readCommandWord(reader, buffer, sizeof(buffer) - 1) != 0) {
+      break;
+    }
+    partition.sectorNumber = strtoull(buffer, &end, 10);
+    if ((end == buffer) || (*end != '\0')) {
+      break;
+    }
+    // Get partition options, the device places partition on the volume itself
+    partition.extentNumber = 1;
+    if (parsePartOptions(reader, &partition, &formatType) != 0) {
+      break;
+    }
+    if ((addConfPartition(&partition) != 0)
+        || ((formatType != FORMAT_NONE) && (requestPartitionFormat(part, &partition, formatType) != 0))) {
+      return 1;
+    }
+    skipCommandLine(reader);
+  }
+  return partNumber > 1 ? 0 : 1;
+}
+
+/*******************************************************************************
+* Description    : Parsers options which follow the partition number of sectors till the line end.
+*                    Supported options: extents=[N] - spread the partition in N pieces across the card,
+*                    clone=[Name] - the partition is the clone of the partition Name,
+*                    format=[fat32|exfat] - the device writes the file system to the new partition,
+*                    compress - the device compresses the partition sectors,
+*                    readonly - the host can't write the partition.
+* Input          : reader - reader after the partition number of sectors.
+* Output         : partition - the partition with the options
+*                  formatType - requested file system or FORMAT_NONE.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t parsePartOptions(CommandReader *reader, Partition *partition, FormatType *formatType) {
+  char option[PART_OPTION_LENGTH];
+  char *end;
+  *formatType = FORMAT_NONE;
+  memset(option, '\0', sizeof(option));
+  while (readCommandWord(reader, option, sizeof(option) - 1) == 0) {
+    if (strncmp(option, EXTENTS_OPTION, sizeof(EXTENTS_OPTION) - 1) == 0) {
+      partition->extentNumber = strtol(option + sizeof(EXTENTS_OPTION) - 1, &end, 10);
+      if ((end == option + sizeof(EXTENTS_OPTION) - 1) || (*end != '\0')
+          || (partition->extentNumber == 0) || (partition->extentNumber > MAX_PART_EXTENTS)) {
+        return 1;
+      }
+    } else if (strncmp(option, CLONE_OPTION, sizeof(CLONE_OPTION) - 1) == 0) {
+      strncpy(partition->sourceName, option + sizeof(CLONE_OPTION) - 1, PART_NAME_LENGHT);
+      if (partition->sourceName[0] == '\0') {
+        return 1;
       }
+    } else if (strcmp(option, COMPRESS_OPTION) == 0) {
+      partition->isCompressed = 1;
+    } else if (strcmp(option, READ_ONLY_OPTION) == 0) {
+      partition->isReadOnly = 1;
+    } else if (strcmp(option, FORMAT_OPTION FAT32_OPTION_VALUE) == 0) {
+      *formatType = FORMAT_FAT32;
+    } else if (strcmp(option, FORMAT_OPTION EXFAT_OPTION_VALUE) == 0) {
+      *formatType = FORMAT_EXFAT;
+    } else {
+      return 1;                                               // Unknown option
     }
   }
-              
-  return res;
+  return 0;
 }
 
 /*******************************************************************************
@@ -539,70 +1174,209 @@ uint8_t parseRootConfig(const char *buff, const uint32_t *bytesRead, const uint3
 *******************************************************************************/
 uint8_t doShowConfig(const char *fileName, const PartitionsStructure *partitionsStructure) {
   FIL configFile;    
+  ConfText text;
+  uint32_t startTime = HAL_GetTick();
+  uint32_t startWrites = deviceStatistics.fileSystemWrites;
+  char *buffer = allocWorkBuffer(CONF_TEXT_BUFFER_SIZE);   // Text is written to the file by whole sectors
   uint8_t res = 1;
-  
+  if (buffer == NULL) {
+    return res;
+  }
   res = f_open(&configFile, fileName, FA_CREATE_ALWAYS | FA_WRITE);
-  if ((res == FR_OK) && (USBD_Stop(&hUsbDeviceFS) == USBD_OK)) {
-    formConfFileText(&configFile, partitionsStructure);
-    f_close(&configFile);
-    HAL_Delay(2000);                                      // Time delay for host to recognize detachment of the stick
-    res = USBD_Start(&hUsbDeviceFS);
+  if (res == FR_OK) {
+    beginConfText(&text, &configFile, buffer);
+    formConfFileText(&text, partitionsStructure, 1);
+    res = endConfText(&text);
+    res = (f_close(&configFile) != FR_OK) ? 1 : res;
+    notifyMediaChange(COMMAND_LUN);                       // Host reads the file system with the new file
+    deviceStatistics.showConfFileWrites = text.writeCount;
   }
+  releaseWorkBuffer(buffer);
+  deviceStatistics.showConfTime = HAL_GetTick() - startTime;
+  deviceStatistics.showConfCardWrites = deviceStatistics.fileSystemWrites - startWrites;
   return res;
 }
 
 /*******************************************************************************
 * Description    : Forms file that contains current device configurations
-* Input          : fil - file that will contains configurations
-*                  partitionsStructure - the device configurations.
+* Input          : text - text output of the file that will contains configurations
+*                  partitionsStructure - the device configurations
+*                  isKeyShown - the keys and the update template are printed.
 * Output         : None.
 * Return         : None.
 *******************************************************************************/
-void formConfFileText(FIL *fil, const PartitionsStructure *partitionsStructure) {
-  f_printf(fil, "%s\n", "-------Configurations of The Device---->To save changes please delete this line");
-  f_printf(fil, "%s\n", conversion[1].str);      // Update to update configurations
-  f_printf(fil, "%s\n", partitionsStructure->rootKey);
-  f_printf(fil, "%s\n", partitionsStructure->confKey);
-  // Configuration
-  f_printf(fil, "%s <--- Key for revealing device configurations\n", partitionsStructure->confKey);
-  f_printf(fil, "%s <--- Root Key of the device\n", partitionsStructure->rootKey);
+void formConfFileText(ConfText *text, const PartitionsStructure *partitionsStructure, uint8_t isKeyShown) {
+  char number[21];                                        // The text output can't print 64-bit numbers
+  Partition partition;
+  if (isKeyShown) {
+    printConfText(text, "%s\n", "-------Configurations of The Device---->To save changes please delete this line");
+    printConfText(text, "%s\n", conversion[1].str);    // Update to update configurations
+    printConfText(text, "%s\n", partitionsStructure->rootKey);
+    printConfText(text, "%s\n", partitionsStructure->confKey);
+    // Configuration
+    printConfText(text, "%s <--- Key for revealing device configurations\n", partitionsStructure->confKey);
+    printConfText(text, "%s <--- Root Key of the device\n", partitionsStructure->rootKey);
+  }
   // Partitions table
-  f_printf(fil, "#N___________Name___________Key___________Number of sectors\n");
-  f_printf(fil, "%-3s", "0"); 
-  f_printf(fil, "%-20s ", partitionsStructure->partitions[0].name); 
-  f_printf(fil, "%-20s ", PUBLIC_PARTITION_KEY);
-  f_printf(fil, "%-10d\n", partitionsStructure->partitions[0].sectorNumber);
-  for (uint8_t i = 1; i < partitionsStructure->partitionsNumber; ++i) {
-    f_printf(fil, "%-3d", i);
-    f_printf(fil, "%-20s ", partitionsStructure->partitions[i].name);
-    f_printf(fil, "%-20s ", partitionsStructure->partitions[i].key);
-    f_printf(fil, "%-10d\n", partitionsStructure->partitions[i].sectorNumber);
-  }
-  f_printf(fil, "-------------SD card available memory-------------\n");
-  f_printf(fil, "%-15u     <- Card capacity memory\t\n", SDCardInfo.CardCapacity); 
-  f_printf(fil, "%-15u     <- Card block size\t\n", SDCardInfo.CardBlockSize);
-  f_printf(fil, "%-15u     <- Card block sector number\t\n", 
-            SDCardInfo.CardCapacity / SDCardInfo.CardBlockSize - STORAGE_SECTOR_NUMBER);
-}
-
-/*******************************************************************************
-* Description    : Detects and of the line. Works with Windows and Unix line separators
-* Input          : buff - the file data
-*                  position - the position to check end of the line
-*                  size - thw file size.
-* Output         : None.
-* Return         : 0 if success or 1 if not.
-*******************************************************************************/
-int8_t isNewLineOrEnd(const char *buff, const uint32_t *position, const uint32_t *size) {
-  int8_t shift = -1;
-  
-  if ((buff[*position] == '\r') || (buff[*position] == '\n') || (*size == *position + 1)) {
-    shift = 0;
+  printConfText(text, "#N___________Name___________Key___________Number of sectors___Options\n");
+  for (uint16_t i = 0; i < partitionsStructure->partitionsNumber; ++i) {
+    if (getConfPartition(partitionsStructure, i, &partition) != 0) {
+      break;
+    }
+    printConfText(text, "%-3d", i);
+    printConfText(text, "%-20s ", partition.name);
+    printConfText(text, "%-20s ", !isKeyShown ? "-" : i == 0 ? PUBLIC_PARTITION_KEY : partition.key);
+    printConfText(text, "%-10s ", formatUInt64(number, partition.sectorNumber));
+    if (partition.extentNumber > 1) {
+      printConfText(text, "%s%d ", EXTENTS_OPTION, partition.extentNumber);
+    }
+    if (partition.isCompressed) {
+      printConfText(text, "%s ", COMPRESS_OPTION);
+    }
+    if (partition.isReadOnly) {
+      printConfText(text, "%s ", READ_ONLY_OPTION);
+    }
+    if (partition.sourceName[0] != '\0') {
+      printConfText(text, "%s%s", CLONE_OPTION, partition.sourceName);
+    }
+    printConfText(text, "\n");
   }
-  if ((buff[*position] == '\r') && (buff[*position + 1] == '\n')) {
-    shift = 1;
+  printConfText(text, "-------------SD card available memory-------------\n");
+  printConfText(text, "%-15s     <- Card capacity memory\t\n", formatUInt64(number, getCardSectorNumber() * STORAGE_BLOCK_SIZE));
+  printConfText(text, "%-15u     <- Card block size\t\n", STORAGE_BLOCK_SIZE);
+  printConfText(text, "%-15s     <- Card block sector number\t\n", formatUInt64(number, getVolumeSectorNumber()));
+  printConfText(text, "%-15u     <- Striped cards\t\n", partitionsStructure->stripeGeometry.deviceNumber);
+  printConfText(text, "%-15u     <- Stripe unit (sectors)\t\n", partitionsStructure->stripeGeometry.stripeUnit);
+  // Partitions visible to the host
+  printConfText(text, "-------------Logical units-------------\n");
+  for (uint8_t lun = 0; lun < MAX_LUN_NUMBER; ++lun) {
+    const Partition *lunPartition = getLunPartition(lun);
+    printConfText(text, "%-15s     <- LUN %d\t\n", lunPartition != NULL ? lunPartition->name : "-", lun);
   }
-  return shift;  
+  // Erasing of the memory freed by the last configurations update
+  const EraseProgress *eraseProgress = getEraseProgress();
+  printConfText(text, "-------------Freed memory erase-------------\n");
+  printConfText(text, "%-15s     <- Erase status\t\n", eraseStatusNames[eraseProgress->status]);
+  printConfText(text, "%-15s     <- Erased sectors\t\n", formatUInt64(number, eraseProgress->erasedSectors));
+  printConfText(text, "%-15s     <- Freed sectors\t\n", formatUInt64(number, eraseProgress->freedSectors));
+  printConfText(text, "%-15u     <- Erase time (ms)\t\n", eraseProgress->eraseTime);
+  // Moving of the partition data to the layout of the last configurations update
+  const RelocationProgress *relocationProgress = getRelocationProgress();
+  printConfText(text, "-------------Partition relocation-------------\n");
+  printConfText(text, "%-15s     <- Relocation status\t\n", relocationStatusNames[relocationProgress->status]);
+  printConfText(text, "%-15u     <- Moves\t\n", relocationProgress->moveNumber);
+  printConfText(text, "%-15s     <- Moved sectors\t\n", formatUInt64(number, relocationProgress->movedSectors));
+  printConfText(text, "%-15s     <- Sectors to move\t\n", formatUInt64(number, relocationProgress->totalSectors));
+  printConfText(text, "%-15u     <- Relocation time (ms)\t\n", relocationProgress->relocationTime);
+  // File system of the visible partition
+  printConfText(text, "-------------File system-------------\n");
+  printConfText(text, "%-15s     <- File system type\t\n", fileSystemNames[deviceStatistics.fileSystemType]);
+  printConfText(text, "%-15u     <- Mount time (us)\t\n", deviceStatistics.mountTime);
+  printConfText(text, "%-15u     <- Capacity calculation time (us)\t\n", deviceStatistics.capacityQueryTime);
+  printConfText(text, "%-15u     <- Capacity requests\t\n", deviceStatistics.capacityQueryCount);
+  printConfText(text, "%-15u     <- Enumeration to mount time (ms)\t\n", deviceStatistics.enumerationTime);
+  printConfText(text, "%-15u     <- Card initialization end (ms)\t\n", deviceStatistics.cardInitTime);
+  printConfText(text, "%-15u     <- First mount (ms)\t\n", deviceStatistics.bootMountTime);
+  printConfText(text, "%-15s     <- Capacity from boot record\t\n", deviceStatistics.isBootRecordUsed ? "yes" : "no");
+  // Partition to volume sector translation through the extent index
+  printConfText(text, "-------------Sector translation-------------\n");
+  printConfText(text, "%-15u     <- Translations\t\n", deviceStatistics.translationCount);
+  printConfText(text, "%-15u     <- Average translation time (cycles)\t\n", deviceStatistics.translationCount != 0
+      ? (uint32_t) (deviceStatistics.translationCycles / deviceStatistics.translationCount) : 0);
+  printConfText(text, "%-15u     <- Requests split on extents\t\n", deviceStatistics.splitRequestCount);
+  // Lookups of the clone blocks in the remap table
+  printConfText(text, "-------------Clone remap-------------\n");
+  printConfText(text, "%-15u     <- Remap lookups\t\n", deviceStatistics.remapLookupCount);
+  printConfText(text, "%-15u     <- Average remap lookup time (cycles)\t\n", deviceStatistics.remapLookupCount != 0
+      ? (uint32_t) (deviceStatistics.remapLookupCycles / deviceStatistics.remapLookupCount) : 0);
+  printConfText(text, "%-15u     <- Blocks copied on write\t\n", deviceStatistics.cloneCopyCount);
+  // The last export of the changed sectors
+  printConfText(text, "-------------Changed block export-------------\n");
+  printConfText(text, "%-15s     <- Exported sectors\t\n", formatUInt64(number, deviceStatistics.exportSectors));
+  printConfText(text, "%-15u     <- Export time (ms)\t\n", deviceStatistics.exportTime);
+  // The last format of the partitions by the device
+  printConfText(text, "-------------Partition quick format-------------\n");
+  printConfText(text, "%-15u     <- Written metadata sectors\t\n", deviceStatistics.formatSectors);
+  printConfText(text, "%-15u     <- Format time (ms)\t\n", deviceStatistics.formatTime);
+  printConfText(text, "%-15u     <- Formats not done\t\n", deviceStatistics.formatFailCount);
+  // Compression of the partition chunks
+  printConfText(text, "-------------Compression-------------\n");
+  printConfText(text, "%-15s     <- Written sectors\t\n", formatUInt64(number, deviceStatistics.compressedSectors));
+  printConfText(text, "%-15s     <- Stored sectors\t\n", formatUInt64(number, deviceStatistics.storedSectors));
+  printConfText(text, "%-15u     <- Stored of written (%%)\t\n", deviceStatistics.compressedSectors != 0
+      ? (uint32_t) (deviceStatistics.storedSectors * 100 / deviceStatistics.compressedSectors) : 0);
+  printConfText(text, "%-15u     <- Average compression time (cycles)\t\n", deviceStatistics.compressCount != 0
+      ? (uint32_t) (deviceStatistics.compressCycles / deviceStatistics.compressCount) : 0);
+  printConfText(text, "%-15u     <- Average decompression time (cycles)\t\n", deviceStatistics.decompressCount != 0
+      ? (uint32_t) (deviceStatistics.decompressCycles / deviceStatistics.decompressCount) : 0);
+  printConfText(text, "%-15u     <- Chunk cache hits\t\n", deviceStatistics.chunkCacheHits);
+  printConfText(text, "%-15u     <- Chunk cache misses\t\n", deviceStatistics.chunkCacheMisses);
+  // Cache of the read-only partitions
+  printConfText(text, "-------------Read cache-------------\n");
+  printConfText(text, "%-15u     <- Cache hits\t\n", deviceStatistics.readCacheHits);
+  printConfText(text, "%-15u     <- Cache misses\t\n", deviceStatistics.readCacheMisses);
+  printConfText(text, "%-15s     <- Read ahead sectors\t\n", formatUInt64(number, deviceStatistics.readAheadSectors));
+  printConfText(text, "%-15s     <- Sectors read past the cache\t\n", formatUInt64(number, deviceStatistics.readDirectSectors));
+  // Log of the hot sectors in the pool
+  const WearPoolState *wearPoolState = getWearPoolState();
+  uint32_t minEraseCount = wearPoolState->eraseCounts[0];
+  uint32_t maxEraseCount = wearPoolState->eraseCounts[0];
+  printConfText(text, "-------------Wear leveling-------------\n");
+  printConfText(text, "%-15u     <- Hot sectors in the pool\t\n", wearPoolState->mappedSectors);
+  printConfText(text, "%-15u     <- Free segments\t\n", wearPoolState->freeSegments);
+  printConfText(text, "%-15u     <- Pool writes\t\n", deviceStatistics.wearPoolWrites);
+  printConfText(text, "%-15u     <- Home writes\t\n", deviceStatistics.wearHomeWrites);
+  printConfText(text, "%-15u     <- Collected segments\t\n", deviceStatistics.wearCollectCount);
+  printConfText(text, "%-15u     <- Collections during host writes\t\n", deviceStatistics.wearForegroundCollects);
+  printConfText(text, "%-15u     <- Last collection time (us)\t\n", deviceStatistics.wearCollectTime);
+  printConfText(text, "%-15u     <- Max collection time (us)\t\n", deviceStatistics.wearCollectMaxTime);
+  for (uint8_t i = 0; i < WEAR_SEGMENT_NUMBER; ++i) {
+    minEraseCount = wearPoolState->eraseCounts[i] < minEraseCount ? wearPoolState->eraseCounts[i] : minEraseCount;
+    maxEraseCount = wearPoolState->eraseCounts[i] > maxEraseCount ? wearPoolState->eraseCounts[i] : maxEraseCount;
+    printConfText(text, "%-7u%s", wearPoolState->eraseCounts[i], (i + 1) % 8 == 0 ? "<- Segment erase counts\n" : "");
+  }
+  printConfText(text, "%-15u     <- Min segment erase count\t\n", minEraseCount);
+  printConfText(text, "%-15u     <- Max segment erase count\t\n", maxEraseCount);
+  // Header slots of the stored configurations
+  printConfText(text, "-------------Configurations header-------------\n");
+  printConfText(text, "%-15u     <- Load time (us)\t\n", deviceStatistics.confLoadTime);
+  printConfText(text, "%-15u     <- Save time (us)\t\n", deviceStatistics.confSaveTime);
+  // Memory of the command processing
+  printConfText(text, "-------------Command memory-------------\n");
+  printConfText(text, "%-15u     <- Work arena size (bytes)\t\n", WORK_ARENA_SIZE);
+  printConfText(text, "%-15u     <- Last command arena peak (bytes)\t\n", deviceStatistics.commandArenaPeak);
+  printConfText(text, "%-15u     <- Last command stack peak (bytes)\t\n", deviceStatistics.commandStackPeak);
+  printConfText(text, "%-15u     <- Max arena peak (bytes)\t\n", deviceStatistics.maxArenaPeak);
+  printConfText(text, "%-15u     <- Max stack peak (bytes)\t\n", deviceStatistics.maxStackPeak);
+  printConfText(text, "%-15u     <- Last command file size (bytes)\t\n", deviceStatistics.commandFileBytes);
+  printConfText(text, "%-15u     <- Last command file read time (us)\t\n", deviceStatistics.commandReadTime);
+  // Writing of the configurations file by the previous ShowConf
+  printConfText(text, "-------------Configurations file-------------\n");
+  printConfText(text, "%-15u     <- Previous file time (ms)\t\n", deviceStatistics.showConfTime);
+  printConfText(text, "%-15u     <- Previous file writes\t\n", deviceStatistics.showConfFileWrites);
+  printConfText(text, "%-15u     <- Previous card writes\t\n", deviceStatistics.showConfCardWrites);
+  // Detection of the command file
+  printConfText(text, "-------------Command detection-------------\n");
+  printConfText(text, "%-15u     <- Last detection time (ms)\t\n", deviceStatistics.commandDetectTime);
+  printConfText(text, "%-15u     <- Command file lookups\t\n", deviceStatistics.commandLookupCount);
+  printConfText(text, "%-15u     <- Root directory scans\t\n", deviceStatistics.rootScanCount);
+  printConfText(text, "%-15u     <- File system mounts\t\n", deviceStatistics.mountCount);
+  printConfText(text, "%-15u     <- Dropped FatFs windows\t\n", deviceStatistics.windowDropCount);
+  printConfText(text, "%-15u     <- FatFs sector reads\t\n", deviceStatistics.fileSystemReads);
+  printConfText(text, "%-15u     <- FatFs card writes\t\n", deviceStatistics.fileSystemWrites);
+  // Service time of the host requests
+  printConfText(text, "-------------Host requests-------------\n");
+  printConfText(text, "%-15u     <- Read and write requests\t\n", deviceStatistics.hostRequestCount);
+  printConfText(text, "%-15u     <- Average request time (us)\t\n", deviceStatistics.hostRequestCount != 0
+      ? (uint32_t) (deviceStatistics.hostRequestTime / deviceStatistics.hostRequestCount) : 0);
+  printConfText(text, "%-15u     <- Max request time (us)\t\n", deviceStatistics.hostRequestMaxTime);
+  // Requests of the host through the mailbox commands
+  printConfText(text, "-------------Mailbox requests-------------\n");
+  printConfText(text, "%-15u     <- Requests\t\n", deviceStatistics.mailboxRequestCount);
+  printConfText(text, "%-15u     <- Last request time (ms)\t\n", deviceStatistics.mailboxServiceTime);
+  // Partition switch through the medium change
+  printConfText(text, "-------------Partition switch-------------\n");
+  printConfText(text, "%-15u     <- Last switch time (ms)\t\n", deviceStatistics.partitionSwitchTime);
 }
 
 /*******************************************************************************
@@ -633,3 +1407,23 @@ void commandExecutionResult(uint8_t res) {
   }
 }
 
+/*******************************************************************************
+* Description    : Converts 64-bit unsigned number to the decimal string.
+* Input          : value - the number.
+* Output         : str - the string, must fit 21 symbols.
+* Return         : The string.
+*******************************************************************************/
+char* formatUInt64(char *str, uint64_t value) {
+  char digits[20];
+  uint8_t length = 0;
+  do {
+    digits[length++] = '0' + value % 10;
+    value /= 10;
+  } while (value != 0);
+  for (uint8_t i = 0; i < length; ++i) {
+    str[i] = digits[length - i - 1];
+  }
+  str[length] = '\0';
+  return str;
+}
+
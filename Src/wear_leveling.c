@@ -0,0 +1,657 @@
+/**
+  ******************************************************************************
+  * @file           : WEAR_LEVELING
+  * @version        : v1.0
+  * @brief          : This file implements the log of the hot volume sectors
+  ******************************************************************************
+  * MIT License
+  *
+  * Copyright (c) 2017 Oleksandr Borysov
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+ ******************************************************************************
+*/
+
+
+
+/* Includes ------------------------------------------------------------------*/
+#include "wear_leveling.h"
+#include "relocation.h"
+#include "device_stats.h"
+#include "task_scheduler.h"
+#include <stddef.h>
+#include <string.h>
+
+/* Private define ------------------------------------------------------------*/
+#define WEAR_MAGIC                       0x4C524557u    // "WERL"
+#define SEGMENT_SLOTS                    (WEAR_SEGMENT_SECTORS - 1)  // Data slots after the segment header
+#define SEGMENT_RECORDS                  60             // Slot and home records of one segment, they fill the header sector
+#define HOME_RECORD                      0x8000000000000000ull      // Record returns the sector to its home place
+#define NO_SLOT                          0              // Pool sector 0 is the segment header, it is never a slot
+#define NO_SEGMENT                       0xFF
+#define CHECKSUM_BASIS                   2166136261u    // FNV-1a hash of the segment header
+#define CHECKSUM_PRIME                   16777619u
+
+/* Private typedef -----------------------------------------------------------*/
+// The first sector of the segment. It is rewritten after the data slots, the log
+// relies on the atomic write of one sector like the relocation journal
+typedef struct {
+   uint32_t magic;                                        // WEAR_MAGIC
+   uint32_t sequence;                                     // Segments are started in the order of the sequence
+   uint32_t tailSequence;                                 // Oldest segment of the log when the header was written
+   uint32_t eraseCount;                                   // Times the segment was started
+   uint16_t recordNumber;
+   uint16_t slotNumber;
+   uint64_t records[SEGMENT_RECORDS];                     // Volume sectors in the order of writes, slot record takes the next slot
+   uint32_t reserved;
+   uint32_t checksum;
+} WearSegmentHeader;
+// Hot sector which data is in the pool
+typedef struct {
+   uint64_t sector;                                       // Home volume sector
+   uint16_t slot;                                         // Pool sector with the data or NO_SLOT for the free entry
+   uint32_t lastWrite;                                    // Tick of the last host write, cold sectors return home
+} WearMapEntry;
+// Write counter of the sectors which share the counter
+typedef struct {
+   uint64_t sector;
+   uint16_t count;
+} HotCounter;
+
+/* Private variables ---------------------------------------------------------*/
+WearMapEntry wearMap[WEAR_MAP_ENTRIES];
+HotCounter hotCounters[WEAR_HOT_COUNTERS];
+WearPoolState wearPoolState;
+WearSegmentHeader headHeader;                             // Header of the segment which gets the writes
+WearSegmentHeader tailHeader;                             // Header of the collected or scanned segment
+uint32_t slotData[STORAGE_BLOCK_SIZE / 4];                // Slot moved by the collection, word aligned for DMA
+uint8_t headSegment;
+uint8_t tailSegment;
+uint8_t usedSegments;                                     // Segments from the tail to the head
+uint32_t headSequence;
+uint32_t tailSequence;
+uint8_t isHeadDirty;                                      // Header of the head segment isn't written after the last record
+
+/* Private wear leveling function prototypes -----------------------------------------------*/
+uint8_t isSectorHot(uint64_t);
+uint8_t isPromotionAllowed(void);
+uint8_t appendSlot(WearMapEntry*, uint64_t, const BYTE*, uint8_t);
+uint8_t reserveHeadRecord(uint8_t, uint8_t);
+uint8_t startHeadSegment(void);
+uint8_t storeHeadHeader(void);
+uint8_t collectTailSegment(void);
+uint8_t replaySegment(uint8_t, const WearSegmentHeader*);
+uint8_t loadSegmentHeader(uint8_t, WearSegmentHeader*);
+uint32_t getHeaderChecksum(const WearSegmentHeader*);
+WearMapEntry* findMapEntry(uint64_t);
+WearMapEntry* findFirstMapEntry(uint64_t, UINT);
+WearMapEntry* addMapEntry(uint64_t);
+void removeMapEntry(WearMapEntry*);
+uint64_t getSegmentSector(uint8_t);
+
+/* Public wear leveling functions ---------------------------------------------------------*/
+
+/*******************************************************************************
+* Description    : Calculates the first sector of the pool. The pool is placed before
+*                    the stored configurations.
+* Input          : None.
+* Output         : None.
+* Return         : Card sector of the pool.
+*******************************************************************************/
+uint64_t getWearPoolSector(void) {
+  return getConfSector() - WEAR_POOL_SECTORS;
+}
+
+/*******************************************************************************
+* Description    : Rebuilds the map of the hot sectors from the segment headers. The
+*                    newest segment names the oldest one, segments between them are
+*                    replayed in the order of writes.
+* Input          : None.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t initWearPool(void) {
+  uint8_t newest = NO_SEGMENT;
+  memset(wearMap, 0, sizeof(wearMap));
+  memset(hotCounters, 0, sizeof(hotCounters));
+  memset(&wearPoolState, 0, sizeof(wearPoolState));
+  headSegment = WEAR_SEGMENT_NUMBER - 1;                      // Empty log starts from the first segment
+  usedSegments = 0;
+  headSequence = 0;
+  isHeadDirty = 0;
+  for (uint8_t i = 0; i < WEAR_SEGMENT_NUMBER; ++i) {
+    if (loadSegmentHeader(i, &tailHeader) != 0) {
+      continue;
+    }
+    wearPoolState.eraseCounts[i] = tailHeader.eraseCount;
+    if ((newest == NO_SEGMENT) || (tailHeader.sequence > headSequence)) {
+      newest = i;
+      headSequence = tailHeader.sequence;
+    }
+  }
+  if (newest != NO_SEGMENT) {
+    if ((loadSegmentHeader(newest, &headHeader) != 0) || (headHeader.tailSequence > headSequence)
+        || (headSequence - headHeader.tailSequence >= WEAR_SEGMENT_NUMBER)) {
+      return 1;
+    }
+    headSegment = newest;
+    tailSequence = headHeader.tailSequence;
+    usedSegments = headSequence - tailSequence + 1;
+    tailSegment = (headSegment + WEAR_SEGMENT_NUMBER - (usedSegments - 1)) % WEAR_SEGMENT_NUMBER;
+    for (uint8_t i = usedSegments; i > 1; --i) {
+      uint8_t segment = (headSegment + WEAR_SEGMENT_NUMBER - (i - 1)) % WEAR_SEGMENT_NUMBER;
+      if ((loadSegmentHeader(segment, &tailHeader) != 0) || (tailHeader.sequence != headSequence - (i - 1))
+          || (replaySegment(segment, &tailHeader) != 0)) {
+        return 1;                                             // Sectors of the broken segment would be lost
+      }
+    }
+    if (replaySegment(headSegment, &headHeader) != 0) {
+      return 1;
+    }
+  }
+  wearPoolState.freeSegments = WEAR_SEGMENT_NUMBER - usedSegments;
+#if  WEAR_LEVEL_MOD != 0
+  return flushWearPool();                                     // Hot sectors of the previous firmware return home
+#else
+  return 0;
+#endif
+}
+
+/*******************************************************************************
+* Description    : Reads volume sectors, sectors kept in the pool are read from their slots.
+* Input          : sector - first volume sector
+*                  count - number of the sectors.
+* Output         : buff - read data.
+* Return         : BLOCK_DEVICE_OK if success.
+*******************************************************************************/
+uint8_t wearReadSectors(BYTE *buff, uint64_t sector, UINT count) {
+  uint8_t res = BLOCK_DEVICE_OK;
+  holdHostRequests();                                         // Host write can't move the sector to the pool meanwhile
+  while ((count != 0) && (res == BLOCK_DEVICE_OK)) {
+    WearMapEntry *entry = wearPoolState.mappedSectors != 0 ? findFirstMapEntry(sector, count) : NULL;
+    UINT runLength = entry != NULL ? entry->sector - sector : count;
+    if ((runLength != 0) && (volumeReadSectors(buff, sector, runLength) != BLOCK_DEVICE_OK)) {
+      res = BLOCK_DEVICE_ERROR;
+      break;
+    }
+    buff += runLength * STORAGE_BLOCK_SIZE;
+    sector += runLength;
+    count -= runLength;
+    if (entry != NULL) {
+      if (cardReadSectors(buff, getWearPoolSector() + entry->slot, 1) != MSD_OK) {
+        res = BLOCK_DEVICE_ERROR;
+      }
+      buff += STORAGE_BLOCK_SIZE;
+      sector++;
+      count--;
+    }
+  }
+  releaseHostRequests();
+  return res;
+}
+
+/*******************************************************************************
+* Description    : Writes volume sectors. Sectors kept in the pool and sectors which
+*                    became hot are appended to the log, other sectors are written
+*                    in place. The segment header is written once after the slots.
+* Input          : buff - data to write
+*                  sector - first volume sector
+*                  count - number of the sectors.
+* Output         : None.
+* Return         : BLOCK_DEVICE_OK if success.
+*******************************************************************************/
+uint8_t wearWriteSectors(const BYTE *buff, uint64_t sector, UINT count) {
+  uint8_t res = BLOCK_DEVICE_OK;
+  UINT runLength = 0;                                         // Sectors before the current one written in place
+  WearMapEntry *entry;
+  holdHostRequests();                                         // Host write can't change the log in the middle
+  entry = wearPoolState.mappedSectors != 0 ? findFirstMapEntry(sector, count) : NULL;
+  for (UINT i = 0; (i < count) && (res == BLOCK_DEVICE_OK); ++i) {
+    uint8_t isMapped = (entry != NULL) && (entry->sector == sector + i);
+    if (!isMapped && ((count > WEAR_HOT_REQUEST_SECTORS) || !isSectorHot(sector + i) || !isPromotionAllowed())) {
+      runLength++;
+      continue;
+    }
+    if ((runLength != 0)
+        && (volumeWriteSectors(buff + (i - runLength) * STORAGE_BLOCK_SIZE, sector + i - runLength, runLength)
+            != BLOCK_DEVICE_OK)) {
+      res = BLOCK_DEVICE_ERROR;
+      break;
+    }
+    runLength = 0;
+    if (appendSlot(isMapped ? entry : NULL, sector + i, buff + i * STORAGE_BLOCK_SIZE, 0) != 0) {
+      res = BLOCK_DEVICE_ERROR;
+    }
+    if (i + 1 < count) {                                      // Foreground collection could change the map
+      entry = findFirstMapEntry(sector + i + 1, count - i - 1);
+    }
+  }
+  if ((res == BLOCK_DEVICE_OK) && (runLength != 0)
+      && (volumeWriteSectors(buff + (count - runLength) * STORAGE_BLOCK_SIZE, sector + count - runLength, runLength)
+          != BLOCK_DEVICE_OK)) {
+    res = BLOCK_DEVICE_ERROR;
+  }
+  if (isHeadDirty && (storeHeadHeader() != 0)) {
+    res = BLOCK_DEVICE_ERROR;
+  }
+  releaseHostRequests();
+  return res;
+}
+
+/*******************************************************************************
+* Description    : Returns all hot sectors to their home places and empties the log.
+*                    Sectors are forgotten only when the header of the new empty
+*                    log is written, until then the pool keeps the same data.
+* Input          : None.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t flushWearPool(void) {
+  uint8_t res = 0;
+  if (wearPoolState.mappedSectors == 0) {
+    return 0;
+  }
+  holdHostRequests();
+  for (uint16_t i = 0; (i < WEAR_MAP_ENTRIES) && (res == 0); ++i) {
+    if (wearMap[i].slot == NO_SLOT) {
+      continue;
+    }
+    res = (cardReadSectors((BYTE*) slotData, getWearPoolSector() + wearMap[i].slot, 1) != MSD_OK)
+        || (volumeWriteSectors((BYTE*) slotData, wearMap[i].sector, 1) != BLOCK_DEVICE_OK) ? 1 : 0;
+    deviceStatistics.wearHomeWrites++;
+  }
+  if (res == 0) {
+    isHeadDirty = 0;                                          // New head makes all segments older than the tail
+    usedSegments = 0;
+    res = (startHeadSegment() != 0) || (storeHeadHeader() != 0) ? 1 : 0;
+  }
+  if (res == 0) {
+    memset(wearMap, 0, sizeof(wearMap));
+    wearPoolState.mappedSectors = 0;
+  }
+  releaseHostRequests();
+  return res;
+}
+
+/*******************************************************************************
+* Description    : Collects the oldest segments while the pool has few free segments.
+*                    Hot sectors are copied to the head, cold sectors return home.
+*                    The host interrupt is masked while one segment is collected.
+* Input          : stepTime - collection time in ms.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t collectWearPool(uint32_t stepTime) {
+  uint32_t stepStart = HAL_GetTick();
+  uint8_t res = 0;
+  while ((res == 0) && (wearPoolState.freeSegments < WEAR_FREE_SEGMENTS) && (usedSegments > 1)
+      && (HAL_GetTick() - stepStart < stepTime)) {
+    holdHostRequests();
+    res = collectTailSegment();
+    releaseHostRequests();
+  }
+  return res;
+}
+
+/*******************************************************************************
+* Description    : Gets state of the hot sector pool.
+* Input          : None.
+* Output         : None.
+* Return         : The pool state.
+*******************************************************************************/
+const WearPoolState* getWearPoolState(void) {
+  return &wearPoolState;
+}
+
+/* Private wear leveling functions ---------------------------------------------------------*/
+
+/*******************************************************************************
+* Description    : Counts the write of the sector. Each sector has two counters chosen
+*                    by two hashes, it takes the one with its count or the lower one.
+*                    The write of other sector decrements the counter, so only the sector
+*                    written more often keeps it. Two choices keep the hot sectors with
+*                    the same first hash, like the copies of the FAT, from evicting each other.
+* Input          : sector - the written volume sector.
+* Output         : None.
+* Return         : True if the sector is hot.
+*******************************************************************************/
+uint8_t isSectorHot(uint64_t sector) {
+  HotCounter *counter = &hotCounters[(sector ^ (sector >> 11)) % WEAR_HOT_COUNTERS];
+  HotCounter *otherCounter = &hotCounters[(((uint32_t) sector * 2654435761u) >> 16) % WEAR_HOT_COUNTERS];
+  if ((otherCounter->sector == sector) || ((counter->sector != sector) && (otherCounter->count < counter->count))) {
+    counter = otherCounter;
+  }
+  if (counter->sector == sector) {
+    counter->count++;
+  } else if (counter->count > 1) {
+    counter->count--;
+  } else {
+    counter->sector = sector;
+    counter->count = 1;
+  }
+  if (counter->count < WEAR_HOT_WRITES) {
+    return 0;
+  }
+  counter->count = 0;
+  return 1;
+}
+
+/*******************************************************************************
+* Description    : Checks new sectors to be allowed in the pool. Moves of the
+*                    relocation copy the volume sectors, so the pool is not used then.
+* Input          : None.
+* Output         : None.
+* Return         : True if the hot sector can be added to the pool.
+*******************************************************************************/
+uint8_t isPromotionAllowed(void) {
+#if  WEAR_LEVEL_MOD == 0
+  return !isRelocationActive() && (wearPoolState.mappedSectors < WEAR_MAP_ENTRIES) ? 1 : 0;
+#else
+  return 0;
+#endif
+}
+
+/*******************************************************************************
+* Description    : Writes the sector to the next slot of the head segment and maps
+*                    the sector to it. The slot record is written with the header.
+* Input          : entry - map entry of the sector or NULL for the new hot sector
+*                  sector - volume sector
+*                  data - the sector data
+*                  isCollecting - 1 if the collection copies the sector.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t appendSlot(WearMapEntry *entry, uint64_t sector, const BYTE *data, uint8_t isCollecting) {
+  if (reserveHeadRecord(1, isCollecting) != 0) {
+    return 1;
+  }
+  if (entry == NULL) {                                        // Foreground collection could return the sector home
+    entry = findMapEntry(sector);
+  }
+  if ((entry == NULL) && ((entry = addMapEntry(sector)) == NULL)) {
+    return 1;
+  }
+  uint16_t slot = headSegment * WEAR_SEGMENT_SECTORS + 1 + headHeader.slotNumber;
+  if (cardWriteSectors(data, getWearPoolSector() + slot, 1) != MSD_OK) {
+    if (entry->slot == NO_SLOT) {
+      removeMapEntry(entry);
+    }
+    return 1;
+  }
+  headHeader.records[headHeader.recordNumber++] = sector;
+  headHeader.slotNumber++;
+  isHeadDirty = 1;
+  entry->slot = slot;
+  if (!isCollecting) {
+    entry->lastWrite = HAL_GetTick();
+  }
+  deviceStatistics.wearPoolWrites++;
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Makes room for one record in the head segment. Full head is
+*                    replaced by the next free segment, the last free segment is
+*                    left for the collection, so the host write collects the tail first.
+* Input          : isSlot - 1 if the record takes a data slot
+*                  isCollecting - 1 if the collection adds the record.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t reserveHeadRecord(uint8_t isSlot, uint8_t isCollecting) {
+  uint8_t collectNumber = 0;
+  while ((usedSegments == 0) || (headHeader.recordNumber >= SEGMENT_RECORDS)
+      || (isSlot && (headHeader.slotNumber >= SEGMENT_SLOTS))) {
+    if (!isCollecting && (wearPoolState.freeSegments <= 1)) {
+      if ((++collectNumber > WEAR_SEGMENT_NUMBER) || (collectTailSegment() != 0)) {
+        return 1;
+      }
+      deviceStatistics.wearForegroundCollects++;
+      continue;                                               // Copied sectors could start the new head
+    }
+    if ((wearPoolState.freeSegments == 0) || (startHeadSegment() != 0)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Starts the next segment of the ring as the head. Header of the
+*                    previous head is written first.
+* Input          : None.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t startHeadSegment(void) {
+  if (isHeadDirty && (storeHeadHeader() != 0)) {
+    return 1;
+  }
+  headSegment = (headSegment + 1) % WEAR_SEGMENT_NUMBER;
+  memset(&headHeader, 0, sizeof(headHeader));
+  headHeader.magic = WEAR_MAGIC;
+  headHeader.sequence = ++headSequence;
+  headHeader.eraseCount = ++wearPoolState.eraseCounts[headSegment];
+  if (usedSegments == 0) {
+    tailSegment = headSegment;
+    tailSequence = headSequence;
+  }
+  usedSegments++;
+  wearPoolState.freeSegments = WEAR_SEGMENT_NUMBER - usedSegments;
+  isHeadDirty = 1;
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Writes header of the head segment with the current tail of the log.
+* Input          : None.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t storeHeadHeader(void) {
+  headHeader.tailSequence = tailSequence;
+  headHeader.checksum = getHeaderChecksum(&headHeader);
+  if (cardWriteSectors((BYTE*) &headHeader, getSegmentSector(headSegment), 1) != MSD_OK) {
+    return 1;
+  }
+  isHeadDirty = 0;
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Frees the oldest segment of the log. Its slots still mapped to
+*                    the sectors are copied to the head if the sector is hot or
+*                    written home with the home record, other slots are dead.
+* Input          : None.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t collectTailSegment(void) {
+  uint32_t startStamp = getTimeStamp();
+  uint16_t slot = tailSegment * WEAR_SEGMENT_SECTORS + 1;
+  if ((usedSegments <= 1)                                     // Head segment is never collected
+      || (loadSegmentHeader(tailSegment, &tailHeader) != 0) || (tailHeader.sequence != tailSequence)) {
+    return 1;
+  }
+  for (uint16_t i = 0; i < tailHeader.recordNumber; ++i) {
+    if ((tailHeader.records[i] & HOME_RECORD) != 0) {
+      continue;
+    }
+    WearMapEntry *entry = findMapEntry(tailHeader.records[i]);
+    if ((entry != NULL) && (entry->slot == slot)) {
+      if (cardReadSectors((BYTE*) slotData, getWearPoolSector() + slot, 1) != MSD_OK) {
+        return 1;
+      }
+      if (isPromotionAllowed() && (HAL_GetTick() - entry->lastWrite < WEAR_COLD_TIME)) {
+        if (appendSlot(entry, entry->sector, (BYTE*) slotData, 1) != 0) {
+          return 1;
+        }
+      } else {
+        if ((volumeWriteSectors((BYTE*) slotData, entry->sector, 1) != BLOCK_DEVICE_OK)
+            || (reserveHeadRecord(0, 1) != 0)) {
+          return 1;
+        }
+        headHeader.records[headHeader.recordNumber++] = entry->sector | HOME_RECORD;
+        isHeadDirty = 1;
+        removeMapEntry(entry);
+        deviceStatistics.wearHomeWrites++;
+      }
+    }
+    slot++;
+  }
+  tailSegment = (tailSegment + 1) % WEAR_SEGMENT_NUMBER;
+  tailSequence++;
+  usedSegments--;
+  wearPoolState.freeSegments = WEAR_SEGMENT_NUMBER - usedSegments;
+  if (isHeadDirty && (storeHeadHeader() != 0)) {
+    return 1;
+  }
+  deviceStatistics.wearCollectTime = getElapsedMicros(startStamp);
+  if (deviceStatistics.wearCollectTime > deviceStatistics.wearCollectMaxTime) {
+    deviceStatistics.wearCollectMaxTime = deviceStatistics.wearCollectTime;
+  }
+  deviceStatistics.wearCollectCount++;
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Applies records of the segment to the map of the hot sectors.
+* Input          : segment - number of the segment
+*                  header - header of the segment.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t replaySegment(uint8_t segment, const WearSegmentHeader *header) {
+  uint16_t slot = segment * WEAR_SEGMENT_SECTORS + 1;
+  for (uint16_t i = 0; i < header->recordNumber; ++i) {
+    WearMapEntry *entry = findMapEntry(header->records[i] & ~HOME_RECORD);
+    if ((header->records[i] & HOME_RECORD) != 0) {
+      if (entry != NULL) {
+        removeMapEntry(entry);
+      }
+      continue;
+    }
+    if ((entry == NULL) && ((entry = addMapEntry(header->records[i])) == NULL)) {
+      return 1;
+    }
+    entry->slot = slot++;
+    entry->lastWrite = HAL_GetTick();
+  }
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Reads the segment header and checks it.
+* Input          : segment - number of the segment.
+* Output         : header - the segment header.
+* Return         : 0 if the header is valid or 1 if not.
+*******************************************************************************/
+uint8_t loadSegmentHeader(uint8_t segment, WearSegmentHeader *header) {
+  if (cardReadSectors((BYTE*) header, getSegmentSector(segment), 1) != MSD_OK) {
+    return 1;
+  }
+  return (header->magic == WEAR_MAGIC) && (header->checksum == getHeaderChecksum(header))
+      && (header->recordNumber <= SEGMENT_RECORDS) && (header->slotNumber <= SEGMENT_SLOTS) ? 0 : 1;
+}
+
+/*******************************************************************************
+* Description    : Calculates checksum of the segment header, torn header is not replayed.
+* Input          : header - the segment header.
+* Output         : None.
+* Return         : The checksum.
+*******************************************************************************/
+uint32_t getHeaderChecksum(const WearSegmentHeader *header) {
+  const uint8_t *bytes = (const uint8_t*) header;
+  uint32_t checksum = CHECKSUM_BASIS;
+  for (uint16_t i = 0; i < offsetof(WearSegmentHeader, checksum); ++i) {
+    checksum = (checksum ^ bytes[i]) * CHECKSUM_PRIME;
+  }
+  return checksum;
+}
+
+/*******************************************************************************
+* Description    : Finds the hot sector in the map.
+* Input          : sector - volume sector.
+* Output         : None.
+* Return         : The map entry or NULL if the sector is in its home place.
+*******************************************************************************/
+WearMapEntry* findMapEntry(uint64_t sector) {
+  for (uint16_t i = 0; i < WEAR_MAP_ENTRIES; ++i) {
+    if ((wearMap[i].slot != NO_SLOT) && (wearMap[i].sector == sector)) {
+      return &wearMap[i];
+    }
+  }
+  return NULL;
+}
+
+/*******************************************************************************
+* Description    : Finds the first hot sector of the sector range.
+* Input          : sector - first volume sector
+*                  count - number of the sectors.
+* Output         : None.
+* Return         : The map entry or NULL if the range has no hot sectors.
+*******************************************************************************/
+WearMapEntry* findFirstMapEntry(uint64_t sector, UINT count) {
+  WearMapEntry *first = NULL;
+  for (uint16_t i = 0; i < WEAR_MAP_ENTRIES; ++i) {
+    if ((wearMap[i].slot != NO_SLOT) && (wearMap[i].sector >= sector) && (wearMap[i].sector < sector + count)
+        && ((first == NULL) || (wearMap[i].sector < first->sector))) {
+      first = &wearMap[i];
+    }
+  }
+  return first;
+}
+
+/*******************************************************************************
+* Description    : Takes the free map entry for the sector. The slot is set by the caller.
+* Input          : sector - volume sector.
+* Output         : None.
+* Return         : The map entry or NULL if the map is full.
+*******************************************************************************/
+WearMapEntry* addMapEntry(uint64_t sector) {
+  for (uint16_t i = 0; i < WEAR_MAP_ENTRIES; ++i) {
+    if (wearMap[i].slot == NO_SLOT) {
+      wearMap[i].sector = sector;
+      wearPoolState.mappedSectors++;
+      return &wearMap[i];
+    }
+  }
+  return NULL;
+}
+
+/*******************************************************************************
+* Description    : Releases the map entry, the sector is read from its home place.
+* Input          : entry - the map entry.
+* Output         : None.
+* Return         : None.
+*******************************************************************************/
+void removeMapEntry(WearMapEntry *entry) {
+  entry->slot = NO_SLOT;
+  wearPoolState.mappedSectors--;
+}
+
+/*******************************************************************************
+* Description    : Calculates the card sector of the segment header.
+* Input          : segment - number of the segment.
+* Output         : None.
+* Return         : Card sector of the segment.
+*******************************************************************************/
+uint64_t getSegmentSector(uint8_t segment) {
+  return getWearPoolSector() + (uint64_t) segment * WEAR_SEGMENT_SECTORS;
+}
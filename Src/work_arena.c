@@ -0,0 +1,123 @@
+/**
+  ******************************************************************************
+  * @file           : WORK_ARENA
+  * @version        : v1.0
+  * @brief          : Shared buffers of the command processing
+  ******************************************************************************
+  * MIT License
+  *
+  * Copyright (c) 2017 Oleksandr Borysov
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+ ******************************************************************************
+*/
+
+
+
+
+/* Includes ------------------------------------------------------------------*/
+#include "work_arena.h"
+#include "device_stats.h"
+#include "stm32f4xx_hal.h"
+#include <stddef.h>
+
+/* Private define ------------------------------------------------------------*/
+#define STACK_PAINT_WORD                 0xA5A5A5A5u    // Stack words not touched since the measure start
+#define STACK_PAINT_MARGIN               64             // Bytes under the stack pointer left to the painting loop
+#define STACK_BOTTOM                     ((uint32_t*) ((uint8_t*) &_estack - (uint32_t) &_Min_Stack_Size))
+
+/* Private variables ---------------------------------------------------------*/
+uint64_t workArena[WORK_ARENA_SIZE / sizeof(uint64_t)];
+uint32_t workArenaTop;                                    // Bytes of the arena taken by the live buffers
+uint32_t workArenaPeak;                                   // Highest top since the measure start
+uint32_t *stackMeasureStart;                              // Stack pointer when the measure started
+extern uint32_t _estack;                                  // Linker symbols of the stack
+extern uint32_t _Min_Stack_Size;
+
+/* Public work arena functions ---------------------------------------------------------*/
+
+/*******************************************************************************
+* Description    : Takes the buffer from the arena. The buffer lives till it or
+*                    the buffer taken before it is released.
+* Input          : size - bytes of the buffer.
+* Output         : None.
+* Return         : The buffer or NULL if the arena is full.
+*******************************************************************************/
+void* allocWorkBuffer(uint32_t size) {
+  uint8_t *buffer = (uint8_t*) workArena + workArenaTop;
+  size = (size + WORK_ARENA_ALIGN - 1) / WORK_ARENA_ALIGN * WORK_ARENA_ALIGN;
+  if (size > WORK_ARENA_SIZE - workArenaTop) {
+    return NULL;
+  }
+  workArenaTop += size;
+  if (workArenaTop > workArenaPeak) {
+    workArenaPeak = workArenaTop;
+  }
+  return buffer;
+}
+
+/*******************************************************************************
+* Description    : Releases the buffer and all buffers taken after it.
+* Input          : buffer - the buffer taken from the arena, NULL is ignored.
+* Output         : None.
+* Return         : None.
+*******************************************************************************/
+void releaseWorkBuffer(void *buffer) {
+  if (buffer != NULL) {
+    workArenaTop = (uint8_t*) buffer - (uint8_t*) workArena;
+  }
+}
+
+/*******************************************************************************
+* Description    : Starts the measure of the arena and stack use by the command.
+*                    Free stack under the current stack pointer is painted.
+* Input          : None.
+* Output         : None.
+* Return         : None.
+*******************************************************************************/
+void beginWorkMeasure(void) {
+  uint32_t *word = STACK_BOTTOM;
+  stackMeasureStart = (uint32_t*) __get_MSP();
+  while (word < stackMeasureStart - STACK_PAINT_MARGIN / sizeof(uint32_t)) {
+    *word++ = STACK_PAINT_WORD;
+  }
+  workArenaPeak = workArenaTop;
+}
+
+/*******************************************************************************
+* Description    : Ends the measure and reports the peak arena and stack use of
+*                    the command. The lowest touched stack word gives the stack peak.
+* Input          : None.
+* Output         : None.
+* Return         : None.
+*******************************************************************************/
+void endWorkMeasure(void) {
+  uint32_t *word = STACK_BOTTOM;
+  while ((word < stackMeasureStart) && (*word == STACK_PAINT_WORD)) {
+    ++word;
+  }
+  deviceStatistics.commandArenaPeak = workArenaPeak;
+  deviceStatistics.commandStackPeak = (stackMeasureStart - word) * sizeof(uint32_t);
+  if (deviceStatistics.commandArenaPeak > deviceStatistics.maxArenaPeak) {
+    deviceStatistics.maxArenaPeak = deviceStatistics.commandArenaPeak;
+  }
+  if (deviceStatistics.commandStackPeak > deviceStatistics.maxStackPeak) {
+    deviceStatistics.maxStackPeak = deviceStatistics.commandStackPeak;
+  }
+}
@@ -0,0 +1,143 @@
+/**
+  ******************************************************************************
+  * @file           : BENCH_CLONE_REMAP
+  * @version        : v1.0
+  * @brief          : Bench of the clone remap lookup on a card image
+  ******************************************************************************
+  * MIT License
+  *
+  * Copyright (c) 2017 Oleksandr Borysov
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+ ******************************************************************************
+*/
+
+
+
+
+/* Read overhead of the clone remap table. The same random reads go to the source partition
+   directly and through the clone with the empty and with the full remap table. Times are of
+   the host CPU and the page cache, ShowConf gives the lookup cycles of the device */
+
+/* Includes ------------------------------------------------------------------*/
+#include "clone_remap.h"
+#include "relocation.h"
+#include "partition_table.h"
+#include "host_platform.h"
+#include "test_util.h"
+#include <string.h>
+#include <time.h>
+
+/* Private define ------------------------------------------------------------*/
+#define CARD_SECTORS                     ((uint64_t) 512 * 1024 * 2)   // 512 MB card
+#define SOURCE_START                     2048
+#define SOURCE_BLOCKS                    (2 * MAX_CLONE_BLOCKS)         // Half of the blocks fit the pool
+#define SOURCE_SECTORS                   (SOURCE_BLOCKS * CLONE_BLOCK_SECTORS)
+#define POOL_START                       (SOURCE_START + SOURCE_SECTORS)
+#define LOOKUP_NUMBER                    10000000
+#define READ_NUMBER                      200000
+#define LUN                              1
+
+/* Private variables ---------------------------------------------------------*/
+Partition source;
+Partition clone;
+ExtentIndex sourceIndex;
+uint8_t buff[CLONE_BLOCK_SECTORS * STORAGE_BLOCK_SIZE];
+uint32_t randomState = 1;
+
+/* Private function prototypes -----------------------------------------------*/
+int32_t findCloneBlock(uint32_t);                          // Private function of clone_remap.c
+
+/* Private functions ---------------------------------------------------------*/
+
+static uint32_t nextRandom(void) {
+  randomState = randomState * 1103515245 + 12345;
+  return randomState >> 8;
+}
+
+static uint64_t getNanoseconds(void) {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (uint64_t) time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+static double benchLookup(void) {
+  int64_t found = 0;
+  uint64_t startTime = getNanoseconds();
+  for (uint32_t i = 0; i < LOOKUP_NUMBER; ++i) {
+    found += findCloneBlock(nextRandom() % SOURCE_BLOCKS);
+  }
+  CHECK(found != 0);                                       // Keeps the loop
+  return (double) (getNanoseconds() - startTime) / LOOKUP_NUMBER;
+}
+
+static double benchReads(uint8_t isClone, UINT count) {
+  uint64_t startTime;
+  randomState = 7;
+  startTime = getNanoseconds();
+  for (uint32_t i = 0; i < READ_NUMBER; ++i) {
+    uint64_t sector = (uint64_t) (nextRandom() % (SOURCE_SECTORS / count)) * count;
+    if (isClone) {
+      CHECK(readCloneSectors(buff, sector, count) == BLOCK_DEVICE_OK);
+    } else {
+      CHECK(readPartitionExtents(&source, &sourceIndex, buff, sector, count) == BLOCK_DEVICE_OK);
+    }
+  }
+  return (double) (getNanoseconds() - startTime) / READ_NUMBER;
+}
+
+static void printReads(const char *name, uint8_t isClone) {
+  double smallReads = benchReads(isClone, 8);
+  double blockReads = benchReads(isClone, CLONE_BLOCK_SECTORS);
+  printf("%-30s 4 KB read %6.2f us  64 KB read %6.2f us\n", name, smallReads / 1000, blockReads / 1000);
+}
+
+int main(void) {
+  CHECK(openSdCard(getImagePath("bench_clone.img"), CARD_SECTORS) == 0);
+  CHECK(initSDCard() == RES_OK);
+  source.extents[0].startSector = SOURCE_START;
+  source.extents[0].sectorNumber = SOURCE_SECTORS;
+  source.extentNumber = 1;
+  source.sectorNumber = SOURCE_SECTORS;
+  strcpy(source.name, "template");
+  clone = source;
+  clone.extents[0].startSector = POOL_START;
+  clone.extents[0].sectorNumber = CLONE_META_SECTORS + MAX_CLONE_BLOCKS * CLONE_BLOCK_SECTORS;
+  clone.sectorNumber = clone.extents[0].sectorNumber;
+  strcpy(clone.name, "copy");
+  strcpy(clone.sourceName, "template");
+  clone.cloneId = 0x1234;
+  buildExtentIndex(&source, &sourceIndex);
+  memset(buff, 0x5A, sizeof(buff));
+  for (uint64_t sector = 0; sector < SOURCE_SECTORS; sector += CLONE_BLOCK_SECTORS) {
+    CHECK(writePartitionExtents(&source, &sourceIndex, buff, sector, CLONE_BLOCK_SECTORS) == BLOCK_DEVICE_OK);
+  }
+  CHECK(openCloneRemap(LUN, &clone, &source, NULL) == 0);
+  printf("Clone of %u blocks of 64 KB, %u random reads of each size\n", SOURCE_BLOCKS, READ_NUMBER);
+  printReads("source", 0);
+  printReads("clone, empty remap table", 1);
+  printf("  lookup %.1f ns\n", benchLookup());
+  for (uint32_t block = 0; block < MAX_CLONE_BLOCKS; ++block) {   // Every other block is remapped
+    CHECK(writeCloneSectors(buff, (uint64_t) block * 2 * CLONE_BLOCK_SECTORS, 1) == BLOCK_DEVICE_OK);
+  }
+  printReads("clone, 1024 remapped blocks", 1);
+  printf("  lookup %.1f ns\n", benchLookup());
+  closeCardImage(&sdCardImage);
+  return 0;
+}
@@ -0,0 +1,225 @@
+/**
+  ******************************************************************************
+  * @file           : BENCH_COMMAND_READER
+  * @version        : v1.0
+  * @brief          : Bench of the command file parsing
+  ******************************************************************************
+  * MIT License
+  *
+  * Copyright (c) 2017 Oleksandr Borysov
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+ ******************************************************************************
+*/
+
+
+
+
+/* Parse throughput of the UpdateConf partition lines. The chunked reader of the firmware is
+   compared with the parsing of the whole file in RAM, the walk of the firmware before the
+   command reader: isNewLineOrEnd, scrollToLineEnd and findWordBeforeSpace are copied from it.
+   That firmware read only the first 1000 bytes of the file, here it gets the whole file */
+
+/* Includes ------------------------------------------------------------------*/
+#include "command_reader.h"
+#include "host_platform.h"
+#include "test_util.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Private define ------------------------------------------------------------*/
+#define ROUND_BYTES                      (64 * 1024 * 1024)   // Parsed bytes of each file size
+#define NAME_LENGTH                      21
+#define NUMBER_LENGTH                    21
+
+/* Private typedef -----------------------------------------------------------*/
+// Sum of the parsed lines to compare the parsers
+typedef struct {
+   uint32_t lineNumber;
+   uint64_t sectorNumber;
+   uint32_t nameSum;
+} ParseResult;
+
+/* Private variables ---------------------------------------------------------*/
+const uint32_t lineNumbers[] = { 25, 1000, 10000, 100000 };
+char chunk[COMMAND_CHUNK_SIZE];
+
+/* Private functions ---------------------------------------------------------*/
+
+static uint64_t getNanoseconds(void) {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (uint64_t) time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+static uint32_t writeCommandFile(const char *path, uint32_t lineNumber) {
+  FILE *file = fopen(path, "wb");
+  long size;
+  CHECK(file != NULL);
+  fprintf(file, "UpdateConf confKey \r\nrootKey \r\nNumber Name Key Sectors \r\n");
+  for (uint32_t i = 0; i < lineNumber; ++i) {
+    fprintf(file, "%u part%u key%u %u \r\n", i, i, i * 7, 2048 + i % 100000);   // Old walk needs the space
+  }
+  size = ftell(file);
+  fclose(file);
+  return size;
+}
+
+static void addLine(ParseResult *result, const char *name, const char *sectors) {
+  result->lineNumber++;
+  result->sectorNumber += strtoull(sectors, NULL, 10);
+  for (; *name != '\0'; ++name) {
+    result->nameSum += *name;
+  }
+}
+
+static void parseByReader(const char *path, ParseResult *result) {
+  FIL file;
+  CommandReader reader;
+  char number[NUMBER_LENGTH];
+  char name[NAME_LENGTH];
+  char key[NAME_LENGTH];
+  char sectors[NUMBER_LENGTH];
+  CHECK(openHostFile(&file, path, "rb") == 0);
+  beginCommandReader(&reader, &file, chunk, sizeof(chunk));
+  skipCommandLine(&reader);
+  skipCommandLine(&reader);
+  skipCommandLine(&reader);
+  while ((readCommandWord(&reader, number, sizeof(number) - 1) == 0)
+      && (readCommandWord(&reader, name, sizeof(name) - 1) == 0)
+      && (readCommandWord(&reader, key, sizeof(key) - 1) == 0)
+      && (readCommandWord(&reader, sectors, sizeof(sectors) - 1) == 0)) {
+    addLine(result, name, sectors);
+    skipCommandLine(&reader);
+  }
+  closeHostFile(&file);
+}
+
+static int8_t isNewLineOrEnd(const char *buff, const uint32_t *position, const uint32_t *size) {
+  int8_t shift = -1;
+  if ((buff[*position] == '\r') || (buff[*position] == '\n') || (*size == *position + 1)) {
+    shift = 0;
+  }
+  if ((buff[*position] == '\r') && (buff[*position + 1] == '\n')) {
+    shift = 1;
+  }
+  return shift;
+}
+
+static uint8_t scrollToLineEnd(const char *buff, const uint32_t *bytesRead, uint32_t *shift) {
+  uint8_t res = 1;
+  int8_t newLineStat;
+  for (uint32_t i = *shift; i < *bytesRead; ++i) {
+    newLineStat = isNewLineOrEnd(buff, &i, bytesRead);
+    if (newLineStat != -1) {
+      *shift = i + newLineStat + 1;
+      res = 0;
+      break;
+    }
+  }
+  return res;
+}
+
+static uint8_t findWordBeforeSpace(const char *buff, const uint32_t *bytesRead, uint32_t *start, uint8_t *size) {
+  uint8_t res = 1;
+  for (uint32_t i = *start; i < *bytesRead; ++i) {
+    if ((buff[i] != ' ') && (buff[i] != '\t')) {
+      *start = i;
+      for (; i < *bytesRead; ++i) {
+        if ((buff[i] == ' ') || (buff[i] == '\t')) {
+          *size = i - *start;
+          res = 0;
+          break;
+        }
+      }
+      break;
+    }
+  }
+  return res;
+}
+
+static uint8_t takeWord(const char *buff, const uint32_t *bytesRead, uint32_t *start, char *word, uint8_t wordSize) {
+  uint8_t size;
+  if (findWordBeforeSpace(buff, bytesRead, start, &size) != 0) {
+    return 1;
+  }
+  memset(word, '\0', wordSize);
+  strncpy(word, buff + *start, size < wordSize - 1 ? size : wordSize - 1);
+  *start += size;
+  return 0;
+}
+
+static void parseWholeFile(const char *path, ParseResult *result) {
+  FIL file;
+  char number[NUMBER_LENGTH];
+  char name[NAME_LENGTH];
+  char key[NAME_LENGTH];
+  char sectors[NUMBER_LENGTH];
+  uint32_t bytesRead;
+  uint32_t start = 0;
+  char *buff;
+  CHECK(openHostFile(&file, path, "rb") == 0);
+  buff = malloc(f_size(&file));
+  CHECK(buff != NULL);
+  CHECK(f_read(&file, buff, f_size(&file), (UINT*) &bytesRead) == FR_OK);
+  closeHostFile(&file);
+  scrollToLineEnd(buff, &bytesRead, &start);
+  scrollToLineEnd(buff, &bytesRead, &start);
+  scrollToLineEnd(buff, &bytesRead, &start);
+  while ((takeWord(buff, &bytesRead, &start, number, sizeof(number)) == 0)
+      && (takeWord(buff, &bytesRead, &start, name, sizeof(name)) == 0)
+      && (takeWord(buff, &bytesRead, &start, key, sizeof(key)) == 0)
+      && (takeWord(buff, &bytesRead, &start, sectors, sizeof(sectors)) == 0)) {
+    addLine(result, name, sectors);
+    if (scrollToLineEnd(buff, &bytesRead, &start) != 0) {
+      break;
+    }
+  }
+  free(buff);
+}
+
+static double benchParser(void (*parse)(const char*, ParseResult*), const char *path, uint32_t fileSize,
+    ParseResult *result) {
+  uint32_t rounds = ROUND_BYTES / fileSize + 1;
+  uint64_t startTime = getNanoseconds();
+  for (uint32_t i = 0; i < rounds; ++i) {
+    memset(result, 0, sizeof(ParseResult));
+    parse(path, result);
+  }
+  return (double) fileSize * rounds / (getNanoseconds() - startTime) * 1000;
+}
+
+int main(void) {
+  const char *path = getImagePath("bench_command.txt");
+  printf("UpdateConf partition lines, MB/s of the host CPU, RAM is the file buffer\n");
+  for (uint32_t i = 0; i < sizeof(lineNumbers) / sizeof(lineNumbers[0]); ++i) {
+    ParseResult chunkResult;
+    ParseResult wholeResult;
+    uint32_t fileSize = writeCommandFile(path, lineNumbers[i]);
+    double chunkSpeed = benchParser(parseByReader, path, fileSize, &chunkResult);
+    double wholeSpeed = benchParser(parseWholeFile, path, fileSize, &wholeResult);
+    CHECK(chunkResult.lineNumber == lineNumbers[i]);
+    CHECK(memcmp(&chunkResult, &wholeResult, sizeof(ParseResult)) == 0);
+    printf("%6u lines %8u bytes  chunks %7.1f MB/s in %u B  whole file %7.1f MB/s in %u B\n", lineNumbers[i],
+        fileSize, chunkSpeed, COMMAND_CHUNK_SIZE, wholeSpeed, fileSize);
+  }
+  remove(path);
+  return 0;
+}
@@ -0,0 +1,211 @@
+/**
+  ******************************************************************************
+  * @file           : BENCH_COMPRESSION
+  * @version        : v1.0
+  * @brief          : Bench of the compressed partition on a card image
+  ******************************************************************************
+  * MIT License
+  *
+  * Copyright (c) 2017 Oleksandr Borysov
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+ ******************************************************************************
+*/
+
+
+
+
+/* Ratio, throughput and latency of the compressed partition for the kinds of the host
+   data. The chunks go through the whole store: codec, chunk map and the card image, so
+   the times are of the host CPU and the page cache, they compare the kinds of data and
+   the versions of the code, not the device */
+
+/* Includes ------------------------------------------------------------------*/
+#include "compression.h"
+#include "lz_codec.h"
+#include "device_stats.h"
+#include "sd_io_controller.h"
+#include "host_platform.h"
+#include "test_util.h"
+#include <glob.h>
+#include <string.h>
+#include <time.h>
+
+/* Private define ------------------------------------------------------------*/
+#define CARD_SECTORS                     ((uint64_t) 512 * 1024 * 2)   // 512 MB card
+#define PARTITION_START                  2048
+#define PARTITION_SECTORS                (128 * 1024 * 2)              // 128 MB partition
+#define CHUNK_BYTES                      (COMPRESS_CHUNK_SECTORS * STORAGE_BLOCK_SIZE)
+#define KIND_CHUNKS                      2048                          // 8 MB of each kind
+#define LUN                              0
+#define SOURCE_SIZE                      (2 * 1024 * 1024)
+
+/* Private typedef -----------------------------------------------------------*/
+typedef enum {
+  TEXT_DATA, LOG_DATA, BINARY_DATA, RANDOM_DATA, ZERO_DATA, MIXED_DATA, KIND_NUMBER
+} DataKind;
+
+/* Private variables ---------------------------------------------------------*/
+const char *kindNames[KIND_NUMBER] = { "text", "logs", "binary", "random", "zeros", "mixed" };
+Partition partition;
+uint8_t sources[SOURCE_SIZE];
+uint32_t sourceSize;
+uint8_t chunk[CHUNK_BYTES];
+uint8_t packedChunk[CHUNK_BYTES];
+uint32_t latencies[KIND_CHUNKS];
+uint32_t randomState = 1;
+
+/* Private functions ---------------------------------------------------------*/
+
+static uint32_t nextRandom(void) {
+  randomState = randomState * 1103515245 + 12345;
+  return randomState >> 8;
+}
+
+static uint64_t getNanoseconds(void) {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (uint64_t) time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+static void loadSources(void) {                            // Firmware sources are the text
+  glob_t files;
+  CHECK(glob("../Src/*.c", 0, NULL, &files) == 0);
+  for (size_t i = 0; (i < files.gl_pathc) && (sourceSize < SOURCE_SIZE); ++i) {
+    FILE *file = fopen(files.gl_pathv[i], "rb");
+    CHECK(file != NULL);
+    sourceSize += fread(sources + sourceSize, 1, SOURCE_SIZE - sourceSize, file);
+    fclose(file);
+  }
+  globfree(&files);
+  CHECK(sourceSize > CHUNK_BYTES);
+}
+
+static void fillChunk(DataKind kind, uint32_t number) {
+  uint32_t size = 0;
+  switch (kind == MIXED_DATA ? (DataKind) (nextRandom() % MIXED_DATA) : kind) {
+  case TEXT_DATA:
+    memcpy(chunk, sources + (uint64_t) number * CHUNK_BYTES % (sourceSize - CHUNK_BYTES), CHUNK_BYTES);
+    break;
+  case LOG_DATA:
+    while (size < CHUNK_BYTES) {
+      char line[128];
+      int length = snprintf(line, sizeof(line), "2017-05-%02u %02u:%02u:%02u.%03u %s lun %u sector %u count %u\n",
+          1 + nextRandom() % 28, nextRandom() % 24, nextRandom() % 60, nextRandom() % 60, nextRandom() % 1000,
+          nextRandom() % 4 ? "INFO  read" : "WARN  write", nextRandom() % 3, nextRandom() % 1000000,
+          1 << (nextRandom() % 7));
+      memcpy(chunk + size, line, size + length < CHUNK_BYTES ? length : CHUNK_BYTES - size);
+      size += length;
+    }
+    break;
+  case BINARY_DATA:                                        // Table of records with small fields
+    for (size = 0; size < CHUNK_BYTES; size += 16) {
+      uint32_t record[4] = { number * 256 + size / 16, nextRandom() % 100, 0x3F800000 + (nextRandom() & 0xFFFF), 0 };
+      memcpy(chunk + size, record, sizeof(record));
+    }
+    break;
+  case RANDOM_DATA:
+    for (size = 0; size < CHUNK_BYTES; ++size) {
+      chunk[size] = nextRandom();
+    }
+    break;
+  default:
+    memset(chunk, 0, CHUNK_BYTES);
+    break;
+  }
+}
+
+static uint32_t getCodecSectors(void) {                 // Sectors the chunk takes on the card without the map
+  uint32_t size;
+  for (size = 0; (size < CHUNK_BYTES) && (chunk[size] == 0); ++size);
+  if (size == CHUNK_BYTES) {
+    return 0;
+  }
+  size = compressLZ(chunk, CHUNK_BYTES, packedChunk, CHUNK_BYTES - STORAGE_BLOCK_SIZE);
+  return size != 0 ? (size + STORAGE_BLOCK_SIZE - 1) / STORAGE_BLOCK_SIZE : COMPRESS_CHUNK_SECTORS;
+}
+
+static int compareLatencies(const void *first, const void *second) {
+  uint32_t a = *(const uint32_t*) first;
+  uint32_t b = *(const uint32_t*) second;
+  return (a > b) - (a < b);
+}
+
+static void printTimes(const char *operation, uint64_t totalTime) {
+  qsort(latencies, KIND_CHUNKS, sizeof(uint32_t), compareLatencies);
+  printf("  %-5s %7.1f MB/s  p50 %6.1f us  p99 %6.1f us", operation,
+      (double) KIND_CHUNKS * CHUNK_BYTES / totalTime * 1000, latencies[KIND_CHUNKS / 2] / 1000.0,
+      latencies[KIND_CHUNKS * 99 / 100] / 1000.0);
+}
+
+static void benchKind(DataKind kind) {
+  uint64_t firstChunk = (uint64_t) kind * KIND_CHUNKS;
+  uint64_t hostSectors = deviceStatistics.compressedSectors;
+  uint64_t storedSectors = deviceStatistics.storedSectors;
+  uint64_t codecSectors = 0;
+  uint64_t totalTime = 0;
+  for (uint32_t i = 0; i < KIND_CHUNKS; ++i) {
+    uint64_t startTime;
+    fillChunk(kind, i);
+    codecSectors += getCodecSectors();
+    startTime = getNanoseconds();
+    CHECK(writeCompressedSectors(LUN, chunk, (firstChunk + i) * COMPRESS_CHUNK_SECTORS, COMPRESS_CHUNK_SECTORS)
+        == BLOCK_DEVICE_OK);
+    latencies[i] = getNanoseconds() - startTime;
+    totalTime += latencies[i];
+  }
+  hostSectors = deviceStatistics.compressedSectors - hostSectors;
+  storedSectors = deviceStatistics.storedSectors - storedSectors;
+  printf("%-7s ratio %6.2f  card writes %4.2f", kindNames[kind],
+      codecSectors != 0 ? (double) hostSectors / codecSectors : 0, (double) storedSectors / hostSectors);
+  printTimes("write", totalTime);
+  closeCompressedStore(LUN);                               // Reads miss the chunk cache
+  CHECK(openCompressedStore(LUN, &partition, "partitionKey") == 0);
+  totalTime = 0;
+  for (uint32_t i = 0; i < KIND_CHUNKS; ++i) {
+    uint64_t startTime = getNanoseconds();
+    CHECK(readCompressedSectors(LUN, chunk, (firstChunk + i) * COMPRESS_CHUNK_SECTORS, COMPRESS_CHUNK_SECTORS)
+        == BLOCK_DEVICE_OK);
+    latencies[i] = getNanoseconds() - startTime;
+    totalTime += latencies[i];
+  }
+  printTimes("read", totalTime);
+  printf("\n");
+}
+
+int main(void) {
+  loadSources();
+  CHECK(openSdCard(getImagePath("bench_compression.img"), CARD_SECTORS) == 0);
+  CHECK(initSDCard() == RES_OK);
+  partition.extents[0].startSector = PARTITION_START;
+  partition.extents[0].sectorNumber = PARTITION_SECTORS;
+  partition.extentNumber = 1;
+  partition.sectorNumber = PARTITION_SECTORS;
+  partition.isCompressed = 1;
+  CHECK(openCompressedStore(LUN, &partition, "partitionKey") == 0);
+  CHECK(getCompressedSectorNumber(&partition) >= (uint64_t) KIND_NUMBER * KIND_CHUNKS * COMPRESS_CHUNK_SECTORS);
+  printf("Compressed partition, %u chunks of 4 KB of each kind, cold chunk cache for the reads\n", KIND_CHUNKS);
+  printf("ratio - host sectors per stored chunk sector (0 if nothing stored), card writes - written\n"
+      "sectors per host sector with the chunk map\n");
+  for (DataKind kind = TEXT_DATA; kind < KIND_NUMBER; ++kind) {
+    benchKind(kind);
+  }
+  closeCardImage(&sdCardImage);
+  return 0;
+}
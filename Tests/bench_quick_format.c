@@ -0,0 +1,102 @@
+/**
+  ******************************************************************************
+  * @file           : BENCH_QUICK_FORMAT
+  * @version        : v1.0
+  * @brief          : Bench of the idle time quick format on card images
+  ******************************************************************************
+  * MIT License
+  *
+  * Copyright (c) 2017 Oleksandr Borysov
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+ ******************************************************************************
+*/
+
+
+
+
+
+/* Quick format of the partition made by the configurations update. The whole volume but
+   the zero partition goes to the new private partition, the freed memory is erased and the
+   idle task formats the partition. Times are of the host CPU and the page cache, ShowConf
+   gives the format time of the device */
+
+/* Includes ------------------------------------------------------------------*/
+#include "sd_io_controller.h"
+#include "quick_format.h"
+#include "device_stats.h"
+#include "host_platform.h"
+#include "test_util.h"
+#include <string.h>
+
+/* Private define ------------------------------------------------------------*/
+#define GB_SECTORS                       ((uint64_t) 1024 * 1024 * 2)
+
+/* Private variables ---------------------------------------------------------*/
+extern PartitionsStructure partitionsStructure;
+
+/* Private functions ---------------------------------------------------------*/
+
+static void benchFormat(uint64_t cardSectors, FormatType format) {
+  PartitionsStructure newConf;
+  Partition partition;
+  uint64_t zeroPartSectors;
+  CHECK(openSdCard(getImagePath("bench_format.img"), cardSectors) == 0);
+  CHECK(initSDCard() == RES_OK);
+  CHECK(initStartConf() == 0);
+  completeMediaChange();
+  zeroPartSectors = getLunPartition(COMMAND_LUN)->sectorNumber;
+  memset(&newConf, 0, sizeof(newConf));
+  strcpy(newConf.confKey, "confKey");
+  strcpy(newConf.rootKey, "rootKey");
+  beginConf(&partitionsStructure, &newConf);
+  memset(&partition, 0, sizeof(partition));
+  strcpy(partition.name, "part0");
+  strcpy(partition.key, PUBLIC_PARTITION_KEY);
+  partition.extentNumber = 1;
+  partition.sectorNumber = zeroPartSectors;
+  CHECK(addConfPartition(&partition) == 0);
+  strcpy(partition.name, "fresh");
+  strcpy(partition.key, "freshKey");
+  partition.partitionType = PRIVATE;
+  partition.sectorNumber = getVolumeSectorNumber() - zeroPartSectors;
+  CHECK(addConfPartition(&partition) == 0);
+  CHECK(requestPartitionFormat(1, &partition, format) == 0);
+  CHECK(setConf(&partitionsStructure, &newConf) == 0);
+  while (getEraseProgress()->status == ERASE_IN_PROGRESS) {
+    continueFreedErase();
+  }
+  resetImageCounters();
+  continueFormats();
+  CHECK(deviceStatistics.formatFailCount == 0);
+  printf("%-6s %6u MB partition  %6u metadata sectors  %5u writes  %4u ms\n",
+         (format == FORMAT_EXFAT) ? "exFAT" : "FAT32", (uint32_t) (partition.sectorNumber / 2048),
+         deviceStatistics.formatSectors, sdCardImage.writeNumber, deviceStatistics.formatTime);
+  closeCardImage(&sdCardImage);
+}
+
+int main(void) {
+  static const uint32_t cardSizes[] = { 1, 8, 32, 128 };
+  printf("Quick format in the idle time after the configurations update\n");
+  for (uint8_t i = 0; i < sizeof(cardSizes) / sizeof(cardSizes[0]); ++i) {
+    benchFormat(cardSizes[i] * GB_SECTORS, FORMAT_EXFAT);
+    benchFormat(cardSizes[i] * GB_SECTORS, FORMAT_FAT32);
+  }
+  return 0;
+}
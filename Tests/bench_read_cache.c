@@ -0,0 +1,144 @@
+/**
+  ******************************************************************************
+  * @file           : BENCH_READ_CACHE
+  * @version        : v1.0
+  * @brief          : Bench of the read cache hit rates
+  ******************************************************************************
+  * MIT License
+  *
+  * Copyright (c) 2017 Oleksandr Borysov
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+ ******************************************************************************
+*/
+
+
+
+
+/* Hit rates of the read cache for the host read patterns of a read-only partition. The
+   lines are loaded by a counter, so the bench shows the line hits and the card reads the
+   cache makes for each host request, not times. Long reads which skip the cache are not
+   counted in the line hits */
+
+/* Includes ------------------------------------------------------------------*/
+#include "read_cache.h"
+#include "device_stats.h"
+#include "test_util.h"
+#include <string.h>
+
+/* Private define ------------------------------------------------------------*/
+#define LUN_SECTORS                      (4 * 1024 * 1024 * 2)         // 4 GB partition
+#define DATA_START                       32768
+#define FILE_SECTORS                     2048                          // 1 MB files
+#define FILE_NUMBER                      256
+#define MAX_REQUEST_SECTORS              128
+
+/* Private variables ---------------------------------------------------------*/
+uint32_t loadNumber;
+uint64_t loadedSectors;
+uint32_t requestNumber;
+uint64_t requestedSectors;
+uint32_t randomState = 1;
+BYTE buff[MAX_REQUEST_SECTORS * STORAGE_BLOCK_SIZE];
+
+/* Private functions ---------------------------------------------------------*/
+
+static uint32_t nextRandom(void) {
+  randomState = randomState * 1103515245 + 12345;
+  return randomState >> 8;
+}
+
+static uint8_t loadSectors(BYTE lun, BYTE *data, DWORD sector, UINT count) {
+  loadNumber++;
+  loadedSectors += count;
+  return 0;
+}
+
+static void readHost(uint64_t sector, UINT count) {
+  requestNumber++;
+  requestedSectors += count;
+  CHECK(readCachedSectors(0, buff, sector, count, LUN_SECTORS, loadSectors) == 0);
+}
+
+static void readFiles(UINT requestSectors, uint8_t isLookingUp) {
+  for (uint32_t file = 0; file < FILE_NUMBER; ++file) {
+    uint64_t fileStart = DATA_START + (uint64_t) file * FILE_SECTORS;
+    if (isLookingUp) {
+      readHost(4096 + file / 16, 1);                       // Directory entry
+      readHost(32 + fileStart / 128 / 512 % 1024, 1);      // FAT sector of the cluster chain
+    }
+    for (uint32_t sector = 0; sector < FILE_SECTORS; sector += requestSectors) {
+      readHost(fileStart + sector, requestSectors);
+    }
+  }
+}
+
+static void readRandom(UINT requestSectors) {
+  for (uint32_t i = 0; i < FILE_NUMBER * FILE_SECTORS / requestSectors; ++i) {
+    readHost(DATA_START + (uint64_t) (nextRandom() % (FILE_NUMBER * FILE_SECTORS / requestSectors)) * requestSectors,
+        requestSectors);
+  }
+}
+
+static void readMetadata(void) {                           // Listing of the folders reads FAT and directories
+  for (uint32_t i = 0; i < 100000; ++i) {
+    readHost(nextRandom() % 2 ? 32 + nextRandom() % 16 : 4096 + nextRandom() % 32, 1);
+  }
+}
+
+static void benchPattern(const char *name, void (*pattern)(UINT, uint8_t), UINT requestSectors, uint8_t option) {
+  uint32_t hits = deviceStatistics.readCacheHits;
+  uint32_t misses = deviceStatistics.readCacheMisses;
+  resetReadCache(0);
+  loadNumber = 0;
+  loadedSectors = 0;
+  requestNumber = 0;
+  requestedSectors = 0;
+  pattern(requestSectors, option);
+  hits = deviceStatistics.readCacheHits - hits;
+  misses = deviceStatistics.readCacheMisses - misses;
+  printf("%-34s line hits %5.1f%%  card reads per request %5.2f  card sectors per host sector %4.2f\n", name,
+      hits + misses != 0 ? 100.0 * hits / (hits + misses) : 0, (double) loadNumber / requestNumber,
+      (double) loadedSectors / requestedSectors);
+}
+
+static void readFilesPattern(UINT requestSectors, uint8_t isLookingUp) {
+  readFiles(requestSectors, isLookingUp);
+}
+
+static void readRandomPattern(UINT requestSectors, uint8_t option) {
+  readRandom(requestSectors);
+}
+
+static void readMetadataPattern(UINT requestSectors, uint8_t option) {
+  readMetadata();
+}
+
+int main(void) {
+  printf("Read cache of %u lines of %u sectors, read ahead of %u lines\n", READ_CACHE_LINES, READ_CACHE_LINE_SECTORS,
+      READ_AHEAD_LINES);
+  benchPattern("files, 64 KB requests", readFilesPattern, 128, 0);
+  benchPattern("files, 4 KB requests", readFilesPattern, 8, 0);
+  benchPattern("files, 512 B requests", readFilesPattern, 1, 0);
+  benchPattern("files with lookups, 64 KB requests", readFilesPattern, 128, 1);
+  benchPattern("files with lookups, 4 KB requests", readFilesPattern, 8, 1);
+  benchPattern("random 4 KB requests", readRandomPattern, 8, 0);
+  benchPattern("FAT and directory sectors", readMetadataPattern, 1, 0);
+  return 0;
+}
@@ -0,0 +1,149 @@
+/**
+  ******************************************************************************
+  * @file           : BENCH_WEAR_LEVELING
+  * @version        : v1.0
+  * @brief          : Bench of the hot sector pool on a card image
+  ******************************************************************************
+  * MIT License
+  *
+  * Copyright (c) 2017 Oleksandr Borysov
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+ ******************************************************************************
+*/
+
+
+
+
+/* Card writes and collection latency of the hot sector pool under a FAT-like load: each
+   file rewrites the allocation table, the root directory and FSInfo sectors and writes
+   its data. The card image counts the writes of each sector. Times are of the host CPU */
+
+/* Includes ------------------------------------------------------------------*/
+#include "wear_leveling.h"
+#include "device_stats.h"
+#include "host_platform.h"
+#include "test_util.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Private define ------------------------------------------------------------*/
+#define CARD_SECTORS                     ((uint64_t) 64 * 1024 * 2)    // 64 MB card
+#define FILE_NUMBER                      20000
+#define FILE_SECTORS                     32
+#define DATA_START                       8192
+#define HOT_SECTOR_NUMBER                6                             // FSInfo, two FAT sectors of each copy, root
+#define IDLE_FILES                       8                             // Files written between the idle periods
+#define IDLE_TICKS                       1000                          // Host time between the files in ms
+
+/* Private variables ---------------------------------------------------------*/
+const uint64_t hotSectors[HOT_SECTOR_NUMBER] = { 1, 32, 33, 2080, 2081, 4128 };
+uint8_t data[FILE_SECTORS * STORAGE_BLOCK_SIZE];
+uint32_t writeLatencies[FILE_NUMBER * (HOT_SECTOR_NUMBER + 1)];
+uint32_t collectLatencies[FILE_NUMBER];
+
+/* Private functions ---------------------------------------------------------*/
+
+static uint64_t getNanoseconds(void) {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (uint64_t) time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+static int compareLatencies(const void *first, const void *second) {
+  uint32_t a = *(const uint32_t*) first;
+  uint32_t b = *(const uint32_t*) second;
+  return (a > b) - (a < b);
+}
+
+static void printLatencies(const char *name, uint32_t *latencies, uint32_t number) {
+  if (number == 0) {
+    printf("%-20s none\n", name);
+    return;
+  }
+  qsort(latencies, number, sizeof(uint32_t), compareLatencies);
+  printf("%-20s %6u  p50 %7.1f us  p99 %7.1f us  max %7.1f us\n", name, number, latencies[number / 2] / 1000.0,
+      latencies[number * 99 / 100] / 1000.0, latencies[number - 1] / 1000.0);
+}
+
+static uint32_t timeWrite(const uint8_t *buff, uint64_t sector, UINT count) {
+  uint64_t startTime = getNanoseconds();
+  CHECK(wearWriteSectors(buff, sector, count) == BLOCK_DEVICE_OK);
+  return getNanoseconds() - startTime;
+}
+
+int main(void) {
+  uint64_t poolSector;
+  uint32_t maxHome = 0;
+  uint32_t maxPool = 0;
+  uint32_t maxData = 0;
+  uint32_t minErase = UINT32_MAX;
+  uint32_t maxErase = 0;
+  uint32_t writeNumber = 0;
+  uint32_t collectNumber = 0;
+  CHECK(openSdCard(getImagePath("bench_wear.img"), CARD_SECTORS) == 0);
+  CHECK(initSDCard() == RES_OK);
+  sdCardImage.sectorWrites = calloc(CARD_SECTORS, sizeof(uint32_t));
+  CHECK(sdCardImage.sectorWrites != NULL);
+  poolSector = getWearPoolSector();
+  memset(data, 0x6B, sizeof(data));
+  for (uint32_t file = 0; file < FILE_NUMBER; ++file) {
+    for (uint8_t i = 0; i < HOT_SECTOR_NUMBER; ++i) {
+      writeLatencies[writeNumber++] = timeWrite(data, hotSectors[i], 1);
+    }
+    writeLatencies[writeNumber++] = timeWrite(data, DATA_START + (uint64_t) file * FILE_SECTORS % (CARD_SECTORS / 2),
+        FILE_SECTORS);
+    advanceHostTick(IDLE_TICKS);
+    if (file % IDLE_FILES == IDLE_FILES - 1) {
+      uint32_t collectCount = deviceStatistics.wearCollectCount;
+      uint64_t startTime = getNanoseconds();
+      CHECK(collectWearPool(WEAR_COLLECT_STEP_TIME) == 0);
+      if (deviceStatistics.wearCollectCount != collectCount) {
+        collectLatencies[collectNumber++] = getNanoseconds() - startTime;
+      }
+    }
+  }
+  for (uint64_t sector = 0; sector < CARD_SECTORS; ++sector) {
+    uint32_t writes = sdCardImage.sectorWrites[sector];
+    if ((sector >= poolSector) && (sector < poolSector + WEAR_POOL_SECTORS)) {
+      maxPool = writes > maxPool ? writes : maxPool;
+    } else if (sector < DATA_START) {
+      maxHome = writes > maxHome ? writes : maxHome;
+    } else if (sector < poolSector) {
+      maxData = writes > maxData ? writes : maxData;
+    }
+  }
+  for (uint8_t i = 0; i < WEAR_SEGMENT_NUMBER; ++i) {
+    uint32_t count = getWearPoolState()->eraseCounts[i];
+    minErase = count < minErase ? count : minErase;
+    maxErase = count > maxErase ? count : maxErase;
+  }
+  printf("%u files, %u hot sectors rewritten by each file\n", FILE_NUMBER, HOT_SECTOR_NUMBER);
+  printf("host writes of each hot sector %u\n", FILE_NUMBER);
+  printf("card writes of the hottest sector: home %u  pool %u  file data %u\n", maxHome, maxPool, maxData);
+  printf("segment erase counts: min %u  max %u  segments %u\n", minErase, maxErase, WEAR_SEGMENT_NUMBER);
+  printf("pool writes %u  home writes %u  collections %u  foreground %u\n", deviceStatistics.wearPoolWrites,
+      deviceStatistics.wearHomeWrites, deviceStatistics.wearCollectCount, deviceStatistics.wearForegroundCollects);
+  printLatencies("host write", writeLatencies, writeNumber);
+  printLatencies("idle collection", collectLatencies, collectNumber);
+  free(sdCardImage.sectorWrites);
+  closeCardImage(&sdCardImage);
+  return 0;
+}
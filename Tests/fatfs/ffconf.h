@@ -0,0 +1,77 @@
+/**
+  ******************************************************************************
+  * @file           : FFCONF
+  * @version        : v1.0
+  * @brief          : FatFs R0.12c configurations of the exFAT mount check
+  ******************************************************************************
+  * MIT License
+  *
+  * Copyright (c) 2017 Oleksandr Borysov
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+ ******************************************************************************
+*/
+
+
+
+
+/* Configurations of FatFs R0.12c for the host mount check. The values follow the FATFS
+   parameters of Double_Bottom_USB_Stick.ioc, only f_mkfs is added to format the images */
+#ifndef _FFCONF
+#define _FFCONF 68300               // Revision ID of FatFs R0.12c
+
+#define _FS_READONLY             0
+#define _FS_MINIMIZE             0
+#define _USE_STRFUNC             1
+#define _USE_FIND                0
+#define _USE_MKFS                1                  // 0 on the device
+#define _USE_FASTSEEK            0
+#define _USE_EXPAND              0
+#define _USE_CHMOD               0
+#define _USE_LABEL               0
+#define _USE_FORWARD             0
+
+#define _CODE_PAGE               437
+#define _USE_LFN                 2
+#define _MAX_LFN                 255
+#define _LFN_UNICODE             0
+#define _STRF_ENCODE             3
+#define _FS_RPATH                0
+
+#define _VOLUMES                 1
+#define _STR_VOLUME_ID           0
+#define _VOLUME_STRS             "RAM","NAND","CF","SD","SD2","USB","USB2","USB3"
+#define _MULTI_PARTITION         0
+#define _MIN_SS                  512
+#define _MAX_SS                  4096
+#define _USE_TRIM                0
+#define _FS_NOFSINFO             0
+
+#define _FS_TINY                 0
+#define _FS_EXFAT                1
+#define _FS_NORTC                0
+#define _NORTC_MON               1
+#define _NORTC_MDAY              1
+#define _NORTC_YEAR              2017
+#define _FS_LOCK                 1
+#define _FS_REENTRANT            0
+#define _FS_TIMEOUT              1000
+#define _SYNC_t                  void*
+
+#endif
@@ -0,0 +1,16 @@
+/* Host stand-in of FatFs diskio.h for the tests */
+#ifndef __DISKIO_HOST_H
+#define __DISKIO_HOST_H
+
+#include "ff.h"
+
+typedef BYTE DSTATUS;
+typedef enum {
+  RES_OK = 0,
+  RES_ERROR,
+  RES_WRPRT,
+  RES_NOTRDY,
+  RES_PARERR
+} DRESULT;
+
+#endif
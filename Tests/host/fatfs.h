@@ -0,0 +1,11 @@
+/* Host stand-in of the Cube fatfs.h for the tests */
+#ifndef __FATFS_HOST_H
+#define __FATFS_HOST_H
+
+#include "ff.h"
+#include "ff_gen_drv.h"
+
+extern char SD_Path[4];
+extern FATFS SDFatFs;
+
+#endif
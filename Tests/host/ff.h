@@ -0,0 +1,134 @@
+/* Host stand-in of FatFs ff.h for the tests. Only the types and the calls used by the
+   controller modules are declared, the file calls are given by host_platform.c */
+#ifndef __FF_HOST_H
+#define __FF_HOST_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+typedef unsigned int UINT;
+typedef unsigned char BYTE;
+typedef uint16_t WORD;
+typedef uint32_t DWORD;
+typedef uint64_t QWORD;
+typedef char TCHAR;
+typedef uint16_t WCHAR;
+typedef QWORD FSIZE_t;
+
+#define _USE_WRITE               1
+#define _USE_IOCTL               1
+#define _FS_EXFAT                1
+#define _USE_LFN                 2
+#define _USE_MKFS                1
+#define _MAX_SS                  512
+#define _MIN_SS                  512
+
+#define FS_FAT12                 1
+#define FS_FAT16                 2
+#define FS_FAT32                 3
+#define FS_EXFAT                 4
+
+#define FA_READ                  0x01
+#define FA_WRITE                 0x02
+#define FA_OPEN_EXISTING         0x00
+#define FA_CREATE_NEW            0x04
+#define FA_CREATE_ALWAYS         0x08
+#define FA_OPEN_ALWAYS           0x10
+#define FA_OPEN_APPEND           0x30
+#define AM_RDO                   0x01
+#define AM_DIR                   0x10
+
+#define CTRL_SYNC                0
+#define GET_SECTOR_COUNT         1
+#define GET_SECTOR_SIZE          2
+#define GET_BLOCK_SIZE           3
+#define CTRL_TRIM                4
+
+typedef struct {
+  BYTE fs_type;
+  BYTE drv;
+  BYTE n_fats;
+  BYTE wflag;
+  BYTE fsi_flag;
+  WORD id;
+  WORD n_rootdir;
+  WORD csize;
+  DWORD last_clst;
+  DWORD free_clst;
+  DWORD n_fatent;
+  DWORD fsize;
+  DWORD volbase;
+  DWORD fatbase;
+  DWORD dirbase;
+  DWORD database;
+  DWORD winsect;
+  BYTE win[_MAX_SS];
+} FATFS;
+
+typedef struct {
+  FATFS *fs;
+  WORD id;
+  BYTE attr;
+  BYTE stat;
+  DWORD sclust;
+  FSIZE_t objsize;
+} _FDID;
+
+typedef struct {
+  _FDID obj;
+  BYTE flag;
+  BYTE err;
+  FSIZE_t fptr;
+  DWORD clust;
+  DWORD sect;
+  FILE *hostFile;                                   // Host file behind the FatFs file
+} FIL;
+
+typedef struct {
+  _FDID obj;
+  DWORD dptr;
+  DWORD clust;
+  DWORD sect;
+  BYTE *dir;
+  BYTE fn[12];
+} DIR;
+
+typedef struct {
+  FSIZE_t fsize;
+  WORD fdate;
+  WORD ftime;
+  BYTE fattrib;
+  TCHAR altname[13];
+  TCHAR fname[256];
+} FILINFO;
+
+typedef enum {
+  FR_OK = 0, FR_DISK_ERR, FR_INT_ERR, FR_NOT_READY, FR_NO_FILE, FR_NO_PATH, FR_INVALID_NAME, FR_DENIED,
+  FR_EXIST, FR_INVALID_OBJECT, FR_WRITE_PROTECTED, FR_INVALID_DRIVE, FR_NOT_ENABLED, FR_NO_FILESYSTEM,
+  FR_MKFS_ABORTED, FR_TIMEOUT, FR_LOCKED, FR_NOT_ENOUGH_CORE, FR_TOO_MANY_OPEN_FILES, FR_INVALID_PARAMETER
+} FRESULT;
+
+FRESULT f_open(FIL*, const TCHAR*, BYTE);
+FRESULT f_close(FIL*);
+FRESULT f_read(FIL*, void*, UINT, UINT*);
+FRESULT f_write(FIL*, const void*, UINT, UINT*);
+FRESULT f_lseek(FIL*, FSIZE_t);
+FRESULT f_sync(FIL*);
+FRESULT f_opendir(DIR*, const TCHAR*);
+FRESULT f_closedir(DIR*);
+FRESULT f_readdir(DIR*, FILINFO*);
+FRESULT f_stat(const TCHAR*, FILINFO*);
+FRESULT f_unlink(const TCHAR*);
+FRESULT f_rename(const TCHAR*, const TCHAR*);
+FRESULT f_getfree(const TCHAR*, DWORD*, FATFS**);
+FRESULT f_mount(FATFS*, const TCHAR*, BYTE);
+FRESULT f_mkfs(const TCHAR*, BYTE, DWORD, void*, UINT);
+int f_printf(FIL*, const TCHAR*, ...);
+int f_puts(const TCHAR*, FIL*);
+WCHAR ff_wtoupper(WCHAR);
+
+#define f_size(fp)               ((fp)->obj.objsize)
+#define f_eof(fp)                ((int) ((fp)->fptr == (fp)->obj.objsize))
+
+#endif
@@ -0,0 +1,17 @@
+/* Host stand-in of the FatFs generic driver header for the tests */
+#ifndef __FF_GEN_DRV_HOST_H
+#define __FF_GEN_DRV_HOST_H
+
+#include "diskio.h"
+#include "ff.h"
+#include "stm32f4xx_hal.h"
+
+typedef struct {
+  DSTATUS (*disk_initialize)(BYTE);
+  DSTATUS (*disk_status)(BYTE);
+  DRESULT (*disk_read)(BYTE, BYTE*, DWORD, UINT);
+  DRESULT (*disk_write)(BYTE, const BYTE*, DWORD, UINT);
+  DRESULT (*disk_ioctl)(BYTE, BYTE, void*);
+} Diskio_drvTypeDef;
+
+#endif
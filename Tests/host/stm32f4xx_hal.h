@@ -0,0 +1,72 @@
+/* Host stand-in of the STM32F4 HAL for the tests. The SD card calls are given by
+   host_platform.c over a card image file, the core registers are plain variables */
+#ifndef __STM32F4XX_HAL_HOST_H
+#define __STM32F4XX_HAL_HOST_H
+
+#include <stdint.h>
+
+#define HIGH_CAPACITY_SD_CARD    ((uint32_t) 0x00000002)
+#define MSD_OK                   0x00
+#define MSD_ERROR                0x01
+#define SD_DATATIMEOUT           ((uint32_t) 0xFFFFFFFF)
+#define CoreDebug_DEMCR_TRCENA_Msk (1UL << 24)
+#define DWT_CTRL_CYCCNTENA_Msk   (1UL)
+
+typedef struct {
+  uint32_t CNT;
+} TIM_TypeDef;
+typedef struct {
+  TIM_TypeDef *Instance;
+} TIM_HandleTypeDef;
+typedef struct {
+  uint32_t DeviceSize;
+} HAL_SD_CSDTypedef;
+typedef struct {
+  HAL_SD_CSDTypedef SD_csd;
+  uint64_t CardCapacity;
+  uint32_t CardBlockSize;
+  uint16_t RCA;
+  uint8_t CardType;
+} HAL_SD_CardInfoTypedef;
+typedef struct {
+  int id;
+} SD_HandleTypeDef;
+typedef enum {
+  SD_OK = 0,
+  SD_ERROR = 1
+} HAL_SD_ErrorTypedef;
+typedef struct {
+  volatile uint32_t CTRL;
+  volatile uint32_t CYCCNT;
+} DWT_Type;
+typedef struct {
+  volatile uint32_t DEMCR;
+} CoreDebug_Type;
+typedef enum {
+  OTG_FS_IRQn = 67
+} IRQn_Type;
+
+extern DWT_Type *DWT;
+extern CoreDebug_Type *CoreDebug;
+extern uint32_t SystemCoreClock;
+
+uint8_t BSP_SD_Init(void);
+uint8_t BSP_SD_GetStatus(void);
+uint8_t BSP_SD_ReadBlocks_DMA(uint32_t*, uint64_t, uint32_t, uint32_t);
+uint8_t BSP_SD_WriteBlocks_DMA(uint32_t*, uint64_t, uint32_t, uint32_t);
+uint8_t BSP_SD_Erase(uint64_t, uint64_t);
+HAL_SD_ErrorTypedef HAL_SD_ReadBlocks_DMA(SD_HandleTypeDef*, uint32_t*, uint64_t, uint32_t, uint32_t);
+HAL_SD_ErrorTypedef HAL_SD_WriteBlocks_DMA(SD_HandleTypeDef*, uint32_t*, uint64_t, uint32_t, uint32_t);
+HAL_SD_ErrorTypedef HAL_SD_CheckReadOperation(SD_HandleTypeDef*, uint32_t);
+HAL_SD_ErrorTypedef HAL_SD_CheckWriteOperation(SD_HandleTypeDef*, uint32_t);
+void HAL_Delay(uint32_t);
+uint32_t HAL_GetTick(void);
+void HAL_NVIC_DisableIRQ(IRQn_Type);
+void HAL_NVIC_EnableIRQ(IRQn_Type);
+uint32_t __get_MSP(void);
+void __disable_irq(void);
+void __enable_irq(void);
+uint32_t __get_PRIMASK(void);
+void __set_PRIMASK(uint32_t);
+
+#endif
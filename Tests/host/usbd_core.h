@@ -0,0 +1,17 @@
+/* Host stand-in of the ST usbd_core.h for the tests */
+#ifndef __USBD_CORE_HOST_H
+#define __USBD_CORE_HOST_H
+
+#include <stdint.h>
+#include "usbd_storage_if.h"
+
+#define USBD_STATE_CONFIGURED    3
+
+typedef struct {
+  uint8_t dev_state;
+} USBD_HandleTypeDef;
+
+uint8_t USBD_Stop(USBD_HandleTypeDef*);
+uint8_t USBD_Start(USBD_HandleTypeDef*);
+
+#endif
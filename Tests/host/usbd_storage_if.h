@@ -0,0 +1,9 @@
+/* Host stand-in of the Cube usbd_storage_if.h for the tests */
+#ifndef __USBD_STORAGE_IF_HOST_H
+#define __USBD_STORAGE_IF_HOST_H
+
+#define USBD_OK                  0
+#define USBD_BUSY                1
+#define USBD_FAIL                2
+
+#endif
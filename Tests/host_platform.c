@@ -0,0 +1,452 @@
+/**
+  ******************************************************************************
+  * @file           : HOST_PLATFORM
+  * @version        : v1.0
+  * @brief          : Board and FatFs stand-ins for the host tests
+  ******************************************************************************
+  * MIT License
+  *
+  * Copyright (c) 2017 Oleksandr Borysov
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+ ******************************************************************************
+*/
+
+
+
+
+/* Includes ------------------------------------------------------------------*/
+#define _GNU_SOURCE
+#include "host_platform.h"
+#include "stm32f4xx_hal.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Private define ------------------------------------------------------------*/
+#define SECTOR_SIZE                      512
+#define HOST_STACK_SIZE                  4096
+
+/* Private variables ---------------------------------------------------------*/
+CardImage sdCardImage = { .file = -1 };
+CardImage deviceImages[IMAGE_DEVICE_NUMBER] = { { .file = -1 }, { .file = -1 }, { .file = -1 } };
+uint8_t maxBusyCards;
+uint8_t isTransferOrderBroken;
+uint32_t hostTickOffset;                                  // Time added by the tests
+char imagePath[256];
+
+// Board symbols used by the firmware
+HAL_SD_CardInfoTypedef SDCardInfo;
+SD_HandleTypeDef hsd;
+TIM_TypeDef tim14;
+TIM_HandleTypeDef htim14 = { .Instance = &tim14 };
+DWT_Type dwt;
+CoreDebug_Type coreDebug;
+DWT_Type *DWT = &dwt;
+CoreDebug_Type *CoreDebug = &coreDebug;
+uint32_t SystemCoreClock = 180000000;
+uint32_t hostStack[HOST_STACK_SIZE / sizeof(uint32_t)];
+uint32_t _Min_Stack_Size = 0;
+uint32_t _estack;
+
+/* Private function prototypes -----------------------------------------------*/
+uint8_t startImageTransfer(CardImage*);
+void finishImageTransfer(CardImage*);
+uint8_t failImageTransfer(CardImage*);
+uint8_t eraseImageSectors(CardImage*, uint64_t, uint64_t);
+
+/* Public host functions ---------------------------------------------------------*/
+
+/*******************************************************************************
+* Description    : Creates the sparse image of the card.
+* Input          : path - image file
+*                  sectorNumber - size of the card.
+* Output         : image - the opened image.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t openCardImage(CardImage *image, const char *path, uint64_t sectorNumber) {
+  closeCardImage(image);
+  memset(image, 0, sizeof(CardImage));
+  image->file = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if ((image->file < 0) || (ftruncate(image->file, (off_t) (sectorNumber * SECTOR_SIZE)) != 0)) {
+    return 1;
+  }
+  image->sectorNumber = sectorNumber;
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Closes the image of the card.
+* Input          : image - the card image.
+* Output         : None.
+* Return         : None.
+*******************************************************************************/
+void closeCardImage(CardImage *image) {
+  if (image->file >= 0) {
+    close(image->file);
+  }
+  image->file = -1;
+}
+
+/*******************************************************************************
+* Description    : Opens the image of the SDIO card and fills the card info the
+*                    same way as the SD driver does for SDHC/SDXC cards.
+* Input          : path - image file
+*                  sectorNumber - size of the card, multiple of 1024 sectors.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t openSdCard(const char *path, uint64_t sectorNumber) {
+  memset(&SDCardInfo, 0, sizeof(SDCardInfo));
+  SDCardInfo.CardType = HIGH_CAPACITY_SD_CARD;
+  SDCardInfo.SD_csd.DeviceSize = sectorNumber / 1024 - 1;
+  SDCardInfo.CardCapacity = sectorNumber * SECTOR_SIZE;
+  SDCardInfo.CardBlockSize = SECTOR_SIZE;
+  return openCardImage(&sdCardImage, path, sectorNumber);
+}
+
+/*******************************************************************************
+* Description    : Reads sectors of the image without the transfer checks.
+* Input          : image - the card image
+*                  sector - first sector
+*                  count - number of the sectors.
+* Output         : buff - read data.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t readImageSectors(CardImage *image, uint8_t *buff, uint64_t sector, uint32_t count) {
+  ssize_t size = (ssize_t) count * SECTOR_SIZE;
+  if (sector + count > image->sectorNumber) {
+    return 1;
+  }
+  ++image->readNumber;
+  return pread(image->file, buff, size, (off_t) (sector * SECTOR_SIZE)) != size;
+}
+
+/*******************************************************************************
+* Description    : Writes sectors of the image without the transfer checks. After
+*                    writeLimit runs the writes fail as on the power loss.
+* Input          : image - the card image
+*                  buff - data to write
+*                  sector - first sector
+*                  count - number of the sectors.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t writeImageSectors(CardImage *image, const uint8_t *buff, uint64_t sector, uint32_t count) {
+  ssize_t size = (ssize_t) count * SECTOR_SIZE;
+  if ((sector + count > image->sectorNumber) || ((image->writeLimit != 0) && (image->writeNumber >= image->writeLimit))) {
+    return 1;
+  }
+  image->writeNumber++;
+  for (uint32_t i = 0; (image->sectorWrites != NULL) && (i < count); ++i) {
+    image->sectorWrites[sector + i]++;
+  }
+  return pwrite(image->file, buff, size, (off_t) (sector * SECTOR_SIZE)) != size;
+}
+
+/*******************************************************************************
+* Description    : Clears the transfer, read, write and erase counters of all images.
+* Input          : None.
+* Output         : None.
+* Return         : None.
+*******************************************************************************/
+void resetImageCounters(void) {
+  CardImage *images[IMAGE_DEVICE_NUMBER + 1] = { &sdCardImage, &deviceImages[0], &deviceImages[1], &deviceImages[2] };
+  for (uint8_t i = 0; i < IMAGE_DEVICE_NUMBER + 1; ++i) {
+    images[i]->transferNumber = 0;
+    images[i]->readNumber = 0;
+    images[i]->writeNumber = 0;
+    images[i]->writeLimit = 0;
+    images[i]->eraseNumber = 0;
+    images[i]->eraseTime = 0;
+    images[i]->erasedSectors = 0;
+  }
+  maxBusyCards = 0;
+  isTransferOrderBroken = 0;
+}
+
+/*******************************************************************************
+* Description    : Opens the host file as the FatFs file.
+* Input          : path - host file
+*                  mode - fopen mode.
+* Output         : file - the FatFs file.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t openHostFile(FIL *file, const char *path, const char *mode) {
+  memset(file, 0, sizeof(FIL));
+  file->hostFile = fopen(path, mode);
+  if (file->hostFile == NULL) {
+    return 1;
+  }
+  fseek(file->hostFile, 0, SEEK_END);
+  file->obj.objsize = ftell(file->hostFile);
+  fseek(file->hostFile, 0, SEEK_SET);
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Closes the host file of the FatFs file.
+* Input          : file - the FatFs file.
+* Output         : None.
+* Return         : None.
+*******************************************************************************/
+void closeHostFile(FIL *file) {
+  if (file->hostFile != NULL) {
+    fclose(file->hostFile);
+  }
+  file->hostFile = NULL;
+}
+
+/*******************************************************************************
+* Description    : Moves the tick forward, for the idle and timeout checks.
+* Input          : time - milliseconds.
+* Output         : None.
+* Return         : None.
+*******************************************************************************/
+void advanceHostTick(uint32_t time) {
+  hostTickOffset += time;
+}
+
+/*******************************************************************************
+* Description    : Gets path of the image file in the image directory. The directory
+*                    is given by IMAGE_DIR or the current directory is used.
+* Input          : name - image file name.
+* Output         : None.
+* Return         : The path, valid till the next call.
+*******************************************************************************/
+const char* getImagePath(const char *name) {
+  const char *dir = getenv("IMAGE_DIR");
+  snprintf(imagePath, sizeof(imagePath), "%s/%s", dir != NULL ? dir : ".", name);
+  return imagePath;
+}
+
+/* Board stand-ins -----------------------------------------------------------*/
+
+uint8_t BSP_SD_Init(void) {
+  return sdCardImage.file >= 0 ? MSD_OK : MSD_ERROR;
+}
+
+uint8_t BSP_SD_GetStatus(void) {
+  return sdCardImage.file >= 0 ? MSD_OK : MSD_ERROR;
+}
+
+uint8_t BSP_SD_ReadBlocks_DMA(uint32_t *pData, uint64_t ReadAddr, uint32_t BlockSize, uint32_t NumOfBlocks) {
+  return readImageSectors(&sdCardImage, (uint8_t*) pData, ReadAddr / BlockSize, NumOfBlocks) ? MSD_ERROR : MSD_OK;
+}
+
+uint8_t BSP_SD_WriteBlocks_DMA(uint32_t *pData, uint64_t WriteAddr, uint32_t BlockSize, uint32_t NumOfBlocks) {
+  return writeImageSectors(&sdCardImage, (uint8_t*) pData, WriteAddr / BlockSize, NumOfBlocks) ? MSD_ERROR : MSD_OK;
+}
+
+uint8_t BSP_SD_Erase(uint64_t StartAddr, uint64_t EndAddr) {
+  return eraseImageSectors(&sdCardImage, StartAddr / SECTOR_SIZE, (EndAddr - StartAddr) / SECTOR_SIZE + 1) ? MSD_ERROR : MSD_OK;
+}
+
+HAL_SD_ErrorTypedef HAL_SD_ReadBlocks_DMA(SD_HandleTypeDef *hsd, uint32_t *pReadBuffer, uint64_t ReadAddr,
+                                          uint32_t BlockSize, uint32_t NumberOfBlocks) {
+  if (startImageTransfer(&sdCardImage)) {
+    return SD_ERROR;
+  }
+  return readImageSectors(&sdCardImage, (uint8_t*) pReadBuffer, ReadAddr / BlockSize, NumberOfBlocks)
+      && failImageTransfer(&sdCardImage) ? SD_ERROR : SD_OK;
+}
+
+HAL_SD_ErrorTypedef HAL_SD_WriteBlocks_DMA(SD_HandleTypeDef *hsd, uint32_t *pWriteBuffer, uint64_t WriteAddr,
+                                           uint32_t BlockSize, uint32_t NumberOfBlocks) {
+  if (startImageTransfer(&sdCardImage)) {
+    return SD_ERROR;
+  }
+  return writeImageSectors(&sdCardImage, (uint8_t*) pWriteBuffer, WriteAddr / BlockSize, NumberOfBlocks)
+      && failImageTransfer(&sdCardImage) ? SD_ERROR : SD_OK;
+}
+
+HAL_SD_ErrorTypedef HAL_SD_CheckReadOperation(SD_HandleTypeDef *hsd, uint32_t Timeout) {
+  finishImageTransfer(&sdCardImage);
+  return SD_OK;
+}
+
+HAL_SD_ErrorTypedef HAL_SD_CheckWriteOperation(SD_HandleTypeDef *hsd, uint32_t Timeout) {
+  finishImageTransfer(&sdCardImage);
+  return SD_OK;
+}
+
+void HAL_Delay(uint32_t Delay) {
+  advanceHostTick(Delay);
+}
+
+uint32_t HAL_GetTick(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint32_t) (now.tv_sec * 1000 + now.tv_nsec / 1000000) + hostTickOffset;
+}
+
+void HAL_NVIC_DisableIRQ(IRQn_Type IRQn) {
+}
+
+void HAL_NVIC_EnableIRQ(IRQn_Type IRQn) {
+}
+
+uint32_t __get_MSP(void) {
+  return (uint32_t) (uintptr_t) &hostStack[HOST_STACK_SIZE / sizeof(uint32_t) - 1];
+}
+
+void __disable_irq(void) {
+}
+
+void __enable_irq(void) {
+}
+
+// Tasks of the user interface, it is not built for the host
+void doMailboxRequest(void) {
+}
+
+void doIdleWork(void) {
+}
+
+void checkConfFiles(void) {
+}
+
+/* FatFs stand-ins -----------------------------------------------------------*/
+
+FRESULT f_read(FIL *fp, void *buff, UINT btr, UINT *br) {
+  *br = fread(buff, 1, btr, fp->hostFile);
+  fp->fptr += *br;
+  return ferror(fp->hostFile) ? FR_DISK_ERR : FR_OK;
+}
+
+FRESULT f_write(FIL *fp, const void *buff, UINT btw, UINT *bw) {
+  *bw = fwrite(buff, 1, btw, fp->hostFile);
+  fp->fptr += *bw;
+  if (fp->fptr > fp->obj.objsize) {
+    fp->obj.objsize = fp->fptr;
+  }
+  return ferror(fp->hostFile) ? FR_DISK_ERR : FR_OK;
+}
+
+WCHAR ff_wtoupper(WCHAR chr) {
+  if (((chr >= 'a') && (chr <= 'z')) || ((chr >= 0xE0) && (chr <= 0xFE) && (chr != 0xF7))) {
+    return chr - 0x20;                                    // ASCII and Latin-1 only
+  }
+  return chr;
+}
+
+/* Striped block devices -----------------------------------------------------*/
+
+#define IMAGE_DEVICE_FUNCTIONS(n) \
+  static uint8_t startRead##n(uint8_t *buff, uint64_t sector, uint32_t count) { \
+    return startImageTransfer(&deviceImages[n]) \
+        || (readImageSectors(&deviceImages[n], buff, sector, count) && failImageTransfer(&deviceImages[n])); \
+  } \
+  static uint8_t startWrite##n(const uint8_t *buff, uint64_t sector, uint32_t count) { \
+    return startImageTransfer(&deviceImages[n]) \
+        || (writeImageSectors(&deviceImages[n], buff, sector, count) && failImageTransfer(&deviceImages[n])); \
+  } \
+  static uint8_t wait##n(void) { \
+    finishImageTransfer(&deviceImages[n]); \
+    return BLOCK_DEVICE_OK; \
+  } \
+  static uint8_t erase##n(uint64_t sector, uint64_t count) { \
+    return eraseImageSectors(&deviceImages[n], sector, count); \
+  } \
+  static uint64_t getSectorNumber##n(void) { \
+    return deviceImages[n].sectorNumber; \
+  }
+
+IMAGE_DEVICE_FUNCTIONS(0)
+IMAGE_DEVICE_FUNCTIONS(1)
+IMAGE_DEVICE_FUNCTIONS(2)
+
+const BlockDevice imageDevices[IMAGE_DEVICE_NUMBER] = {
+  { startRead0, startWrite0, wait0, wait0, erase0, getSectorNumber0 },
+  { startRead1, startWrite1, wait1, wait1, erase1, getSectorNumber1 },
+  { startRead2, startWrite2, wait2, wait2, erase2, getSectorNumber2 }
+};
+
+/* Private functions ---------------------------------------------------------*/
+
+/*******************************************************************************
+* Description    : Marks the card busy till its transfer is waited. The data is moved
+*                    at once, the busy mark checks the order of the starts and waits.
+* Input          : image - the card image.
+* Output         : None.
+* Return         : 0 if success or 1 if the card is busy.
+*******************************************************************************/
+uint8_t startImageTransfer(CardImage *image) {
+  CardImage *images[IMAGE_DEVICE_NUMBER + 1] = { &sdCardImage, &deviceImages[0], &deviceImages[1], &deviceImages[2] };
+  uint8_t busyCards = 0;
+  if (image->isBusy) {
+    isTransferOrderBroken = 1;
+    return 1;
+  }
+  image->isBusy = 1;
+  ++image->transferNumber;
+  for (uint8_t i = 0; i < IMAGE_DEVICE_NUMBER + 1; ++i) {
+    busyCards += images[i]->isBusy;
+  }
+  if (busyCards > maxBusyCards) {
+    maxBusyCards = busyCards;
+  }
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Ends the transfer of the card.
+* Input          : image - the card image.
+* Output         : None.
+* Return         : None.
+*******************************************************************************/
+void finishImageTransfer(CardImage *image) {
+  image->isBusy = 0;
+}
+
+/*******************************************************************************
+* Description    : Ends the transfer which failed to start, the DMA is not waited.
+* Input          : image - the card image.
+* Output         : None.
+* Return         : Always 1.
+*******************************************************************************/
+uint8_t failImageTransfer(CardImage *image) {
+  image->isBusy = 0;
+  return 1;
+}
+
+/*******************************************************************************
+* Description    : Erases sectors of the image, the erased sectors read as zeros.
+*                    The host tick moves on by the erase time of the image.
+* Input          : image - the card image
+*                  sector - first sector
+*                  count - number of the sectors.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+uint8_t eraseImageSectors(CardImage *image, uint64_t sector, uint64_t count) {
+  if ((count == 0) || (sector + count > image->sectorNumber) || image->isBusy) {
+    return 1;
+  }
+  image->eraseStart[image->eraseNumber % ERASE_LOG_SIZE] = sector;
+  image->eraseCount[image->eraseNumber % ERASE_LOG_SIZE] = count;
+  ++image->eraseNumber;
+  image->erasedSectors += count;
+  advanceHostTick(image->eraseTime);                      // Card is busy while it erases
+  return fallocate(image->file, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                   (off_t) (sector * SECTOR_SIZE), (off_t) (count * SECTOR_SIZE)) != 0;
+}
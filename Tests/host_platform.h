@@ -0,0 +1,80 @@
+/**
+  ******************************************************************************
+  * @file           : HOST_PLATFORM
+  * @version        : v1.0
+  * @brief          : Header for host_platform file
+  ******************************************************************************
+  * MIT License
+  *
+  * Copyright (c) 2017 Oleksandr Borysov
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+ ******************************************************************************
+*/
+
+
+
+
+/* Host side of the board for the tests. SD cards and the striped block devices are kept
+   in sparse image files, FatFs files are kept in host files */
+#ifndef __HOST_PLATFORM_H
+#define __HOST_PLATFORM_H
+
+#include <stdint.h>
+#include "ff.h"
+#include "block_device.h"
+
+#define IMAGE_DEVICE_NUMBER      3                  // Block devices besides the SD card
+#define ERASE_LOG_SIZE           64
+
+// Card kept in the image file
+typedef struct {
+   int file;
+   uint64_t sectorNumber;
+   uint8_t isBusy;                                  // Transfer is started and not waited
+   uint32_t transferNumber;                         // Started transfers
+   uint32_t readNumber;                             // Read sector runs
+   uint32_t writeNumber;                            // Written sector runs
+   uint32_t writeLimit;                             // Runs written before the power loss, 0 if no loss
+   uint32_t *sectorWrites;                          // Writes of each sector if it is set
+   uint32_t eraseNumber;                            // Erase commands
+   uint32_t eraseTime;                              // ms the host tick moves on by each erase command
+   uint64_t erasedSectors;
+   uint64_t eraseStart[ERASE_LOG_SIZE];             // Last erase commands
+   uint64_t eraseCount[ERASE_LOG_SIZE];
+} CardImage;
+
+extern CardImage sdCardImage;
+extern CardImage deviceImages[IMAGE_DEVICE_NUMBER];
+extern const BlockDevice imageDevices[IMAGE_DEVICE_NUMBER];
+extern uint8_t maxBusyCards;                        // Most cards transferring at the same time
+extern uint8_t isTransferOrderBroken;               // Transfer started on the busy card
+
+uint8_t openCardImage(CardImage*, const char*, uint64_t);
+void closeCardImage(CardImage*);
+uint8_t openSdCard(const char*, uint64_t);
+uint8_t readImageSectors(CardImage*, uint8_t*, uint64_t, uint32_t);
+uint8_t writeImageSectors(CardImage*, const uint8_t*, uint64_t, uint32_t);
+void resetImageCounters(void);
+uint8_t openHostFile(FIL*, const char*, const char*);
+void closeHostFile(FIL*);
+void advanceHostTick(uint32_t);
+const char* getImagePath(const char*);
+
+#endif
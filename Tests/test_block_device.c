@@ -0,0 +1,204 @@
+/**
+  ******************************************************************************
+  * @file           : TEST_BLOCK_DEVICE
+  * @version        : v1.0
+  * @brief          : Tests of the striped volume on card images
+  ******************************************************************************
+  * MIT License
+  *
+  * Copyright (c) 2017 Oleksandr Borysov
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+ ******************************************************************************
+*/
+
+
+
+
+/* Includes ------------------------------------------------------------------*/
+#include "block_device.h"
+#include "host_platform.h"
+#include "test_util.h"
+#include <string.h>
+
+/* Private define ------------------------------------------------------------*/
+#define SECTOR_SIZE                      512
+#define TEST_UNIT                        8
+#define TEST_RESERVED                    16
+
+/* Private variables ---------------------------------------------------------*/
+uint8_t sectors[256 * SECTOR_SIZE];
+
+/* Private functions ---------------------------------------------------------*/
+
+// Opens the images of the devices and builds the volume of them, the first device is given to initVolume
+static void openStripe(uint8_t deviceNumber, const uint64_t *sizes, uint32_t unit) {
+  char name[32];
+  for (uint8_t i = 0; i < deviceNumber; ++i) {
+    snprintf(name, sizeof(name), "stripe%u.img", i);
+    CHECK(openCardImage(&deviceImages[i], getImagePath(name), sizes[i]) == 0);
+  }
+  for (uint8_t i = 1; i < deviceNumber; ++i) {
+    CHECK(registerBlockDevice(&imageDevices[i]) == BLOCK_DEVICE_OK);
+  }
+  initVolume(&imageDevices[0], unit, TEST_RESERVED);
+}
+
+// Fills the sectors with their volume numbers
+static void stampSectors(uint8_t *buff, uint64_t sector, uint32_t count) {
+  for (uint32_t i = 0; i < count; ++i) {
+    memset(buff + i * SECTOR_SIZE, 0x5A, SECTOR_SIZE);
+    memcpy(buff + i * SECTOR_SIZE, &(uint64_t) { sector + i }, sizeof(uint64_t));
+  }
+}
+
+static uint64_t getStamp(const uint8_t *sector) {
+  uint64_t stamp;
+  memcpy(&stamp, sector, sizeof(uint64_t));
+  return stamp;
+}
+
+// Writes the whole volume by requests of the changing length
+static void writeStampedVolume(void) {
+  uint64_t volumeSectors = getVolumeSectorNumber();
+  uint32_t count = 1;
+  for (uint64_t sector = 0; sector < volumeSectors; sector += count) {
+    count = (uint32_t) (sector % 37) + 1;
+    if (sector + count > volumeSectors) {
+      count = volumeSectors - sector;
+    }
+    stampSectors(sectors, sector, count);
+    CHECK(volumeWriteSectors(sectors, sector, count) == BLOCK_DEVICE_OK);
+  }
+}
+
+static void testStripeMapping(void) {
+  const uint64_t sizes[] = { 1000, 1200, 1100 };
+  StripeGeometry geometry;
+  openStripe(3, sizes, TEST_UNIT);
+  getStripeGeometry(&geometry);
+  CHECK(geometry.deviceNumber == 3);
+  CHECK(geometry.stripeUnit == TEST_UNIT);
+  CHECK(getVolumeSectorNumber() == (1000 - TEST_RESERVED) / TEST_UNIT * TEST_UNIT * 3);
+  writeStampedVolume();
+  for (uint8_t device = 0; device < 3; ++device) {       // Units go round-robin over the devices
+    for (uint64_t sector = 0; sector < getVolumeSectorNumber() / 3; ++sector) {
+      uint64_t unit = (sector / TEST_UNIT) * 3 + device;
+      CHECK(readImageSectors(&deviceImages[device], sectors, sector, 1) == 0);
+      CHECK(getStamp(sectors) == unit * TEST_UNIT + sector % TEST_UNIT);
+    }
+  }
+  CHECK(readImageSectors(&deviceImages[1], sectors, getVolumeSectorNumber() / 3, 1) == 0);
+  CHECK(getStamp(sectors) == 0);                          // Nothing is written after the last full row
+}
+
+static void testReadBack(void) {
+  const uint64_t sizes[] = { 600, 700, 600 };
+  uint32_t count = 1;
+  openStripe(3, sizes, TEST_UNIT);
+  writeStampedVolume();
+  for (uint64_t sector = 3; sector < getVolumeSectorNumber(); sector += count) {
+    count = (uint32_t) (sector % 200) + 1;
+    if (sector + count > getVolumeSectorNumber()) {
+      count = getVolumeSectorNumber() - sector;
+    }
+    CHECK(volumeReadSectors(sectors, sector, count) == BLOCK_DEVICE_OK);
+    for (uint32_t i = 0; i < count; ++i) {
+      CHECK(getStamp(sectors + i * SECTOR_SIZE) == sector + i);
+    }
+  }
+}
+
+static void testConcurrentTransfers(void) {
+  const uint64_t sizes[] = { 2048, 2048, 2048 };
+  openStripe(3, sizes, TEST_UNIT);
+  resetImageCounters();
+  stampSectors(sectors, 5, 100);
+  CHECK(volumeWriteSectors(sectors, 5, 100) == BLOCK_DEVICE_OK);
+  CHECK(!isTransferOrderBroken);                          // Device unit is waited before its next unit is started
+  CHECK(maxBusyCards == 3);                               // All devices transfer at the same time
+  CHECK(deviceImages[0].transferNumber + deviceImages[1].transferNumber + deviceImages[2].transferNumber
+        == 14);                                           // Head of 3 sectors, 12 units and tail of 1 sector
+  resetImageCounters();
+  CHECK(volumeReadSectors(sectors, 5, 100) == BLOCK_DEVICE_OK);
+  CHECK(!isTransferOrderBroken);
+  CHECK(maxBusyCards == 3);
+  for (uint8_t i = 0; i < 3; ++i) {
+    CHECK(!deviceImages[i].isBusy);                        // Started transfers are completed
+  }
+}
+
+static void testEraseRuns(void) {
+  const uint64_t sizes[] = { 1024, 1024 };
+  uint64_t first = 3, count = 5 * 2 * TEST_UNIT;
+  openStripe(2, sizes, TEST_UNIT);
+  writeStampedVolume();
+  resetImageCounters();
+  CHECK(volumeEraseSectors(first, count) == BLOCK_DEVICE_OK);
+  for (uint8_t i = 0; i < 2; ++i) {
+    CHECK(deviceImages[i].eraseNumber == 1);              // Units of one device are joined in one command
+  }
+  CHECK(deviceImages[0].eraseStart[0] == 3);
+  CHECK(deviceImages[0].eraseCount[0] == 5 * TEST_UNIT);
+  CHECK(deviceImages[1].eraseStart[0] == 0);
+  CHECK(deviceImages[1].eraseCount[0] == 5 * TEST_UNIT);
+  CHECK(volumeReadSectors(sectors, 0, 100) == BLOCK_DEVICE_OK);
+  for (uint64_t i = 0; i < 100; ++i) {
+    uint64_t stamp = getStamp(sectors + i * SECTOR_SIZE);
+    CHECK(((i >= first) && (i < first + count)) ? stamp == 0 : stamp == i);
+  }
+}
+
+static void testSingleDevice(void) {
+  const uint64_t sizes[] = { 1000 };
+  StripeGeometry geometry;
+  openStripe(1, sizes, 128);
+  getStripeGeometry(&geometry);
+  CHECK(geometry.deviceNumber == 1);
+  CHECK(getVolumeSectorNumber() == 1000 - TEST_RESERVED);  // No row rounding without striping
+  stampSectors(sectors, 900, 84);
+  CHECK(volumeWriteSectors(sectors, 900, 84) == BLOCK_DEVICE_OK);
+  CHECK(readImageSectors(&deviceImages[0], sectors, 983, 1) == 0);
+  CHECK(getStamp(sectors) == 983);
+  CHECK(volumeWriteSectors(sectors, 900, 85) == BLOCK_DEVICE_ERROR);
+  CHECK(volumeReadSectors(sectors, 0, 0) == BLOCK_DEVICE_ERROR);
+  CHECK(volumeEraseSectors(984, 1) == BLOCK_DEVICE_ERROR);
+}
+
+static void testFirstDevice(void) {
+  const uint64_t sizes[] = { 512, 512, 512 };
+  openStripe(3, sizes, TEST_UNIT);                         // Others are registered before the first one is given
+  stampSectors(sectors, 0, 1);
+  CHECK(volumeWriteSectors(sectors, 0, 1) == BLOCK_DEVICE_OK);
+  CHECK(readImageSectors(&deviceImages[0], sectors, 0, 1) == 0);
+  CHECK(getStamp(sectors) == 0);
+  CHECK(deviceImages[1].transferNumber == 0);
+  CHECK(registerBlockDevice(&imageDevices[2]) == BLOCK_DEVICE_OK);
+  CHECK(registerBlockDevice(&imageDevices[2]) == BLOCK_DEVICE_ERROR);   // MAX_BLOCK_DEVICE_NUMBER devices at most
+}
+
+int main(void) {
+  RUN_TEST(testStripeMapping);
+  RUN_TEST(testReadBack);
+  RUN_TEST(testConcurrentTransfers);
+  RUN_TEST(testEraseRuns);
+  RUN_TEST(testSingleDevice);
+  RUN_TEST(testFirstDevice);
+  return testFailures != 0;
+}
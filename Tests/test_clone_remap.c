@@ -0,0 +1,173 @@
+/**
+  ******************************************************************************
+  * @file           : TEST_CLONE_REMAP
+  * @version        : v1.0
+  * @brief          : Tests of the partition clones on a card image
+  ******************************************************************************
+  * MIT License
+  *
+  * Copyright (c) 2017 Oleksandr Borysov
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+ ******************************************************************************
+*/
+
+
+
+
+/* Includes ------------------------------------------------------------------*/
+#include "clone_remap.h"
+#include "relocation.h"
+#include "partition_table.h"
+#include "host_platform.h"
+#include "test_util.h"
+#include <string.h>
+
+/* Private define ------------------------------------------------------------*/
+#define CARD_SECTORS                     ((uint64_t) 256 * 1024 * 2)   // 256 MB card
+#define SOURCE_START                     2048
+#define SOURCE_SECTORS                   (64 * CLONE_BLOCK_SECTORS)
+#define POOL_START                       (SOURCE_START + SOURCE_SECTORS)
+#define POOL_BLOCKS                      4
+#define LUN                              1
+
+/* Private variables ---------------------------------------------------------*/
+Partition source;
+Partition clone;
+uint8_t data[CLONE_BLOCK_SECTORS * STORAGE_BLOCK_SIZE];
+uint8_t readData[CLONE_BLOCK_SECTORS * STORAGE_BLOCK_SIZE];
+
+/* Private functions ---------------------------------------------------------*/
+
+static void fillSectors(uint8_t *buff, uint64_t sector, UINT count, uint8_t mark) {
+  for (UINT i = 0; i < count; ++i) {
+    memset(buff + i * STORAGE_BLOCK_SIZE, mark, STORAGE_BLOCK_SIZE);
+    memcpy(buff + i * STORAGE_BLOCK_SIZE, &sector, sizeof(sector));
+    sector++;
+  }
+}
+
+static void openClone(void) {
+  ExtentIndex sourceIndex;
+  CHECK(openSdCard(getImagePath("clone.img"), CARD_SECTORS) == 0);
+  CHECK(initSDCard() == RES_OK);
+  memset(&source, 0, sizeof(source));
+  source.extents[0].startSector = SOURCE_START;
+  source.extents[0].sectorNumber = SOURCE_SECTORS;
+  source.extentNumber = 1;
+  source.sectorNumber = SOURCE_SECTORS;
+  strcpy(source.name, "template");
+  clone = source;
+  clone.extents[0].startSector = POOL_START;
+  clone.extents[0].sectorNumber = CLONE_META_SECTORS + POOL_BLOCKS * CLONE_BLOCK_SECTORS;
+  clone.sectorNumber = clone.extents[0].sectorNumber;
+  strcpy(clone.name, "copy");
+  strcpy(clone.sourceName, "template");
+  clone.cloneId = 0x1234;
+  buildExtentIndex(&source, &sourceIndex);
+  for (uint64_t sector = 0; sector < SOURCE_SECTORS; sector += CLONE_BLOCK_SECTORS) {
+    fillSectors(data, sector, CLONE_BLOCK_SECTORS, 0x50);
+    CHECK(writePartitionExtents(&source, &sourceIndex, data, sector, CLONE_BLOCK_SECTORS) == BLOCK_DEVICE_OK);
+  }
+  CHECK(openCloneRemap(LUN, &clone, &source, NULL) == 0);
+}
+
+static void checkSectors(uint64_t sector, UINT count, uint8_t mark) {
+  fillSectors(data, sector, count, mark);
+  CHECK(readCloneSectors(readData, sector, count) == BLOCK_DEVICE_OK);
+  CHECK(memcmp(readData, data, count * STORAGE_BLOCK_SIZE) == 0);
+}
+
+static void testReadsSource(void) {
+  openClone();
+  CHECK(getCloneSectorNumber() == SOURCE_SECTORS);
+  checkSectors(0, 16, 0x50);
+  checkSectors(SOURCE_SECTORS - 100, 100, 0x50);
+}
+
+static void testCopyOnWrite(void) {
+  ExtentIndex sourceIndex;
+  openClone();
+  fillSectors(data, 3 * CLONE_BLOCK_SECTORS + 10, 4, 0xC1);
+  CHECK(writeCloneSectors(data, 3 * CLONE_BLOCK_SECTORS + 10, 4) == BLOCK_DEVICE_OK);
+  checkSectors(3 * CLONE_BLOCK_SECTORS, 10, 0x50);         // Rest of the block is copied from the source
+  checkSectors(3 * CLONE_BLOCK_SECTORS + 10, 4, 0xC1);
+  checkSectors(3 * CLONE_BLOCK_SECTORS + 14, CLONE_BLOCK_SECTORS - 14, 0x50);
+  buildExtentIndex(&source, &sourceIndex);
+  CHECK(readPartitionExtents(&source, &sourceIndex, readData, 3 * CLONE_BLOCK_SECTORS + 10, 1) == BLOCK_DEVICE_OK);
+  fillSectors(data, 3 * CLONE_BLOCK_SECTORS + 10, 1, 0x50);
+  CHECK(memcmp(readData, data, STORAGE_BLOCK_SIZE) == 0);  // Source keeps its data
+}
+
+static void testWriteAcrossBlocks(void) {
+  uint64_t sector = 5 * CLONE_BLOCK_SECTORS - 3;
+  openClone();
+  fillSectors(data, sector, 6, 0xC2);
+  CHECK(writeCloneSectors(data, sector, 6) == BLOCK_DEVICE_OK);
+  checkSectors(sector, 6, 0xC2);
+  checkSectors(sector - 5, 5, 0x50);
+  fillSectors(data, sector + 1, 1, 0xC3);                  // Remapped block is written in place
+  CHECK(writeCloneSectors(data, sector + 1, 1) == BLOCK_DEVICE_OK);
+  checkSectors(sector + 1, 1, 0xC3);
+}
+
+static void testRemapLogReload(void) {
+  uint32_t blocks[] = { 40, 2, 17 };
+  openClone();
+  for (uint8_t i = 0; i < 3; ++i) {
+    fillSectors(data, blocks[i] * CLONE_BLOCK_SECTORS, 1, 0xC4 + i);
+    CHECK(writeCloneSectors(data, blocks[i] * CLONE_BLOCK_SECTORS, 1) == BLOCK_DEVICE_OK);
+  }
+  closeCloneRemap(LUN);
+  CHECK(openCloneRemap(LUN, &clone, &source, NULL) == 0);
+  for (uint8_t i = 0; i < 3; ++i) {
+    checkSectors(blocks[i] * CLONE_BLOCK_SECTORS, 1, 0xC4 + i);
+    checkSectors(blocks[i] * CLONE_BLOCK_SECTORS + 1, 1, 0x50);
+  }
+  closeCloneRemap(LUN);
+  clone.cloneId = 0x4321;                                  // Other clone in the same pool starts empty
+  CHECK(openCloneRemap(LUN, &clone, &source, NULL) == 0);
+  checkSectors(blocks[0] * CLONE_BLOCK_SECTORS, 1, 0x50);
+}
+
+static void testPoolFull(void) {
+  openClone();
+  for (uint32_t block = 0; block < POOL_BLOCKS; ++block) {
+    CHECK(writeCloneSectors(data, block * CLONE_BLOCK_SECTORS, 1) == BLOCK_DEVICE_OK);
+  }
+  CHECK(writeCloneSectors(data, POOL_BLOCKS * CLONE_BLOCK_SECTORS, 1) != BLOCK_DEVICE_OK);
+  CHECK(writeCloneSectors(data, 1, 1) == BLOCK_DEVICE_OK);  // Remapped blocks are still written
+}
+
+static void testOtherLunIsRefused(void) {
+  openClone();
+  CHECK(openCloneRemap(LUN + 1, &clone, &source, NULL) != 0);
+  closeCloneRemap(LUN);
+  CHECK(openCloneRemap(LUN + 1, &clone, &source, NULL) == 0);
+}
+
+int main(void) {
+  RUN_TEST(testReadsSource);
+  RUN_TEST(testCopyOnWrite);
+  RUN_TEST(testWriteAcrossBlocks);
+  RUN_TEST(testRemapLogReload);
+  RUN_TEST(testPoolFull);
+  RUN_TEST(testOtherLunIsRefused);
+  return testFailures != 0;
+}
@@ -0,0 +1,116 @@
+/**
+  ******************************************************************************
+  * @file           : TEST_COMMAND_READER
+  * @version        : v1.0
+  * @brief          : Tests of the command file reader
+  ******************************************************************************
+  * MIT License
+  *
+  * Copyright (c) 2017 Oleksandr Borysov
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+ ******************************************************************************
+*/
+
+
+
+
+/* Includes ------------------------------------------------------------------*/
+#include "command_reader.h"
+#include "host_platform.h"
+#include "test_util.h"
+#include <string.h>
+
+/* Private variables ---------------------------------------------------------*/
+FIL file;
+CommandReader reader;
+char chunk[COMMAND_CHUNK_SIZE];
+
+/* Private functions ---------------------------------------------------------*/
+
+static void openText(const char *text, uint32_t chunkSize) {
+  const char *path = getImagePath("command.txt");
+  FILE *hostFile = fopen(path, "wb");
+  CHECK(hostFile != NULL);
+  fputs(text, hostFile);
+  fclose(hostFile);
+  CHECK(openHostFile(&file, path, "rb") == 0);
+  beginCommandReader(&reader, &file, chunk, chunkSize);
+}
+
+static void checkWord(const char *expected, uint16_t wordSize) {
+  char word[32];
+  memset(word, 'x', sizeof(word));
+  CHECK(readCommandWord(&reader, word, wordSize) == 0);
+  CHECK(strncmp(word, expected, wordSize) == 0);
+  CHECK(word[wordSize] == 'x');                          // Nothing written past the word size
+}
+
+static void testWordsAndLines(void) {
+  for (uint32_t chunkSize = 1; chunkSize <= COMMAND_CHUNK_SIZE; chunkSize = chunkSize * 3 + 1) {
+    char line[16];
+    openText("UpdateConf  key\r\n\t0 public\tPublic 100\nlast line", chunkSize);
+    checkWord("UpdateConf", 16);
+    checkWord("key", 16);
+    CHECK(readCommandWord(&reader, line, sizeof(line)) == 1);   // Words end at the line end
+    CHECK(skipCommandLine(&reader) == 0);
+    checkWord("0", 16);
+    checkWord("public", 16);
+    checkWord("Public", 16);
+    checkWord("100", 16);
+    CHECK(isCommandLineEnd(&reader));
+    CHECK(skipCommandLine(&reader) == 0);
+    CHECK(readCommandLine(&reader, line, sizeof(line)) == 0);
+    CHECK(strcmp(line, "last line") == 0);
+    CHECK(peekCommandSymbol(&reader) == COMMAND_READER_END);
+    CHECK(skipCommandLine(&reader) == 1);
+    CHECK(readCommandLine(&reader, line, sizeof(line)) == 1);
+    closeHostFile(&file);
+  }
+}
+
+static void testLongWordIsCut(void) {
+  char line[8];
+  openText("partitionName key\nvery long line\n", 5);
+  checkWord("parti", 5);                                 // Cut like strncpy, the rest is skipped
+  checkWord("key", 5);
+  CHECK(skipCommandLine(&reader) == 0);
+  CHECK(readCommandLine(&reader, line, sizeof(line)) == 0);
+  CHECK(memcmp(line, "very lon", sizeof(line)) == 0);
+  CHECK(peekCommandSymbol(&reader) == COMMAND_READER_END);
+  closeHostFile(&file);
+}
+
+static void testEmptyLines(void) {
+  char word[8];
+  openText("\r\n\n\r\nword", 2);
+  CHECK(skipCommandLine(&reader) == 0);
+  CHECK(skipCommandLine(&reader) == 0);
+  CHECK(skipCommandLine(&reader) == 0);
+  checkWord("word", 8);
+  CHECK(readCommandWord(&reader, word, sizeof(word)) == 1);
+  closeHostFile(&file);
+}
+
+int main(void) {
+  RUN_TEST(testWordsAndLines);
+  RUN_TEST(testLongWordIsCut);
+  RUN_TEST(testEmptyLines);
+  return testFailures != 0;
+}
@@ -0,0 +1,184 @@
+/**
+  ******************************************************************************
+  * @file           : TEST_COMPRESSION
+  * @version        : v1.0
+  * @brief          : Tests of the compressed partitions on a card image
+  ******************************************************************************
+  * MIT License
+  *
+  * Copyright (c) 2017 Oleksandr Borysov
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+ ******************************************************************************
+*/
+
+
+
+
+/* Includes ------------------------------------------------------------------*/
+#include "compression.h"
+#include "sd_io_controller.h"
+#include "host_platform.h"
+#include "test_util.h"
+#include <string.h>
+
+/* Private define ------------------------------------------------------------*/
+#define CARD_SECTORS                     ((uint64_t) 256 * 1024 * 2)   // 256 MB card
+#define PARTITION_START                  2048
+#define PARTITION_SECTORS                20000                         // Nine full map sectors and a short one
+#define CHUNK_BYTES                      (COMPRESS_CHUNK_SECTORS * STORAGE_BLOCK_SIZE)
+#define LUN                              0
+
+/* Private variables ---------------------------------------------------------*/
+Partition partition;
+uint8_t chunk[CHUNK_BYTES];
+uint8_t readChunk[CHUNK_BYTES];
+
+/* Private functions ---------------------------------------------------------*/
+
+static void openStore(const char *xorKey) {
+  CHECK(openSdCard(getImagePath("compression.img"), CARD_SECTORS) == 0);
+  CHECK(initSDCard() == RES_OK);
+  memset(&partition, 0, sizeof(partition));
+  partition.extents[0].startSector = PARTITION_START;
+  partition.extents[0].sectorNumber = PARTITION_SECTORS;
+  partition.extentNumber = 1;
+  partition.sectorNumber = PARTITION_SECTORS;
+  partition.isCompressed = 1;
+  CHECK(openCompressedStore(LUN, &partition, xorKey) == 0);
+}
+
+static void reopenStore(const char *xorKey) {
+  sdCardImage.writeLimit = 0;
+  closeCompressedStore(LUN);                               // Drops the cached chunks as the reset does
+  CHECK(openCompressedStore(LUN, &partition, xorKey) == 0);
+}
+
+static void fillChunk(uint8_t *data, uint32_t seed, uint8_t isCompressible) {
+  for (uint32_t i = 0; i < CHUNK_BYTES; ++i) {
+    seed = seed * 1103515245 + 12345;
+    data[i] = isCompressible ? "chunk map "[(i + seed % 3) % 10] : (uint8_t) (seed >> 16);
+  }
+}
+
+static void writeChunk(uint32_t number, const uint8_t *data) {
+  CHECK(writeCompressedSectors(LUN, data, (uint64_t) number * COMPRESS_CHUNK_SECTORS, COMPRESS_CHUNK_SECTORS)
+      == BLOCK_DEVICE_OK);
+}
+
+static void checkChunk(uint32_t number, const uint8_t *data) {
+  CHECK(readCompressedSectors(LUN, readChunk, (uint64_t) number * COMPRESS_CHUNK_SECTORS, COMPRESS_CHUNK_SECTORS)
+      == BLOCK_DEVICE_OK);
+  CHECK(memcmp(readChunk, data, CHUNK_BYTES) == 0);
+}
+
+static void testLayout(void) {
+  uint64_t hostSectors;
+  openStore(NULL);
+  hostSectors = getCompressedSectorNumber(&partition);
+  CHECK(hostSectors % COMPRESS_CHUNK_SECTORS == 0);
+  CHECK(hostSectors < PARTITION_SECTORS);
+  CHECK(hostSectors > PARTITION_SECTORS - PARTITION_SECTORS / 100 - 2 * COMPRESS_CHUNK_SECTORS);   // Under 1% is lost
+}
+
+static void testReadWrite(void) {
+  uint32_t lastChunk;
+  openStore(NULL);
+  lastChunk = getCompressedSectorNumber(&partition) / COMPRESS_CHUNK_SECTORS - 1;
+  memset(chunk, 0, CHUNK_BYTES);
+  checkChunk(0, chunk);                                    // New map reads zeros
+  for (uint32_t i = 0; i < 3; ++i) {
+    fillChunk(chunk, i, i != 1);
+    writeChunk(i, chunk);
+    writeChunk(lastChunk - i, chunk);
+  }
+  reopenStore(NULL);
+  for (uint32_t i = 0; i < 3; ++i) {
+    fillChunk(chunk, i, i != 1);
+    checkChunk(i, chunk);
+    checkChunk(lastChunk - i, chunk);
+  }
+  CHECK(readCompressedSectors(LUN, readChunk, (uint64_t) (lastChunk + 1) * COMPRESS_CHUNK_SECTORS, 1)
+      != BLOCK_DEVICE_OK);
+}
+
+static void testPartialWrite(void) {
+  openStore("partitionKey");
+  fillChunk(chunk, 7, 1);
+  writeChunk(5, chunk);
+  memset(chunk + 3 * STORAGE_BLOCK_SIZE, 0xA5, STORAGE_BLOCK_SIZE);
+  CHECK(writeCompressedSectors(LUN, chunk + 3 * STORAGE_BLOCK_SIZE, 5 * COMPRESS_CHUNK_SECTORS + 3, 1)
+      == BLOCK_DEVICE_OK);
+  reopenStore("partitionKey");
+  checkChunk(5, chunk);
+}
+
+static void testRewritesKeepPlaces(void) {
+  openStore(NULL);
+  for (uint32_t round = 0; round < 4; ++round) {          // Chunks move between the places of the map sector
+    for (uint32_t i = 0; i < COMPRESS_MAP_ENTRIES + 2; ++i) {
+      fillChunk(chunk, i * 31 + round, (i + round) % 3 != 0);
+      writeChunk(i, chunk);
+    }
+  }
+  reopenStore(NULL);
+  for (uint32_t i = 0; i < COMPRESS_MAP_ENTRIES + 2; ++i) {
+    fillChunk(chunk, i * 31 + 3, (i + 3) % 3 != 0);
+    checkChunk(i, chunk);
+  }
+}
+
+static void testPowerLoss(void) {
+  uint8_t oldChunk[CHUNK_BYTES];
+  uint8_t isOld = 0;
+  uint8_t isNew = 0;
+  openStore("partitionKey");
+  for (uint32_t limit = 0; limit < 3; ++limit) {
+    for (uint32_t i = 0; i < 6; ++i) {
+      fillChunk(oldChunk, i + 100 * limit, i % 2);
+      writeChunk(i, oldChunk);
+    }
+    for (uint32_t i = 0; i < 6; ++i) {                     // Stored size changes between the writes
+      fillChunk(oldChunk, i + 100 * limit, i % 2);
+      fillChunk(chunk, i + 100 * limit + 50, (i + 1) % 2);
+      sdCardImage.writeLimit = sdCardImage.writeNumber + limit;
+      if (limit == 0) {
+        sdCardImage.writeLimit = sdCardImage.writeNumber;
+        sdCardImage.writeNumber++;                         // No write passes
+      }
+      writeCompressedSectors(LUN, chunk, (uint64_t) i * COMPRESS_CHUNK_SECTORS, COMPRESS_CHUNK_SECTORS);
+      reopenStore("partitionKey");
+      CHECK(readCompressedSectors(LUN, readChunk, (uint64_t) i * COMPRESS_CHUNK_SECTORS, COMPRESS_CHUNK_SECTORS)
+          == BLOCK_DEVICE_OK);
+      isOld |= memcmp(readChunk, oldChunk, CHUNK_BYTES) == 0;
+      isNew |= memcmp(readChunk, chunk, CHUNK_BYTES) == 0;
+      CHECK((memcmp(readChunk, oldChunk, CHUNK_BYTES) == 0) || (memcmp(readChunk, chunk, CHUNK_BYTES) == 0));
+    }
+  }
+  CHECK(isOld && isNew);
+}
+
+int main(void) {
+  RUN_TEST(testLayout);
+  RUN_TEST(testReadWrite);
+  RUN_TEST(testPartialWrite);
+  RUN_TEST(testRewritesKeepPlaces);
+  RUN_TEST(testPowerLoss);
+  return testFailures != 0;
+}
@@ -0,0 +1,132 @@
+/**
+  ******************************************************************************
+  * @file           : TEST_CONF_TEXT
+  * @version        : v1.0
+  * @brief          : Tests of the configurations text output
+  ******************************************************************************
+  * MIT License
+  *
+  * Copyright (c) 2017 Oleksandr Borysov
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+ ******************************************************************************
+*/
+
+
+
+
+/* Includes ------------------------------------------------------------------*/
+#include "conf_text.h"
+#include "host_platform.h"
+#include "test_util.h"
+#include <string.h>
+
+/* Private define ------------------------------------------------------------*/
+#define TEXT_LINES                       300
+#define MAX_TEXT_SIZE                    (TEXT_LINES * 64)
+// Formats the text to the window which covers the whole text
+#define CHECK_FORMAT(expectedText, ...) \
+  do { \
+    ConfText text; \
+    beginConfTextWindow(&text, buffer, 0, sizeof(buffer) - 1); \
+    printConfText(&text, __VA_ARGS__); \
+    CHECK(endConfText(&text) == 0); \
+    buffer[text.size] = '\0'; \
+    CHECK(strcmp(buffer, expectedText) == 0); \
+  } while (0)
+
+/* Private variables ---------------------------------------------------------*/
+char buffer[CONF_TEXT_BUFFER_SIZE];
+char expected[MAX_TEXT_SIZE];
+char written[MAX_TEXT_SIZE];
+
+/* Private functions ---------------------------------------------------------*/
+
+// Prints the lines of the ShowConf kind to the text and to the expected string
+static uint32_t printLines(ConfText *text) {
+  uint32_t length = 0;
+  for (uint32_t i = 0; i < TEXT_LINES; ++i) {
+    printConfText(text, "%-20s %10u %s\r\n", "partition", i * 1000, i % 2 ? "private" : "public");
+    length += sprintf(expected + length, "%-20s %10u %s\r\n", "partition", i * 1000, i % 2 ? "private" : "public");
+  }
+  return length;
+}
+
+static void testFormats(void) {
+  CHECK_FORMAT("ab|cd      |      ef", "%s|%-8s|%8s", "ab", "cd", "ef");
+  CHECK_FORMAT("0|   42|00042|42   |", "%u|%5u|%05u|%-5u|", 0, 42, 42, 42);
+  CHECK_FORMAT("-7|-1|4294967295", "%d|%d|%u", -7, 0xFFFFFFFFu, 0xFFFFFFFFu);
+  CHECK_FORMAT("ok|  x", "%c%c|%3c", 'o', 'k', 'x');
+  CHECK_FORMAT("100%|q|end", "100%%|%q|end%");             // Unknown conversions are kept
+}
+
+static void testWindow(void) {
+  ConfText text;
+  uint32_t length;
+  beginConfTextWindow(&text, buffer, 1000, 100);
+  length = printLines(&text);
+  CHECK(endConfText(&text) == 0);
+  CHECK(text.length == length);
+  CHECK(text.size == 100);
+  CHECK(memcmp(buffer, expected + 1000, 100) == 0);
+  beginConfTextWindow(&text, buffer, length - 10, 100); // Window passes the end of the text
+  printLines(&text);
+  CHECK(text.size == 10);
+  CHECK(memcmp(buffer, expected + length - 10, 10) == 0);
+}
+
+static void testWholeSectorWrites(void) {
+  const char *path = getImagePath("conf_text.txt");
+  ConfText text;
+  FIL file;
+  uint32_t length;
+  CHECK(openHostFile(&file, path, "wb") == 0);
+  beginConfText(&text, &file, buffer);
+  length = printLines(&text);
+  CHECK(endConfText(&text) == 0);
+  closeHostFile(&file);
+  CHECK(text.writeCount == (length + CONF_TEXT_BUFFER_SIZE - 1) / CONF_TEXT_BUFFER_SIZE);
+  CHECK(openHostFile(&file, path, "rb") == 0);
+  CHECK(file.obj.objsize == length);
+  CHECK(fread(written, 1, length, file.hostFile) == length);
+  closeHostFile(&file);
+  CHECK(memcmp(written, expected, length) == 0);
+}
+
+static void testFailedWrite(void) {
+  const char *path = getImagePath("conf_text.txt");
+  ConfText text;
+  FIL file;
+  CHECK(openHostFile(&file, path, "wb") == 0);
+  closeHostFile(&file);
+  CHECK(openHostFile(&file, path, "rb") == 0);           // Writes of the read-only file fail
+  beginConfText(&text, &file, buffer);
+  printLines(&text);
+  CHECK(endConfText(&text) != 0);
+  CHECK(text.writeCount == 1);                           // The rest of the text is dropped
+  closeHostFile(&file);
+}
+
+int main(void) {
+  RUN_TEST(testFormats);
+  RUN_TEST(testWindow);
+  RUN_TEST(testWholeSectorWrites);
+  RUN_TEST(testFailedWrite);
+  return testFailures != 0;
+}
@@ -0,0 +1,160 @@
+/**
+  ******************************************************************************
+  * @file           : TEST_FATFS_MOUNT
+  * @version        : v1.0
+  * @brief          : Mount check of FAT32 and exFAT volumes by FatFs of the Cube project
+  ******************************************************************************
+  * MIT License
+  *
+  * Copyright (c) 2017 Oleksandr Borysov
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+ ******************************************************************************
+*/
+
+
+
+
+/* Formats card images by FatFs of the generated Cube project and mounts them through f_mount.
+   The check is built apart from the other tests, FATFS_DIR gives the FatFs sources:
+     make -C Tests fatfs FATFS_DIR=../Middlewares/Third_Party/FatFs/src */
+
+/* Includes ------------------------------------------------------------------*/
+#include "ff.h"
+#include "diskio.h"
+#include "test_util.h"
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+
+/* Private define ------------------------------------------------------------*/
+#define IMAGE_SECTORS                    ((DWORD) 256 * 1024 * 2)      // 256 MB volume
+#define SECTOR_SIZE                      512
+#define FILE_SIZE                        (1024 * 1024)
+#define FILE_NAME                        "Long file name of the partition.bin"
+
+/* Private variables ---------------------------------------------------------*/
+int imageFile = -1;
+FATFS fileSystem;
+BYTE workBuffer[32 * 1024];
+BYTE fileData[FILE_SIZE];
+BYTE readData[FILE_SIZE];
+
+/* Disk functions of FatFs over the image file -------------------------------*/
+
+DSTATUS disk_initialize(BYTE pdrv) {
+  return imageFile < 0 ? STA_NOINIT : 0;
+}
+
+DSTATUS disk_status(BYTE pdrv) {
+  return imageFile < 0 ? STA_NOINIT : 0;
+}
+
+DRESULT disk_read(BYTE pdrv, BYTE *buff, DWORD sector, UINT count) {
+  ssize_t size = (ssize_t) count * SECTOR_SIZE;
+  return pread(imageFile, buff, size, (off_t) sector * SECTOR_SIZE) == size ? RES_OK : RES_ERROR;
+}
+
+DRESULT disk_write(BYTE pdrv, const BYTE *buff, DWORD sector, UINT count) {
+  ssize_t size = (ssize_t) count * SECTOR_SIZE;
+  return pwrite(imageFile, buff, size, (off_t) sector * SECTOR_SIZE) == size ? RES_OK : RES_ERROR;
+}
+
+DRESULT disk_ioctl(BYTE pdrv, BYTE cmd, void *buff) {
+  switch (cmd) {
+    case CTRL_SYNC:
+      return RES_OK;
+    case GET_SECTOR_COUNT:
+      *(DWORD*) buff = IMAGE_SECTORS;
+      return RES_OK;
+    case GET_SECTOR_SIZE:
+      *(WORD*) buff = SECTOR_SIZE;
+      return RES_OK;
+    case GET_BLOCK_SIZE:
+      *(DWORD*) buff = 1;
+      return RES_OK;
+  }
+  return RES_PARERR;
+}
+
+DWORD get_fattime(void) {
+  return ((DWORD) (2017 - 1980) << 25) | ((DWORD) 8 << 21) | ((DWORD) 1 << 16);
+}
+
+/* Private functions ---------------------------------------------------------*/
+
+static uint32_t getMicros(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint32_t) (now.tv_sec * 1000000 + now.tv_nsec / 1000);
+}
+
+// Formats the new image file and mounts it, prints the mount and free space query times
+static void mountVolume(BYTE format, BYTE fileSystemType, const char *name) {
+  char path[256];
+  const char *imageDir = getenv("IMAGE_DIR");
+  FATFS *freeFileSystem;
+  DWORD freeClusters = 0;
+  uint32_t mountTime;
+  uint32_t freeTime;
+  FIL file;
+  UINT bytes = 0;
+  snprintf(path, sizeof(path), "%s/%s", imageDir != NULL ? imageDir : ".", name);
+  imageFile = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  CHECK(imageFile >= 0);
+  CHECK(ftruncate(imageFile, (off_t) IMAGE_SECTORS * SECTOR_SIZE) == 0);
+  CHECK(f_mkfs("", format | FM_SFD, 0, workBuffer, sizeof(workBuffer)) == FR_OK);
+  mountTime = getMicros();
+  CHECK(f_mount(&fileSystem, "", 1) == FR_OK);
+  mountTime = getMicros() - mountTime;
+  CHECK(fileSystem.fs_type == fileSystemType);
+  for (uint32_t i = 0; i < FILE_SIZE; ++i) {
+    fileData[i] = (BYTE) (i * 7 + i / SECTOR_SIZE);
+  }
+  CHECK(f_open(&file, FILE_NAME, FA_CREATE_ALWAYS | FA_WRITE) == FR_OK);
+  CHECK((f_write(&file, fileData, FILE_SIZE, &bytes) == FR_OK) && (bytes == FILE_SIZE));
+  CHECK(f_close(&file) == FR_OK);
+  CHECK(f_mount(NULL, "", 0) == FR_OK);
+  CHECK(f_mount(&fileSystem, "", 1) == FR_OK);             // Mounted again from the card
+  CHECK(f_open(&file, FILE_NAME, FA_READ) == FR_OK);
+  CHECK((f_read(&file, readData, FILE_SIZE, &bytes) == FR_OK) && (bytes == FILE_SIZE));
+  CHECK(f_close(&file) == FR_OK);
+  CHECK(memcmp(readData, fileData, FILE_SIZE) == 0);
+  freeTime = getMicros();
+  CHECK(f_getfree("", &freeClusters, &freeFileSystem) == FR_OK);
+  freeTime = getMicros() - freeTime;
+  CHECK((QWORD) freeClusters * freeFileSystem->csize * SECTOR_SIZE + FILE_SIZE < (QWORD) IMAGE_SECTORS * SECTOR_SIZE);
+  printf("%-6s cluster %6u B, mount %5u us, free space query %6u us\n", fileSystemType == FS_EXFAT ? "exFAT" : "FAT32",
+      (unsigned) fileSystem.csize * SECTOR_SIZE, (unsigned) mountTime, (unsigned) freeTime);
+  close(imageFile);
+}
+
+static void testMountFat32(void) {
+  mountVolume(FM_FAT32, FS_FAT32, "fat32.img");
+}
+
+static void testMountExFat(void) {
+  mountVolume(FM_EXFAT, FS_EXFAT, "exfat.img");
+}
+
+int main(void) {
+  RUN_TEST(testMountFat32);
+  RUN_TEST(testMountExFat);
+  return testFailures != 0;
+}
@@ -0,0 +1,121 @@
+/**
+  ******************************************************************************
+  * @file           : TEST_LZ_CODEC
+  * @version        : v1.0
+  * @brief          : Tests of the LZ codec
+  ******************************************************************************
+  * MIT License
+  *
+  * Copyright (c) 2017 Oleksandr Borysov
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+ ******************************************************************************
+*/
+
+
+
+
+/* Includes ------------------------------------------------------------------*/
+#include "lz_codec.h"
+#include "test_util.h"
+#include <string.h>
+
+/* Private define ------------------------------------------------------------*/
+#define CHUNK_BYTES                      4096
+
+/* Private variables ---------------------------------------------------------*/
+uint8_t source[CHUNK_BYTES];
+uint8_t packed[CHUNK_BYTES + CHUNK_BYTES / 255 + 16];
+uint8_t unpacked[CHUNK_BYTES];
+uint32_t randomState = 1;
+
+/* Private functions ---------------------------------------------------------*/
+
+static uint8_t nextRandom(void) {
+  randomState = randomState * 1103515245 + 12345;
+  return randomState >> 16;
+}
+
+static void fillText(uint8_t *data, uint32_t size) {
+  static const char *words[] = { "partition ", "sector ", "card ", "the ", "key ", "chunk ", "of ", "map\n" };
+  uint32_t i = 0;
+  while (i < size) {
+    const char *word = words[nextRandom() % 8];
+    while ((*word != 0) && (i < size)) {
+      data[i++] = *word++;
+    }
+  }
+}
+
+static void checkRoundTrip(uint32_t size) {
+  uint32_t packedSize = compressLZ(source, size, packed, sizeof(packed));
+  CHECK(packedSize != 0);
+  CHECK(decompressLZ(packed, packedSize, unpacked, size) == size);
+  CHECK(memcmp(source, unpacked, size) == 0);
+}
+
+static void testTextRoundTrip(void) {
+  fillText(source, CHUNK_BYTES);
+  checkRoundTrip(CHUNK_BYTES);
+  CHECK(compressLZ(source, CHUNK_BYTES, packed, sizeof(packed)) < CHUNK_BYTES / 2);
+}
+
+static void testShortInputs(void) {
+  fillText(source, CHUNK_BYTES);
+  for (uint32_t size = 1; size < 80; ++size) {
+    checkRoundTrip(size);
+  }
+}
+
+static void testRepeatedBytes(void) {
+  memset(source, 0x5A, CHUNK_BYTES);
+  checkRoundTrip(CHUNK_BYTES);
+  CHECK(compressLZ(source, CHUNK_BYTES, packed, sizeof(packed)) < 64);
+}
+
+static void testRandomData(void) {
+  for (uint32_t i = 0; i < CHUNK_BYTES; ++i) {
+    source[i] = nextRandom();
+  }
+  checkRoundTrip(CHUNK_BYTES);
+  CHECK(compressLZ(source, CHUNK_BYTES, packed, CHUNK_BYTES - 512) == 0);   // Doesn't save a sector
+}
+
+static void testCorruptedInput(void) {
+  uint32_t packedSize;
+  fillText(source, CHUNK_BYTES);
+  packedSize = compressLZ(source, CHUNK_BYTES, packed, sizeof(packed));
+  CHECK(decompressLZ(packed, packedSize - 1, unpacked, CHUNK_BYTES) != CHUNK_BYTES);
+  CHECK(decompressLZ(packed, packedSize, unpacked, CHUNK_BYTES - 1) != CHUNK_BYTES);
+  for (uint32_t i = 0; i < packedSize; ++i) {            // Any byte may break the block, no read or write past the buffers
+    uint8_t saved = packed[i];
+    packed[i] ^= 0xFF;
+    decompressLZ(packed, packedSize, unpacked, CHUNK_BYTES);
+    packed[i] = saved;
+  }
+}
+
+int main(void) {
+  RUN_TEST(testTextRoundTrip);
+  RUN_TEST(testShortInputs);
+  RUN_TEST(testRepeatedBytes);
+  RUN_TEST(testRandomData);
+  RUN_TEST(testCorruptedInput);
+  return testFailures != 0;
+}
@@ -0,0 +1,261 @@
+/**
+  ******************************************************************************
+  * @file           : TEST_PARTITION_TABLE
+  * @version        : v1.0
+  * @brief          : Tests of the partition table and its name index on a card image
+  ******************************************************************************
+  * MIT License
+  *
+  * Copyright (c) 2017 Oleksandr Borysov
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+ ******************************************************************************
+*/
+
+
+
+
+/* Includes ------------------------------------------------------------------*/
+#include "partition_table.h"
+#include "host_platform.h"
+#include "test_util.h"
+#include <stdio.h>
+#include <string.h>
+
+/* Private define ------------------------------------------------------------*/
+#define CARD_SECTORS                     ((uint64_t) 256 * 1024 * 2)   // 256 MB card
+#define ROOT_KEY                         "rootKey"
+#define TABLE                            1
+
+/* Private functions ---------------------------------------------------------*/
+
+static void openCard(void) {
+  CHECK(openSdCard(getImagePath("table.img"), CARD_SECTORS) == 0);
+  CHECK(initSDCard() == RES_OK);
+}
+
+static void makePartition(Partition *partition, const char *name, uint64_t sectorNumber, uint8_t extentNumber) {
+  memset(partition, 0, sizeof(*partition));
+  strcpy(partition->name, name);
+  strcpy(partition->key, "key");
+  partition->partitionType = PRIVATE;
+  partition->sectorNumber = sectorNumber;
+  partition->extentNumber = extentNumber;
+}
+
+static void writeTable(uint16_t partitionsNumber) {
+  Partition partition;
+  char name[PART_NAME_LENGHT];
+  uint16_t number = 0;
+  uint64_t usedSectors = 0;
+  beginPartitionTable(TABLE, ROOT_KEY);
+  for (uint16_t i = 0; i < partitionsNumber; ++i) {
+    snprintf(name, sizeof(name), "part%u", i);
+    makePartition(&partition, name, 100 + i, 1 + i % 3);
+    CHECK(addPartitionEntry(&partition) == 0);
+  }
+  CHECK(endPartitionTable(&number, &usedSectors) == 0);
+  CHECK(number == partitionsNumber);
+}
+
+static void testEntriesReadBack(void) {
+  Partition partition;
+  Partition readPartition;
+  uint16_t number = 0;
+  uint64_t usedSectors = 0;
+  openCard();
+  beginPartitionTable(TABLE, ROOT_KEY);
+  makePartition(&partition, "zero", 1000, 1);
+  CHECK(addPartitionEntry(&partition) == 0);
+  makePartition(&partition, "private", 301, 1);
+  CHECK(addPartitionEntry(&partition) == 0);
+  makePartition(&partition, "public", 50, 1);
+  strcpy(partition.key, PUBLIC_PARTITION_KEY);
+  partition.partitionType = PUBLIC;
+  CHECK(addPartitionEntry(&partition) == 0);
+  CHECK(endPartitionTable(&number, &usedSectors) == 0);
+  CHECK(number == 3);
+  CHECK(usedSectors == 1351);
+  CHECK(readPartitionEntry(TABLE, 1, ROOT_KEY, &readPartition) == 0);
+  CHECK(strcmp(readPartition.name, "private") == 0);
+  CHECK(readPartition.sectorNumber == 301);
+  CHECK(readPartition.extents[0].startSector == 1000);
+  CHECK(readPartition.extents[0].sectorNumber == 301);
+  CHECK(readPartitionEntry(TABLE, 2, ROOT_KEY, &readPartition) == 0);
+  CHECK(readPartition.partitionType == PUBLIC);
+  CHECK(readPartition.extents[0].startSector == 1301);
+}
+
+static void testExtentsAlternate(void) {
+  Partition partition;
+  uint16_t number = 0;
+  uint64_t usedSectors = 0;
+  openCard();
+  beginPartitionTable(TABLE, ROOT_KEY);
+  makePartition(&partition, "zero", 100, 3);                // Zero partition is always solid
+  CHECK(addPartitionEntry(&partition) == 0);
+  CHECK(partition.extentNumber == 1);
+  makePartition(&partition, "first", 31, 3);
+  CHECK(addPartitionEntry(&partition) == 0);
+  makePartition(&partition, "second", 20, 2);
+  CHECK(addPartitionEntry(&partition) == 0);
+  CHECK(endPartitionTable(&number, &usedSectors) == 0);
+  CHECK(usedSectors == 151);
+  CHECK(findPartitionEntry("first", &partition) == 1);
+  CHECK(partition.extentNumber == 3);
+  CHECK(partition.extents[0].startSector == 100);           // Round 0: zero, first, second
+  CHECK(partition.extents[0].sectorNumber == 10);
+  CHECK(partition.extents[1].startSector == 120);           // Round 1: first, second
+  CHECK(partition.extents[1].sectorNumber == 10);
+  CHECK(partition.extents[2].startSector == 140);           // Round 2: the rest of first
+  CHECK(partition.extents[2].sectorNumber == 11);
+  CHECK(findPartitionEntry("second", &partition) == 2);
+  CHECK(partition.extents[0].startSector == 110);
+  CHECK(partition.extents[1].startSector == 130);
+  CHECK(partition.extents[1].sectorNumber == 10);
+}
+
+static void testExtentTranslation(void) {
+  Partition partition;
+  ExtentIndex extentIndex;
+  UINT runLength = 0;
+  memset(&partition, 0, sizeof(partition));
+  partition.extentNumber = 3;
+  partition.extents[0] = (SectorRange) { 1000, 10 };
+  partition.extents[1] = (SectorRange) { 50, 5 };
+  partition.extents[2] = (SectorRange) { (uint64_t) 1 << 33, 20 };
+  buildExtentIndex(&partition, &extentIndex);
+  CHECK(translateExtentSector(&partition, &extentIndex, 0, &runLength) == 1000);
+  CHECK(runLength == 10);
+  CHECK(translateExtentSector(&partition, &extentIndex, 9, &runLength) == 1009);
+  CHECK(runLength == 1);
+  CHECK(translateExtentSector(&partition, &extentIndex, 10, &runLength) == 50);
+  CHECK(runLength == 5);
+  CHECK(translateExtentSector(&partition, &extentIndex, 16, &runLength) == ((uint64_t) 1 << 33) + 1);
+  CHECK(runLength == 19);
+}
+
+static void testIndexFindsAllNames(void) {
+  Partition partition;
+  char name[PART_NAME_LENGHT];
+  openCard();
+  writeTable(MAX_PART_NUMBER);
+  for (uint16_t i = 0; i < MAX_PART_NUMBER; ++i) {
+    snprintf(name, sizeof(name), "part%u", i);
+    CHECK(findPartitionEntry(name, &partition) == i);
+    CHECK(strcmp(partition.name, name) == 0);
+  }
+  CHECK(findPartitionEntry("part256", &partition) == -1);
+  CHECK(findPartitionEntry("", &partition) == -1);
+}
+
+static void testIndexRebuild(void) {
+  Partition partition;
+  openCard();
+  writeTable(40);
+  CHECK(buildPartitionIndex(TABLE, 0, ROOT_KEY) == 0);      // Empty table finds nothing
+  CHECK(findPartitionEntry("part7", &partition) == -1);
+  CHECK(buildPartitionIndex(TABLE, 40, ROOT_KEY) == 0);
+  CHECK(findPartitionEntry("part7", &partition) == 7);
+  CHECK(findPartitionEntry("part39", &partition) == 39);
+  CHECK(findPartitionEntry("part40", &partition) == -1);
+}
+
+static void testLookupReadsOneSector(void) {
+  Partition partition;
+  openCard();
+  writeTable(MAX_PART_NUMBER);
+  CHECK(readPartitionEntry(TABLE, 0, ROOT_KEY, &partition) == 0);
+  resetImageCounters();
+  CHECK(findPartitionEntry("part200", &partition) == 200);
+  CHECK(sdCardImage.readNumber == 1);                      // Tags skip the entries of the other names
+  resetImageCounters();
+  CHECK(findPartitionEntry("part201", &partition) == 201); // Same table sector is cached
+  CHECK(sdCardImage.readNumber == 0);
+}
+
+static void testWrongEntriesRejected(void) {
+  Partition partition;
+  uint16_t number = 0;
+  uint64_t usedSectors = 0;
+  openCard();
+  beginPartitionTable(TABLE, ROOT_KEY);
+  makePartition(&partition, "zero", 100, 1);
+  CHECK(addPartitionEntry(&partition) == 0);
+  makePartition(&partition, "public", 100, 1);
+  partition.partitionType = PUBLIC;                         // Public partition must have the public key
+  CHECK(addPartitionEntry(&partition) != 0);
+  makePartition(&partition, "other", 100, 1);
+  CHECK(addPartitionEntry(&partition) != 0);               // Table stays failed
+  CHECK(endPartitionTable(&number, &usedSectors) != 0);
+  beginPartitionTable(TABLE, ROOT_KEY);
+  makePartition(&partition, "", 100, 1);
+  CHECK(addPartitionEntry(&partition) != 0);
+  beginPartitionTable(TABLE, ROOT_KEY);
+  makePartition(&partition, "empty", 0, 1);
+  CHECK(addPartitionEntry(&partition) != 0);
+}
+
+static void testDuplicateNameRejected(void) {
+  Partition partition;
+  uint16_t number = 0;
+  uint64_t usedSectors = 0;
+  openCard();
+  beginPartitionTable(TABLE, ROOT_KEY);
+  makePartition(&partition, "zero", 100, 1);
+  CHECK(addPartitionEntry(&partition) == 0);
+  makePartition(&partition, "same", 100, 1);
+  CHECK(addPartitionEntry(&partition) == 0);
+  makePartition(&partition, "same", 200, 1);
+  CHECK(addPartitionEntry(&partition) == 0);
+  CHECK(endPartitionTable(&number, &usedSectors) != 0);
+}
+
+static void testTableFitsVolume(void) {
+  Partition partition;
+  uint16_t number = 0;
+  uint64_t usedSectors = 0;
+  openCard();
+  beginPartitionTable(TABLE, ROOT_KEY);
+  makePartition(&partition, "zero", getVolumeSectorNumber() - 10, 1);
+  CHECK(addPartitionEntry(&partition) == 0);
+  makePartition(&partition, "tail", 11, 2);
+  CHECK(addPartitionEntry(&partition) == 0);
+  CHECK(endPartitionTable(&number, &usedSectors) != 0);
+  beginPartitionTable(TABLE, ROOT_KEY);
+  makePartition(&partition, "zero", getVolumeSectorNumber() - 10, 1);
+  CHECK(addPartitionEntry(&partition) == 0);
+  makePartition(&partition, "tail", 10, 2);
+  CHECK(addPartitionEntry(&partition) == 0);
+  CHECK(endPartitionTable(&number, &usedSectors) == 0);
+  CHECK(usedSectors == getVolumeSectorNumber());
+}
+
+int main(void) {
+  RUN_TEST(testEntriesReadBack);
+  RUN_TEST(testExtentsAlternate);
+  RUN_TEST(testExtentTranslation);
+  RUN_TEST(testIndexFindsAllNames);
+  RUN_TEST(testIndexRebuild);
+  RUN_TEST(testLookupReadsOneSector);
+  RUN_TEST(testWrongEntriesRejected);
+  RUN_TEST(testDuplicateNameRejected);
+  RUN_TEST(testTableFitsVolume);
+  return testFailures != 0;
+}
@@ -0,0 +1,159 @@
+/**
+  ******************************************************************************
+  * @file           : TEST_READ_CACHE
+  * @version        : v1.0
+  * @brief          : Tests of the read cache of the read-only partitions
+  ******************************************************************************
+  * MIT License
+  *
+  * Copyright (c) 2017 Oleksandr Borysov
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+ ******************************************************************************
+*/
+
+
+
+
+/* Includes ------------------------------------------------------------------*/
+#include "read_cache.h"
+#include "device_stats.h"
+#include "test_util.h"
+#include <string.h>
+
+/* Private define ------------------------------------------------------------*/
+#define LUN_SECTORS                      1003               // Last line is shorter
+#define LINE_SECTORS                     READ_CACHE_LINE_SECTORS
+
+/* Private variables ---------------------------------------------------------*/
+uint32_t loadNumber;
+uint32_t loadedSectors;
+uint64_t failedSector = UINT64_MAX;
+BYTE buff[4 * LINE_SECTORS * STORAGE_BLOCK_SIZE];
+
+/* Private functions ---------------------------------------------------------*/
+
+static uint8_t loadSectors(BYTE lun, BYTE *data, DWORD sector, UINT count) {
+  if ((sector <= failedSector) && (failedSector < sector + count)) {
+    return 1;
+  }
+  loadNumber++;
+  loadedSectors += count;
+  for (UINT i = 0; i < count; ++i) {
+    memset(data + i * STORAGE_BLOCK_SIZE, lun, STORAGE_BLOCK_SIZE);
+    memcpy(data + i * STORAGE_BLOCK_SIZE, &(uint32_t) { sector + i }, sizeof(uint32_t));
+  }
+  return 0;
+}
+
+static void readChecked(uint8_t lun, uint64_t sector, UINT count) {
+  CHECK(readCachedSectors(lun, buff, sector, count, LUN_SECTORS, loadSectors) == 0);
+  for (UINT i = 0; i < count; ++i) {
+    uint32_t number;
+    memcpy(&number, buff + i * STORAGE_BLOCK_SIZE, sizeof(number));
+    CHECK(number == sector + i);
+    CHECK(buff[i * STORAGE_BLOCK_SIZE + STORAGE_BLOCK_SIZE - 1] == lun);
+  }
+}
+
+static void testHitAfterMiss(void) {
+  resetReadCache(0);
+  readChecked(0, 3, 2);
+  CHECK((loadNumber == 1) && (loadedSectors == LINE_SECTORS));   // Miss reads the whole line
+  readChecked(0, 0, LINE_SECTORS);
+  CHECK(loadNumber == 1);
+  CHECK((deviceStatistics.readCacheHits == 1) && (deviceStatistics.readCacheMisses == 1));
+}
+
+static void testReadAhead(void) {
+  resetReadCache(0);
+  readChecked(0, 0, 1);
+  readChecked(0, LINE_SECTORS, 1);                         // Miss right after the last line reads ahead
+  CHECK(loadNumber == 1 + READ_AHEAD_LINES);
+  CHECK(deviceStatistics.readAheadSectors == (READ_AHEAD_LINES - 1) * LINE_SECTORS);
+  readChecked(0, LINE_SECTORS, READ_AHEAD_LINES * LINE_SECTORS);
+  CHECK(loadNumber == 1 + READ_AHEAD_LINES);
+}
+
+static void testLongReadGoesDirect(void) {
+  resetReadCache(0);
+  readChecked(0, 2 * LINE_SECTORS, 2 * LINE_SECTORS + 3);  // Whole lines at once, the tail through the cache
+  CHECK(deviceStatistics.readDirectSectors == 2 * LINE_SECTORS);
+  CHECK((loadNumber == 1 + READ_AHEAD_LINES) && (loadedSectors == (2 + READ_AHEAD_LINES) * LINE_SECTORS));
+  readChecked(0, 4 * LINE_SECTORS + 1, 2 * LINE_SECTORS);   // Not at the line start, served by the lines
+  CHECK(loadNumber == 1 + READ_AHEAD_LINES);
+  readChecked(0, 4 * LINE_SECTORS, 2 * LINE_SECTORS);       // Cached line isn't read again
+  CHECK(loadNumber == 1 + READ_AHEAD_LINES);
+  readChecked(0, 7 * LINE_SECTORS, 2 * LINE_SECTORS);
+  CHECK((loadNumber == 2 + READ_AHEAD_LINES) && (deviceStatistics.readDirectSectors == 4 * LINE_SECTORS));
+}
+
+static void testShortLastLine(void) {
+  resetReadCache(0);
+  readChecked(0, LUN_SECTORS - 3, 3);
+  CHECK(loadedSectors == LUN_SECTORS % LINE_SECTORS);
+  readChecked(0, LUN_SECTORS - 2 * LINE_SECTORS, LINE_SECTORS);
+  readChecked(0, LUN_SECTORS - LINE_SECTORS, LINE_SECTORS);
+}
+
+static void testLeastRecentlyUsed(void) {
+  resetReadCache(0);
+  for (uint8_t i = 0; i < READ_CACHE_LINES; ++i) {
+    readChecked(0, (uint64_t) i * 10 * LINE_SECTORS, 1);   // Not sequential, no read ahead
+  }
+  readChecked(0, 0, 1);                                     // First line is used again
+  readChecked(0, 100 * LINE_SECTORS, 1);                    // Replaces the second line
+  loadNumber = 0;
+  readChecked(0, 0, 1);
+  CHECK(loadNumber == 0);
+  readChecked(0, 10 * LINE_SECTORS, 1);
+  CHECK(loadNumber == 1);
+}
+
+static void testLunsAreSeparate(void) {
+  resetReadCache(0);
+  resetReadCache(1);
+  readChecked(0, 0, 1);
+  readChecked(1, 0, 1);
+  CHECK(loadNumber == 2);
+  resetReadCache(1);                                        // Partition of the unit is switched
+  readChecked(0, 0, 1);
+  readChecked(1, 0, 1);
+  CHECK(loadNumber == 3);
+}
+
+static void testFailedLoad(void) {
+  resetReadCache(0);
+  failedSector = 2 * LINE_SECTORS + 1;
+  CHECK(readCachedSectors(0, buff, 2 * LINE_SECTORS, 1, LUN_SECTORS, loadSectors) != 0);
+  failedSector = UINT64_MAX;
+  readChecked(0, 2 * LINE_SECTORS, 1);                      // Failed line is not cached
+  CHECK(loadNumber == 1);
+}
+
+int main(void) {
+  RUN_TEST(testHitAfterMiss);
+  RUN_TEST(testReadAhead);
+  RUN_TEST(testLongReadGoesDirect);
+  RUN_TEST(testShortLastLine);
+  RUN_TEST(testLeastRecentlyUsed);
+  RUN_TEST(testLunsAreSeparate);
+  RUN_TEST(testFailedLoad);
+  return testFailures != 0;
+}
@@ -0,0 +1,240 @@
+/**
+  ******************************************************************************
+  * @file           : TEST_RELOCATION
+  * @version        : v1.0
+  * @brief          : Tests of the partition data relocation on a card image
+  ******************************************************************************
+  * MIT License
+  *
+  * Copyright (c) 2017 Oleksandr Borysov
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+ ******************************************************************************
+*/
+
+
+
+
+/* Includes ------------------------------------------------------------------*/
+#include "relocation.h"
+#include "wear_leveling.h"
+#include "host_platform.h"
+#include "test_util.h"
+#include <string.h>
+
+/* Private define ------------------------------------------------------------*/
+#define CARD_SECTORS                     ((uint64_t) 256 * 1024 * 2)   // 256 MB card
+#define ROOT_KEY                         "rootKey"
+#define MAX_TEST_SECTORS                 64
+#define MAX_VACATED_RANGES               8
+
+/* Private variables ---------------------------------------------------------*/
+PartitionsStructure oldConf;
+PartitionsStructure newConf;
+uint8_t data[MAX_TEST_SECTORS * STORAGE_BLOCK_SIZE];
+uint8_t readData[MAX_TEST_SECTORS * STORAGE_BLOCK_SIZE];
+SectorRange vacatedRanges[MAX_VACATED_RANGES];
+uint8_t vacatedNumber;
+
+/* Private functions ---------------------------------------------------------*/
+
+static void fillSectors(uint8_t *buff, char mark, uint64_t sector, UINT count) {
+  for (UINT i = 0; i < count; ++i) {
+    memset(buff + i * STORAGE_BLOCK_SIZE, mark, STORAGE_BLOCK_SIZE);
+    memcpy(buff + i * STORAGE_BLOCK_SIZE, &sector, sizeof(sector));
+    sector++;
+  }
+}
+
+// Writes the table of the zero partition and partitions "a" and "b" of the given sizes
+static void writeTable(PartitionsStructure *conf, uint8_t table, const uint64_t *sizes, const char *names) {
+  Partition partition;
+  beginPartitionTable(table, ROOT_KEY);
+  for (uint8_t i = 0; i < 3; ++i) {
+    memset(&partition, 0, sizeof(partition));
+    partition.name[0] = names[i];
+    strcpy(partition.key, "key");
+    partition.partitionType = PRIVATE;
+    partition.sectorNumber = sizes[i];
+    partition.extentNumber = 1;
+    CHECK(addPartitionEntry(&partition) == 0);
+  }
+  memset(conf, 0, sizeof(*conf));
+  CHECK(endPartitionTable(&conf->partitionsNumber, &conf->usedSectors) == 0);
+  conf->activeTable = table;
+  conf->initializeStatus = INITIALIZED;
+  strcpy(conf->rootKey, ROOT_KEY);
+}
+
+static void accessPartition(char name, uint64_t sector, UINT count, uint8_t isWrite) {
+  Partition partition;
+  ExtentIndex extentIndex;
+  char partName[2] = { name, '\0' };
+  CHECK(findPartitionEntry(partName, &partition) >= 0);
+  buildExtentIndex(&partition, &extentIndex);
+  if (isWrite) {
+    CHECK(writePartitionExtents(&partition, &extentIndex, data, sector, count) == BLOCK_DEVICE_OK);
+  } else {
+    CHECK(readPartitionExtents(&partition, &extentIndex, readData, sector, count) == BLOCK_DEVICE_OK);
+  }
+}
+
+static void writeData(char name, uint64_t sector, UINT count) {
+  fillSectors(data, name, sector, count);
+  accessPartition(name, sector, count, 1);
+}
+
+static void checkData(char name, uint64_t sector, UINT count) {
+  fillSectors(data, name, sector, count);
+  accessPartition(name, sector, count, 0);
+  CHECK(memcmp(readData, data, count * STORAGE_BLOCK_SIZE) == 0);
+}
+
+// Fills the old layout and plans the moves to the new one
+static uint8_t planLayout(const uint64_t *oldSizes, const uint64_t *newSizes, const char *newNames) {
+  CHECK(openSdCard(getImagePath("relocation.img"), CARD_SECTORS) == 0);
+  CHECK(initSDCard() == RES_OK);
+  writeTable(&oldConf, 0, oldSizes, "zab");
+  writeData('a', 0, oldSizes[1]);
+  writeData('b', 0, oldSizes[2]);
+  CHECK(flushWearPool() == 0);
+  writeTable(&newConf, 1, newSizes, newNames);
+  if (planRelocation(&oldConf) != 0) {
+    return 1;
+  }
+  CHECK(prepareRelocation(&oldConf, &newConf) == 0);
+  startRelocation();
+  return 0;
+}
+
+static void runRelocation(void) {
+  while (!isRelocationFinished()) {
+    CHECK(runRelocationStep(RELOCATION_STEP_TIME) == 0);
+  }
+  CHECK(finishRelocation() == 0);
+}
+
+static uint8_t collectVacatedRange(uint64_t sector, uint64_t count) {
+  CHECK(vacatedNumber < MAX_VACATED_RANGES);
+  vacatedRanges[vacatedNumber].startSector = sector;
+  vacatedRanges[vacatedNumber++].sectorNumber = count;
+  return 0;
+}
+
+static void testGrowFirstPartition(void) {
+  uint64_t oldSizes[] = { 100, 50, 50 };
+  uint64_t newSizes[] = { 120, 60, 50 };
+  CHECK(planLayout(oldSizes, newSizes, "zab") == 0);
+  CHECK(getRelocationProgress()->moveNumber == 2);         // "a" goes up into the source of "b", "b" moves first
+  CHECK(getRelocationProgress()->totalSectors == 100);
+  runRelocation();
+  checkData('a', 0, 50);
+  checkData('b', 0, 50);
+  CHECK(getRelocationProgress()->movedSectors == 100);
+  CHECK(getRelocationProgress()->status == RELOCATION_DONE);
+}
+
+static void testShrinkFirstPartition(void) {
+  uint64_t oldSizes[] = { 100, 50, 50 };
+  uint64_t newSizes[] = { 80, 40, 50 };
+  CHECK(planLayout(oldSizes, newSizes, "zab") == 0);
+  CHECK(getRelocationProgress()->moveNumber == 2);         // "b" goes down into the source of "a", "a" moves first
+  CHECK(getRelocationProgress()->totalSectors == 90);      // Cut tail of "a" is not carried
+  runRelocation();
+  checkData('a', 0, 40);
+  checkData('b', 0, 50);
+}
+
+static void testJoinedShift(void) {
+  uint64_t oldSizes[] = { 100, 50, 50 };
+  uint64_t newSizes[] = { 110, 50, 50 };
+  CHECK(planLayout(oldSizes, newSizes, "zab") == 0);
+  CHECK(getRelocationProgress()->moveNumber == 1);         // Neighbours shifted by the same distance
+  runRelocation();
+  checkData('a', 0, 50);
+  checkData('b', 0, 50);
+}
+
+static void testSwapIsRefused(void) {
+  uint64_t sizes[] = { 100, 50, 50 };
+  CHECK(planLayout(sizes, sizes, "zba") != 0);             // Each move overwrites the source of the other
+}
+
+static void testAccessDuringRelocation(void) {
+  uint64_t oldSizes[] = { 100, 50, 50 };
+  uint64_t newSizes[] = { 120, 60, 50 };
+  CHECK(planLayout(oldSizes, newSizes, "zab") == 0);
+  resetImageCounters();
+  sdCardImage.writeLimit = 3;                              // Step stops after a few chunks
+  CHECK(runRelocationStep(RELOCATION_STEP_TIME) != 0);
+  sdCardImage.writeLimit = 0;
+  CHECK(!isRelocationFinished());
+  checkData('a', 0, 50);                                   // Pending sectors are read at the source
+  checkData('b', 0, 50);
+  writeData('a', 10, 5);
+  writeData('b', 40, 10);
+  runRelocation();
+  checkData('a', 0, 50);
+  checkData('b', 0, 50);
+}
+
+static void testResumeAfterPowerLoss(void) {
+  uint64_t oldSizes[] = { 100, 50, 50 };
+  uint64_t newSizes[] = { 120, 60, 50 };
+  for (uint32_t writeLimit = 1; writeLimit < 12; ++writeLimit) {
+    CHECK(planLayout(oldSizes, newSizes, "zab") == 0);
+    resetImageCounters();
+    sdCardImage.writeLimit = writeLimit;
+    runRelocationStep(RELOCATION_STEP_TIME);
+    sdCardImage.writeLimit = 0;
+    resetRelocation();                                     // Device starts again
+    CHECK(buildPartitionIndex(newConf.activeTable, newConf.partitionsNumber, ROOT_KEY) == 0);
+    CHECK(resumeRelocation(&newConf) == 0);
+    if (isRelocationActive()) {
+      runRelocation();
+    }
+    checkData('a', 0, 50);
+    checkData('b', 0, 50);
+  }
+}
+
+static void testVacatedRanges(void) {
+  uint64_t oldSizes[] = { 100, 50, 50 };
+  uint64_t newSizes[] = { 120, 60, 50 };
+  CHECK(planLayout(oldSizes, newSizes, "zab") == 0);
+  runRelocation();
+  vacatedNumber = 0;
+  CHECK(forEachVacatedRange(newConf.usedSectors, collectVacatedRange) == 0);
+  CHECK(vacatedNumber == 2);                               // Sources which no destination covers
+  CHECK(vacatedRanges[0].startSector == 170);
+  CHECK(vacatedRanges[0].sectorNumber == 10);
+  CHECK(vacatedRanges[1].startSector == 100);
+  CHECK(vacatedRanges[1].sectorNumber == 20);
+}
+
+int main(void) {
+  RUN_TEST(testGrowFirstPartition);
+  RUN_TEST(testShrinkFirstPartition);
+  RUN_TEST(testJoinedShift);
+  RUN_TEST(testSwapIsRefused);
+  RUN_TEST(testAccessDuringRelocation);
+  RUN_TEST(testResumeAfterPowerLoss);
+  RUN_TEST(testVacatedRanges);
+  return testFailures != 0;
+}
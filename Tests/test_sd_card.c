@@ -0,0 +1,198 @@
+/**
+  ******************************************************************************
+  * @file           : TEST_SD_CARD
+  * @version        : v1.0
+  * @brief          : Tests of the 64-bit sector math on a large card image
+  ******************************************************************************
+  * MIT License
+  *
+  * Copyright (c) 2017 Oleksandr Borysov
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+ ******************************************************************************
+*/
+
+
+
+
+/* Includes ------------------------------------------------------------------*/
+#include "sd_io_controller.h"
+#include "wear_leveling.h"
+#include "quick_format.h"
+#include "device_stats.h"
+#include "usbd_storage_if.h"
+#include "host_platform.h"
+#include "test_util.h"
+#include <string.h>
+
+/* Private define ------------------------------------------------------------*/
+#define SDXC_SECTORS                     ((uint64_t) 128 * 1024 * 1024 * 2)   // 128 GB card
+#define SDHC_SECTORS                     ((uint64_t) 4 * 1024 * 1024 * 2)     // 4 GB card
+#define FOUR_GB_SECTORS                  ((uint64_t) 1 << 23)
+#define ERASE_CARD_SECTORS               ((uint64_t) 512 * 1024 * 2)          // 512 MB card
+
+/* Private variables ---------------------------------------------------------*/
+uint8_t sector[STORAGE_BLOCK_SIZE];
+extern PartitionsStructure partitionsStructure;
+
+/* Private functions ---------------------------------------------------------*/
+
+static void openCard(uint64_t sectorNumber) {
+  CHECK(openSdCard(getImagePath("sdcard.img"), sectorNumber) == 0);
+  CHECK(initSDCard() == RES_OK);
+}
+
+static void testCardCapacity(void) {
+  openCard(SDXC_SECTORS);
+  CHECK(getCardSectorNumber() == SDXC_SECTORS);           // C_SIZE of 512 KB units, no 32-bit byte capacity
+  CHECK(getVolumeSectorNumber() == SDXC_SECTORS - STORAGE_SECTOR_NUMBER - WEAR_POOL_SECTORS);
+  CHECK(getConfSector() == SDXC_SECTORS - STORAGE_SECTOR_NUMBER);
+  CHECK(getConfSector() > FOUR_GB_SECTORS);
+}
+
+static void testSectorCount(void) {
+  DWORD sectorCount = 0;
+  uint32_t blockNumber = 0;
+  uint16_t blockSize = 0;
+  openCard(SDXC_SECTORS);
+  CHECK(SD_Driver.disk_ioctl(COMMAND_LUN, GET_SECTOR_COUNT, &sectorCount) == RES_OK);
+  CHECK(sectorCount == getVolumeSectorNumber() - 1);      // Default partition before the configurations are made
+  CHECK(currentPartitionCapacity(COMMAND_LUN, &blockNumber, &blockSize) == USBD_OK);
+  CHECK(blockSize == STORAGE_BLOCK_SIZE);
+  CHECK(blockNumber == getVolumeSectorNumber());          // No boot sector, capacity of the volume
+}
+
+static void testWriteAboveFourGb(void) {
+  DWORD partSector;
+  openCard(SDXC_SECTORS);
+  partSector = getVolumeSectorNumber() - 2;               // The last sector of the default partition
+  memset(sector, 0xC3, sizeof(sector));
+  CHECK(SD_Driver.disk_write(COMMAND_LUN, sector, partSector, 1) == RES_OK);
+  memset(sector, 0, sizeof(sector));
+  CHECK(readImageSectors(&sdCardImage, sector, partSector, 1) == 0);
+  CHECK((sector[0] == 0xC3) && (sector[STORAGE_BLOCK_SIZE - 1] == 0xC3));
+  CHECK(SD_Driver.disk_write(COMMAND_LUN, sector, partSector + 1, 1) != RES_OK);   // Past the partition end
+  CHECK(cardReadSectors(sector, SDXC_SECTORS - 1, 1) == MSD_OK);
+  CHECK(cardReadSectors(sector, SDXC_SECTORS, 1) != MSD_OK);
+}
+
+static void testConfAtCardEnd(void) {
+  PartitionsStructure conf;
+  openCard(SDXC_SECTORS);
+  CHECK(initStartConf() == 0);
+  CHECK(readImageSectors(&sdCardImage, sector, getConfSector(), 1) == 0);
+  CHECK(memcmp(sector, (uint8_t[STORAGE_BLOCK_SIZE]) { 0 }, STORAGE_BLOCK_SIZE) != 0);
+  memset(&conf, 0, sizeof(conf));
+  CHECK(loadConf(&conf, "rootKey") == 0);
+  CHECK(conf.partitionsNumber == 2);
+  CHECK(conf.usedSectors == getVolumeSectorNumber());
+  completeMediaChange();                                  // No host to see the medium change
+  CHECK(getLunPartition(COMMAND_LUN)->sectorNumber == getVolumeSectorNumber() / 2 + 1);
+}
+
+// Keeps the zero partition, replaces the second one by the new partition "fresh"
+static void updateFreshPartition(Partition *partition, FormatType format) {
+  PartitionsStructure newConf;
+  uint64_t zeroPartSectors;
+  openCard(ERASE_CARD_SECTORS);
+  CHECK(initStartConf() == 0);
+  completeMediaChange();
+  zeroPartSectors = getLunPartition(COMMAND_LUN)->sectorNumber;
+  memset(&newConf, 0, sizeof(newConf));
+  strcpy(newConf.confKey, "confKey");
+  strcpy(newConf.rootKey, "rootKey");
+  beginConf(&partitionsStructure, &newConf);
+  memset(partition, 0, sizeof(*partition));
+  strcpy(partition->name, "part0");
+  strcpy(partition->key, PUBLIC_PARTITION_KEY);
+  partition->extentNumber = 1;
+  partition->sectorNumber = zeroPartSectors;
+  CHECK(addConfPartition(partition) == 0);
+  strcpy(partition->name, "fresh");
+  strcpy(partition->key, "freshKey");
+  partition->partitionType = PRIVATE;
+  partition->sectorNumber = getVolumeSectorNumber() - zeroPartSectors;
+  CHECK(addConfPartition(partition) == 0);
+  CHECK((format == FORMAT_NONE) || (requestPartitionFormat(1, partition, format) == 0));
+  resetImageCounters();
+  sdCardImage.eraseTime = ERASE_STEP_TIME / 2;            // Two batches in a step
+  CHECK(setConf(&partitionsStructure, &newConf) == 0);
+  CHECK(sdCardImage.eraseNumber == 0);                    // Command doesn't wait for the erase
+  CHECK(changePartition(1, "fresh", "freshKey") == 0);
+  CHECK(currentPartitionisReady(1) != USBD_OK);           // Host is told about the medium change
+}
+
+static void testFreshMemoryErasedInSteps(void) {
+  Partition partition;
+  PartitionsStructure newConf = partitionsStructure;
+  uint32_t steps = 0;
+  updateFreshPartition(&partition, FORMAT_NONE);
+  CHECK(getEraseProgress()->status == ERASE_IN_PROGRESS);
+  CHECK(getEraseProgress()->freedSectors == partition.sectorNumber);
+  CHECK(currentPartitionisReady(1) != USBD_OK);           // Host waits for the erase
+  completeMediaChange();
+  CHECK(getLunPartition(1) == NULL);
+  CHECK(getLunPartition(COMMAND_LUN) != NULL);            // Zero partition has no fresh memory
+  CHECK(setConf(&partitionsStructure, &newConf) != 0);    // Old table is the erase source
+  while ((getEraseProgress()->status == ERASE_IN_PROGRESS) && (steps < 100)) {
+    continueFreedErase();
+    steps++;
+  }
+  CHECK(steps == (partition.sectorNumber + 2 * ERASE_BATCH_SECTORS - 1) / (2 * ERASE_BATCH_SECTORS));
+  CHECK(getEraseProgress()->status == ERASE_DONE);
+  CHECK(getEraseProgress()->erasedSectors == partition.sectorNumber);
+  CHECK(sdCardImage.erasedSectors == partition.sectorNumber);
+  CHECK(currentPartitionisReady(1) == USBD_OK);
+  CHECK(getLunPartition(1)->sectorNumber == partition.sectorNumber);
+}
+
+static void testFormatInIdleTime(void) {
+  Partition partition;
+  updateFreshPartition(&partition, FORMAT_EXFAT);
+  CHECK(deviceStatistics.formatSectors == 0);             // Command doesn't wait for the format
+  continueFormats();
+  CHECK(deviceStatistics.formatSectors == 0);             // Format waits for the erase
+  while (getEraseProgress()->status == ERASE_IN_PROGRESS) {
+    continueFreedErase();
+  }
+  CHECK(currentPartitionisReady(1) != USBD_OK);           // Host waits for the format
+  continueFormats();
+  CHECK(deviceStatistics.formatSectors != 0);
+  CHECK(deviceStatistics.formatFailCount == 0);
+  CHECK(currentPartitionisReady(1) == USBD_OK);
+  CHECK(currentPartitionRead(1, sector, 0, 1) == USBD_OK);
+  CHECK(memcmp(sector + 3, "EXFAT   ", 8) == 0);
+}
+
+static void testSmallCard(void) {
+  openCard(SDHC_SECTORS);
+  CHECK(getCardSectorNumber() == SDHC_SECTORS);
+  CHECK(getConfSector() == SDHC_SECTORS - STORAGE_SECTOR_NUMBER);
+}
+
+int main(void) {
+  RUN_TEST(testCardCapacity);
+  RUN_TEST(testSectorCount);
+  RUN_TEST(testWriteAboveFourGb);
+  RUN_TEST(testConfAtCardEnd);
+  RUN_TEST(testFreshMemoryErasedInSteps);
+  RUN_TEST(testFormatInIdleTime);
+  RUN_TEST(testSmallCard);
+  return testFailures != 0;
+}
@@ -0,0 +1,69 @@
+/**
+  ******************************************************************************
+  * @file           : TEST_UTIL
+  * @version        : v1.0
+  * @brief          : Header for the host tests
+  ******************************************************************************
+  * MIT License
+  *
+  * Copyright (c) 2017 Oleksandr Borysov
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+ ******************************************************************************
+*/
+
+
+
+
+/* Checks of the host tests. Each test runs in its own process, so the firmware
+   modules start from their power-on state */
+#ifndef __TEST_UTIL_H
+#define __TEST_UTIL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define CHECK(condition) \
+  do { \
+    if (!(condition)) { \
+      printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+      exit(1); \
+    } \
+  } while (0)
+
+#define RUN_TEST(test) \
+  do { \
+    int status = 0; \
+    pid_t pid; \
+    fflush(stdout); \
+    pid = fork(); \
+    if (pid == 0) { \
+      test(); \
+      exit(0); \
+    } \
+    waitpid(pid, &status, 0); \
+    printf("%-48s %s\n", #test, (WIFEXITED(status) && WEXITSTATUS(status) == 0) ? "ok" : "FAILED"); \
+    testFailures += !(WIFEXITED(status) && WEXITSTATUS(status) == 0); \
+  } while (0)
+
+static int testFailures __attribute__((unused));   // Benches use only the checks
+
+#endif
@@ -0,0 +1,177 @@
+/**
+  ******************************************************************************
+  * @file           : TEST_WEAR_LEVELING
+  * @version        : v1.0
+  * @brief          : Tests of the hot sector pool on a card image
+  ******************************************************************************
+  * MIT License
+  *
+  * Copyright (c) 2017 Oleksandr Borysov
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+ ******************************************************************************
+*/
+
+
+
+
+/* Includes ------------------------------------------------------------------*/
+#include "wear_leveling.h"
+#include "block_device.h"
+#include "device_stats.h"
+#include "host_platform.h"
+#include "test_util.h"
+#include <string.h>
+
+/* Private define ------------------------------------------------------------*/
+#define CARD_SECTORS                     ((uint64_t) 64 * 1024 * 2)    // 64 MB card
+#define HOT_SECTOR                       4096
+
+/* Private variables ---------------------------------------------------------*/
+uint8_t sector[STORAGE_BLOCK_SIZE];
+uint8_t readSector[STORAGE_BLOCK_SIZE];
+
+/* Private functions ---------------------------------------------------------*/
+
+static void openCard(void) {
+  CHECK(openSdCard(getImagePath("wear.img"), CARD_SECTORS) == 0);
+  CHECK(initSDCard() == RES_OK);
+}
+
+static void writeMarked(uint64_t number, uint32_t mark) {
+  memset(sector, 0, sizeof(sector));
+  memcpy(sector, &number, sizeof(number));
+  memcpy(sector + sizeof(number), &mark, sizeof(mark));
+  CHECK(wearWriteSectors(sector, number, 1) == BLOCK_DEVICE_OK);
+}
+
+static void checkMarked(uint64_t number, uint32_t mark, uint8_t isHome) {
+  memset(sector, 0, sizeof(sector));
+  memcpy(sector, &number, sizeof(number));
+  memcpy(sector + sizeof(number), &mark, sizeof(mark));
+  CHECK(wearReadSectors(readSector, number, 1) == BLOCK_DEVICE_OK);
+  CHECK(memcmp(readSector, sector, STORAGE_BLOCK_SIZE) == 0);
+  CHECK(volumeReadSectors(readSector, number, 1) == BLOCK_DEVICE_OK);
+  CHECK((memcmp(readSector, sector, STORAGE_BLOCK_SIZE) == 0) == isHome);
+}
+
+static void testHotSectorGoesToPool(void) {
+  openCard();
+  for (uint32_t i = 0; i < WEAR_HOT_WRITES - 1; ++i) {
+    writeMarked(HOT_SECTOR, i);
+  }
+  CHECK(getWearPoolState()->mappedSectors == 0);
+  checkMarked(HOT_SECTOR, WEAR_HOT_WRITES - 2, 1);
+  writeMarked(HOT_SECTOR, WEAR_HOT_WRITES - 1);
+  CHECK(getWearPoolState()->mappedSectors == 1);
+  checkMarked(HOT_SECTOR, WEAR_HOT_WRITES - 1, 0);        // Home keeps the older data
+}
+
+static void testLongWritesStayHome(void) {
+  uint8_t data[(WEAR_HOT_REQUEST_SECTORS + 1) * STORAGE_BLOCK_SIZE];
+  openCard();
+  memset(data, 0x3C, sizeof(data));
+  for (uint32_t i = 0; i < 2 * WEAR_HOT_WRITES; ++i) {
+    CHECK(wearWriteSectors(data, HOT_SECTOR, WEAR_HOT_REQUEST_SECTORS + 1) == BLOCK_DEVICE_OK);
+  }
+  CHECK(getWearPoolState()->mappedSectors == 0);
+}
+
+static void testPoolIsReplayed(void) {
+  openCard();
+  for (uint32_t i = 0; i < WEAR_HOT_WRITES + 40; ++i) {    // Log goes over several segments
+    writeMarked(HOT_SECTOR, i);
+    writeMarked(HOT_SECTOR + 1, i);
+  }
+  CHECK(getWearPoolState()->mappedSectors == 2);
+  CHECK(initWearPool() == 0);                              // As after the reset
+  CHECK(getWearPoolState()->mappedSectors == 2);
+  checkMarked(HOT_SECTOR, WEAR_HOT_WRITES + 39, 0);
+  checkMarked(HOT_SECTOR + 1, WEAR_HOT_WRITES + 39, 0);
+}
+
+static void testColdSectorReturnsHome(void) {
+  uint32_t mark = 0;
+  openCard();
+  for (uint32_t i = 0; i < WEAR_HOT_WRITES; ++i) {
+    writeMarked(HOT_SECTOR, i);
+  }
+  advanceHostTick(WEAR_COLD_TIME);
+  while (getWearPoolState()->freeSegments >= WEAR_FREE_SEGMENTS) {   // Other hot sector fills the pool
+    writeMarked(HOT_SECTOR + 1, mark++);
+  }
+  CHECK(collectWearPool(WEAR_COLLECT_STEP_TIME) == 0);
+  CHECK(getWearPoolState()->freeSegments >= WEAR_FREE_SEGMENTS);
+  CHECK(getWearPoolState()->mappedSectors == 1);
+  checkMarked(HOT_SECTOR, WEAR_HOT_WRITES - 1, 1);
+  checkMarked(HOT_SECTOR + 1, mark - 1, 0);                // Recently written sector is copied to the head
+}
+
+static void testForegroundCollection(void) {
+  openCard();
+  for (uint32_t i = 0; i < WEAR_SEGMENT_NUMBER * WEAR_SEGMENT_SECTORS * 2; ++i) {
+    writeMarked(HOT_SECTOR + i % 4, i);                    // No idle time, the writes collect the pool
+  }
+  CHECK(deviceStatistics.wearForegroundCollects != 0);
+  CHECK(getWearPoolState()->freeSegments >= 1);
+  for (uint32_t i = 0; i < 4; ++i) {
+    checkMarked(HOT_SECTOR + i, WEAR_SEGMENT_NUMBER * WEAR_SEGMENT_SECTORS * 2 - 4 + i, 0);
+  }
+  CHECK(initWearPool() == 0);
+  checkMarked(HOT_SECTOR + 3, WEAR_SEGMENT_NUMBER * WEAR_SEGMENT_SECTORS * 2 - 1, 0);
+}
+
+static void testFlush(void) {
+  openCard();
+  for (uint32_t i = 0; i < WEAR_HOT_WRITES; ++i) {
+    writeMarked(HOT_SECTOR, i);
+  }
+  CHECK(flushWearPool() == 0);
+  CHECK(getWearPoolState()->mappedSectors == 0);
+  checkMarked(HOT_SECTOR, WEAR_HOT_WRITES - 1, 1);
+  CHECK(initWearPool() == 0);
+  CHECK(getWearPoolState()->mappedSectors == 0);
+}
+
+static void testEraseCountsSpread(void) {
+  uint32_t minCount = UINT32_MAX;
+  uint32_t maxCount = 0;
+  openCard();
+  for (uint32_t i = 0; i < WEAR_SEGMENT_NUMBER * WEAR_SEGMENT_SECTORS * 8; ++i) {
+    writeMarked(HOT_SECTOR + i % 2, i);
+  }
+  for (uint8_t i = 0; i < WEAR_SEGMENT_NUMBER; ++i) {
+    uint32_t count = getWearPoolState()->eraseCounts[i];
+    minCount = count < minCount ? count : minCount;
+    maxCount = count > maxCount ? count : maxCount;
+  }
+  CHECK(minCount != 0);
+  CHECK(maxCount - minCount <= 1);                         // Segments are written in a ring
+}
+
+int main(void) {
+  RUN_TEST(testHotSectorGoesToPool);
+  RUN_TEST(testLongWritesStayHome);
+  RUN_TEST(testPoolIsReplayed);
+  RUN_TEST(testColdSectorReturnsHome);
+  RUN_TEST(testForegroundCollection);
+  RUN_TEST(testFlush);
+  RUN_TEST(testEraseCountsSpread);
+  return testFailures != 0;
+}
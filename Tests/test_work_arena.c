@@ -0,0 +1,86 @@
+/**
+  ******************************************************************************
+  * @file           : TEST_WORK_ARENA
+  * @version        : v1.0
+  * @brief          : Tests of the work arena
+  ******************************************************************************
+  * MIT License
+  *
+  * Copyright (c) 2017 Oleksandr Borysov
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+ ******************************************************************************
+*/
+
+
+
+
+/* Includes ------------------------------------------------------------------*/
+#include "work_arena.h"
+#include "sd_io_controller.h"
+#include "host_platform.h"
+#include "test_util.h"
+#include <string.h>
+
+/* Private define ------------------------------------------------------------*/
+#define CARD_SECTORS                     ((uint64_t) 1024 * 1024 * 2)          // 1 GB card
+
+/* Private variables ---------------------------------------------------------*/
+extern uint32_t workArenaTop;
+
+/* Private functions ---------------------------------------------------------*/
+
+static void testReverseRelease(void) {
+  uint8_t *first = allocWorkBuffer(100);
+  uint8_t *second = allocWorkBuffer(1);
+  CHECK((first != NULL) && (second != NULL));
+  CHECK(second - first == 104);                           // Buffers are aligned by WORK_ARENA_ALIGN
+  CHECK(((uintptr_t) first % WORK_ARENA_ALIGN) == 0);
+  releaseWorkBuffer(first);                               // Releases the second buffer too
+  CHECK(workArenaTop == 0);
+  CHECK(allocWorkBuffer(WORK_ARENA_SIZE) == first);
+  CHECK(allocWorkBuffer(1) == NULL);
+  releaseWorkBuffer(NULL);
+  CHECK(workArenaTop == WORK_ARENA_SIZE);
+}
+
+// The configurations and the header sector must not stay taken when the arena is full
+static void testLoadConfFullArena(void) {
+  PartitionsStructure conf;
+  uint32_t space;
+  CHECK(openSdCard(getImagePath("arena.img"), CARD_SECTORS) == 0);
+  CHECK(initSDCard() == RES_OK);
+  CHECK(initStartConf() == 0);
+  CHECK(workArenaTop == 0);
+  for (space = WORK_ARENA_SIZE; space > WORK_ARENA_SIZE - sizeof(PartitionsStructure) - STORAGE_BLOCK_SIZE;
+      space -= WORK_ARENA_ALIGN) {                         // Only the configurations fit or none of the buffers
+    uint8_t *filler = allocWorkBuffer(space);
+    CHECK(loadConf(&conf, "rootKey") == 1);
+    CHECK(workArenaTop == space);
+    releaseWorkBuffer(filler);
+  }
+  CHECK(loadConf(&conf, "rootKey") == 0);
+  CHECK(workArenaTop == 0);
+}
+
+int main(void) {
+  RUN_TEST(testReverseRelease);
+  RUN_TEST(testLoadConfFullArena);
+  return testFailures != 0;
+}
@@ -0,0 +1,437 @@
+/**
+  ******************************************************************************
+  * @file           : MAILBOX_TOOL
+  * @version        : v1.0
+  * @brief          : Linux host tool of the mailbox requests
+  ******************************************************************************
+  * MIT License
+  *
+  * Copyright (c) 2017 Oleksandr Borysov
+  *
+  * Permission is hereby granted, free of charge, to any person obtaining a copy
+  * of this software and associated documentation files (the "Software"), to deal
+  * in the Software without restriction, including without limitation the rights
+  * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  * copies of the Software, and to permit persons to whom the Software is
+  * furnished to do so, subject to the following conditions:
+  *
+  * The above copyright notice and this permission notice shall be included in all
+  * copies or substantial portions of the Software.
+  *
+  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  * SOFTWARE.
+ ******************************************************************************
+*/
+
+
+
+
+/* Sends the mailbox requests to the logical unit of the device by the vendor SCSI commands
+   through SG_IO, the vendor commands need root rights. Build it with
+     gcc -O2 -I../Inc -o mailbox_tool mailbox_tool.c
+   Usage:
+     mailbox_tool /dev/sdX change [Root key] [Partition name] [Partition key] [LUN]
+     mailbox_tool /dev/sdX query [Root key] [Configurations key]
+     mailbox_tool /dev/sdX stats [Root key] [Configurations key]
+     mailbox_tool /dev/sdX update [Root key] [Configurations key] [New configurations key] [New root key] [File]
+   The file of update has the partition lines of UpdateConf */
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <scsi/sg.h>
+#include "mailbox.h"
+
+/* Private define ------------------------------------------------------------*/
+#define SCSI_TIMEOUT             5000               // ms of one SCSI command
+#define POLL_TIMEOUT             30000              // ms of waiting for the response
+#define POLL_INTERVAL            1                  // ms between the response reads
+#define SENSE_LENGTH             32
+#define LINE_LENGTH              256
+#define PUBLIC_PARTITION_KEY     "public"
+
+/* Private variables ---------------------------------------------------------*/
+int device;                                         // Logical unit of the device
+uint32_t sequence;
+
+/* Private tool function prototypes -----------------------------------------------*/
+int sendScsi(uint8_t*, uint8_t, int, uint8_t*, uint32_t);
+int transferMailbox(int, uint8_t*, uint32_t);
+int sendRequest(MailboxRequest*, MailboxResponse*);
+int beginRequest(MailboxRequest*, uint16_t, const char*, const char*);
+int copyArgument(char*, size_t, const char*);
+int doChange(char**, int);
+int doQuery(char**);
+int doStats(char**);
+int doUpdate(char**);
+int parsePartitionLine(char*, MailboxRequest*);
+uint64_t getMillis(void);
+
+/* Public tool functions ---------------------------------------------------------*/
+
+int main(int argc, char **argv) {
+  int res = 1;
+  if (argc < 5) {
+    fprintf(stderr, "Usage: %s /dev/sdX change|query|stats|update [Root key] ...\n", argv[0]);
+    return 1;
+  }
+  device = open(argv[1], O_RDWR);
+  if (device < 0) {
+    perror(argv[1]);
+    return 1;
+  }
+  sequence = (uint32_t) time(NULL) ^ (uint32_t) getpid();
+  if (strcmp(argv[2], "change") == 0) {
+    res = doChange(argv + 3, argc - 3);
+  } else if (strcmp(argv[2], "query") == 0) {
+    res = doQuery(argv + 3);
+  } else if (strcmp(argv[2], "stats") == 0) {
+    res = doStats(argv + 3);
+  } else if ((strcmp(argv[2], "update") == 0) && (argc >= 8)) {
+    res = doUpdate(argv + 3);
+  } else {
+    fprintf(stderr, "Unknown operation %s\n", argv[2]);
+  }
+  close(device);
+  return res;
+}
+
+/* Private tool functions ---------------------------------------------------------*/
+
+/*******************************************************************************
+* Description    : Sends the SCSI command to the logical unit.
+* Input          : cdb - the command
+*                  cdbLength - bytes of the command
+*                  direction - SG_DXFER_FROM_DEV, SG_DXFER_TO_DEV or SG_DXFER_NONE
+*                  data - data of the command
+*                  dataLength - bytes of the data.
+* Output         : data - data read from the device.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+int sendScsi(uint8_t *cdb, uint8_t cdbLength, int direction, uint8_t *data, uint32_t dataLength) {
+  sg_io_hdr_t io;
+  uint8_t sense[SENSE_LENGTH];
+  memset(&io, 0, sizeof(io));
+  io.interface_id = 'S';
+  io.cmdp = cdb;
+  io.cmd_len = cdbLength;
+  io.dxfer_direction = direction;
+  io.dxferp = data;
+  io.dxfer_len = dataLength;
+  io.sbp = sense;
+  io.mx_sb_len = sizeof(sense);
+  io.timeout = SCSI_TIMEOUT;
+  if ((ioctl(device, SG_IO, &io) < 0) || ((io.info & SG_INFO_OK_MASK) != SG_INFO_OK)) {
+    return 1;
+  }
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Sends the request by MAILBOX_WRITE_OPCODE or reads the response by
+*                    MAILBOX_READ_OPCODE.
+* Input          : isWrite - the request is sent
+*                  data - the request
+*                  length - bytes of the data.
+* Output         : data - the response.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+int transferMailbox(int isWrite, uint8_t *data, uint32_t length) {
+  uint8_t cdb[MAILBOX_CDB_LENGTH] = {isWrite ? MAILBOX_WRITE_OPCODE : MAILBOX_READ_OPCODE};
+  return sendScsi(cdb, sizeof(cdb), isWrite ? SG_DXFER_TO_DEV : SG_DXFER_FROM_DEV, data, length);
+}
+
+/*******************************************************************************
+* Description    : Sends the request and reads the response till the device answers it.
+* Input          : request - the request.
+* Output         : response - the response of the device.
+* Return         : 0 if the request was done or 1 if not.
+*******************************************************************************/
+int sendRequest(MailboxRequest *request, MailboxResponse *response) {
+  uint64_t startTime = getMillis();
+  request->sequence = ++sequence;
+  if (transferMailbox(1, (uint8_t*) request, sizeof(*request)) != 0) {
+    fprintf(stderr, "Request write failed\n");
+    return 1;
+  }
+  do {
+    if (transferMailbox(0, (uint8_t*) response, sizeof(*response)) != 0) {
+      fprintf(stderr, "Response read failed\n");
+      return 1;
+    }
+    if ((response->magic == MAILBOX_MAGIC) && (response->sequence == request->sequence)
+        && (response->status != MAILBOX_PENDING)) {
+      if (response->status != MAILBOX_DONE) {
+        fprintf(stderr, "Request failed\n");
+      }
+      return response->status == MAILBOX_DONE ? 0 : 1;
+    }
+    usleep(POLL_INTERVAL * 1000);
+  } while (getMillis() - startTime < POLL_TIMEOUT);
+  fprintf(stderr, "No response\n");
+  return 1;
+}
+
+/*******************************************************************************
+* Description    : Fills the common fields of the request.
+* Input          : operation - MailboxOperation
+*                  rootKey - root key of the device
+*                  confKey - configurations key or NULL.
+* Output         : request - the request.
+* Return         : 0 if success or 1 if a key doesn't fit the request.
+*******************************************************************************/
+int beginRequest(MailboxRequest *request, uint16_t operation, const char *rootKey, const char *confKey) {
+  memset(request, 0, sizeof(*request));
+  request->magic = MAILBOX_MAGIC;
+  request->version = MAILBOX_VERSION;
+  request->operation = operation;
+  if (copyArgument(request->rootKey, sizeof(request->rootKey), rootKey) != 0) {
+    return 1;
+  }
+  return (confKey != NULL) ? copyArgument(request->confKey, sizeof(request->confKey), confKey) : 0;
+}
+
+/*******************************************************************************
+* Description    : Copies the argument to the field of the request. The device reads
+*                    the field by its size, so the argument which fills the field
+*                    is not terminated.
+* Input          : size - bytes of the field
+*                  argument - the argument.
+* Output         : field - the field, zero filled after the argument.
+* Return         : 0 if success or 1 if the argument is longer than the field.
+*******************************************************************************/
+int copyArgument(char *field, size_t size, const char *argument) {
+  size_t length = strlen(argument);
+  if (length > size) {
+    fprintf(stderr, "%s is longer than %u symbols\n", argument, (unsigned) size);
+    return 1;
+  }
+  memset(field, 0, size);
+  memcpy(field, argument, length);
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Changes the partition visible through the logical unit.
+* Input          : args - root key, partition name, partition key and optional LUN
+*                  argNumber - number of the arguments.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+int doChange(char **args, int argNumber) {
+  MailboxRequest request;
+  MailboxResponse response;
+  uint64_t startTime = getMillis();
+  if (argNumber < 3) {
+    fprintf(stderr, "change needs [Root key] [Partition name] [Partition key] [LUN]\n");
+    return 1;
+  }
+  if ((beginRequest(&request, MAILBOX_CHANGE_PARTITION, args[0], NULL) != 0)
+      || (copyArgument(request.name, sizeof(request.name), args[1]) != 0)
+      || (copyArgument(request.key, sizeof(request.key), args[2]) != 0)) {
+    return 1;
+  }
+  request.lun = argNumber > 3 ? (uint8_t) atoi(args[3]) : 0;
+  if (sendRequest(&request, &response) != 0) {
+    return 1;
+  }
+  printf("Partition changed in %llu ms\n", (unsigned long long) (getMillis() - startTime));
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Prints the partitions of the device.
+* Input          : args - root key and configurations key.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+int doQuery(char **args) {
+  MailboxRequest request;
+  MailboxResponse response;
+  MailboxPartition partition;
+  uint32_t offset = 0;
+  printf("#N   Name                 Sectors              LUN Options\n");
+  do {
+    if (beginRequest(&request, MAILBOX_QUERY_CONFIG, args[0], args[1]) != 0) {
+      return 1;
+    }
+    request.offset = offset;
+    if (sendRequest(&request, &response) != 0) {
+      return 1;
+    }
+    for (uint32_t i = 0; i < response.length / sizeof(partition); ++i, ++offset) {
+      memcpy(&partition, response.data + i * sizeof(partition), sizeof(partition));
+      printf("%-4u %-20.20s %-20llu ", offset, partition.name, (unsigned long long) partition.sectorNumber);
+      printf(partition.lun == MAILBOX_NO_LUN ? "-   " : "%-3u ", partition.lun);
+      printf("%s", partition.flags & MAILBOX_PART_PRIVATE ? "private " : "public ");
+      if (partition.extentNumber > 1) {
+        printf("extents=%u ", partition.extentNumber);
+      }
+      printf("%s%s", partition.flags & MAILBOX_PART_COMPRESSED ? "compress " : "",
+          partition.flags & MAILBOX_PART_READ_ONLY ? "readonly " : "");
+      if (partition.sourceName[0] != '\0') {
+        printf("clone=%.20s", partition.sourceName);
+      }
+      printf("\n");
+    }
+  } while ((response.length != 0) && (offset < response.total));
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Prints the configurations file text of the device with its statistics.
+* Input          : args - root key and configurations key.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+int doStats(char **args) {
+  MailboxRequest request;
+  MailboxResponse response;
+  uint32_t offset = 0;
+  do {
+    if (beginRequest(&request, MAILBOX_READ_STATS, args[0], args[1]) != 0) {
+      return 1;
+    }
+    request.offset = offset;
+    if (sendRequest(&request, &response) != 0) {
+      return 1;
+    }
+    fwrite(response.data, 1, response.length, stdout);
+    offset += response.length;
+  } while ((response.length != 0) && (offset < response.total));
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Sets new configurations from the file of the partition lines.
+* Input          : args - root key, configurations key, new configurations key,
+*                    new root key and the file.
+* Output         : None.
+* Return         : 0 if success or 1 if not.
+*******************************************************************************/
+int doUpdate(char **args) {
+  MailboxRequest request;
+  MailboxResponse response;
+  char line[LINE_LENGTH];
+  uint32_t partNumber = 0;
+  int res;
+  FILE *file;
+  if ((beginRequest(&request, MAILBOX_UPDATE_BEGIN, args[0], args[1]) != 0)
+      || (copyArgument(request.newConfKey, sizeof(request.newConfKey), args[2]) != 0)
+      || (copyArgument(request.newRootKey, sizeof(request.newRootKey), args[3]) != 0)) {
+    return 1;
+  }
+  file = fopen(args[4], "r");
+  if (file == NULL) {
+    perror(args[4]);
+    return 1;
+  }
+  if (sendRequest(&request, &response) != 0) {
+    fclose(file);
+    return 1;
+  }
+  while (fgets(line, sizeof(line), file) != NULL) {
+    beginRequest(&request, MAILBOX_UPDATE_ADD, args[0], args[1]);   // Keys are checked by the first request
+    res = parsePartitionLine(line, &request);
+    if (res > 0) {
+      continue;                                     // Comments and empty lines
+    }
+    if (res < 0) {
+      fprintf(stderr, "Partition %u is not sent, the update is not committed\n", partNumber);
+      fclose(file);
+      return 1;
+    }
+    if (request.offset != partNumber) {
+      fprintf(stderr, "Partition %u is out of order\n", request.offset);
+      fclose(file);
+      return 1;
+    }
+    if (sendRequest(&request, &response) != 0) {
+      fclose(file);
+      return 1;
+    }
+    partNumber++;
+  }
+  fclose(file);
+  beginRequest(&request, MAILBOX_UPDATE_COMMIT, args[0], args[1]);
+  if (sendRequest(&request, &response) != 0) {
+    return 1;
+  }
+  printf("%u partitions set\n", partNumber);
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Parses the partition line of UpdateConf:
+*                    [Number] [Name] [Key] [Number of sectors] [Options].
+* Input          : line - the line.
+* Output         : request - the request with the partition.
+* Return         : 0 if success, 1 if the line is not the partition or -1 if
+*                    the partition doesn't fit the request.
+*******************************************************************************/
+int parsePartitionLine(char *line, MailboxRequest *request) {
+  char *word[4];
+  char *option;
+  char *end;
+  for (uint8_t i = 0; i < 4; ++i) {
+    word[i] = strtok(i == 0 ? line : NULL, " \t\r\n");
+    if (word[i] == NULL) {
+      return 1;
+    }
+  }
+  request->offset = strtoul(word[0], &end, 10);
+  if (*end != '\0') {
+    return 1;
+  }
+  if ((copyArgument(request->name, sizeof(request->name), word[1]) != 0)
+      || (copyArgument(request->key, sizeof(request->key), word[2]) != 0)) {
+    return -1;
+  }
+  request->sectorNumber = strtoull(word[3], &end, 10);
+  if (*end != '\0') {
+    return 1;
+  }
+  request->extentNumber = 1;
+  while ((option = strtok(NULL, " \t\r\n")) != NULL) {
+    if (strncmp(option, "extents=", 8) == 0) {
+      request->extentNumber = (uint8_t) atoi(option + 8);
+    } else if (strncmp(option, "clone=", 6) == 0) {
+      if (copyArgument(request->sourceName, sizeof(request->sourceName), option + 6) != 0) {
+        return -1;
+      }
+    } else if (strcmp(option, "format=fat32") == 0) {
+      request->formatType = 1;                      // FORMAT_FAT32
+    } else if (strcmp(option, "format=exfat") == 0) {
+      request->formatType = 2;                      // FORMAT_EXFAT
+    } else if (strcmp(option, "compress") == 0) {
+      request->flags |= MAILBOX_PART_COMPRESSED;
+    } else if (strcmp(option, "readonly") == 0) {
+      request->flags |= MAILBOX_PART_READ_ONLY;
+    } else {
+      fprintf(stderr, "Unknown option %s\n", option);
+    }
+  }
+  return 0;
+}
+
+/*******************************************************************************
+* Description    : Gets the monotonic time.
+* Input          : None.
+* Output         : None.
+* Return         : Time in ms.
+*******************************************************************************/
+uint64_t getMillis(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}